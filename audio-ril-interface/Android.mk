@@ -7,20 +7,25 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := libaudio-ril-interface
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_SRC_FILES := audio-ril-interface.cpp
+LOCAL_SRC_FILES := \
+	audio-ril-interface.cpp \
+	voice-router.cpp \
+	voice-fir.cpp \
+	voice-pcm.cpp \
+	voice-record.cpp
+
+LOCAL_ARM_NEON := true
 
 LOCAL_SHARED_LIBRARIES := \
 	liblog \
 	libcutils \
-	libtinyalsa \
-	libaudioutils
+	libtinyalsa
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)
 LOCAL_C_INCLUDES := $(LOCAL_PATH)
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
-	hardware/tinyalsa-audio/include/ \
-	system/media/audio_utils/include
+	hardware/tinyalsa-audio/include/
 
 LOCAL_LDLIBS += -lpthread
 
@@ -28,4 +33,6 @@ LOCAL_PRELINK_MODULE := false
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(call all-makefiles-under,$(LOCAL_PATH))
+
 endif
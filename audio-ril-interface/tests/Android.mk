@@ -0,0 +1,80 @@
+# Copyright (C) 2015 Golden Delicious Computers
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# FIR test, on the host with the scalar kernels and on the device with the
+# NEON ones, the clock in MHz gives the cost in cycles:
+#   make gta04_voice_fir_test && gta04_voice_fir_test
+#   adb shell /system/xbin/gta04_voice_fir_test -c 800
+#
+# Router test, on the host with the file backend standing in for the cards
+# through the gta04.voice.* properties, the modem card 150 ppm fast:
+#   make gta04_voice_router_test && gta04_voice_router_test -m 150
+
+LOCAL_PATH:= $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fir.cpp ../voice-fir.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include
+
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lm
+
+LOCAL_MODULE := gta04_voice_fir_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fir.cpp ../voice-fir.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include
+
+LOCAL_ARM_NEON := true
+
+LOCAL_SHARED_LIBRARIES := liblog
+
+LOCAL_MODULE := gta04_voice_fir_test
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	router.cpp \
+	fake.cpp \
+	../voice-router.cpp \
+	../voice-fir.cpp \
+	../voice-pcm.cpp \
+	../voice-record.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include
+
+# Properties and tinyalsa are provided by fake.cpp
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lrt -lm
+
+LOCAL_MODULE := gta04_voice_router_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
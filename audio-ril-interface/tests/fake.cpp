@@ -0,0 +1,127 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tinyalsa/asoundlib.h>
+#include <cutils/properties.h>
+
+#include "fake.h"
+
+/*
+ * Properties
+ */
+
+struct gta04_voice_fake_property {
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+};
+
+static struct gta04_voice_fake_property gta04_voice_fake_properties[GTA04_VOICE_FAKE_PROPERTIES_COUNT];
+
+void gta04_voice_fake_property_set(const char *key, const char *value)
+{
+	int i;
+
+	for (i = 0; i < GTA04_VOICE_FAKE_PROPERTIES_COUNT; i++) {
+		if (gta04_voice_fake_properties[i].key[0] == '\0' || strcmp(gta04_voice_fake_properties[i].key, key) == 0)
+			break;
+	}
+
+	if (i == GTA04_VOICE_FAKE_PROPERTIES_COUNT)
+		return;
+
+	strncpy(gta04_voice_fake_properties[i].key, key, PROPERTY_KEY_MAX - 1);
+	strncpy(gta04_voice_fake_properties[i].value, value, PROPERTY_VALUE_MAX - 1);
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+	int i;
+
+	for (i = 0; i < GTA04_VOICE_FAKE_PROPERTIES_COUNT; i++) {
+		if (strcmp(gta04_voice_fake_properties[i].key, key) == 0) {
+			strcpy(value, gta04_voice_fake_properties[i].value);
+			return strlen(value);
+		}
+	}
+
+	if (default_value == NULL)
+		default_value = "";
+
+	strncpy(value, default_value, PROPERTY_VALUE_MAX - 1);
+	value[PROPERTY_VALUE_MAX - 1] = '\0';
+
+	return strlen(value);
+}
+
+/*
+ * Tinyalsa: there are no cards on the host, the router is run with the file
+ * backend
+ */
+
+struct pcm *pcm_open(unsigned int card, unsigned int device,
+	unsigned int flags, struct pcm_config *config)
+{
+	return NULL;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+	return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+	return 0;
+}
+
+int pcm_prepare(struct pcm *pcm)
+{
+	return -1;
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+	return -1;
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+	return -1;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+	return 0;
+}
+
+unsigned int pcm_get_latency(struct pcm *pcm)
+{
+	return 0;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+	return "No cards on the host";
+}
@@ -0,0 +1,29 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GTA04_VOICE_FAKE_H_
+#define _GTA04_VOICE_FAKE_H_
+
+#define GTA04_VOICE_FAKE_PROPERTIES_COUNT	16
+
+void gta04_voice_fake_property_set(const char *key, const char *value);
+
+#endif
@@ -0,0 +1,336 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "voice-router.h"
+
+/*
+ * FIR test: the resampler, run period by period like the router does, must
+ * be bit-exact with a plain convolution of the whole signal with the same
+ * coefficients, summed in 64 bits. On the device, that checks the NEON
+ * kernels, on other hosts the scalar ones. The CPU time per second of audio
+ * is then measured for both directions.
+ *
+ * Usage: gta04_voice_fir_test [-c MHz]
+ */
+
+#define GTA04_VOICE_FIR_TEST_SECONDS	10
+#define GTA04_VOICE_FIR_TEST_RUNS	5
+
+struct gta04_voice_fir_test {
+	const char *name;
+	unsigned int in_rate;
+	unsigned int out_rate;
+	unsigned int in_channels;
+	unsigned int out_channels;
+	unsigned int taps;
+};
+
+static struct gta04_voice_fir_test gta04_voice_fir_tests[] = {
+	{ "uplink", GTA04_VOICE_GTA04_RATE, GTA04_VOICE_MODEM_RATE, GTA04_VOICE_GTA04_CHANNELS, GTA04_VOICE_MODEM_CHANNELS, GTA04_VOICE_FIR_TAPS_DECIMATE },
+	{ "downlink", GTA04_VOICE_MODEM_RATE, GTA04_VOICE_GTA04_RATE, GTA04_VOICE_MODEM_CHANNELS, GTA04_VOICE_GTA04_CHANNELS, GTA04_VOICE_FIR_TAPS_INTERPOLATE },
+};
+
+static int gta04_voice_fir_tests_count = sizeof(gta04_voice_fir_tests) /
+	sizeof(struct gta04_voice_fir_test);
+
+static int16_t gta04_voice_fir_test_reference(struct gta04_voice_fir *fir,
+	const int16_t *signal, unsigned int k)
+{
+	unsigned long long position;
+	unsigned int index;
+	unsigned int phase;
+	const int16_t *coefs;
+	const int16_t *in;
+	int64_t sum = 0;
+	int sample;
+	unsigned int j;
+
+	position = (unsigned long long) k * fir->down;
+	index = position / fir->up;
+	phase = position % fir->up;
+
+	coefs = &fir->coefs[phase * fir->taps];
+	in = &signal[index * fir->in_channels];
+
+	for (j = 0; j < fir->taps; j++) {
+		if (fir->in_channels == 2)
+			sample = (int) floor((in[j * 2] + in[j * 2 + 1]) / 2.0);
+		else
+			sample = in[j];
+
+		sum += (int64_t) coefs[j] * sample;
+	}
+
+	sum = (sum + (1 << 14)) >> 15;
+	if (sum > 32767)
+		sum = 32767;
+	else if (sum < -32768)
+		sum = -32768;
+
+	return (int16_t) sum;
+}
+
+/*
+ * The kernels sum in 32 bits: the worst input for each phase must not
+ * overflow.
+ */
+static int gta04_voice_fir_test_headroom(struct gta04_voice_fir *fir)
+{
+	int64_t sum;
+	unsigned int p;
+	unsigned int j;
+
+	for (p = 0; p < fir->up; p++) {
+		sum = 0;
+		for (j = 0; j < fir->taps; j++)
+			sum += abs(fir->coefs[p * fir->taps + j]) * 32768LL;
+
+		if (sum > INT_MAX) {
+			printf("  phase %u can overflow: %lld\n", p, (long long int) sum);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Signals: 0 is random, 1 is a full scale square wave at the input rate and
+ * 2 is a 1 kHz sine, with the channels out of phase.
+ */
+static void gta04_voice_fir_test_signal(int16_t *signal, unsigned int frames,
+	unsigned int channels, unsigned int rate, int type)
+{
+	unsigned int i;
+	unsigned int c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++) {
+			if (type == 0)
+				signal[i * channels + c] = (int16_t) (rand() & 0xffff);
+			else if (type == 1)
+				signal[i * channels + c] = (i + c) % 2 ? -32768 : 32767;
+			else
+				signal[i * channels + c] = (int16_t) lrint(32767 * sin(2 * M_PI * 1000 * i / rate + c * M_PI));
+		}
+	}
+}
+
+static int gta04_voice_fir_test_exact(struct gta04_voice_fir_test *test,
+	int type)
+{
+	struct gta04_voice_fir fir;
+	int16_t *signal = NULL;
+	int16_t *buffer = NULL;
+	int16_t *out = NULL;
+	unsigned int history;
+	unsigned int frames;
+	unsigned int period;
+	unsigned int position;
+	unsigned int count;
+	unsigned int total;
+	unsigned int k;
+	int mismatches = 0;
+	int rc;
+
+	rc = gta04_voice_fir_init(&fir, test->in_rate, test->out_rate, test->in_channels, test->out_channels, test->taps);
+	if (rc < 0) {
+		printf("  %s: init failed\n", test->name);
+		return -1;
+	}
+
+	rc = gta04_voice_fir_test_headroom(&fir);
+	if (rc < 0)
+		goto complete;
+
+	history = test->taps - 1;
+	frames = test->in_rate;
+	period = test->in_rate * GTA04_VOICE_PERIOD_MS / 1000;
+
+	// The reference sees the whole signal, with the history the router starts with
+	signal = (int16_t *) calloc((history + frames) * test->in_channels, sizeof(int16_t));
+	buffer = (int16_t *) calloc((history + period * 2) * test->in_channels, sizeof(int16_t));
+	out = (int16_t *) calloc((test->out_rate + 1) * test->out_channels, sizeof(int16_t));
+	if (signal == NULL || buffer == NULL || out == NULL) {
+		rc = -1;
+		goto complete;
+	}
+
+	gta04_voice_fir_test_signal(&signal[history * test->in_channels], frames, test->in_channels, test->in_rate, type);
+
+	// Periods of random lengths, up to twice the usual one
+	position = 0;
+	total = 0;
+
+	while (position < frames) {
+		count = 1 + rand() % (period * 2);
+		if (count > frames - position)
+			count = frames - position;
+
+		memcpy(&buffer[history * test->in_channels], &signal[(history + position) * test->in_channels], count * test->in_channels * sizeof(int16_t));
+		total += gta04_voice_fir_process(&fir, buffer, count, &out[total * test->out_channels], test->out_rate + 1 - total);
+		position += count;
+	}
+
+	if (total != (unsigned int) (((unsigned long long) frames * fir.up + fir.down - 1) / fir.down)) {
+		printf("  %s: %u frames out of %u\n", test->name, total, frames);
+		rc = -1;
+		goto complete;
+	}
+
+	for (k = 0; k < total; k++) {
+		if (out[k * test->out_channels] == gta04_voice_fir_test_reference(&fir, signal, k) &&
+			out[k * test->out_channels] == out[(k + 1) * test->out_channels - 1])
+			continue;
+
+		if (mismatches++ < 4)
+			printf("  %s: frame %u is %d, expected %d\n", test->name, k, out[k * test->out_channels], gta04_voice_fir_test_reference(&fir, signal, k));
+	}
+
+	printf("%s, signal %d: %u frames, %d mismatching\n", test->name, type, total, mismatches);
+
+	rc = mismatches > 0 ? -1 : 0;
+
+complete:
+	if (signal != NULL)
+		free(signal);
+
+	if (buffer != NULL)
+		free(buffer);
+
+	if (out != NULL)
+		free(out);
+
+	gta04_voice_fir_deinit(&fir);
+
+	return rc;
+}
+
+static int64_t gta04_voice_fir_test_cpu(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+		return 0;
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int gta04_voice_fir_test_benchmark(struct gta04_voice_fir_test *test,
+	double mhz)
+{
+	struct gta04_voice_fir fir;
+	int16_t *buffer;
+	int16_t *out;
+	unsigned int history;
+	unsigned int period;
+	int64_t best = 0;
+	int64_t start;
+	int64_t cpu;
+	double seconds;
+	int rc;
+	int i, r;
+
+	rc = gta04_voice_fir_init(&fir, test->in_rate, test->out_rate, test->in_channels, test->out_channels, test->taps);
+	if (rc < 0)
+		return -1;
+
+	history = test->taps - 1;
+	period = test->in_rate * GTA04_VOICE_PERIOD_MS / 1000;
+
+	buffer = (int16_t *) calloc((history + period) * test->in_channels, sizeof(int16_t));
+	out = (int16_t *) calloc(test->out_rate * GTA04_VOICE_PERIOD_MS / 1000 + 1, test->out_channels * sizeof(int16_t));
+
+	gta04_voice_fir_test_signal(buffer, history + period, test->in_channels, test->in_rate, 0);
+
+	for (r = 0; r < GTA04_VOICE_FIR_TEST_RUNS; r++) {
+		start = gta04_voice_fir_test_cpu();
+
+		for (i = 0; i < GTA04_VOICE_FIR_TEST_SECONDS * 1000 / GTA04_VOICE_PERIOD_MS; i++)
+			gta04_voice_fir_process(&fir, buffer, period, out, test->out_rate * GTA04_VOICE_PERIOD_MS / 1000 + 1);
+
+		cpu = gta04_voice_fir_test_cpu() - start;
+		if (r == 0 || cpu < best)
+			best = cpu;
+	}
+
+	seconds = best / 1e9 / GTA04_VOICE_FIR_TEST_SECONDS;
+
+	if (mhz > 0)
+		printf("%s: %.3f ms of CPU per second of audio, %.2f Mcycles at %.0f MHz\n", test->name, seconds * 1e3, seconds * mhz, mhz);
+	else
+		printf("%s: %.3f ms of CPU per second of audio\n", test->name, seconds * 1e3);
+
+	free(buffer);
+	free(out);
+
+	gta04_voice_fir_deinit(&fir);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	double mhz = 0;
+	int failures = 0;
+	int type;
+	int rc;
+	int i;
+
+	while ((rc = getopt(argc, argv, "c:")) != -1) {
+		switch (rc) {
+			case 'c':
+				mhz = atof(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-c MHz]\n", argv[0]);
+				return 1;
+		}
+	}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	printf("Kernels: NEON\n");
+#else
+	printf("Kernels: scalar\n");
+#endif
+
+	srand(1);
+
+	for (i = 0; i < gta04_voice_fir_tests_count; i++)
+		for (type = 0; type < 3; type++)
+			if (gta04_voice_fir_test_exact(&gta04_voice_fir_tests[i], type) < 0)
+				failures++;
+
+	for (i = 0; i < gta04_voice_fir_tests_count; i++)
+		gta04_voice_fir_test_benchmark(&gta04_voice_fir_tests[i], mhz);
+
+	if (failures > 0)
+		printf("FAIL: %d\n", failures);
+
+	return failures > 0 ? 1 : 0;
+}
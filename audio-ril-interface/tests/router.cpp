@@ -0,0 +1,297 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "voice-router.h"
+#include "fake.h"
+
+/*
+ * Router test: runs the whole router, call states included, with the file
+ * backend standing in for both cards, paced in real time. Without a session
+ * directory, one is synthesized with a click one second into each capture,
+ * whose position in the playback files gives the latency of each direction.
+ * The modem capture is one second shorter, so that its end hangs the call up.
+ *
+ * Usage: gta04_voice_router_test [-d seconds] [-p period_ms] [-g ppm] [-m ppm]
+ *	[-r record] [session]
+ *
+ * Sessions hold card0-capture.raw and card1-capture.raw, raw samples or WAV
+ * files, the playbacks are written next to them.
+ */
+
+#define GTA04_VOICE_ROUTER_TEST_DURATION	10
+#define GTA04_VOICE_ROUTER_TEST_CLICK		1000
+#define GTA04_VOICE_ROUTER_TEST_THRESHOLD	1000
+#define GTA04_VOICE_ROUTER_TEST_LATENCY_MAX	200
+
+static int gta04_voice_router_test_synthesize(const char *directory,
+	unsigned int card, unsigned int rate, unsigned int channels,
+	unsigned int seconds)
+{
+	char path[PATH_MAX];
+	int16_t frame[GTA04_VOICE_CHANNELS_MAX];
+	unsigned int click;
+	unsigned int i;
+	unsigned int c;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/card%u-capture.raw", directory, card);
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Opening %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	click = rate * GTA04_VOICE_ROUTER_TEST_CLICK / 1000;
+
+	for (i = 0; i < rate * seconds; i++) {
+		for (c = 0; c < channels; c++)
+			frame[c] = i == click ? 30000 : 0;
+
+		fwrite(frame, sizeof(int16_t), channels, file);
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+/*
+ * Returns the time of the loudest frame of a playback in ms, or -1.
+ */
+static int gta04_voice_router_test_click(const char *directory,
+	unsigned int card, unsigned int rate, unsigned int channels)
+{
+	char path[PATH_MAX];
+	int16_t frame[GTA04_VOICE_CHANNELS_MAX];
+	unsigned long long position = 0;
+	long long peak_position = -1;
+	int peak = GTA04_VOICE_ROUTER_TEST_THRESHOLD;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/card%u-playback.raw", directory, card);
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Opening %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fread(frame, sizeof(int16_t), channels, file) == channels) {
+		if (abs(frame[0]) > peak) {
+			peak = abs(frame[0]);
+			peak_position = position;
+		}
+
+		position++;
+	}
+
+	fclose(file);
+
+	if (peak_position < 0)
+		return -1;
+
+	return (int) (peak_position * 1000 / rate);
+}
+
+static void gta04_voice_router_test_remove(const char *directory)
+{
+	const char *names[] = { "card0-capture.raw", "card1-capture.raw", "card0-playback.raw", "card1-playback.raw" };
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+		unlink(path);
+	}
+
+	rmdir(directory);
+}
+
+static double gta04_voice_router_test_cpu(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	struct gta04_voice_router router;
+	struct gta04_voice_direction *direction;
+	struct gta04_voice_stats *stats;
+	char temporary[] = "/tmp/gta04_voice_router_test.XXXXXX";
+	const char *directory = NULL;
+	const char *record = NULL;
+	const char *drift_gta04 = "0";
+	const char *drift_modem = "0";
+	const char *period_ms = "";
+	unsigned int seconds = GTA04_VOICE_ROUTER_TEST_DURATION;
+	unsigned int waited = 0;
+	int latencies[GTA04_VOICE_DIRECTIONS_COUNT];
+	int active = 0;
+	int state;
+	int failures = 0;
+	double cpu;
+	int rc;
+	int i;
+
+	while ((rc = getopt(argc, argv, "d:p:g:m:r:")) != -1) {
+		switch (rc) {
+			case 'd':
+				seconds = atoi(optarg);
+				break;
+			case 'p':
+				period_ms = optarg;
+				break;
+			case 'g':
+				drift_gta04 = optarg;
+				break;
+			case 'm':
+				drift_modem = optarg;
+				break;
+			case 'r':
+				record = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (seconds < 2)
+		goto usage;
+
+	if (optind < argc) {
+		directory = argv[optind];
+	} else {
+		directory = mkdtemp(temporary);
+		if (directory == NULL) {
+			fprintf(stderr, "Creating %s failed: %s\n", temporary, strerror(errno));
+			return 1;
+		}
+
+		if (gta04_voice_router_test_synthesize(directory, GTA04_VOICE_CARD_GTA04, GTA04_VOICE_GTA04_RATE, GTA04_VOICE_GTA04_CHANNELS, seconds + 1) < 0 ||
+			gta04_voice_router_test_synthesize(directory, GTA04_VOICE_CARD_MODEM, GTA04_VOICE_MODEM_RATE, GTA04_VOICE_MODEM_CHANNELS, seconds) < 0)
+			goto error;
+	}
+
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_BACKEND, "file");
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_FILE_PATH, directory);
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_FILE_DRIFT "0", drift_gta04);
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_FILE_DRIFT "1", drift_modem);
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_PERIOD_MS, period_ms);
+	gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_CALL_STATE, "active");
+
+	if (record != NULL)
+		gta04_voice_fake_property_set(GTA04_VOICE_PROPERTY_RECORD_PATH, record);
+
+	cpu = gta04_voice_router_test_cpu();
+
+	rc = gta04_voice_router_open(&router);
+	if (rc < 0) {
+		fprintf(stderr, "Opening the router failed\n");
+		goto error;
+	}
+
+	gta04_voice_router_request(&router, GTA04_VOICE_STATE_ACTIVE);
+
+	// The end of the modem capture hangs up, which brings the router back to idle
+	while (waited < (seconds * 2 + 5) * 1000) {
+		pthread_mutex_lock(&router.mutex);
+		state = router.state;
+		pthread_mutex_unlock(&router.mutex);
+
+		if (state == GTA04_VOICE_STATE_ACTIVE)
+			active = 1;
+		else if (state == GTA04_VOICE_STATE_IDLE && active)
+			break;
+
+		usleep(10000);
+		waited += 10;
+	}
+
+	if (state != GTA04_VOICE_STATE_IDLE || !active) {
+		printf("FAIL: the call didn't %s\n", active ? "hang up" : "connect");
+		failures++;
+	}
+
+	cpu = gta04_voice_router_test_cpu() - cpu;
+
+	printf("Routed %u s of audio with %u ms periods, CPU %.1f ms per second of audio\n", seconds, router.period_ms, cpu * 1000 / seconds);
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		direction = &router.directions[i];
+		stats = &direction->stats;
+
+		printf("%s: %u periods, %u overruns, %u underruns, %u errors, drift %d ppm (min %d, max %d)\n", direction->name, stats->periods, stats->overruns, stats->underruns, stats->errors, direction->drift.ppm, stats->drift_ppm_min, stats->drift_ppm_max);
+
+		if (stats->overruns > 0) {
+			printf("FAIL: %s overruns\n", direction->name);
+			failures++;
+		}
+
+		latencies[i] = -1;
+
+		// Recorded sessions have nothing to look for
+		if (optind < argc)
+			continue;
+
+		latencies[i] = gta04_voice_router_test_click(directory, direction->sink_card, direction->sink_config.rate, direction->sink_config.channels);
+		if (latencies[i] >= 0)
+			latencies[i] -= GTA04_VOICE_ROUTER_TEST_CLICK;
+
+		printf("%s: click played %d ms after it was captured\n", direction->name, latencies[i]);
+
+		if (latencies[i] < 0 || latencies[i] > GTA04_VOICE_ROUTER_TEST_LATENCY_MAX) {
+			printf("FAIL: %s latency\n", direction->name);
+			failures++;
+		}
+	}
+
+	gta04_voice_router_close(&router);
+
+	if (optind >= argc)
+		gta04_voice_router_test_remove(directory);
+
+	return failures > 0 ? 1 : 0;
+
+error:
+	if (optind >= argc)
+		gta04_voice_router_test_remove(directory);
+
+	return 1;
+
+usage:
+	fprintf(stderr, "Usage: %s [-d seconds] [-p period_ms] [-g ppm] [-m ppm] [-r record] [session]\n", argv[0]);
+
+	return 1;
+}
@@ -0,0 +1,302 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GTA04_VOICE_FIR_NEON
+#endif
+
+#define LOG_TAG "AudioRILInterface"
+#include <cutils/log.h>
+
+#include "voice-router.h"
+
+/*
+ * Polyphase FIR resampling, with the up or down mixing done in the same pass:
+ * each output frame is the dot product of one phase of the filter with the
+ * last input frames, that are read straight from the capture buffer.
+ *
+ * The filter is a Kaiser windowed sinc, designed for the rate ratio once when
+ * the router is opened and kept in Q15. Products are summed in 32 bits: the
+ * filter is scaled down so that no phase can overflow, even with the worst
+ * full scale input.
+ */
+
+static unsigned int gta04_voice_fir_gcd(unsigned int a, unsigned int b)
+{
+	unsigned int t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static double gta04_voice_fir_bessel(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	int k;
+
+	for (k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+int gta04_voice_fir_init(struct gta04_voice_fir *fir, unsigned int in_rate,
+	unsigned int out_rate, unsigned int in_channels, unsigned int out_channels,
+	unsigned int taps)
+{
+	unsigned int length;
+	unsigned int gcd;
+	unsigned int p;
+	unsigned int j;
+	double cutoff;
+	double window;
+	double center;
+	double rate;
+	double x;
+	double h;
+	long value;
+	long long sum;
+	long long sum_max;
+	unsigned int i;
+
+	if (fir == NULL || taps == 0 || taps % 8 != 0)
+		return -1;
+
+	// Only stereo to mono and mono to stereo have kernels
+	if (in_channels + out_channels != 3)
+		return -1;
+
+	memset(fir, 0, sizeof(struct gta04_voice_fir));
+
+	gcd = gta04_voice_fir_gcd(in_rate, out_rate);
+
+	fir->up = out_rate / gcd;
+	fir->down = in_rate / gcd;
+	fir->taps = taps;
+	fir->in_channels = in_channels;
+	fir->out_channels = out_channels;
+
+	fir->coefs = (int16_t *) malloc(fir->up * taps * sizeof(int16_t));
+	if (fir->coefs == NULL)
+		return -1;
+
+	// The prototype filter runs at the input rate times the up factor
+	length = fir->up * taps;
+	rate = (double) in_rate * fir->up;
+	cutoff = GTA04_VOICE_FIR_CUTOFF * (in_rate < out_rate ? in_rate : out_rate) / 2.0 / rate;
+	center = (length - 1) / 2.0;
+
+	for (p = 0; p < fir->up; p++) {
+		for (j = 0; j < taps; j++) {
+			// Phases are stored reversed, to run along the input
+			x = p + (double) fir->up * (taps - 1 - j) - center;
+
+			window = 1.0 - (x / (center + 1.0)) * (x / (center + 1.0));
+			window = gta04_voice_fir_bessel(GTA04_VOICE_FIR_BETA * sqrt(window > 0 ? window : 0)) / gta04_voice_fir_bessel(GTA04_VOICE_FIR_BETA);
+
+			h = x == 0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+			h *= window * fir->up;
+
+			value = lround(h * 32768.0);
+			if (value > 32767)
+				value = 32767;
+			else if (value < -32768)
+				value = -32768;
+
+			fir->coefs[p * taps + j] = (int16_t) value;
+		}
+	}
+
+	sum_max = 0;
+
+	for (p = 0; p < fir->up; p++) {
+		sum = 0;
+		for (j = 0; j < taps; j++)
+			sum += abs(fir->coefs[p * taps + j]);
+
+		if (sum > sum_max)
+			sum_max = sum;
+	}
+
+	// Rounded towards zero, so that the sums only get smaller
+	if (sum_max * 32768 > INT_MAX)
+		for (i = 0; i < length; i++)
+			fir->coefs[i] = (int16_t) (fir->coefs[i] * (long long) (INT_MAX / 32768) / sum_max);
+
+	return 0;
+}
+
+void gta04_voice_fir_deinit(struct gta04_voice_fir *fir)
+{
+	if (fir == NULL)
+		return;
+
+	if (fir->coefs != NULL)
+		free(fir->coefs);
+
+	memset(fir, 0, sizeof(struct gta04_voice_fir));
+}
+
+static inline int16_t gta04_voice_fir_round(int32_t sum)
+{
+	sum = (sum + (1 << 14)) >> 15;
+
+	if (sum > 32767)
+		return 32767;
+	else if (sum < -32768)
+		return -32768;
+
+	return (int16_t) sum;
+}
+
+/*
+ * Stereo in: both channels are averaged, rounding down like vhadd.
+ */
+static inline int16_t gta04_voice_fir_stereo(const int16_t *in,
+	const int16_t *coefs, unsigned int taps)
+{
+	unsigned int j;
+
+#ifdef GTA04_VOICE_FIR_NEON
+	int32x4_t sum = vdupq_n_s32(0);
+	int32x2_t total;
+	int16x8x2_t frames;
+	int16x8_t mono;
+	int16x8_t coef;
+
+	for (j = 0; j < taps; j += 8) {
+		frames = vld2q_s16(&in[j * 2]);
+		mono = vhaddq_s16(frames.val[0], frames.val[1]);
+		coef = vld1q_s16(&coefs[j]);
+
+		sum = vmlal_s16(sum, vget_low_s16(mono), vget_low_s16(coef));
+		sum = vmlal_s16(sum, vget_high_s16(mono), vget_high_s16(coef));
+	}
+
+	total = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+	total = vpadd_s32(total, total);
+
+	return gta04_voice_fir_round(vget_lane_s32(total, 0));
+#else
+	int32_t sum = 0;
+
+	for (j = 0; j < taps; j++)
+		sum += coefs[j] * ((in[j * 2] + in[j * 2 + 1]) >> 1);
+
+	return gta04_voice_fir_round(sum);
+#endif
+}
+
+static inline int16_t gta04_voice_fir_mono(const int16_t *in,
+	const int16_t *coefs, unsigned int taps)
+{
+	unsigned int j;
+
+#ifdef GTA04_VOICE_FIR_NEON
+	int32x4_t sum = vdupq_n_s32(0);
+	int32x2_t total;
+	int16x8_t frames;
+	int16x8_t coef;
+
+	for (j = 0; j < taps; j += 8) {
+		frames = vld1q_s16(&in[j]);
+		coef = vld1q_s16(&coefs[j]);
+
+		sum = vmlal_s16(sum, vget_low_s16(frames), vget_low_s16(coef));
+		sum = vmlal_s16(sum, vget_high_s16(frames), vget_high_s16(coef));
+	}
+
+	total = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+	total = vpadd_s32(total, total);
+
+	return gta04_voice_fir_round(vget_lane_s32(total, 0));
+#else
+	int32_t sum = 0;
+
+	for (j = 0; j < taps; j++)
+		sum += coefs[j] * in[j];
+
+	return gta04_voice_fir_round(sum);
+#endif
+}
+
+/*
+ * The buffer holds the last taps - 1 frames of the previous period, followed
+ * by the frames of this one: the next period is expected at the same offset.
+ * Returns the number of output frames.
+ */
+unsigned int gta04_voice_fir_process(struct gta04_voice_fir *fir,
+	int16_t *buffer, unsigned int frames, int16_t *out, unsigned int out_frames)
+{
+	unsigned int step;
+	unsigned int fraction;
+	unsigned int count;
+	const int16_t *coefs;
+	int16_t sample;
+
+	step = fir->down / fir->up;
+	fraction = fir->down % fir->up;
+	count = 0;
+
+	while (count < out_frames && fir->index < frames) {
+		coefs = &fir->coefs[fir->phase * fir->taps];
+
+		if (fir->in_channels == 2) {
+			out[count] = gta04_voice_fir_stereo(&buffer[fir->index * 2], coefs, fir->taps);
+		} else {
+			sample = gta04_voice_fir_mono(&buffer[fir->index], coefs, fir->taps);
+			out[count * 2] = sample;
+			out[count * 2 + 1] = sample;
+		}
+
+		fir->index += step;
+		fir->phase += fraction;
+		if (fir->phase >= fir->up) {
+			fir->phase -= fir->up;
+			fir->index++;
+		}
+
+		count++;
+	}
+
+	// Output would have been cut short: skip the rest of the input
+	if (fir->index < frames)
+		fir->index = frames;
+
+	fir->index -= frames;
+
+	memmove(buffer, &buffer[frames * fir->in_channels], (fir->taps - 1) * fir->in_channels * sizeof(int16_t));
+
+	return count;
+}
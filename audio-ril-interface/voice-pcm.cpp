@@ -0,0 +1,345 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "AudioRILInterface"
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "voice-router.h"
+
+/*
+ * The router only goes through a backend to get to the PCMs: tinyalsa on the
+ * device, or files and named pipes, paced like the cards would be, to run and
+ * measure it anywhere.
+ */
+
+/*
+ * Tinyalsa
+ */
+
+static void *gta04_voice_tinyalsa_open(unsigned int card, int capture,
+	struct pcm_config *config)
+{
+	struct pcm *pcm;
+
+	pcm = pcm_open(card, 0, capture ? PCM_IN : PCM_OUT, config);
+	if (!pcm || !pcm_is_ready(pcm)) {
+		ALOGE("Unable to open PCM device %d,0 (%s)", card, pcm_get_error(pcm));
+		if (pcm)
+			pcm_close(pcm);
+		return NULL;
+	}
+
+	return (void *) pcm;
+}
+
+static int gta04_voice_tinyalsa_prepare(void *data)
+{
+	return pcm_prepare((struct pcm *) data);
+}
+
+static int gta04_voice_tinyalsa_read(void *data, void *buffer,
+	unsigned int frames)
+{
+	struct pcm *pcm = (struct pcm *) data;
+
+	return pcm_read(pcm, buffer, pcm_frames_to_bytes(pcm, frames));
+}
+
+static int gta04_voice_tinyalsa_write(void *data, const void *buffer,
+	unsigned int frames)
+{
+	struct pcm *pcm = (struct pcm *) data;
+
+	return pcm_write(pcm, buffer, pcm_frames_to_bytes(pcm, frames));
+}
+
+static unsigned int gta04_voice_tinyalsa_latency(void *data)
+{
+	return pcm_get_latency((struct pcm *) data);
+}
+
+static const char *gta04_voice_tinyalsa_error(void *data)
+{
+	return pcm_get_error((struct pcm *) data);
+}
+
+static void gta04_voice_tinyalsa_close(void *data)
+{
+	pcm_close((struct pcm *) data);
+}
+
+const struct gta04_voice_backend gta04_voice_backend_tinyalsa = {
+	"tinyalsa",
+	gta04_voice_tinyalsa_open,
+	gta04_voice_tinyalsa_prepare,
+	gta04_voice_tinyalsa_read,
+	gta04_voice_tinyalsa_write,
+	gta04_voice_tinyalsa_latency,
+	gta04_voice_tinyalsa_error,
+	gta04_voice_tinyalsa_close,
+};
+
+/*
+ * File
+ *
+ * Captures read card<N>-capture.raw (or a WAV file with the right format)
+ * and playbacks write card<N>-playback.raw, in the directory set by
+ * gta04.voice.file.path: both can be named pipes. Each card runs from its
+ * own clock, off by gta04.voice.file.drift<N> ppm. The end of a capture file
+ * is reported as an error, which ends the call for the modem.
+ */
+
+struct gta04_voice_file {
+	int fd;
+	int capture;
+	unsigned int frame_size;
+	unsigned int buffer_frames;
+	double rate;
+
+	int64_t start;
+	unsigned long long frames;
+
+	const char *error;
+};
+
+static int64_t gta04_voice_file_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Waits until the card clock gets to the given frame.
+ */
+static void gta04_voice_file_pace(struct gta04_voice_file *file,
+	long long frame)
+{
+	struct timespec ts;
+	int64_t time;
+
+	if (file->start == 0)
+		file->start = gta04_voice_file_time();
+
+	if (frame <= 0)
+		return;
+
+	time = file->start + (int64_t) (frame * 1000000000.0 / file->rate);
+
+	ts.tv_sec = time / 1000000000LL;
+	ts.tv_nsec = time % 1000000000LL;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void gta04_voice_file_header(struct gta04_voice_file *file)
+{
+	struct stat st;
+	char header[44];
+	int rc;
+
+	// Pipes are expected to carry raw samples
+	if (fstat(file->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	rc = read(file->fd, header, sizeof(header));
+	if (rc == (int) sizeof(header) && strncmp(header, "RIFF", 4) == 0 && strncmp(&header[8], "WAVE", 4) == 0)
+		return;
+
+	lseek(file->fd, 0, SEEK_SET);
+}
+
+static void *gta04_voice_file_open(unsigned int card, int capture,
+	struct pcm_config *config)
+{
+	struct gta04_voice_file *file;
+	char value[PROPERTY_VALUE_MAX];
+	char name[PROPERTY_KEY_MAX];
+	char path[PATH_MAX];
+	int drift;
+
+	file = (struct gta04_voice_file *) calloc(1, sizeof(struct gta04_voice_file));
+	if (file == NULL)
+		return NULL;
+
+	property_get(GTA04_VOICE_PROPERTY_FILE_PATH, value, GTA04_VOICE_FILE_PATH);
+	snprintf(path, sizeof(path), "%s/card%u-%s.raw", value, card, capture ? "capture" : "playback");
+
+	snprintf(name, sizeof(name), "%s%u", GTA04_VOICE_PROPERTY_FILE_DRIFT, card);
+	property_get(name, value, "0");
+	drift = atoi(value);
+
+	file->capture = capture;
+	file->frame_size = config->channels * sizeof(int16_t);
+	file->buffer_frames = config->period_size * config->period_count;
+	file->rate = config->rate * (1.0 + drift / 1000000.0);
+
+	if (capture)
+		file->fd = open(path, O_RDONLY);
+	else
+		file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (file->fd < 0) {
+		ALOGE("Unable to open %s: %s", path, strerror(errno));
+		free(file);
+		return NULL;
+	}
+
+	if (capture)
+		gta04_voice_file_header(file);
+
+	return (void *) file;
+}
+
+static int gta04_voice_file_prepare(void *data)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+
+	file->start = 0;
+	file->frames = 0;
+
+	return 0;
+}
+
+static int gta04_voice_file_read(void *data, void *buffer, unsigned int frames)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+	unsigned int length;
+	unsigned int count;
+	int rc;
+
+	// The period is only there once the card has captured all of it
+	gta04_voice_file_pace(file, file->frames + frames);
+
+	length = frames * file->frame_size;
+	count = 0;
+
+	while (count < length) {
+		rc = read(file->fd, (char *) buffer + count, length - count);
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc <= 0) {
+			file->error = rc == 0 ? "End of file" : strerror(errno);
+			return -1;
+		}
+
+		count += rc;
+	}
+
+	file->frames += frames;
+
+	return 0;
+}
+
+static int gta04_voice_file_write(void *data, const void *buffer,
+	unsigned int frames)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+	unsigned int length;
+	unsigned int count;
+	int rc;
+
+	// Writes block while the buffer of the card is full
+	gta04_voice_file_pace(file, (long long) file->frames + frames - file->buffer_frames);
+
+	length = frames * file->frame_size;
+	count = 0;
+
+	while (count < length) {
+		rc = write(file->fd, (const char *) buffer + count, length - count);
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc <= 0) {
+			file->error = strerror(errno);
+			return -1;
+		}
+
+		count += rc;
+	}
+
+	file->frames += frames;
+
+	return 0;
+}
+
+static unsigned int gta04_voice_file_latency(void *data)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+
+	return (unsigned int) (file->buffer_frames * 1000 / file->rate);
+}
+
+static const char *gta04_voice_file_error(void *data)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+
+	return file->error != NULL ? file->error : "";
+}
+
+static void gta04_voice_file_close(void *data)
+{
+	struct gta04_voice_file *file = (struct gta04_voice_file *) data;
+
+	close(file->fd);
+	free(file);
+}
+
+const struct gta04_voice_backend gta04_voice_backend_file = {
+	"file",
+	gta04_voice_file_open,
+	gta04_voice_file_prepare,
+	gta04_voice_file_read,
+	gta04_voice_file_write,
+	gta04_voice_file_latency,
+	gta04_voice_file_error,
+	gta04_voice_file_close,
+};
+
+/*
+ * Backend
+ */
+
+const struct gta04_voice_backend *gta04_voice_backend_get(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+
+	property_get(GTA04_VOICE_PROPERTY_BACKEND, value, "");
+
+	if (strcmp(value, gta04_voice_backend_file.name) == 0)
+		return &gta04_voice_backend_file;
+
+	return &gta04_voice_backend_tinyalsa;
+}
@@ -0,0 +1,354 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define LOG_TAG "AudioRILInterface"
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "voice-router.h"
+
+/*
+ * Call recording
+ *
+ * Both directions are tapped on their modem side, where they are 8000Hz mono:
+ * the capture threads only push their period to a ring each, after the ring
+ * of the playback thread got it. A writer thread interleaves them, uplink on
+ * the left and downlink on the right, to a WAV file in the directory set by
+ * gta04.voice.record.path. When it falls behind, the tap drops frames rather
+ * than holding up the call.
+ */
+
+static void gta04_voice_record_le16(unsigned char *p, unsigned int value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+}
+
+static void gta04_voice_record_le32(unsigned char *p, unsigned int value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+}
+
+static int gta04_voice_record_header(struct gta04_voice_record *record)
+{
+	unsigned char header[44];
+	unsigned int size;
+	int rc;
+
+	size = (unsigned int) (record->written * GTA04_VOICE_RECORD_CHANNELS * sizeof(int16_t));
+
+	memcpy(&header[0], "RIFF", 4);
+	gta04_voice_record_le32(&header[4], 36 + size);
+	memcpy(&header[8], "WAVE", 4);
+	memcpy(&header[12], "fmt ", 4);
+	gta04_voice_record_le32(&header[16], 16);
+	gta04_voice_record_le16(&header[20], 1);
+	gta04_voice_record_le16(&header[22], GTA04_VOICE_RECORD_CHANNELS);
+	gta04_voice_record_le32(&header[24], record->rate);
+	gta04_voice_record_le32(&header[28], record->rate * GTA04_VOICE_RECORD_CHANNELS * sizeof(int16_t));
+	gta04_voice_record_le16(&header[32], GTA04_VOICE_RECORD_CHANNELS * sizeof(int16_t));
+	gta04_voice_record_le16(&header[34], 16);
+	memcpy(&header[36], "data", 4);
+	gta04_voice_record_le32(&header[40], size);
+
+	rc = pwrite(record->fd, header, sizeof(header), 0);
+	if (rc != (int) sizeof(header))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Writes what both directions have, or everything padded with silence when
+ * the call is over.
+ */
+static void gta04_voice_record_flush(struct gta04_voice_record *record,
+	int last)
+{
+	unsigned int fills[GTA04_VOICE_DIRECTIONS_COUNT];
+	unsigned int frames;
+	unsigned int count;
+	unsigned int length;
+	unsigned int i;
+	unsigned int j;
+	int rc;
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++)
+		fills[i] = gta04_voice_ring_fill(&record->rings[i]);
+
+	frames = last ? (fills[0] > fills[1] ? fills[0] : fills[1]) : (fills[0] < fills[1] ? fills[0] : fills[1]);
+
+	while (frames > 0) {
+		count = frames < record->frames ? frames : record->frames;
+
+		for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+			length = gta04_voice_ring_read(&record->rings[i], record->samples, count);
+			if (length < count)
+				memset(&record->samples[length], 0, (count - length) * sizeof(int16_t));
+
+			for (j = 0; j < count; j++)
+				record->buffer[j * GTA04_VOICE_RECORD_CHANNELS + i] = record->samples[j];
+		}
+
+		frames -= count;
+
+		// Keep draining after a write error, so that the tap never blocks
+		if (record->fd < 0)
+			continue;
+
+		length = count * GTA04_VOICE_RECORD_CHANNELS * sizeof(int16_t);
+
+		rc = write(record->fd, record->buffer, length);
+		if (rc != (int) length) {
+			ALOGE("Unable to write call recording: %s", rc < 0 ? strerror(errno) : "Short write");
+			close(record->fd);
+			record->fd = -1;
+			continue;
+		}
+
+		record->written += count;
+	}
+}
+
+static void *gta04_voice_record_thread(void *data)
+{
+	struct gta04_voice_record *record;
+	struct timespec ts;
+	char path[PATH_MAX];
+	struct tm tm;
+	time_t now;
+	int rc;
+
+	record = (struct gta04_voice_record *) data;
+
+	now = time(NULL);
+	localtime_r(&now, &tm);
+
+	snprintf(path, sizeof(path), "%s/call-%04d%02d%02d-%02d%02d%02d.wav", record->path, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+	record->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (record->fd < 0) {
+		ALOGE("Unable to open %s: %s", path, strerror(errno));
+	} else if (gta04_voice_record_header(record) < 0) {
+		ALOGE("Unable to write call recording header: %s", strerror(errno));
+		close(record->fd);
+		record->fd = -1;
+	} else {
+		// The header is written with pwrite, the samples go after it
+		lseek(record->fd, 0, SEEK_END);
+	}
+
+	pthread_mutex_lock(&record->mutex);
+
+	while (record->running) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += GTA04_VOICE_RECORD_PERIOD_MS * 1000000;
+		while (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		rc = pthread_cond_timedwait(&record->cond, &record->mutex, &ts);
+		if (rc != ETIMEDOUT)
+			continue;
+
+		pthread_mutex_unlock(&record->mutex);
+		gta04_voice_record_flush(record, 0);
+		pthread_mutex_lock(&record->mutex);
+	}
+
+	pthread_mutex_unlock(&record->mutex);
+
+	gta04_voice_record_flush(record, 1);
+
+	if (record->fd >= 0) {
+		gta04_voice_record_header(record);
+		close(record->fd);
+		record->fd = -1;
+	}
+
+	ALOGD("Voice recording: %llu ms to %s, %u frames dropped", record->written * 1000 / record->rate, path, record->dropped[GTA04_VOICE_UPLINK] + record->dropped[GTA04_VOICE_DOWNLINK]);
+
+	return NULL;
+}
+
+/*
+ * Recording is only enabled when gta04.voice.record.path is set.
+ */
+int gta04_voice_record_open(struct gta04_voice_record *record,
+	unsigned int rate)
+{
+	int rc;
+	int i;
+
+	if (record == NULL)
+		return -1;
+
+	memset(record, 0, sizeof(struct gta04_voice_record));
+	record->fd = -1;
+
+	property_get(GTA04_VOICE_PROPERTY_RECORD_PATH, record->path, "");
+	if (record->path[0] == '\0')
+		return 0;
+
+	record->rate = rate;
+	record->frames = rate * GTA04_VOICE_RECORD_PERIOD_MS / 1000;
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		rc = gta04_voice_ring_init(&record->rings[i], rate * GTA04_VOICE_RECORD_RING_MS / 1000, 1);
+		if (rc < 0)
+			goto error;
+	}
+
+	record->samples = (int16_t *) malloc(record->frames * sizeof(int16_t));
+	record->buffer = (int16_t *) malloc(record->frames * GTA04_VOICE_RECORD_CHANNELS * sizeof(int16_t));
+	if (record->samples == NULL || record->buffer == NULL)
+		goto error;
+
+	pthread_mutex_init(&record->mutex, NULL);
+	pthread_cond_init(&record->cond, NULL);
+
+	record->enabled = 1;
+
+	ALOGD("Voice recording to %s", record->path);
+
+	return 0;
+
+error:
+	ALOGE("Unable to allocate memory");
+	gta04_voice_record_close(record);
+
+	return -1;
+}
+
+void gta04_voice_record_close(struct gta04_voice_record *record)
+{
+	int i;
+
+	if (record == NULL)
+		return;
+
+	gta04_voice_record_stop(record);
+
+	if (record->enabled) {
+		pthread_cond_destroy(&record->cond);
+		pthread_mutex_destroy(&record->mutex);
+	}
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++)
+		gta04_voice_ring_deinit(&record->rings[i]);
+
+	free(record->samples);
+	free(record->buffer);
+
+	memset(record, 0, sizeof(struct gta04_voice_record));
+	record->fd = -1;
+}
+
+/*
+ * Called before the routing threads run, to start the call on empty rings.
+ */
+void gta04_voice_record_arm(struct gta04_voice_record *record)
+{
+	int i;
+
+	if (record == NULL || !record->enabled)
+		return;
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		record->rings[i].head = 0;
+		record->rings[i].tail = 0;
+		record->dropped[i] = 0;
+	}
+
+	record->written = 0;
+}
+
+/*
+ * Called once the call is connected: the file is opened by the writer
+ * thread, away from the routing threads.
+ */
+int gta04_voice_record_start(struct gta04_voice_record *record)
+{
+	int rc;
+
+	if (record == NULL || !record->enabled || record->started)
+		return 0;
+
+	record->running = 1;
+
+	rc = pthread_create(&record->thread, NULL, gta04_voice_record_thread, (void *) record);
+	if (rc != 0) {
+		ALOGE("Unable to create voice recording thread");
+		record->running = 0;
+		return -1;
+	}
+
+	record->started = 1;
+
+	return 0;
+}
+
+/*
+ * Called once the routing threads are done: writes what is left.
+ */
+void gta04_voice_record_stop(struct gta04_voice_record *record)
+{
+	if (record == NULL || !record->started)
+		return;
+
+	pthread_mutex_lock(&record->mutex);
+	record->running = 0;
+	pthread_cond_broadcast(&record->cond);
+	pthread_mutex_unlock(&record->mutex);
+
+	pthread_join(record->thread, NULL);
+	record->started = 0;
+}
+
+/*
+ * Called by the capture thread of the direction only.
+ */
+void gta04_voice_record_tap(struct gta04_voice_record *record, int direction,
+	int16_t *samples, unsigned int frames)
+{
+	unsigned int count;
+
+	if (!record->enabled)
+		return;
+
+	count = gta04_voice_ring_write(&record->rings[direction], samples, frames);
+	if (count < frames)
+		record->dropped[direction] += frames - count;
+}
@@ -0,0 +1,933 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define LOG_TAG "AudioRILInterface"
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "voice-router.h"
+
+/*
+ * GTA04 A3 Software Routing
+ *
+ * The modem works with 8000Hz, 16bit, mono
+ * The gta04 works with 44100Hz, 16bit, stereo
+ * => resampling and up/downmixing are needed in between, which are done in a
+ *    single pass by the kernels in voice-fir.cpp
+ */
+
+/*
+ * Ring
+ */
+
+int gta04_voice_ring_init(struct gta04_voice_ring *ring, unsigned int frames,
+	unsigned int channels)
+{
+	unsigned int size;
+
+	if (ring == NULL || frames == 0 || channels == 0)
+		return -1;
+
+	// A power of two size keeps the indexes right when they wrap around
+	size = 1;
+	while (size < frames)
+		size <<= 1;
+
+	memset(ring, 0, sizeof(struct gta04_voice_ring));
+
+	ring->samples = (int16_t *) calloc(size * channels, sizeof(int16_t));
+	if (ring->samples == NULL)
+		return -1;
+
+	ring->frames = size;
+	ring->channels = channels;
+
+	return 0;
+}
+
+void gta04_voice_ring_deinit(struct gta04_voice_ring *ring)
+{
+	if (ring == NULL)
+		return;
+
+	if (ring->samples != NULL)
+		free(ring->samples);
+
+	memset(ring, 0, sizeof(struct gta04_voice_ring));
+}
+
+unsigned int gta04_voice_ring_fill(struct gta04_voice_ring *ring)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return head - tail;
+}
+
+/*
+ * Called by the producer only: returns the number of frames that fit.
+ */
+unsigned int gta04_voice_ring_write(struct gta04_voice_ring *ring,
+	int16_t *samples, unsigned int frames)
+{
+	unsigned int head;
+	unsigned int tail;
+	unsigned int offset;
+	unsigned int count;
+	unsigned int chunk;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	count = ring->frames - (head - tail);
+	if (count > frames)
+		count = frames;
+
+	offset = head & (ring->frames - 1);
+	chunk = ring->frames - offset;
+	if (chunk > count)
+		chunk = count;
+
+	memcpy(&ring->samples[offset * ring->channels], samples, chunk * ring->channels * sizeof(int16_t));
+	if (count > chunk)
+		memcpy(ring->samples, &samples[chunk * ring->channels], (count - chunk) * ring->channels * sizeof(int16_t));
+
+	__atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+/*
+ * Called by the consumer only: returns the number of frames available.
+ */
+unsigned int gta04_voice_ring_read(struct gta04_voice_ring *ring,
+	int16_t *samples, unsigned int frames)
+{
+	unsigned int head;
+	unsigned int tail;
+	unsigned int offset;
+	unsigned int count;
+	unsigned int chunk;
+
+	tail = ring->tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	count = head - tail;
+	if (count > frames)
+		count = frames;
+
+	offset = tail & (ring->frames - 1);
+	chunk = ring->frames - offset;
+	if (chunk > count)
+		chunk = count;
+
+	memcpy(samples, &ring->samples[offset * ring->channels], chunk * ring->channels * sizeof(int16_t));
+	if (count > chunk)
+		memcpy(&samples[chunk * ring->channels], ring->samples, (count - chunk) * ring->channels * sizeof(int16_t));
+
+	__atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+/*
+ * Drift
+ */
+
+void gta04_voice_drift_init(struct gta04_voice_drift *drift,
+	unsigned int channels, unsigned int period)
+{
+	memset(drift, 0, sizeof(struct gta04_voice_drift));
+
+	drift->channels = channels;
+	drift->period = period;
+	// Away from the whole periods, where the measured fill jumps by a period
+	drift->target = period * GTA04_VOICE_DRIFT_TARGET_PERIODS + period / 2;
+	drift->fill = drift->target << 8;
+	drift->step = 1ULL << 32;
+}
+
+/*
+ * Trims the ratio from the ring fill, that is smoothed first. The proportional
+ * term corrects GTA04_VOICE_DRIFT_KP ppm per period of
+ * error and the integral term, critically damped with it, takes the steady
+ * offset between the two clocks.
+ */
+void gta04_voice_drift_update(struct gta04_voice_drift *drift,
+	unsigned int fill)
+{
+	int error;
+	int ppm;
+
+	if (drift->period == 0)
+		return;
+
+	// Filtered fill in 1/256 frames
+	drift->fill += (((int) fill << 8) - drift->fill) / 32;
+
+	error = (drift->fill - ((int) drift->target << 8)) / (int) drift->period;
+
+	// Integral in 1/1024 ppm
+	drift->integral += error;
+	if (drift->integral > GTA04_VOICE_DRIFT_PPM_MAX << 10)
+		drift->integral = GTA04_VOICE_DRIFT_PPM_MAX << 10;
+	else if (drift->integral < -(GTA04_VOICE_DRIFT_PPM_MAX << 10))
+		drift->integral = -(GTA04_VOICE_DRIFT_PPM_MAX << 10);
+
+	ppm = (error * GTA04_VOICE_DRIFT_KP + drift->integral / 4) >> 8;
+	if (ppm > GTA04_VOICE_DRIFT_PPM_MAX)
+		ppm = GTA04_VOICE_DRIFT_PPM_MAX;
+	else if (ppm < -GTA04_VOICE_DRIFT_PPM_MAX)
+		ppm = -GTA04_VOICE_DRIFT_PPM_MAX;
+
+	drift->ppm = ppm;
+
+	// A fuller ring means the sink is slower: consume input faster
+	drift->step = (1ULL << 32) + (int64_t) ppm * (1LL << 32) / 1000000;
+}
+
+/*
+ * Interpolates between the input frames, with the last frame of the previous
+ * period kept as the first point. Returns the number of output frames.
+ */
+unsigned int gta04_voice_drift_process(struct gta04_voice_drift *drift,
+	int16_t *in, unsigned int in_frames, int16_t *out, unsigned int out_frames)
+{
+	unsigned int channels;
+	unsigned int index;
+	unsigned int count;
+	unsigned int i;
+	int16_t *a;
+	int16_t *b;
+	int fraction;
+
+	if (in_frames == 0)
+		return 0;
+
+	channels = drift->channels;
+	count = 0;
+
+	while (count < out_frames) {
+		index = (unsigned int) (drift->position >> 32);
+		if (index >= in_frames)
+			break;
+
+		// 15 bits, so that a full scale step times the fraction fits in an int
+		fraction = (int) ((drift->position >> 17) & 0x7fff);
+
+		a = index == 0 ? drift->last : &in[(index - 1) * channels];
+		b = &in[index * channels];
+
+		for (i = 0; i < channels; i++)
+			out[count * channels + i] = a[i] + (((b[i] - a[i]) * fraction) >> 15);
+
+		drift->position += drift->step;
+		count++;
+	}
+
+	// Output would have been cut short: skip the rest of the input
+	if ((drift->position >> 32) < in_frames)
+		drift->position = (uint64_t) in_frames << 32;
+
+	drift->position -= (uint64_t) in_frames << 32;
+	memcpy(drift->last, &in[(in_frames - 1) * channels], channels * sizeof(int16_t));
+
+	return count;
+}
+
+/*
+ * Direction
+ */
+
+static void gta04_voice_priority(struct gta04_voice_router *router,
+	const char *name)
+{
+	struct sched_param param;
+	int rc;
+
+	if (router->priority <= 0)
+		return;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = router->priority;
+
+	rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (rc != 0)
+		ALOGE("Unable to use SCHED_FIFO for %s: %s", name, strerror(rc));
+}
+
+static int64_t gta04_voice_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * The ring fill jumps by a period whenever the playback thread runs, so the
+ * part of the period it drained since then is taken out: this keeps the
+ * estimate continuous when both threads drift in and out of phase.
+ */
+static unsigned int gta04_voice_drift_fill(struct gta04_voice_direction *direction)
+{
+	unsigned int fill;
+	int64_t elapsed;
+	int64_t drained;
+
+	fill = gta04_voice_ring_fill(&direction->ring);
+
+	elapsed = gta04_voice_time() - __atomic_load_n(&direction->read_time, __ATOMIC_ACQUIRE);
+	drained = elapsed * direction->sink_config.rate / 1000000000LL;
+	if (drained < 0)
+		drained = 0;
+	else if (drained > direction->sink_frames)
+		drained = direction->sink_frames;
+
+	return fill > drained ? fill - (unsigned int) drained : 0;
+}
+
+static int gta04_voice_router_wait(struct gta04_voice_router *router);
+
+static void *gta04_voice_capture_thread(void *data)
+{
+	struct gta04_voice_direction *direction;
+	struct gta04_voice_router *router;
+	int16_t *capture;
+	unsigned int frames;
+	unsigned int count;
+	int rc;
+
+	direction = (struct gta04_voice_direction *) data;
+	router = direction->router;
+
+	// Periods are read after the history the filter needs
+	capture = &direction->capture_buffer[(direction->fir.taps - 1) * direction->source_config.channels];
+
+	gta04_voice_priority(router, direction->name);
+
+	if (gta04_voice_router_wait(router) < 0)
+		return NULL;
+
+	while (router->running) {
+		rc = router->backend->read(direction->source, capture, direction->source_frames);
+		if (rc < 0) {
+			direction->stats.errors++;
+
+			// This might fail, then we have to stop routing (hangup happened)
+			if (direction->source_card == GTA04_VOICE_CARD_MODEM) {
+				ALOGD("Error capturing sample from modem (hangup)");
+				gta04_voice_router_stop(router);
+				break;
+			}
+
+			ALOGD("pcm_read, %s: %s", direction->name, router->backend->error(direction->source));
+			continue;
+		}
+
+		frames = gta04_voice_fir_process(&direction->fir, direction->capture_buffer, direction->source_frames, direction->convert_buffer, direction->convert_frames);
+		frames = gta04_voice_drift_process(&direction->drift, direction->convert_buffer, frames, direction->drift_buffer, direction->drift_frames);
+
+		count = gta04_voice_ring_write(&direction->ring, direction->drift_buffer, frames);
+		if (count < frames)
+			direction->stats.overruns++;
+
+		// The call is recorded on the modem side of both directions
+		if (direction->source_card == GTA04_VOICE_CARD_MODEM)
+			gta04_voice_record_tap(&router->record, direction - router->directions, capture, direction->source_frames);
+		else
+			gta04_voice_record_tap(&router->record, direction - router->directions, direction->drift_buffer, frames);
+
+		// Nothing is drained before playback starts
+		if (!__atomic_load_n(&direction->primed, __ATOMIC_ACQUIRE))
+			continue;
+
+		gta04_voice_drift_update(&direction->drift, gta04_voice_drift_fill(direction));
+
+		if (direction->drift.ppm < direction->stats.drift_ppm_min)
+			direction->stats.drift_ppm_min = direction->drift.ppm;
+		if (direction->drift.ppm > direction->stats.drift_ppm_max)
+			direction->stats.drift_ppm_max = direction->drift.ppm;
+	}
+
+	return NULL;
+}
+
+static void *gta04_voice_playback_thread(void *data)
+{
+	struct gta04_voice_direction *direction;
+	struct gta04_voice_router *router;
+	unsigned int stats_periods;
+	unsigned int fill;
+	unsigned int count;
+	int rc;
+
+	direction = (struct gta04_voice_direction *) data;
+	router = direction->router;
+
+	gta04_voice_priority(router, direction->name);
+
+	stats_periods = GTA04_VOICE_STATS_INTERVAL_MS / router->period_ms;
+
+	if (gta04_voice_router_wait(router) < 0)
+		return NULL;
+
+	while (router->running) {
+		fill = gta04_voice_ring_fill(&direction->ring);
+
+		// Don't fill the sink with silence before the first samples arrive
+		if (!direction->primed) {
+			if (fill < direction->sink_frames) {
+				usleep(router->period_ms * 1000 / 2);
+				continue;
+			}
+
+			__atomic_store_n(&direction->primed, 1, __ATOMIC_RELEASE);
+		}
+
+		direction->stats.periods++;
+		direction->stats.fill_sum += fill;
+		if (fill > direction->stats.fill_max)
+			direction->stats.fill_max = fill;
+
+		count = gta04_voice_ring_read(&direction->ring, direction->playback_buffer, direction->sink_frames);
+		__atomic_store_n(&direction->read_time, gta04_voice_time(), __ATOMIC_RELEASE);
+
+		if (count < direction->sink_frames) {
+			memset(&direction->playback_buffer[count * direction->sink_config.channels], 0, (direction->sink_frames - count) * direction->sink_config.channels * sizeof(int16_t));
+			direction->stats.underruns++;
+		}
+
+		rc = router->backend->write(direction->sink, direction->playback_buffer, direction->sink_frames);
+		if (rc < 0) {
+			direction->stats.errors++;
+
+			// This might fail, then we have to stop routing (hangup happened)
+			if (direction->sink_card == GTA04_VOICE_CARD_MODEM) {
+				ALOGE("Error playing sample on modem (hangup)");
+				gta04_voice_router_stop(router);
+				break;
+			}
+
+			ALOGD("pcm_write, %s: %s", direction->name, router->backend->error(direction->sink));
+		} else if (direction->first_time == 0) {
+			direction->first_time = gta04_voice_time();
+			ALOGD("Voice %s: first sample played %lld ms after connect", direction->name, (long long) ((direction->first_time - router->unpause_time) / 1000000));
+		}
+
+		if (stats_periods > 0 && direction->stats.periods % stats_periods == 0)
+			gta04_voice_router_stats(router);
+	}
+
+	return NULL;
+}
+
+static void gta04_voice_config(struct pcm_config *config, unsigned int rate,
+	unsigned int channels, unsigned int period_ms)
+{
+	memset(config, 0, sizeof(struct pcm_config));
+
+	config->channels = channels;
+	config->rate = rate;
+	config->period_size = rate * period_ms / 1000;
+	config->period_count = GTA04_VOICE_PERIOD_COUNT;
+	config->format = PCM_FORMAT_S16_LE;
+	config->start_threshold = 0; //default
+	config->stop_threshold = 0; //default
+	config->silence_threshold = 0;
+}
+
+static int gta04_voice_direction_open(struct gta04_voice_direction *direction,
+	struct gta04_voice_router *router, const char *name,
+	unsigned int source_card, unsigned int source_rate, unsigned int source_channels,
+	unsigned int sink_card, unsigned int sink_rate, unsigned int sink_channels)
+{
+	int rc;
+
+	direction->name = name;
+	direction->router = router;
+	direction->source_card = source_card;
+	direction->sink_card = sink_card;
+
+	gta04_voice_config(&direction->source_config, source_rate, source_channels, router->period_ms);
+	gta04_voice_config(&direction->sink_config, sink_rate, sink_channels, router->period_ms);
+
+	direction->source_frames = direction->source_config.period_size;
+	direction->sink_frames = direction->sink_config.period_size;
+	// Leave some room for the resampler's rounding
+	direction->convert_frames = direction->source_frames * sink_rate / source_rate + 2;
+	// And for the drift stage, that may output slightly more than it gets
+	direction->drift_frames = direction->convert_frames + direction->convert_frames / 256 + 2;
+
+	rc = gta04_voice_fir_init(&direction->fir, source_rate, sink_rate, source_channels, sink_channels, source_rate > sink_rate ? GTA04_VOICE_FIR_TAPS_DECIMATE : GTA04_VOICE_FIR_TAPS_INTERPOLATE);
+	if (rc < 0) {
+		ALOGE("Unable to create %s resampler", name);
+		return -1;
+	}
+
+	direction->capture_buffer = (int16_t *) calloc((direction->fir.taps - 1 + direction->source_frames) * source_channels, sizeof(int16_t));
+	direction->convert_buffer = (int16_t *) malloc(direction->convert_frames * sink_channels * sizeof(int16_t));
+	direction->drift_buffer = (int16_t *) malloc(direction->drift_frames * sink_channels * sizeof(int16_t));
+	direction->playback_buffer = (int16_t *) malloc(direction->sink_frames * sink_channels * sizeof(int16_t));
+
+	if (!direction->capture_buffer || !direction->convert_buffer || !direction->drift_buffer || !direction->playback_buffer) {
+		ALOGE("Unable to allocate memory");
+		return -1;
+	}
+
+	rc = gta04_voice_ring_init(&direction->ring, direction->sink_frames * GTA04_VOICE_RING_PERIODS, sink_channels);
+	if (rc < 0) {
+		ALOGE("Unable to allocate memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void gta04_voice_direction_close(struct gta04_voice_direction *direction)
+{
+	gta04_voice_fir_deinit(&direction->fir);
+
+	gta04_voice_ring_deinit(&direction->ring);
+
+	free(direction->capture_buffer);
+	free(direction->convert_buffer);
+	free(direction->drift_buffer);
+	free(direction->playback_buffer);
+
+	memset(direction, 0, sizeof(struct gta04_voice_direction));
+}
+
+/*
+ * Opens and prepares the PCMs and clears what the previous call left, so
+ * that nothing but the transfers is left to do once the call is connected.
+ */
+static int gta04_voice_direction_arm(struct gta04_voice_direction *direction)
+{
+	const struct gta04_voice_backend *backend = direction->router->backend;
+
+	direction->source = backend->open(direction->source_card, 1, &direction->source_config);
+	if (direction->source == NULL)
+		return -1;
+
+	direction->sink = backend->open(direction->sink_card, 0, &direction->sink_config);
+	if (direction->sink == NULL)
+		return -1;
+
+	backend->prepare(direction->source);
+	backend->prepare(direction->sink);
+
+	memset(direction->capture_buffer, 0, (direction->fir.taps - 1) * direction->source_config.channels * sizeof(int16_t));
+	direction->fir.phase = 0;
+	direction->fir.index = 0;
+
+	direction->ring.head = 0;
+	direction->ring.tail = 0;
+
+	gta04_voice_drift_init(&direction->drift, direction->sink_config.channels, direction->sink_frames);
+
+	memset(&direction->stats, 0, sizeof(struct gta04_voice_stats));
+	direction->primed = 0;
+	direction->read_time = 0;
+	direction->first_time = 0;
+
+	return 0;
+}
+
+static void gta04_voice_direction_disarm(struct gta04_voice_direction *direction)
+{
+	const struct gta04_voice_backend *backend = direction->router->backend;
+
+	if (direction->source != NULL)
+		backend->close(direction->source);
+	if (direction->sink != NULL)
+		backend->close(direction->sink);
+
+	direction->source = NULL;
+	direction->sink = NULL;
+}
+
+/*
+ * Router
+ */
+
+/*
+ * Called by the routing threads: returns once the router is unpaused, or -1
+ * when it is stopped before that.
+ */
+static int gta04_voice_router_wait(struct gta04_voice_router *router)
+{
+	int rc;
+
+	pthread_mutex_lock(&router->mutex);
+
+	while (router->running && router->paused)
+		pthread_cond_wait(&router->cond, &router->mutex);
+
+	rc = router->running ? 0 : -1;
+
+	pthread_mutex_unlock(&router->mutex);
+
+	return rc;
+}
+
+static int gta04_voice_router_arm(struct gta04_voice_router *router)
+{
+	struct gta04_voice_direction *direction;
+	int64_t time;
+	int rc;
+	int i;
+
+	time = gta04_voice_time();
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		rc = gta04_voice_direction_arm(&router->directions[i]);
+		if (rc < 0)
+			return -1;
+	}
+
+	gta04_voice_record_arm(&router->record);
+
+	router->running = 1;
+	router->paused = 1;
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		direction = &router->directions[i];
+
+		rc = pthread_create(&direction->capture_thread, NULL, gta04_voice_capture_thread, (void *) direction);
+		if (rc != 0)
+			goto error;
+		direction->capture_started = 1;
+
+		rc = pthread_create(&direction->playback_thread, NULL, gta04_voice_playback_thread, (void *) direction);
+		if (rc != 0)
+			goto error;
+		direction->playback_started = 1;
+	}
+
+	ALOGD("Voice routing armed in %lld ms", (long long) ((gta04_voice_time() - time) / 1000000));
+
+	return 0;
+
+error:
+	ALOGE("Unable to create voice routing threads");
+	return -1;
+}
+
+static void gta04_voice_router_disarm(struct gta04_voice_router *router)
+{
+	struct gta04_voice_direction *direction;
+	int i;
+
+	gta04_voice_router_stop(router);
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		direction = &router->directions[i];
+
+		if (direction->capture_started)
+			pthread_join(direction->capture_thread, NULL);
+		if (direction->playback_started)
+			pthread_join(direction->playback_thread, NULL);
+
+		direction->capture_started = 0;
+		direction->playback_started = 0;
+	}
+
+	gta04_voice_record_stop(&router->record);
+
+	gta04_voice_router_stats(router);
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++)
+		gta04_voice_direction_disarm(&router->directions[i]);
+}
+
+/*
+ * The service thread brings the router to the requested state: the PCMs and
+ * routing threads are set up as soon as a call starts ringing or dialing and
+ * only have to be unpaused when it connects, which the RIL call state is
+ * watched for meanwhile. A hangup, noticed by the routing threads, brings the
+ * router back to idle.
+ */
+static void *gta04_voice_router_service(void *data)
+{
+	struct gta04_voice_router *router;
+	struct timespec ts;
+	int state;
+	int rc;
+
+	router = (struct gta04_voice_router *) data;
+
+	pthread_mutex_lock(&router->mutex);
+
+	while (!router->quit) {
+		if (router->state != GTA04_VOICE_STATE_IDLE && (router->target == GTA04_VOICE_STATE_IDLE || !router->running)) {
+			// Don't start over for the call that was just hung up
+			if (!router->running)
+				router->target = GTA04_VOICE_STATE_IDLE;
+
+			pthread_mutex_unlock(&router->mutex);
+			gta04_voice_router_disarm(router);
+			pthread_mutex_lock(&router->mutex);
+
+			router->state = GTA04_VOICE_STATE_IDLE;
+			ALOGD("Voice routing idle");
+			continue;
+		}
+
+		if (router->state == GTA04_VOICE_STATE_IDLE && router->target != GTA04_VOICE_STATE_IDLE) {
+			pthread_mutex_unlock(&router->mutex);
+			rc = gta04_voice_router_arm(router);
+			pthread_mutex_lock(&router->mutex);
+
+			router->state = GTA04_VOICE_STATE_ARMED;
+
+			// Disarming the half set up router brings it back to idle
+			if (rc < 0) {
+				router->target = GTA04_VOICE_STATE_IDLE;
+				router->running = 0;
+			}
+
+			continue;
+		}
+
+		if (router->state == GTA04_VOICE_STATE_ARMED && router->target == GTA04_VOICE_STATE_ACTIVE) {
+			router->unpause_time = gta04_voice_time();
+			router->paused = 0;
+			router->state = GTA04_VOICE_STATE_ACTIVE;
+			pthread_cond_broadcast(&router->cond);
+
+			gta04_voice_record_start(&router->record);
+
+			ALOGD("Voice routing active");
+			continue;
+		}
+
+		if (router->state == GTA04_VOICE_STATE_ARMED) {
+			// Catch the call connecting, without waiting for a routing change
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += GTA04_VOICE_ARMED_POLL_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			rc = pthread_cond_timedwait(&router->cond, &router->mutex, &ts);
+			if (rc == ETIMEDOUT) {
+				state = gta04_voice_call_state();
+				if (state >= 0)
+					router->target = state;
+			}
+		} else {
+			pthread_cond_wait(&router->cond, &router->mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&router->mutex);
+
+	if (router->state != GTA04_VOICE_STATE_IDLE)
+		gta04_voice_router_disarm(router);
+
+	return NULL;
+}
+
+/*
+ * Returns the call state published by the RIL, or -1 when there is none.
+ */
+int gta04_voice_call_state(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+
+	property_get(GTA04_VOICE_PROPERTY_CALL_STATE, value, "");
+
+	if (strcmp(value, "idle") == 0)
+		return GTA04_VOICE_STATE_IDLE;
+	else if (strcmp(value, "ringing") == 0 || strcmp(value, "dialing") == 0)
+		return GTA04_VOICE_STATE_ARMED;
+	else if (strcmp(value, "active") == 0)
+		return GTA04_VOICE_STATE_ACTIVE;
+
+	return -1;
+}
+
+/*
+ * Allocates all that routing needs, so that only the PCMs are left to open
+ * when a call starts.
+ */
+int gta04_voice_router_open(struct gta04_voice_router *router)
+{
+	char value[PROPERTY_VALUE_MAX];
+	int period_ms;
+	int rc;
+
+	if (router == NULL)
+		return -1;
+
+	memset(router, 0, sizeof(struct gta04_voice_router));
+
+	pthread_mutex_init(&router->mutex, NULL);
+	pthread_cond_init(&router->cond, NULL);
+
+	property_get(GTA04_VOICE_PROPERTY_PERIOD_MS, value, "");
+	period_ms = atoi(value);
+	if (period_ms < GTA04_VOICE_PERIOD_MS_MIN || period_ms > GTA04_VOICE_PERIOD_MS_MAX)
+		period_ms = GTA04_VOICE_PERIOD_MS;
+
+	router->period_ms = period_ms;
+	router->backend = gta04_voice_backend_get();
+
+	property_get(GTA04_VOICE_PROPERTY_PRIORITY, value, "");
+	router->priority = value[0] != '\0' ? atoi(value) : GTA04_VOICE_PRIORITY;
+
+	ALOGD("Voice routing with %d ms periods through %s", router->period_ms, router->backend->name);
+
+	/* Uplink: gta04 internal ("default") to modem ("hw:1,0") */
+	rc = gta04_voice_direction_open(&router->directions[GTA04_VOICE_UPLINK], router, "uplink",
+		GTA04_VOICE_CARD_GTA04, GTA04_VOICE_GTA04_RATE, GTA04_VOICE_GTA04_CHANNELS,
+		GTA04_VOICE_CARD_MODEM, GTA04_VOICE_MODEM_RATE, GTA04_VOICE_MODEM_CHANNELS);
+	if (rc < 0)
+		goto error;
+
+	/* Downlink: modem ("hw:1,0") to gta04 internal ("default") */
+	rc = gta04_voice_direction_open(&router->directions[GTA04_VOICE_DOWNLINK], router, "downlink",
+		GTA04_VOICE_CARD_MODEM, GTA04_VOICE_MODEM_RATE, GTA04_VOICE_MODEM_CHANNELS,
+		GTA04_VOICE_CARD_GTA04, GTA04_VOICE_GTA04_RATE, GTA04_VOICE_GTA04_CHANNELS);
+	if (rc < 0)
+		goto error;
+
+	rc = gta04_voice_record_open(&router->record, GTA04_VOICE_MODEM_RATE);
+	if (rc < 0)
+		goto error;
+
+	rc = pthread_create(&router->thread, NULL, gta04_voice_router_service, (void *) router);
+	if (rc != 0) {
+		ALOGE("Unable to create voice routing service thread");
+		goto error;
+	}
+
+	router->started = 1;
+
+	return 0;
+
+error:
+	gta04_voice_router_close(router);
+
+	return -1;
+}
+
+/*
+ * Asks the service for a state: it doesn't wait for the router to get there.
+ */
+void gta04_voice_router_request(struct gta04_voice_router *router, int state)
+{
+	if (router == NULL || !router->started)
+		return;
+
+	pthread_mutex_lock(&router->mutex);
+
+	if (router->target != state) {
+		router->target = state;
+		pthread_cond_broadcast(&router->cond);
+	}
+
+	pthread_mutex_unlock(&router->mutex);
+}
+
+void gta04_voice_router_stop(struct gta04_voice_router *router)
+{
+	if (router == NULL)
+		return;
+
+	pthread_mutex_lock(&router->mutex);
+
+	router->running = 0;
+	pthread_cond_broadcast(&router->cond);
+
+	pthread_mutex_unlock(&router->mutex);
+}
+
+void gta04_voice_router_close(struct gta04_voice_router *router)
+{
+	int i;
+
+	if (router == NULL)
+		return;
+
+	if (router->started) {
+		pthread_mutex_lock(&router->mutex);
+		router->quit = 1;
+		pthread_cond_broadcast(&router->cond);
+		pthread_mutex_unlock(&router->mutex);
+
+		pthread_join(router->thread, NULL);
+		router->started = 0;
+	}
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++)
+		gta04_voice_direction_close(&router->directions[i]);
+
+	gta04_voice_record_close(&router->record);
+
+	pthread_cond_destroy(&router->cond);
+	pthread_mutex_destroy(&router->mutex);
+}
+
+/*
+ * Logs the latency of each direction: one capture period, the average time
+ * spent in the ring and the sink buffer, along with the xrun counters.
+ */
+void gta04_voice_router_stats(struct gta04_voice_router *router)
+{
+	struct gta04_voice_direction *direction;
+	struct gta04_voice_stats *stats;
+	unsigned int ring_ms;
+	unsigned int latency_ms;
+	int i;
+
+	if (router == NULL)
+		return;
+
+	for (i = 0; i < GTA04_VOICE_DIRECTIONS_COUNT; i++) {
+		direction = &router->directions[i];
+		stats = &direction->stats;
+
+		if (stats->periods == 0 || direction->sink == NULL)
+			continue;
+
+		ring_ms = (unsigned int) (stats->fill_sum * 1000 / stats->periods / direction->sink_config.rate);
+		latency_ms = router->period_ms + ring_ms + router->backend->latency(direction->sink);
+
+		ALOGD("Voice %s: ~%u ms latency (ring %u ms, max %u ms), %u overruns, %u underruns, %u errors", direction->name, latency_ms, ring_ms, stats->fill_max * 1000 / direction->sink_config.rate, stats->overruns, stats->underruns, stats->errors);
+		ALOGD("Voice %s: drift %d ppm (min %d, max %d), ring now %u ms", direction->name, direction->drift.ppm, stats->drift_ppm_min, stats->drift_ppm_max, (unsigned int) ((direction->drift.fill >> 8) * 1000 / (int) direction->sink_config.rate));
+	}
+}
@@ -0,0 +1,318 @@
+/**
+ * Audio RIL Interface for GTA04
+ *
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *               2015 Golden Delicious Computers
+                      Lukas Märdian <lukas@goldelico.com>
+ *
+ * Audio RIL Interface is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Audio RIL Interface is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Audio RIL Interface.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VOICE_ROUTER_H_
+#define _VOICE_ROUTER_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <tinyalsa/asoundlib.h>
+
+/*
+ * Cards
+ */
+
+#define GTA04_VOICE_CARD_GTA04			0
+#define GTA04_VOICE_CARD_MODEM			1
+
+#define GTA04_VOICE_GTA04_RATE			44100
+#define GTA04_VOICE_GTA04_CHANNELS		2
+#define GTA04_VOICE_MODEM_RATE			8000
+#define GTA04_VOICE_MODEM_CHANNELS		1
+#define GTA04_VOICE_CHANNELS_MAX		2
+
+/*
+ * Router
+ */
+
+#define GTA04_VOICE_UPLINK			0
+#define GTA04_VOICE_DOWNLINK			1
+#define GTA04_VOICE_DIRECTIONS_COUNT		2
+
+#define GTA04_VOICE_PERIOD_MS			10
+#define GTA04_VOICE_PERIOD_MS_MIN		5
+#define GTA04_VOICE_PERIOD_MS_MAX		40
+#define GTA04_VOICE_PERIOD_COUNT		4
+#define GTA04_VOICE_RING_PERIODS		8
+#define GTA04_VOICE_PRIORITY			2
+#define GTA04_VOICE_STATS_INTERVAL_MS		10000
+
+#define GTA04_VOICE_FIR_TAPS_DECIMATE		256
+#define GTA04_VOICE_FIR_TAPS_INTERPOLATE	48
+#define GTA04_VOICE_FIR_CUTOFF			0.92
+#define GTA04_VOICE_FIR_BETA			7.0
+
+#define GTA04_VOICE_DRIFT_TARGET_PERIODS	1
+#define GTA04_VOICE_DRIFT_KP			1000
+#define GTA04_VOICE_DRIFT_PPM_MAX		2000
+
+#define GTA04_VOICE_STATE_IDLE			0
+#define GTA04_VOICE_STATE_ARMED			1
+#define GTA04_VOICE_STATE_ACTIVE		2
+#define GTA04_VOICE_ARMED_POLL_MS		20
+
+#define GTA04_VOICE_RECORD_CHANNELS		2
+#define GTA04_VOICE_RECORD_RING_MS		1000
+#define GTA04_VOICE_RECORD_PERIOD_MS		100
+
+#define GTA04_VOICE_PROPERTY_PERIOD_MS		"gta04.voice.period_ms"
+#define GTA04_VOICE_PROPERTY_PRIORITY		"gta04.voice.priority"
+#define GTA04_VOICE_PROPERTY_CALL_STATE		"ril.call.state"
+#define GTA04_VOICE_PROPERTY_BACKEND		"gta04.voice.backend"
+#define GTA04_VOICE_PROPERTY_FILE_PATH		"gta04.voice.file.path"
+#define GTA04_VOICE_PROPERTY_FILE_DRIFT		"gta04.voice.file.drift"
+#define GTA04_VOICE_PROPERTY_RECORD_PATH	"gta04.voice.record.path"
+
+#define GTA04_VOICE_FILE_PATH			"/data/voice"
+
+/*
+ * PCM backend, reads and writes are in frames.
+ */
+struct gta04_voice_backend {
+	const char *name;
+	void *(*open)(unsigned int card, int capture, struct pcm_config *config);
+	int (*prepare)(void *pcm);
+	int (*read)(void *pcm, void *buffer, unsigned int frames);
+	int (*write)(void *pcm, const void *buffer, unsigned int frames);
+	unsigned int (*latency)(void *pcm);
+	const char *(*error)(void *pcm);
+	void (*close)(void *pcm);
+};
+
+/*
+ * Single producer, single consumer ring of interleaved samples. Each index
+ * is only written by its owner and they wrap around.
+ */
+struct gta04_voice_ring {
+	int16_t *samples;
+	unsigned int frames;
+	unsigned int channels;
+
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct gta04_voice_stats {
+	unsigned int periods;
+	unsigned int overruns;
+	unsigned int underruns;
+	unsigned int errors;
+
+	unsigned long long fill_sum;
+	unsigned int fill_max;
+
+	int drift_ppm_min;
+	int drift_ppm_max;
+};
+
+/*
+ * The cards run from independent clocks, so the fixed ratio resampler is
+ * followed by a small linear interpolation stage, whose ratio is trimmed to
+ * keep the ring at its target fill.
+ */
+struct gta04_voice_drift {
+	uint64_t position;
+	uint64_t step;
+	int16_t last[GTA04_VOICE_CHANNELS_MAX];
+	unsigned int channels;
+
+	unsigned int period;
+	unsigned int target;
+	int fill;
+	int integral;
+	int ppm;
+};
+
+/*
+ * Fixed ratio resampler, up times faster and down times slower, that also
+ * mixes stereo to mono or mono to stereo.
+ */
+struct gta04_voice_fir {
+	int16_t *coefs;
+	unsigned int up;
+	unsigned int down;
+	unsigned int taps;
+	unsigned int in_channels;
+	unsigned int out_channels;
+
+	unsigned int phase;
+	unsigned int index;
+};
+
+/*
+ * Call recording, fed from the capture threads through a ring per direction.
+ */
+struct gta04_voice_record {
+	struct gta04_voice_ring rings[GTA04_VOICE_DIRECTIONS_COUNT];
+	unsigned int dropped[GTA04_VOICE_DIRECTIONS_COUNT];
+	int16_t *samples;
+	int16_t *buffer;
+	unsigned int frames;
+	unsigned int rate;
+
+	char path[PATH_MAX];
+	int fd;
+	unsigned long long written;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int enabled;
+	int started;
+	int running;
+};
+
+struct gta04_voice_router;
+
+/*
+ * Each direction is a capture stage, that reads the source card and
+ * converts to the sink format, and a playback stage, that writes to the
+ * sink card. They run in their own threads, with a ring in-between.
+ */
+struct gta04_voice_direction {
+	const char *name;
+	struct gta04_voice_router *router;
+
+	unsigned int source_card;
+	unsigned int sink_card;
+	struct pcm_config source_config;
+	struct pcm_config sink_config;
+	void *source;
+	void *sink;
+
+	unsigned int source_frames;
+	unsigned int sink_frames;
+	unsigned int convert_frames;
+	unsigned int drift_frames;
+
+	struct gta04_voice_fir fir;
+
+	int16_t *capture_buffer;
+	int16_t *convert_buffer;
+	int16_t *drift_buffer;
+	int16_t *playback_buffer;
+
+	struct gta04_voice_ring ring;
+	struct gta04_voice_drift drift;
+	int64_t read_time;
+	int64_t first_time;
+	struct gta04_voice_stats stats;
+	int primed;
+
+	pthread_t capture_thread;
+	pthread_t playback_thread;
+	int capture_started;
+	int playback_started;
+};
+
+struct gta04_voice_router {
+	struct gta04_voice_direction directions[GTA04_VOICE_DIRECTIONS_COUNT];
+	struct gta04_voice_record record;
+
+	const struct gta04_voice_backend *backend;
+	unsigned int period_ms;
+	int priority;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int started;
+	int quit;
+
+	int state;
+	int target;
+	int paused;
+	volatile int running;
+
+	int64_t unpause_time;
+};
+
+/*
+ * FIR
+ */
+
+int gta04_voice_fir_init(struct gta04_voice_fir *fir, unsigned int in_rate,
+	unsigned int out_rate, unsigned int in_channels, unsigned int out_channels,
+	unsigned int taps);
+void gta04_voice_fir_deinit(struct gta04_voice_fir *fir);
+unsigned int gta04_voice_fir_process(struct gta04_voice_fir *fir,
+	int16_t *buffer, unsigned int frames, int16_t *out, unsigned int out_frames);
+
+/*
+ * Ring
+ */
+
+int gta04_voice_ring_init(struct gta04_voice_ring *ring, unsigned int frames,
+	unsigned int channels);
+void gta04_voice_ring_deinit(struct gta04_voice_ring *ring);
+unsigned int gta04_voice_ring_fill(struct gta04_voice_ring *ring);
+unsigned int gta04_voice_ring_write(struct gta04_voice_ring *ring,
+	int16_t *samples, unsigned int frames);
+unsigned int gta04_voice_ring_read(struct gta04_voice_ring *ring,
+	int16_t *samples, unsigned int frames);
+
+/*
+ * Drift
+ */
+
+void gta04_voice_drift_init(struct gta04_voice_drift *drift,
+	unsigned int channels, unsigned int period);
+void gta04_voice_drift_update(struct gta04_voice_drift *drift,
+	unsigned int fill);
+unsigned int gta04_voice_drift_process(struct gta04_voice_drift *drift,
+	int16_t *in, unsigned int in_frames, int16_t *out, unsigned int out_frames);
+
+/*
+ * Backend
+ */
+
+extern const struct gta04_voice_backend gta04_voice_backend_tinyalsa;
+extern const struct gta04_voice_backend gta04_voice_backend_file;
+
+const struct gta04_voice_backend *gta04_voice_backend_get(void);
+
+/*
+ * Record
+ */
+
+int gta04_voice_record_open(struct gta04_voice_record *record,
+	unsigned int rate);
+void gta04_voice_record_close(struct gta04_voice_record *record);
+void gta04_voice_record_arm(struct gta04_voice_record *record);
+int gta04_voice_record_start(struct gta04_voice_record *record);
+void gta04_voice_record_stop(struct gta04_voice_record *record);
+void gta04_voice_record_tap(struct gta04_voice_record *record, int direction,
+	int16_t *samples, unsigned int frames);
+
+/*
+ * Router
+ */
+
+int gta04_voice_call_state(void);
+int gta04_voice_router_open(struct gta04_voice_router *router);
+void gta04_voice_router_request(struct gta04_voice_router *router, int state);
+void gta04_voice_router_stop(struct gta04_voice_router *router);
+void gta04_voice_router_close(struct gta04_voice_router *router);
+void gta04_voice_router_stats(struct gta04_voice_router *router);
+
+#endif
@@ -28,3 +28,5 @@ LOCAL_MODULE := libbt-vendor
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
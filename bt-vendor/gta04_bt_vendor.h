@@ -38,8 +38,14 @@
 
 #define HCI_CMD_PREAMBLE_SIZE					3
 
+#define HCI_EVENT_COMMAND_COMPLETE				0x0E
+#define HCI_EVENT_COMMAND_STATUS				0x0F
 #define HCI_EVENT_VENDOR					0xFF
 
+#define HCI_H4_HEADER_MIN					(1 + 2)
+#define HCI_H4_PACKET_SIZE					(1 + 2 + 255)
+#define HCI_H4_TIMEOUT_MS					5000
+
 #define HCI_BCCMD_PDU_GETREQ					0x0000
 #define HCI_BCCMD_PDU_GETRESP					0x0001
 #define HCI_BCCMD_PDU_SETREQ					0x0002
@@ -98,6 +104,8 @@ int gta04_bt_vendor_hci_bccmd(void *buffer, size_t length,
 	unsigned short pdu, unsigned short varid);
 unsigned short gta04_bt_vendor_hci_bccmd_speed(speed_t speed);
 int gta04_bt_vendor_hci_h4_write(void *buffer, size_t length);
+int gta04_bt_vendor_hci_h4_read(void *buffer, size_t length,
+	unsigned char event, unsigned short opcode);
 int gta04_bt_vendor_hci_h4_read_event(void *buffer, size_t length,
 	unsigned char event);
 
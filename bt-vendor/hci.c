@@ -16,8 +16,12 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <poll.h>
 #include <termios.h>
 
 #define LOG_TAG "gta04_bt_vendor"
@@ -188,172 +192,217 @@ int gta04_bt_vendor_hci_h4_write(void *buffer, size_t length)
 	return 0;
 }
 
-int gta04_bt_vendor_hci_h4_read_event(void *buffer, size_t length,
-	unsigned char event)
+/*
+ * H4 framing: each packet is read with one read for its header and one for
+ * its payload, but never past its end, so that whatever follows is left on
+ * the serial for the next reader, the stack included. Bytes that can't start
+ * a packet are dropped one at a time until a packet type shows up.
+ *
+ * All packets have at least HCI_H4_HEADER_MIN bytes, that are read at once.
+ */
+
+static int64_t gta04_bt_vendor_hci_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int gta04_bt_vendor_hci_h4_header_size(unsigned char type)
+{
+	switch (type) {
+		case HCI_H4_TYPE_CMD:
+			return 1 + 3;
+		case HCI_H4_TYPE_ACL_DATA:
+			return 1 + 4;
+		case HCI_H4_TYPE_SCO_DATA:
+			return 1 + 3;
+		case HCI_H4_TYPE_EVENT:
+			return 1 + 2;
+		default:
+			return -1;
+	}
+}
+
+static unsigned int gta04_bt_vendor_hci_h4_payload_size(unsigned char *header)
+{
+	switch (header[0]) {
+		case HCI_H4_TYPE_ACL_DATA:
+			return header[3] | (header[4] << 8);
+		case HCI_H4_TYPE_EVENT:
+			return header[2];
+		default:
+			return header[3];
+	}
+}
+
+static int gta04_bt_vendor_hci_h4_fill(void *buffer, size_t length,
+	int64_t deadline)
 {
-	struct timeval timeout;
-	unsigned char cleanup[256];
-	unsigned char byte;
-	unsigned char type = 0;
-	unsigned char size = 0;
-	unsigned char *p = NULL;
+	struct pollfd pollfd;
+	unsigned char *p;
 	unsigned int count;
-	unsigned int limit;
-	int failures;
-	int skip = 0;
-	fd_set fds;
+	int64_t timeout;
 	int rc;
 
-	if (gta04_bt_vendor == NULL || gta04_bt_vendor->serial_fd < 0)
-		return -1;
+	p = (unsigned char *) buffer;
+	count = 0;
 
-	failures = 0;
+	while (count < length) {
+		timeout = deadline - gta04_bt_vendor_hci_time();
+		if (timeout <= 0) {
+			ALOGE("%s: Polling timed out", __func__);
+			return -1;
+		}
 
-	while (1) {
-		FD_ZERO(&fds);
-		FD_SET(gta04_bt_vendor->serial_fd, &fds);
+		pollfd.fd = gta04_bt_vendor->serial_fd;
+		pollfd.events = POLLIN;
+		pollfd.revents = 0;
 
-		timeout.tv_sec = 5;
-		timeout.tv_usec = 0;
+		rc = poll(&pollfd, 1, (int) timeout);
+		if (rc < 0 && errno == EINTR)
+			continue;
 
-		rc = select(gta04_bt_vendor->serial_fd + 1, &fds, NULL, NULL, &timeout);
 		if (rc < 0) {
 			ALOGE("%s: Polling failed", __func__);
-
-			if (failures) {
-				return -1;
-			} else {
-				failures++;
-				continue;
-			}
-		} else if (rc == 0) {
-			ALOGE("%s: Polling timed out", __func__);
 			return -1;
+		} else if (rc == 0) {
+			continue;
 		}
 
-		if (failures > 10) {
-			ALOGE("%s: Too many failures", __func__);
+		rc = gta04_bt_vendor_serial_read(p + count, length - count);
+		if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		if (rc <= 0) {
+			ALOGE("%s: Reading from serial failed", __func__);
 			return -1;
 		}
 
-		if (p == NULL) {
-			// Read single bytes first
+		count += rc;
+	}
+
+	return 0;
+}
 
-			rc = gta04_bt_vendor_serial_read(&byte, sizeof(byte));
-			if (rc < (int) sizeof(byte)) {
-				ALOGE("%s: Reading from serial failed", __func__);
+/*
+ * Reads packets until an event with the given code comes. When an opcode is
+ * given, command complete and command status events must also be for it.
+ * The event parameters are copied to the buffer, if any.
+ */
+int gta04_bt_vendor_hci_h4_read(void *buffer, size_t length,
+	unsigned char event, unsigned short opcode)
+{
+	unsigned char packet[HCI_H4_PACKET_SIZE];
+	unsigned char *header;
+	unsigned char *p;
+	unsigned short packet_opcode;
+	unsigned int size;
+	unsigned int count;
+	unsigned int chunk;
+	unsigned int have;
+	int64_t deadline;
+	int header_size;
+	int rc;
+
+	if (gta04_bt_vendor == NULL || gta04_bt_vendor->serial_fd < 0)
+		return -1;
+
+	header = packet;
+
+	// The whole exchange has to fit in the timeout, however busy the line is
+	deadline = gta04_bt_vendor_hci_time() + HCI_H4_TIMEOUT_MS;
+
+	have = 0;
+
+	while (1) {
+		if (have < HCI_H4_HEADER_MIN) {
+			rc = gta04_bt_vendor_hci_h4_fill(header + have, HCI_H4_HEADER_MIN - have, deadline);
+			if (rc < 0)
 				return -1;
-			}
+		}
 
-			if (type != HCI_H4_TYPE_EVENT) {
-				if (byte != HCI_H4_TYPE_EVENT) {
-					ALOGD("%s: Ignored response with type: %d", __func__, byte);
-					gta04_bt_vendor_serial_read(&cleanup, sizeof(cleanup));
-					continue;
-				}
-
-				type = byte;
-			} else {
-				if (byte != event) {
-					ALOGD("%s: Ignored response with event: 0x%x", __func__, byte);
-					gta04_bt_vendor_serial_read(&cleanup, sizeof(cleanup));
-					type = 0;
-					continue;
-				}
-
-				rc = gta04_bt_vendor_serial_read(&size, sizeof(size));
-				if (rc <= 0) {
-					ALOGE("%s: Reading from serial failed", __func__);
-					failures++;
-					continue;
-				} else if (failures) {
-					failures = 0;
-				}
-
-
-				if (size == 0)
-					return 0;
-
-				if (buffer == NULL || length == 0) {
-					count = 0;
-
-					while (count < size) {
-						rc = gta04_bt_vendor_serial_read(&cleanup, size - count);
-						if (rc <= 0) {
-							ALOGE("%s: Reading from serial failed", __func__);
-							failures++;
-							break;
-						} else if (failures) {
-							failures = 0;
-						}
-
-						count += rc;
-					}
-
-					if (rc <= 0)
-						continue;
-
-					return 0;
-				}
-
-				p = (unsigned char *) buffer;
-			}
+		header_size = gta04_bt_vendor_hci_h4_header_size(header[0]);
+		if (header_size < 0) {
+			ALOGD("%s: Ignored byte with type: %d", __func__, header[0]);
+
+			// What follows might be the start of a packet
+			memmove(header, header + 1, HCI_H4_HEADER_MIN - 1);
+			have = HCI_H4_HEADER_MIN - 1;
+			continue;
 		}
 
-		if (p != NULL) {
-			// Make sure to read from the start in case of failure
-			p = (unsigned char *) buffer;
+		have = 0;
 
-			if (size > length) {
-				ALOGE("%s: Provided buffer length is too small for size: %d/%d bytes", __func__, length, size);
+		rc = gta04_bt_vendor_hci_h4_fill(header + HCI_H4_HEADER_MIN, header_size - HCI_H4_HEADER_MIN, deadline);
+		if (rc < 0)
+			return -1;
 
-				limit = length;
-			} else {
-				limit = size;
-			}
+		size = gta04_bt_vendor_hci_h4_payload_size(header);
+		p = packet + header_size;
 
+		if (header[0] != HCI_H4_TYPE_EVENT) {
+			ALOGD("%s: Ignored packet with type: %d", __func__, header[0]);
+
+			// Data packets might not fit, they are skipped in chunks
 			count = 0;
 
-			while (count < limit) {
-				rc = gta04_bt_vendor_serial_read(p, limit - count);
-				if (rc <= 0) {
-					ALOGE("%s: Reading from serial failed", __func__);
-					failures++;
-					break;
-				} else if (failures) {
-					failures = 0;
-				}
-
-				p += rc;
-				count += rc;
-			}
+			while (count < size) {
+				chunk = size - count;
+				if (chunk > sizeof(packet) - header_size)
+					chunk = sizeof(packet) - header_size;
 
-			if (rc <= 0)
-				continue;
+				rc = gta04_bt_vendor_hci_h4_fill(p, chunk, deadline);
+				if (rc < 0)
+					return -1;
 
-			if (limit < size) {
-				limit = size;
-
-				while (count < limit) {
-					rc = gta04_bt_vendor_serial_read(&cleanup, limit - count);
-					if (rc <= 0) {
-						ALOGE("%s: Reading from serial failed", __func__);
-						failures++;
-						break;
-					} else if (failures) {
-						failures = 0;
-					}
-
-					count += rc;
-				}
+				count += chunk;
 			}
 
-			if (rc <= 0)
+			continue;
+		}
+
+		rc = gta04_bt_vendor_hci_h4_fill(p, size, deadline);
+		if (rc < 0)
+			return -1;
+
+		if (header[1] != event) {
+			ALOGD("%s: Ignored response with event: 0x%x", __func__, header[1]);
+			continue;
+		}
+
+		if (opcode != 0 && (event == HCI_EVENT_COMMAND_COMPLETE || event == HCI_EVENT_COMMAND_STATUS)) {
+			// Command complete: packets, opcode; command status: status, packets, opcode
+			if (event == HCI_EVENT_COMMAND_COMPLETE && size >= 3)
+				packet_opcode = p[1] | (p[2] << 8);
+			else if (event == HCI_EVENT_COMMAND_STATUS && size >= 4)
+				packet_opcode = p[2] | (p[3] << 8);
+			else
+				packet_opcode = 0;
+
+			if (packet_opcode != opcode) {
+				ALOGD("%s: Ignored response with opcode: 0x%x", __func__, packet_opcode);
 				continue;
+			}
+		}
 
-			return 0;
+		if (buffer != NULL && length > 0) {
+			if (size > length)
+				ALOGE("%s: Provided buffer length is too small for size: %d/%d bytes", __func__, length, size);
+
+			memcpy(buffer, p, size < length ? size : length);
 		}
+
+		return 0;
 	}
 
 	return 0;
 }
+
+int gta04_bt_vendor_hci_h4_read_event(void *buffer, size_t length,
+	unsigned char event)
+{
+	return gta04_bt_vendor_hci_h4_read(buffer, length, event, 0);
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+
+#include "gta04_bt_vendor.h"
+
+/*
+ * H4 test: the framer reads from a pty, whose master end is fed at the UART
+ * byte rate with rounds of a stray byte, an ACL packet full of bytes that
+ * look like event packets, events that are not waited for, then the command
+ * complete, command status and vendor events the test waits for. Each
+ * round's wanted events carry the round number.
+ *
+ * Usage: gta04_bt_vendor_h4_test [-r rounds] [-b baud]
+ */
+
+#define GTA04_BT_VENDOR_H4_TEST_ROUNDS		200
+#define GTA04_BT_VENDOR_H4_TEST_BAUD		3000000
+#define GTA04_BT_VENDOR_H4_TEST_ROUND_SIZE	512
+#define GTA04_BT_VENDOR_H4_TEST_CHUNK		64
+#define GTA04_BT_VENDOR_H4_TEST_ACL_SIZE	300
+
+struct gta04_bt_vendor_h4_test {
+	unsigned char *stream;
+	size_t length;
+	int packets;
+
+	int master_fd;
+	int baud;
+
+	unsigned int reads;
+};
+
+struct gta04_bt_vendor_h4_test test;
+
+struct gta04_bt_vendor vendor = {
+	.serial_fd = -1,
+};
+
+struct gta04_bt_vendor *gta04_bt_vendor = &vendor;
+
+/*
+ * Serial, the rest of gta04_bt_vendor.c is not needed
+ */
+
+int gta04_bt_vendor_serial_read(void *buffer, size_t length)
+{
+	test.reads++;
+
+	return read(gta04_bt_vendor->serial_fd, buffer, length);
+}
+
+int gta04_bt_vendor_serial_write(void *buffer, size_t length)
+{
+	return -1;
+}
+
+/*
+ * Stream
+ */
+
+static void gta04_bt_vendor_h4_test_put(const unsigned char *data,
+	size_t length, int packet)
+{
+	memcpy(test.stream + test.length, data, length);
+	test.length += length;
+
+	if (packet)
+		test.packets++;
+}
+
+static int gta04_bt_vendor_h4_test_build(int rounds)
+{
+	unsigned char acl[5 + GTA04_BT_VENDOR_H4_TEST_ACL_SIZE] = { HCI_H4_TYPE_ACL_DATA, 0x01, 0x20, GTA04_BT_VENDOR_H4_TEST_ACL_SIZE & 0xff, GTA04_BT_VENDOR_H4_TEST_ACL_SIZE >> 8 };
+	unsigned char stray[] = { 0x00 };
+	// Number of completed packets, an event nobody waits for
+	unsigned char nocp[] = { HCI_H4_TYPE_EVENT, 0x13, 5, 1, 0x01, 0x00, 0x01, 0x00 };
+	unsigned char other_complete[] = { HCI_H4_TYPE_EVENT, HCI_EVENT_COMMAND_COMPLETE, 4, 1, HCI_CMD_LOCAL_VERSION_INFO & 0xff, HCI_CMD_LOCAL_VERSION_INFO >> 8, 0x00 };
+	unsigned char reset_complete[] = { HCI_H4_TYPE_EVENT, HCI_EVENT_COMMAND_COMPLETE, 4, 1, HCI_CMD_RESET & 0xff, HCI_CMD_RESET >> 8, 0x00 };
+	unsigned char other_status[] = { HCI_H4_TYPE_EVENT, HCI_EVENT_COMMAND_STATUS, 4, 0x00, 1, HCI_CMD_LOCAL_VERSION_INFO & 0xff, HCI_CMD_LOCAL_VERSION_INFO >> 8 };
+	unsigned char reset_status[] = { HCI_H4_TYPE_EVENT, HCI_EVENT_COMMAND_STATUS, 4, 0x00, 1, HCI_CMD_RESET & 0xff, HCI_CMD_RESET >> 8 };
+	unsigned char vendor_event[] = { HCI_H4_TYPE_EVENT, HCI_EVENT_VENDOR, 3, HCI_BCCMD_DESCRIPTOR, 0x00, 0x55 };
+	int i;
+
+	test.stream = (unsigned char *) malloc(rounds * GTA04_BT_VENDOR_H4_TEST_ROUND_SIZE);
+	if (test.stream == NULL)
+		return -1;
+
+	test.length = 0;
+	test.packets = 0;
+
+	// The payload is full of event packet types
+	memset(&acl[5], HCI_H4_TYPE_EVENT, GTA04_BT_VENDOR_H4_TEST_ACL_SIZE);
+
+	for (i = 0; i < rounds; i++) {
+		reset_complete[6] = (unsigned char) i;
+		reset_status[3] = (unsigned char) i;
+		vendor_event[4] = (unsigned char) i;
+
+		if (i % 3 == 0)
+			gta04_bt_vendor_h4_test_put(stray, sizeof(stray), 0);
+
+		gta04_bt_vendor_h4_test_put(acl, sizeof(acl), 1);
+		gta04_bt_vendor_h4_test_put(nocp, sizeof(nocp), 1);
+		gta04_bt_vendor_h4_test_put(other_complete, sizeof(other_complete), 1);
+		gta04_bt_vendor_h4_test_put(reset_complete, sizeof(reset_complete), 1);
+		gta04_bt_vendor_h4_test_put(other_status, sizeof(other_status), 1);
+		gta04_bt_vendor_h4_test_put(reset_status, sizeof(reset_status), 1);
+		gta04_bt_vendor_h4_test_put(vendor_event, sizeof(vendor_event), 1);
+	}
+
+	return 0;
+}
+
+static int64_t gta04_bt_vendor_h4_test_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Writes the stream in chunks, paced at 10 bits per byte.
+ */
+static void *gta04_bt_vendor_h4_test_writer(void *data)
+{
+	struct timespec ts;
+	size_t offset = 0;
+	size_t chunk;
+	int64_t time;
+	int rc;
+
+	time = gta04_bt_vendor_h4_test_time();
+
+	while (offset < test.length) {
+		chunk = test.length - offset;
+		if (chunk > GTA04_BT_VENDOR_H4_TEST_CHUNK)
+			chunk = GTA04_BT_VENDOR_H4_TEST_CHUNK;
+
+		rc = write(test.master_fd, test.stream + offset, chunk);
+		if (rc <= 0) {
+			usleep(100);
+			continue;
+		}
+
+		offset += rc;
+
+		time += (int64_t) rc * 10 * 1000000000LL / test.baud;
+		ts.tv_sec = time / 1000000000LL;
+		ts.tv_nsec = time % 1000000000LL;
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+
+	return NULL;
+}
+
+static int gta04_bt_vendor_h4_test_pty(void)
+{
+	struct termios termios;
+
+	test.master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (test.master_fd < 0 || grantpt(test.master_fd) < 0 || unlockpt(test.master_fd) < 0)
+		return -1;
+
+	vendor.serial_fd = open(ptsname(test.master_fd), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (vendor.serial_fd < 0)
+		return -1;
+
+	tcgetattr(vendor.serial_fd, &termios);
+	cfmakeraw(&termios);
+	tcsetattr(vendor.serial_fd, TCSANOW, &termios);
+
+	tcgetattr(test.master_fd, &termios);
+	cfmakeraw(&termios);
+	tcsetattr(test.master_fd, TCSANOW, &termios);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char buffer[16];
+	pthread_t thread;
+	int rounds = GTA04_BT_VENDOR_H4_TEST_ROUNDS;
+	int completes = 0;
+	int statuses = 0;
+	int vendors = 0;
+	int failures = 0;
+	int64_t start;
+	int64_t time;
+	int rc;
+	int i;
+
+	test.baud = GTA04_BT_VENDOR_H4_TEST_BAUD;
+
+	while ((rc = getopt(argc, argv, "r:b:")) != -1) {
+		switch (rc) {
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 'b':
+				test.baud = atoi(optarg);
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (rounds <= 0 || test.baud <= 0)
+		goto usage;
+
+	if (gta04_bt_vendor_h4_test_build(rounds) < 0)
+		return 1;
+
+	if (gta04_bt_vendor_h4_test_pty() < 0) {
+		fprintf(stderr, "Opening a pty failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	pthread_create(&thread, NULL, gta04_bt_vendor_h4_test_writer, NULL);
+
+	start = gta04_bt_vendor_h4_test_time();
+
+	for (i = 0; i < rounds && failures < 4; i++) {
+		memset(buffer, 0xaa, sizeof(buffer));
+		rc = gta04_bt_vendor_hci_h4_read(buffer, 4, HCI_EVENT_COMMAND_COMPLETE, HCI_CMD_RESET);
+		if (rc == 0 && buffer[3] == (unsigned char) i)
+			completes++;
+		else
+			failures++;
+
+		memset(buffer, 0xaa, sizeof(buffer));
+		rc = gta04_bt_vendor_hci_h4_read(buffer, 4, HCI_EVENT_COMMAND_STATUS, HCI_CMD_RESET);
+		if (rc == 0 && buffer[0] == (unsigned char) i)
+			statuses++;
+		else
+			failures++;
+
+		memset(buffer, 0xaa, sizeof(buffer));
+		rc = gta04_bt_vendor_hci_h4_read_event(buffer, 3, HCI_EVENT_VENDOR);
+		if (rc == 0 && buffer[0] == HCI_BCCMD_DESCRIPTOR && buffer[1] == (unsigned char) i && buffer[2] == 0x55)
+			vendors++;
+		else
+			failures++;
+	}
+
+	time = gta04_bt_vendor_h4_test_time() - start;
+
+	pthread_join(thread, NULL);
+
+	printf("%zu bytes at %d baud in %.0f ms, %u reads, %.1f per packet\n", test.length, test.baud, time / 1e6, test.reads, (double) test.reads / test.packets);
+	printf("Matched %d/%d command complete, %d/%d command status and %d/%d vendor events\n", completes, rounds, statuses, rounds, vendors, rounds);
+
+	close(vendor.serial_fd);
+	close(test.master_fd);
+	free(test.stream);
+
+	if (failures > 0) {
+		printf("FAIL: %d\n", failures);
+		return 1;
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-r rounds] [-b baud]\n", argv[0]);
+
+	return 1;
+}
@@ -16,9 +16,9 @@
 LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := gta04_gps.c nmea.c
+LOCAL_SRC_FILES := gta04_gps.c nmea.c cache.c batching.c
 
-LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_SHARED_LIBRARIES := liblog libcutils
 
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
@@ -26,3 +26,5 @@ LOCAL_MODULE_TAGS := optional
 
 LOCAL_MODULE := gps.gta04
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define LOG_TAG "gta04_gps"
+#include <cutils/log.h>
+
+#include <hardware/gps.h>
+
+#include "gta04_gps.h"
+
+/*
+ * Batching keeps fixes in a ring instead of reporting them one by one, so
+ * that the framework is only woken up once the ring is full or when it
+ * explicitly asks for the batched fixes.
+ */
+
+int gta04_gps_batch_add(void)
+{
+	struct gta04_gps_batch *batch;
+	int full = 0;
+	int i;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	batch = &gta04_gps->batch;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (batch->locations == NULL || batch->capacity <= 0)
+		goto complete;
+
+	if (batch->count > 0 && (gta04_gps->location.timestamp - batch->timestamp) < batch->period)
+		goto complete;
+
+	if (batch->count == batch->capacity) {
+		// Drop the oldest fix
+		batch->index = (batch->index + 1) % batch->capacity;
+		batch->count--;
+		batch->stats.dropped++;
+	}
+
+	i = (batch->index + batch->count) % batch->capacity;
+	memcpy(&batch->locations[i], &gta04_gps->location, sizeof(GpsLocation));
+
+	batch->count++;
+	batch->timestamp = gta04_gps->location.timestamp;
+	batch->stats.fixes++;
+
+	if (batch->count == batch->capacity && (batch->flags & GTA04_GPS_BATCH_WAKEUP_ON_FIFO_FULL))
+		full = 1;
+
+complete:
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	return full;
+}
+
+int gta04_gps_batch_deliver(int count)
+{
+	struct gta04_gps_batch *batch;
+	GpsLocation *locations = NULL;
+	GpsLocation **burst = NULL;
+	int index;
+	int i;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	batch = &gta04_gps->batch;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (batch->locations == NULL || batch->count == 0) {
+		pthread_mutex_unlock(&gta04_gps->mutex);
+		return 0;
+	}
+
+	if (count <= 0 || count > batch->count)
+		count = batch->count;
+
+	// The framework may call back into the HAL, so fixes are delivered from a copy, unlocked
+	locations = (GpsLocation *) calloc(count, sizeof(GpsLocation));
+	burst = (GpsLocation **) calloc(count, sizeof(GpsLocation *));
+	if (locations == NULL || burst == NULL) {
+		pthread_mutex_unlock(&gta04_gps->mutex);
+		count = -1;
+		goto complete;
+	}
+
+	// Most recent fixes, from the oldest to the newest
+	index = batch->index + batch->count - count;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&locations[i], &batch->locations[(index + i) % batch->capacity], sizeof(GpsLocation));
+		burst[i] = &locations[i];
+	}
+
+	// Older fixes would be reported out of order after these ones
+	batch->stats.dropped += batch->count - count;
+
+	batch->index = 0;
+	batch->count = 0;
+
+	batch->stats.bursts++;
+	batch->stats.wakeups_avoided += count - 1;
+
+	ALOGD("Delivering %d batched fixes, %d wakeups avoided so far", count, batch->stats.wakeups_avoided);
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	gta04_gps_acquire_wakelock_callback();
+	gta04_gps_batch_location_callback(count, burst);
+	gta04_gps_release_wakelock_callback();
+
+complete:
+	if (locations != NULL)
+		free(locations);
+
+	if (burst != NULL)
+		free(burst);
+
+	return count;
+}
+
+void gta04_gps_batch_release(void)
+{
+	struct gta04_gps_batch *batch;
+
+	if (gta04_gps == NULL)
+		return;
+
+	batch = &gta04_gps->batch;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (batch->locations != NULL) {
+		free(batch->locations);
+		batch->locations = NULL;
+	}
+
+	batch->capacity = 0;
+	batch->count = 0;
+	batch->index = 0;
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+}
+
+/*
+ * GPS Batching Interface
+ */
+
+int gta04_gps_batching_init(struct gta04_gps_batching_callbacks *callbacks)
+{
+	ALOGD("%s(%p)", __func__, callbacks);
+
+	if (callbacks == NULL)
+		return -EINVAL;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	gta04_gps->batching_callbacks = callbacks;
+
+	return 0;
+}
+
+int gta04_gps_batching_get_batch_size(void)
+{
+	ALOGD("%s()", __func__);
+
+	if (gta04_gps != NULL && gta04_gps->batch.capacity > 0)
+		return gta04_gps->batch.capacity;
+
+	return GTA04_GPS_BATCH_MEMORY / sizeof(GpsLocation);
+}
+
+int gta04_gps_batching_start_batching(struct gta04_gps_batch_options *options)
+{
+	struct gta04_gps_batch *batch;
+	size_t memory;
+	int capacity;
+	int rc;
+
+	if (options == NULL)
+		return -EINVAL;
+
+	ALOGD("%s(%lld, 0x%x, %d)", __func__, (long long int) options->period_ns, options->flags, (int) options->max_memory);
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	batch = &gta04_gps->batch;
+
+	memory = options->max_memory > 0 ? options->max_memory : GTA04_GPS_BATCH_MEMORY;
+
+	capacity = memory / sizeof(GpsLocation);
+	if (capacity < 1)
+		capacity = 1;
+	else if (capacity > GTA04_GPS_BATCH_COUNT_MAX)
+		capacity = GTA04_GPS_BATCH_COUNT_MAX;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (batch->capacity != capacity) {
+		if (batch->count > 0)
+			batch->stats.dropped += batch->count;
+
+		if (batch->locations != NULL)
+			free(batch->locations);
+
+		batch->locations = (GpsLocation *) calloc(capacity, sizeof(GpsLocation));
+		batch->capacity = capacity;
+		batch->count = 0;
+		batch->index = 0;
+	}
+
+	batch->period = options->period_ns / 1000000;
+	batch->flags = options->flags;
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	// The framework's own mode and session are kept aside
+	rc = gta04_gps_event_write(GTA04_GPS_EVENT_START_BATCHING);
+	if (rc < 0) {
+		ALOGE("Writing event failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int gta04_gps_batching_stop_batching(void)
+{
+	int rc;
+
+	ALOGD("%s()", __func__);
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	// Remaining fixes are delivered and the receiver is only stopped when
+	// the framework is off as well
+	rc = gta04_gps_event_write(GTA04_GPS_EVENT_STOP_BATCHING);
+	if (rc < 0) {
+		ALOGE("Writing event failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+void gta04_gps_batching_get_batched_location(int count)
+{
+	int rc;
+
+	ALOGD("%s(%d)", __func__, count);
+
+	if (gta04_gps == NULL)
+		return;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+	gta04_gps->batch.flush = count;
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	rc = gta04_gps_event_write(GTA04_GPS_EVENT_FLUSH);
+	if (rc < 0)
+		ALOGE("Writing event failed");
+}
+
+void gta04_gps_batching_get_stats(struct gta04_gps_batch_stats *stats)
+{
+	if (stats == NULL || gta04_gps == NULL)
+		return;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+	memcpy(stats, &gta04_gps->batch.stats, sizeof(struct gta04_gps_batch_stats));
+	pthread_mutex_unlock(&gta04_gps->mutex);
+}
+
+const struct gta04_gps_batching_interface gta04_gps_batching_interface = {
+	.size = sizeof(struct gta04_gps_batching_interface),
+	.init = gta04_gps_batching_init,
+	.get_batch_size = gta04_gps_batching_get_batch_size,
+	.start_batching = gta04_gps_batching_start_batching,
+	.stop_batching = gta04_gps_batching_stop_batching,
+	.get_batched_location = gta04_gps_batching_get_batched_location,
+	.get_stats = gta04_gps_batching_get_stats,
+};
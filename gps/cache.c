@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define LOG_TAG "gta04_gps"
+#include <cutils/log.h>
+
+#include <hardware/gps.h>
+
+#include "gta04_gps.h"
+
+/*
+ * The receiver is powered off with rfkill when stopped, so it forgets
+ * everything it knew. Keep the last position, along with the XTRA data
+ * downloaded by the framework, in a file so that they survive both the
+ * power cycle and a reboot. The file holds the cache structure followed
+ * by the XTRA data.
+ */
+
+int gta04_gps_cache_load(void)
+{
+	struct gta04_gps_cache cache;
+	void *xtra_data = NULL;
+	int fd = -1;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	fd = open(gta04_gps->cache_path, O_RDONLY);
+	if (fd < 0) {
+		ALOGD("No GPS cache available");
+		return 0;
+	}
+
+	rc = read(fd, &cache, sizeof(cache));
+	if (rc < (int) sizeof(cache) || cache.magic != GTA04_GPS_CACHE_MAGIC) {
+		ALOGE("Invalid GPS cache");
+		goto error;
+	}
+
+	if (cache.flags & GTA04_GPS_CACHE_HAS_XTRA) {
+		if (cache.xtra_length == 0 || cache.xtra_length > GTA04_GPS_XTRA_LENGTH_MAX)
+			goto error;
+
+		xtra_data = malloc(cache.xtra_length);
+
+		rc = read(fd, xtra_data, cache.xtra_length);
+		if (rc < (int) cache.xtra_length) {
+			ALOGE("Reading XTRA data from cache failed");
+			goto error;
+		}
+	} else {
+		cache.xtra_length = 0;
+	}
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (gta04_gps->xtra_data != NULL)
+		free(gta04_gps->xtra_data);
+
+	gta04_gps->xtra_data = xtra_data;
+	memcpy(&gta04_gps->cache, &cache, sizeof(cache));
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	ALOGD("Loaded GPS cache with flags 0x%x", cache.flags);
+
+	rc = 0;
+	goto complete;
+
+error:
+	if (xtra_data != NULL)
+		free(xtra_data);
+
+	rc = -1;
+
+complete:
+	if (fd >= 0)
+		close(fd);
+
+	return rc;
+}
+
+int gta04_gps_cache_save(void)
+{
+	char path[PATH_MAX];
+	int fd = -1;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	snprintf((char *) &path, sizeof(path), "%s.tmp", gta04_gps->cache_path);
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (gta04_gps->cache.flags == 0) {
+		unlink(gta04_gps->cache_path);
+
+		rc = 0;
+		goto complete;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		ALOGE("Opening GPS cache failed");
+		goto error;
+	}
+
+	gta04_gps->cache.magic = GTA04_GPS_CACHE_MAGIC;
+
+	rc = write(fd, &gta04_gps->cache, sizeof(gta04_gps->cache));
+	if (rc < (int) sizeof(gta04_gps->cache))
+		goto error;
+
+	if (gta04_gps->cache.flags & GTA04_GPS_CACHE_HAS_XTRA) {
+		rc = write(fd, gta04_gps->xtra_data, gta04_gps->cache.xtra_length);
+		if (rc < (int) gta04_gps->cache.xtra_length)
+			goto error;
+	}
+
+	close(fd);
+	fd = -1;
+
+	// Only replace the previous cache once the new one is complete
+	rc = rename(path, gta04_gps->cache_path);
+	if (rc < 0)
+		goto error;
+
+	rc = 0;
+	goto complete;
+
+error:
+	ALOGE("Writing GPS cache failed");
+
+	if (fd >= 0)
+		close(fd);
+
+	unlink(path);
+
+	rc = -1;
+
+complete:
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	return rc;
+}
+
+int gta04_gps_cache_location(double latitude, double longitude,
+	double altitude, float accuracy, GpsUtcTime timestamp)
+{
+	if (gta04_gps == NULL)
+		return -1;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	gta04_gps->cache.latitude = latitude;
+	gta04_gps->cache.longitude = longitude;
+	gta04_gps->cache.altitude = altitude;
+	gta04_gps->cache.accuracy = accuracy;
+	gta04_gps->cache.location_timestamp = timestamp;
+	gta04_gps->cache.flags |= GTA04_GPS_CACHE_HAS_LOCATION;
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	return 0;
+}
+
+int gta04_gps_cache_xtra(char *data, size_t length)
+{
+	void *xtra_data;
+
+	if (data == NULL || length == 0)
+		return -EINVAL;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	if (length > GTA04_GPS_XTRA_LENGTH_MAX) {
+		ALOGE("XTRA data is too large: %d bytes", (int) length);
+		return -1;
+	}
+
+	xtra_data = malloc(length);
+	memcpy(xtra_data, data, length);
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (gta04_gps->xtra_data != NULL)
+		free(gta04_gps->xtra_data);
+
+	gta04_gps->xtra_data = xtra_data;
+	gta04_gps->cache.xtra_length = length;
+	gta04_gps->cache.xtra_timestamp = gta04_gps_time();
+	gta04_gps->cache.flags |= GTA04_GPS_CACHE_HAS_XTRA;
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	return gta04_gps_cache_save();
+}
+
+int gta04_gps_cache_delete(GpsAidingData flags)
+{
+	if (gta04_gps == NULL)
+		return -1;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (flags & GPS_DELETE_POSITION)
+		gta04_gps->cache.flags &= ~GTA04_GPS_CACHE_HAS_LOCATION;
+
+	if (flags & GPS_DELETE_TIME)
+		gta04_gps->time_injected = 0;
+
+	if (flags & GPS_DELETE_EPHEMERIS) {
+		if (gta04_gps->xtra_data != NULL) {
+			free(gta04_gps->xtra_data);
+			gta04_gps->xtra_data = NULL;
+		}
+
+		gta04_gps->cache.xtra_length = 0;
+		gta04_gps->cache.flags &= ~GTA04_GPS_CACHE_HAS_XTRA;
+	}
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	return gta04_gps_cache_save();
+}
+
+int gta04_gps_cache_inject(void)
+{
+	struct gta04_gps_cache cache;
+	GpsUtcTime time;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+	memcpy(&cache, &gta04_gps->cache, sizeof(cache));
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	time = gta04_gps_time();
+
+	if (!(cache.flags & GTA04_GPS_CACHE_HAS_XTRA) || (time - cache.xtra_timestamp) > GTA04_GPS_XTRA_AGE)
+		gta04_gps_xtra_download_request_callback();
+
+	if (!(cache.flags & GTA04_GPS_CACHE_HAS_LOCATION))
+		return 0;
+
+	ALOGD("Injecting cached location (%f, %f) from %ld s ago", cache.latitude, cache.longitude, (long int) ((time - cache.location_timestamp) / 1000));
+
+	// Warm start with initialization data: a hot start would ignore them
+	rc = gta04_gps_nmea_psrf104(cache.latitude, cache.longitude, cache.altitude, time, 3);
+	if (rc < 0) {
+		ALOGE("Injecting cached location failed");
+		return -1;
+	}
+
+	return 0;
+}
@@ -18,12 +18,16 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <termios.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <sys/eventfd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #define LOG_TAG "gta04_gps"
 #include <cutils/log.h>
@@ -42,6 +46,10 @@ const char antenna_state_path[] = "/sys/class/switch/gps_antenna/state";
 const char serial_path[] = "/dev/ttyO1";
 const speed_t serial_speed = B9600;
 
+const char rfkill_path[] = "/dev/rfkill";
+
+const char cache_path[] = "/data/misc/gps/gta04_gps.cache";
+
 const int channel_count = 12;
 
 struct gta04_gps *gta04_gps = NULL;
@@ -53,18 +61,40 @@ struct gta04_gps *gta04_gps = NULL;
 void gta04_gps_location_callback(void)
 {
 	GpsLocationFlags single_flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE | GPS_LOCATION_HAS_ACCURACY;
+	unsigned char batching;
+	unsigned char started;
 
 	if (gta04_gps == NULL || gta04_gps->callbacks == NULL || gta04_gps->callbacks->location_cb == NULL)
 		return;
 
-	if (gta04_gps->recurrence == GPS_POSITION_RECURRENCE_SINGLE) {
+	batching = gta04_gps->batch.enabled;
+	started = gta04_gps->started;
+
+	// Incomplete fixes are still batched
+	if (started && gta04_gps->position_recurrence == GPS_POSITION_RECURRENCE_SINGLE) {
 		if ((gta04_gps->location.flags & single_flags) != single_flags)
-			return;
+			started = 0;
 		else
 			gta04_gps_event_write(GTA04_GPS_EVENT_STOP);
 	}
 
-	gta04_gps->callbacks->location_cb(&gta04_gps->location);
+	if (!started && !batching)
+		return;
+
+	if (gta04_gps->location.flags & GPS_LOCATION_HAS_LAT_LONG) {
+		gta04_gps_cache_location(gta04_gps->location.latitude, gta04_gps->location.longitude, gta04_gps->location.altitude, gta04_gps->location.accuracy, gta04_gps->location.timestamp);
+
+		if (gta04_gps_duty_cycle_enabled())
+			gta04_gps_duty_cycle_schedule();
+	}
+
+	if (batching) {
+		if (gta04_gps_batch_add() > 0)
+			gta04_gps_batch_deliver(0);
+	}
+
+	if (started)
+		gta04_gps->callbacks->location_cb(&gta04_gps->location);
 }
 
 void gta04_gps_status_callback(void)
@@ -80,7 +110,7 @@ void gta04_gps_sv_status_callback(void)
 	if (gta04_gps == NULL || gta04_gps->callbacks == NULL || gta04_gps->callbacks->sv_status_cb == NULL)
 		return;
 
-	if (gta04_gps->recurrence == GPS_POSITION_RECURRENCE_SINGLE)
+	if (!gta04_gps->started || gta04_gps->position_recurrence == GPS_POSITION_RECURRENCE_SINGLE)
 		return;
 
 	gta04_gps->callbacks->sv_status_cb(&gta04_gps->sv_status);
@@ -110,16 +140,74 @@ void gta04_gps_release_wakelock_callback(void)
 	gta04_gps->callbacks->release_wakelock_cb();
 }
 
+void gta04_gps_xtra_download_request_callback(void)
+{
+	if (gta04_gps == NULL || gta04_gps->xtra_callbacks == NULL || gta04_gps->xtra_callbacks->download_request_cb == NULL)
+		return;
+
+	gta04_gps->xtra_callbacks->download_request_cb();
+}
+
+void gta04_gps_batch_location_callback(int count, GpsLocation **locations)
+{
+	if (gta04_gps == NULL || gta04_gps->batching_callbacks == NULL || gta04_gps->batching_callbacks->location_cb == NULL)
+		return;
+
+	gta04_gps->batching_callbacks->location_cb(count, locations);
+}
+
 /*
  * GTA04 GPS
  */
 
+int gta04_gps_paths_setup(void)
+{
+	if (gta04_gps == NULL)
+		return -1;
+
+	property_get(GTA04_GPS_PROPERTY_SERIAL_PATH, gta04_gps->serial_path, serial_path);
+	property_get(GTA04_GPS_PROPERTY_RFKILL_PATH, gta04_gps->rfkill_path, rfkill_path);
+	property_get(GTA04_GPS_PROPERTY_ANTENNA_PATH, gta04_gps->antenna_state_path, antenna_state_path);
+	property_get(GTA04_GPS_PROPERTY_CACHE_PATH, gta04_gps->cache_path, cache_path);
+
+	ALOGD("Using GPS serial %s, rfkill %s and antenna state %s", gta04_gps->serial_path, gta04_gps->rfkill_path, gta04_gps->antenna_state_path);
+
+	return 0;
+}
+
+int64_t gta04_gps_boottime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+GpsUtcTime gta04_gps_time(void)
+{
+	struct timeval tv;
+	GpsUtcTime time;
+
+	// Injected time is relative to the elapsed realtime clock
+	if (gta04_gps != NULL && gta04_gps->time_injected)
+		return gta04_gps_boottime() + gta04_gps->time_offset;
+
+	gettimeofday(&tv, NULL);
+	time = (GpsUtcTime) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	return time;
+}
+
 int gta04_gps_antenna_state(void)
 {
 	char state[9] = { 0 };
 	int fd;
 
-	fd = open(antenna_state_path, O_RDONLY);
+	if (gta04_gps == NULL)
+		return -1;
+
+	fd = open(gta04_gps->antenna_state_path, O_RDONLY);
 	if (fd < 0)
 		return -1;
 
@@ -141,7 +229,10 @@ int gta04_gps_rfkill_change(unsigned char type, unsigned char soft)
 	int fd = -1;
 	int rc;
 
-	fd = open("/dev/rfkill", O_WRONLY);
+	if (gta04_gps == NULL)
+		return -1;
+
+	fd = open(gta04_gps->rfkill_path, O_WRONLY);
 	if (fd < 0) {
 		ALOGE("Opening rfkill device failed");
 		return -1;
@@ -175,6 +266,7 @@ complete:
 
 int gta04_gps_serial_open(void)
 {
+	struct epoll_event event;
 	struct termios termios;
 	int serial_fd = -1;
 	int rc;
@@ -187,7 +279,7 @@ int gta04_gps_serial_open(void)
 	if (gta04_gps->serial_fd >= 0)
 		close(gta04_gps->serial_fd);
 
-	serial_fd = open(serial_path, O_RDWR | O_NONBLOCK);
+	serial_fd = open(gta04_gps->serial_path, O_RDWR | O_NONBLOCK);
 	if (serial_fd < 0) {
 		ALOGE("Opening serial failed");
 		goto error;
@@ -214,6 +306,20 @@ int gta04_gps_serial_open(void)
 	}
 
 	gta04_gps->serial_fd = serial_fd;
+	gta04_gps->serial_length = 0;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = serial_fd;
+
+	rc = epoll_ctl(gta04_gps->epoll_fd, EPOLL_CTL_ADD, serial_fd, &event);
+	if (rc < 0) {
+		ALOGE("Adding serial to epoll failed");
+		goto error;
+	}
+
+	// The receiver is expected to talk shortly after being opened
+	gta04_gps_timer_set(gta04_gps->watchdog_fd, GTA04_GPS_WATCHDOG_TIMEOUT);
 
 	rc = 0;
 	goto complete;
@@ -242,6 +348,10 @@ int gta04_gps_serial_close(void)
 
 	pthread_mutex_lock(&gta04_gps->mutex);
 
+	gta04_gps_timer_set(gta04_gps->watchdog_fd, -1);
+
+	epoll_ctl(gta04_gps->epoll_fd, EPOLL_CTL_DEL, gta04_gps->serial_fd, NULL);
+
 	close(gta04_gps->serial_fd);
 	gta04_gps->serial_fd = -1;
 
@@ -261,20 +371,24 @@ int gta04_gps_serial_read(void *buffer, size_t length)
 		return -1;
 
 	pthread_mutex_lock(&gta04_gps->mutex);
-	gta04_gps_acquire_wakelock_callback();
+
+	// Batched fixes are delivered with their own wakelock
+	if (gta04_gps->started)
+		gta04_gps_acquire_wakelock_callback();
 
 	rc = read(gta04_gps->serial_fd, buffer, length);
 	if (rc <= 0)
 		goto error;
 
-	rc = 0;
 	goto complete;
 
 error:
 	rc = -1;
 
 complete:
-	gta04_gps_release_wakelock_callback();
+	if (gta04_gps->started)
+		gta04_gps_release_wakelock_callback();
+
 	pthread_mutex_unlock(&gta04_gps->mutex);
 
 	return rc;
@@ -310,62 +424,329 @@ complete:
 	return rc;
 }
 
+// Power
+
+int gta04_gps_power_on(void)
+{
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	rc = gta04_gps_rfkill_change(RFKILL_TYPE_GPS, 0);
+	if (rc < 0)
+		return -1;
+
+	// Give it some time to power up the antenna
+	usleep(20000);
+
+	gta04_gps_antenna_state();
+
+	rc = gta04_gps_serial_open();
+	if (rc < 0)
+		return -1;
+
+	gta04_gps->duty_cycle.power_on = gta04_gps_boottime();
+
+	return 0;
+}
+
+int gta04_gps_power_off(void)
+{
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	rc = gta04_gps_serial_close();
+	if (rc < 0)
+		return -1;
+
+	rc = gta04_gps_rfkill_change(RFKILL_TYPE_GPS, 1);
+	if (rc < 0)
+		return -1;
+
+	return 0;
+}
+
+// Position mode
+
+/*
+ * The receiver runs in the framework's mode, unless batching needs fixes at
+ * a shorter interval or while the framework is off. Called with the mutex
+ * held.
+ */
+void gta04_gps_position_mode_update(void)
+{
+	uint32_t interval;
+
+	if (gta04_gps == NULL)
+		return;
+
+	gta04_gps->recurrence = gta04_gps->position_recurrence;
+	gta04_gps->interval = gta04_gps->position_interval;
+
+	if (gta04_gps->batch.enabled) {
+		interval = gta04_gps->batch.period > 1000 ? (uint32_t) gta04_gps->batch.period : 1000;
+
+		if (gta04_gps->started && gta04_gps->position_recurrence == GPS_POSITION_RECURRENCE_PERIODIC && gta04_gps->position_interval < interval)
+			interval = gta04_gps->position_interval;
+
+		gta04_gps->recurrence = GPS_POSITION_RECURRENCE_PERIODIC;
+		gta04_gps->interval = interval;
+	}
+
+	if (gta04_gps->recurrence == GPS_POSITION_RECURRENCE_SINGLE)
+		gta04_gps->interval = 1000;
+}
+
+int gta04_gps_position_mode_apply(void)
+{
+	int interval;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	// The mode is applied when the session begins otherwise
+	if (gta04_gps->serial_fd < 0 || gta04_gps->status.status != GPS_STATUS_SESSION_BEGIN)
+		return 0;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	// Get a fix as soon as possible when powered on for one fix only
+	if (gta04_gps_duty_cycle_enabled())
+		interval = 1;
+	else
+		interval = gta04_gps->interval / 1000;
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
+	// Location is reported from GPRMC message
+	return gta04_gps_nmea_psrf103(4, interval);
+}
+
+// Duty cycle
+
+int gta04_gps_duty_cycle_enabled(void)
+{
+	if (gta04_gps == NULL)
+		return 0;
+
+	if (gta04_gps->recurrence != GPS_POSITION_RECURRENCE_PERIODIC || gta04_gps->interval < GTA04_GPS_DUTY_CYCLE_INTERVAL)
+		return 0;
+
+	return 1;
+}
+
+int gta04_gps_duty_cycle_schedule(void)
+{
+	struct gta04_gps_duty_cycle *duty_cycle;
+	int64_t now;
+	int64_t on_time;
+	int64_t off_time;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	duty_cycle = &gta04_gps->duty_cycle;
+
+	// Only the first fix after powering on is accounted
+	if (duty_cycle->power_on == 0)
+		return 0;
+
+	now = gta04_gps_boottime();
+	on_time = now - duty_cycle->power_on;
+	duty_cycle->power_on = 0;
+
+	duty_cycle->fixes++;
+	duty_cycle->on_time_total += on_time;
+
+	// Follow changing conditions while smoothing out lucky fixes
+	if (duty_cycle->on_time == 0)
+		duty_cycle->on_time = on_time;
+	else
+		duty_cycle->on_time = (duty_cycle->on_time * 3 + on_time) / 4;
+
+	ALOGD("GPS fix after %ld ms powered on, %ld ms on average over %d fixes", (long int) on_time, (long int) (duty_cycle->on_time_total / duty_cycle->fixes), duty_cycle->fixes);
+
+	off_time = gta04_gps->interval - duty_cycle->on_time - GTA04_GPS_DUTY_CYCLE_MARGIN;
+	if (off_time < GTA04_GPS_DUTY_CYCLE_OFF_MIN) {
+		ALOGD("GPS fixes take too long to power off in between");
+		return 0;
+	}
+
+	duty_cycle->wake = now + off_time;
+
+	rc = gta04_gps_event_write(GTA04_GPS_EVENT_SLEEP);
+	if (rc < 0) {
+		ALOGE("Writing event failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int gta04_gps_duty_cycle_sleep(void)
+{
+	int64_t delay;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	delay = gta04_gps->duty_cycle.wake - gta04_gps_boottime();
+	if (delay < 0)
+		delay = 0;
+
+	ALOGD("Powering off the GPS for %ld ms", (long int) delay);
+
+	gta04_gps_cache_save();
+
+	rc = gta04_gps_power_off();
+	if (rc < 0)
+		return -1;
+
+	rc = gta04_gps_timer_set(gta04_gps->schedule_fd, delay);
+	if (rc < 0)
+		return -1;
+
+	gta04_gps->duty_cycle.sleeping = 1;
+
+	gta04_gps->status.status = GPS_STATUS_ENGINE_OFF;
+	gta04_gps_status_callback();
+
+	return 0;
+}
+
+int gta04_gps_duty_cycle_wake(void)
+{
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	ALOGD("Powering on the GPS for the next fix");
+
+	gta04_gps->duty_cycle.sleeping = 0;
+
+	rc = gta04_gps_power_on();
+	if (rc < 0)
+		return -1;
+
+	gta04_gps->status.status = GPS_STATUS_ENGINE_ON;
+	gta04_gps_status_callback();
+
+	return 0;
+}
+
 // Event
 
-int gta04_gps_event_read(eventfd_t *event)
+/*
+ * Events are queued in order and the eventfd only wakes up the thread, so
+ * that events written in a row are neither merged nor lost.
+ */
+
+int gta04_gps_event_read(int *event)
 {
 	int rc;
 
 	if (event == NULL)
 		return -EINVAL;
 
+	if (gta04_gps == NULL)
+		return -1;
+
+	pthread_mutex_lock(&gta04_gps->events_mutex);
+
+	if (gta04_gps->events_count == 0) {
+		rc = -1;
+		goto complete;
+	}
+
+	*event = gta04_gps->events[gta04_gps->events_index];
+
+	gta04_gps->events_index = (gta04_gps->events_index + 1) % GTA04_GPS_EVENTS_COUNT;
+	gta04_gps->events_count--;
+
+	rc = 0;
+
+complete:
+	pthread_mutex_unlock(&gta04_gps->events_mutex);
+
+	return rc;
+}
+
+int gta04_gps_event_write(int event)
+{
+	int index;
+	int rc;
+
 	if (gta04_gps == NULL || gta04_gps->event_fd < 0)
 		return -1;
 
-	rc = eventfd_read(gta04_gps->event_fd, event);
+	pthread_mutex_lock(&gta04_gps->events_mutex);
+
+	if (gta04_gps->events_count == GTA04_GPS_EVENTS_COUNT) {
+		ALOGE("Too many pending events");
+		pthread_mutex_unlock(&gta04_gps->events_mutex);
+		return -1;
+	}
+
+	index = (gta04_gps->events_index + gta04_gps->events_count) % GTA04_GPS_EVENTS_COUNT;
+	gta04_gps->events[index] = event;
+	gta04_gps->events_count++;
+
+	pthread_mutex_unlock(&gta04_gps->events_mutex);
+
+	rc = eventfd_write(gta04_gps->event_fd, 1);
 	if (rc < 0)
 		return -1;
 
 	return 0;
 }
 
-int gta04_gps_event_write(eventfd_t event)
+// Timer
+
+int gta04_gps_timer_set(int fd, int64_t delay)
 {
-	eventfd_t flush;
+	struct itimerspec its;
 	int rc;
 
-	if (gta04_gps == NULL || gta04_gps->event_fd < 0)
+	if (fd < 0)
 		return -1;
 
-	eventfd_read(gta04_gps->event_fd, &flush);
+	memset(&its, 0, sizeof(its));
 
-	rc = eventfd_write(gta04_gps->event_fd, event);
-	if (rc < 0)
+	// Negative delay disarms the timer, zero delay fires right away
+	if (delay > 0) {
+		its.it_value.tv_sec = delay / 1000;
+		its.it_value.tv_nsec = (delay % 1000) * 1000000;
+	} else if (delay == 0) {
+		its.it_value.tv_nsec = 1;
+	}
+
+	rc = timerfd_settime(fd, 0, &its, NULL);
+	if (rc < 0) {
+		ALOGE("Setting timer failed");
 		return -1;
+	}
 
 	return 0;
 }
 
 // Thread
 
-int gta04_gps_serial_handle(void)
+int gta04_gps_serial_sentence(char *line, size_t length)
 {
-	char buffer[80] = { 0 };
 	char *nmea = NULL;
 	char *address;
-	int interval;
 	int rc;
 
 	if (gta04_gps == NULL)
 		return -1;
 
-	rc = gta04_gps_serial_read(&buffer, sizeof(buffer));
-	if (rc < 0) {
-		ALOGE("Reading from serial failed");
-		return -1;
-	}
-
-	nmea = gta04_gps_nmea_extract(buffer, sizeof(buffer));
+	nmea = gta04_gps_nmea_extract(line, length);
 	if (nmea == NULL) {
 		rc = 0;
 		goto complete;
@@ -374,15 +755,11 @@ int gta04_gps_serial_handle(void)
 	if (gta04_gps->status.status != GPS_STATUS_SESSION_BEGIN) {
 		// Now is a good time to setup the interval of location messages
 
-		if (gta04_gps->recurrence == GPS_POSITION_RECURRENCE_SINGLE)
-			gta04_gps->interval = 1000;
-
-		interval = gta04_gps->interval / 1000;
-
-		// Location is reported from GPRMC message
-		gta04_gps_nmea_psrf103(4, interval);
+		gta04_gps_cache_inject();
 
 		gta04_gps->status.status = GPS_STATUS_SESSION_BEGIN;
+		gta04_gps_position_mode_apply();
+
 		gta04_gps_status_callback();
 	}
 
@@ -421,36 +798,91 @@ complete:
 	return rc;
 }
 
-int gta04_gps_event_handle(void)
+/*
+ * A read may return several sentences and end in the middle of one, when the
+ * serial is not in canonical mode: every complete line is handled and the
+ * rest is kept for the next read.
+ */
+int gta04_gps_serial_handle(void)
 {
-	eventfd_t event = 0;
+	char *buffer;
+	char *line;
+	char *end;
+	size_t length;
 	int rc;
 
 	if (gta04_gps == NULL)
 		return -1;
 
-	rc = gta04_gps_event_read(&event);
+	buffer = gta04_gps->serial_buffer;
+
+	// Keep the buffer terminated for the extraction
+	rc = gta04_gps_serial_read(&buffer[gta04_gps->serial_length], sizeof(gta04_gps->serial_buffer) - gta04_gps->serial_length - 1);
 	if (rc < 0) {
-		ALOGE("Reading event failed");
+		ALOGE("Reading from serial failed");
 		return -1;
 	}
 
+	gta04_gps->serial_length += rc;
+	buffer[gta04_gps->serial_length] = '\0';
+
+	line = buffer;
+	rc = 0;
+
+	while ((end = (char *) memchr(line, '\n', &buffer[gta04_gps->serial_length] - line)) != NULL) {
+		*end = '\0';
+
+		if (gta04_gps_serial_sentence(line, end - line) < 0)
+			rc = -1;
+
+		line = end + 1;
+	}
+
+	length = &buffer[gta04_gps->serial_length] - line;
+
+	// A line that long is not a sentence
+	if (length == sizeof(gta04_gps->serial_buffer) - 1)
+		length = 0;
+
+	memmove(buffer, line, length);
+	gta04_gps->serial_length = length;
+
+	return rc;
+}
+
+int gta04_gps_event_dispatch(int event)
+{
+	unsigned char batching;
+	unsigned char started;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
 	switch (event) {
 		case GTA04_GPS_EVENT_TERMINATE:
 			return 1;
 		case GTA04_GPS_EVENT_START:
-			ALOGD("Starting the GPS");
+		case GTA04_GPS_EVENT_START_BATCHING:
+			pthread_mutex_lock(&gta04_gps->mutex);
 
-			rc = gta04_gps_rfkill_change(RFKILL_TYPE_GPS, 0);
-			if (rc < 0)
-				return -1;
+			if (event == GTA04_GPS_EVENT_START)
+				gta04_gps->started = 1;
+			else
+				gta04_gps->batch.enabled = 1;
 
-			// Give it some time to power up the antenna
-			usleep(20000);
+			gta04_gps_position_mode_update();
+			pthread_mutex_unlock(&gta04_gps->mutex);
 
-			gta04_gps_antenna_state();
+			// The other client may have started the receiver already
+			if (gta04_gps->serial_fd >= 0 || gta04_gps->duty_cycle.sleeping) {
+				gta04_gps_position_mode_apply();
+				break;
+			}
 
-			rc = gta04_gps_serial_open();
+			ALOGD("Starting the GPS");
+
+			rc = gta04_gps_power_on();
 			if (rc < 0)
 				return -1;
 
@@ -458,16 +890,49 @@ int gta04_gps_event_handle(void)
 			gta04_gps_status_callback();
 			break;
 		case GTA04_GPS_EVENT_STOP:
+		case GTA04_GPS_EVENT_STOP_BATCHING:
+			pthread_mutex_lock(&gta04_gps->mutex);
+
+			if (event == GTA04_GPS_EVENT_STOP)
+				gta04_gps->started = 0;
+			else
+				gta04_gps->batch.enabled = 0;
+
+			gta04_gps_position_mode_update();
+
+			batching = gta04_gps->batch.enabled;
+			started = gta04_gps->started;
+
+			pthread_mutex_unlock(&gta04_gps->mutex);
+
+			// Remaining fixes are delivered when batching stops
+			if (!batching) {
+				gta04_gps_batch_deliver(0);
+				gta04_gps_batch_release();
+			}
+
+			// The other client keeps the receiver on, in its own mode
+			if (batching || started) {
+				gta04_gps_position_mode_apply();
+				break;
+			}
+
+			if (gta04_gps->serial_fd < 0 && !gta04_gps->duty_cycle.sleeping)
+				break;
+
 			ALOGD("Stopping the GPS");
 
 			gta04_gps->status.status = GPS_STATUS_SESSION_END;
 			gta04_gps_status_callback();
 
-			rc = gta04_gps_serial_close();
-			if (rc < 0)
-				return -1;
+			gta04_gps_cache_save();
+
+			gta04_gps->duty_cycle.sleeping = 0;
+			gta04_gps->duty_cycle.power_on = 0;
 
-			rc = gta04_gps_rfkill_change(RFKILL_TYPE_GPS, 1);
+			gta04_gps_timer_set(gta04_gps->schedule_fd, -1);
+
+			rc = gta04_gps_power_off();
 			if (rc < 0)
 				return -1;
 
@@ -475,6 +940,9 @@ int gta04_gps_event_handle(void)
 			gta04_gps_status_callback();
 			break;
 		case GTA04_GPS_EVENT_RESTART:
+			if (gta04_gps->serial_fd < 0)
+				break;
+
 			ALOGD("Restarting the GPS");
 
 			gta04_gps->status.status = GPS_STATUS_SESSION_END;
@@ -502,67 +970,139 @@ int gta04_gps_event_handle(void)
 		case GTA04_GPS_EVENT_INJECT_LOCATION:
 			break;
 		case GTA04_GPS_EVENT_SET_POSITION_MODE:
-			// Position mode is set later on
+			gta04_gps_position_mode_apply();
+			break;
+		case GTA04_GPS_EVENT_FLUSH:
+			gta04_gps_batch_deliver(gta04_gps->batch.flush);
+			break;
+		case GTA04_GPS_EVENT_SLEEP:
+			// The session might have been stopped in the meantime
+			if (gta04_gps->serial_fd < 0 || !gta04_gps_duty_cycle_enabled())
+				break;
+
+			rc = gta04_gps_duty_cycle_sleep();
+			if (rc < 0)
+				return -1;
 			break;
 	}
 
 	return 0;
 }
 
+int gta04_gps_event_handle(void)
+{
+	eventfd_t flush;
+	int event;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	rc = eventfd_read(gta04_gps->event_fd, &flush);
+	if (rc < 0) {
+		ALOGE("Reading event failed");
+		return -1;
+	}
+
+	while (gta04_gps_event_read(&event) >= 0) {
+		rc = gta04_gps_event_dispatch(event);
+		if (rc != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+int gta04_gps_watchdog_handle(void)
+{
+	uint64_t expirations;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	rc = read(gta04_gps->watchdog_fd, &expirations, sizeof(expirations));
+	if (rc < (int) sizeof(expirations))
+		return 0;
+
+	if (gta04_gps->serial_fd < 0 || gta04_gps->status.status != GPS_STATUS_ENGINE_ON)
+		return 0;
+
+	ALOGE("Not receiving anything from the GPS");
+
+	return gta04_gps_event_dispatch(GTA04_GPS_EVENT_RESTART);
+}
+
+int gta04_gps_schedule_handle(void)
+{
+	uint64_t expirations;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	rc = read(gta04_gps->schedule_fd, &expirations, sizeof(expirations));
+	if (rc < (int) sizeof(expirations))
+		return 0;
+
+	if (!gta04_gps->duty_cycle.sleeping)
+		return 0;
+
+	return gta04_gps_duty_cycle_wake();
+}
+
 void gta04_gps_thread(void *data)
 {
-	struct timeval time;
-	struct timeval *timeout;
-	fd_set fds;
-	int fd_max;
+	struct epoll_event events[4];
 	int failures;
+	int count;
+	int fd;
 	int rc;
+	int i;
 
 	ALOGD("%s(%p)", __func__, data);
 
-	if (gta04_gps == NULL || gta04_gps->event_fd < 0)
+	if (gta04_gps == NULL)
 		return;
 
+	if (gta04_gps->epoll_fd < 0)
+		goto complete;
+
 	failures = 0;
 
 	while (1) {
-		timeout = NULL;
-
-		FD_ZERO(&fds);
-		FD_SET(gta04_gps->event_fd, &fds);
-
-		if (gta04_gps->serial_fd >= 0) {
-			FD_SET(gta04_gps->serial_fd, &fds);
-
-			time.tv_sec = 2;
-			time.tv_usec = 0;
-
-			timeout = &time;
-		}
-
-		fd_max = gta04_gps->event_fd > gta04_gps->serial_fd ? gta04_gps->event_fd : gta04_gps->serial_fd;
+		count = epoll_wait(gta04_gps->epoll_fd, events, sizeof(events) / sizeof(struct epoll_event), -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
 
-		rc = select(fd_max + 1, &fds, NULL, NULL, timeout);
-		if (rc < 0) {
 			ALOGE("Polling failed");
 
 			if (failures)
 				break;
-			else
-				failures++;
-		} else if (rc == 0 && gta04_gps->status.status == GPS_STATUS_ENGINE_ON) {
-			ALOGE("Not receiving anything from the GPS");
-			gta04_gps_event_write(GTA04_GPS_EVENT_RESTART);
+
+			failures++;
 			continue;
 		}
 
 		rc = 0;
 
-		if (FD_ISSET(gta04_gps->serial_fd, &fds))
-			rc |= gta04_gps_serial_handle();
+		// Events are handled last, as they may close the serial
+		for (i = 0; i < count; i++) {
+			fd = events[i].data.fd;
 
-		if (FD_ISSET(gta04_gps->event_fd, &fds))
-			rc |= gta04_gps_event_handle();
+			if (fd == gta04_gps->serial_fd)
+				rc |= gta04_gps_serial_handle();
+			else if (fd == gta04_gps->watchdog_fd)
+				rc |= gta04_gps_watchdog_handle();
+			else if (fd == gta04_gps->schedule_fd)
+				rc |= gta04_gps_schedule_handle();
+		}
+
+		for (i = 0; i < count; i++) {
+			if (events[i].data.fd == gta04_gps->event_fd)
+				rc |= gta04_gps_event_handle();
+		}
 
 		if (rc < 0)
 			failures++;
@@ -576,16 +1116,90 @@ void gta04_gps_thread(void *data)
 			break;
 		}
 	}
+
+complete:
+	pthread_mutex_lock(&gta04_gps->mutex);
+	gta04_gps->thread_running = 0;
+	pthread_cond_broadcast(&gta04_gps->thread_cond);
+	pthread_mutex_unlock(&gta04_gps->mutex);
+}
+
+/*
+ * The thread comes from the framework and is detached, so it cannot be
+ * joined: wait for it to report that it is done instead.
+ */
+void gta04_gps_thread_terminate(void)
+{
+	if (gta04_gps == NULL)
+		return;
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	if (gta04_gps->thread_running) {
+		pthread_mutex_unlock(&gta04_gps->mutex);
+		gta04_gps_event_write(GTA04_GPS_EVENT_TERMINATE);
+		pthread_mutex_lock(&gta04_gps->mutex);
+	}
+
+	while (gta04_gps->thread_running)
+		pthread_cond_wait(&gta04_gps->thread_cond, &gta04_gps->mutex);
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+}
+
+/*
+ * GPS XTRA Interface
+ */
+
+int gta04_gps_xtra_init(GpsXtraCallbacks *callbacks)
+{
+	ALOGD("%s(%p)", __func__, callbacks);
+
+	if (callbacks == NULL)
+		return -EINVAL;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	gta04_gps->xtra_callbacks = callbacks;
+
+	return 0;
+}
+
+int gta04_gps_xtra_inject_xtra_data(char *data, int length)
+{
+	int rc;
+
+	ALOGD("%s(%p, %d)", __func__, data, length);
+
+	if (data == NULL || length <= 0)
+		return -EINVAL;
+
+	rc = gta04_gps_cache_xtra(data, (size_t) length);
+	if (rc < 0) {
+		ALOGE("Caching XTRA data failed");
+		return -1;
+	}
+
+	return 0;
 }
 
+const GpsXtraInterface gta04_gps_xtra_interface = {
+	.size = sizeof(GpsXtraInterface),
+	.init = gta04_gps_xtra_init,
+	.inject_xtra_data = gta04_gps_xtra_inject_xtra_data,
+};
+
 /*
  * GPS Interface
  */
 
 int gta04_gps_init(GpsCallbacks *callbacks)
 {
-	int event_fd;
+	struct epoll_event event;
+	int fds[3];
 	int rc;
+	int i;
 
 	ALOGD("%s(%p)", __func__, callbacks);
 
@@ -598,6 +1212,10 @@ int gta04_gps_init(GpsCallbacks *callbacks)
 	gta04_gps = (struct gta04_gps *) calloc(1, sizeof(struct gta04_gps));
 	gta04_gps->callbacks = callbacks;
 	gta04_gps->serial_fd = -1;
+	gta04_gps->epoll_fd = -1;
+	gta04_gps->event_fd = -1;
+	gta04_gps->watchdog_fd = -1;
+	gta04_gps->schedule_fd = -1;
 
 	gta04_gps->location.size = sizeof(GpsLocation);
 	gta04_gps->status.size = sizeof(GpsStatus);
@@ -606,16 +1224,67 @@ int gta04_gps_init(GpsCallbacks *callbacks)
 	gta04_gps->capabilities = GPS_CAPABILITY_SCHEDULING | GPS_CAPABILITY_SINGLE_SHOT;
 
 	pthread_mutex_init(&gta04_gps->mutex, NULL);
+	pthread_mutex_init(&gta04_gps->events_mutex, NULL);
+	pthread_cond_init(&gta04_gps->thread_cond, NULL);
+
+	gta04_gps_paths_setup();
+	gta04_gps_cache_load();
 
-	event_fd = eventfd(0, EFD_NONBLOCK);
-	if (event_fd < 0) {
+	gta04_gps->epoll_fd = epoll_create(4);
+	if (gta04_gps->epoll_fd < 0) {
+		ALOGE("Opening epoll failed");
+		goto error;
+	}
+
+	gta04_gps->event_fd = eventfd(0, EFD_NONBLOCK);
+	if (gta04_gps->event_fd < 0) {
 		ALOGE("Opening eventfd failed");
 		goto error;
 	}
 
-	gta04_gps->event_fd = event_fd;
+	gta04_gps->watchdog_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (gta04_gps->watchdog_fd < 0) {
+		ALOGE("Opening watchdog timerfd failed");
+		goto error;
+	}
+
+	// Scheduled fixes should happen even if the system is suspended
+#ifdef CLOCK_BOOTTIME_ALARM
+	gta04_gps->schedule_fd = timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_NONBLOCK);
+	if (gta04_gps->schedule_fd < 0)
+#endif
+		gta04_gps->schedule_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK);
+	if (gta04_gps->schedule_fd < 0)
+		gta04_gps->schedule_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (gta04_gps->schedule_fd < 0) {
+		ALOGE("Opening schedule timerfd failed");
+		goto error;
+	}
+
+	fds[0] = gta04_gps->event_fd;
+	fds[1] = gta04_gps->watchdog_fd;
+	fds[2] = gta04_gps->schedule_fd;
+
+	for (i = 0; i < (int) (sizeof(fds) / sizeof(int)); i++) {
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fds[i];
+
+		rc = epoll_ctl(gta04_gps->epoll_fd, EPOLL_CTL_ADD, fds[i], &event);
+		if (rc < 0) {
+			ALOGE("Adding to epoll failed");
+			goto error;
+		}
+	}
+
+	gta04_gps->thread_running = 1;
 
 	gta04_gps->thread = callbacks->create_thread_cb("GTA04 GPS", &gta04_gps_thread, NULL);
+	if (gta04_gps->thread == 0) {
+		ALOGE("Creating thread failed");
+		gta04_gps->thread_running = 0;
+		goto error;
+	}
 
 	rc = gta04_gps_rfkill_change(RFKILL_TYPE_GPS, 1);
 	if (rc < 0)
@@ -630,14 +1299,23 @@ int gta04_gps_init(GpsCallbacks *callbacks)
 	goto complete;
 
 error:
-	pthread_mutex_destroy(&gta04_gps->mutex);
+	gta04_gps_thread_terminate();
 
-	if (event_fd >= 0) {
-		gta04_gps_event_write(GTA04_GPS_EVENT_TERMINATE);
+	pthread_cond_destroy(&gta04_gps->thread_cond);
+	pthread_mutex_destroy(&gta04_gps->mutex);
+	pthread_mutex_destroy(&gta04_gps->events_mutex);
 
+	if (gta04_gps->event_fd >= 0)
 		close(gta04_gps->event_fd);
-		gta04_gps->event_fd = -1;
-	}
+
+	if (gta04_gps->watchdog_fd >= 0)
+		close(gta04_gps->watchdog_fd);
+
+	if (gta04_gps->schedule_fd >= 0)
+		close(gta04_gps->schedule_fd);
+
+	if (gta04_gps->epoll_fd >= 0)
+		close(gta04_gps->epoll_fd);
 
 	if (gta04_gps != NULL) {
 		free(gta04_gps);
@@ -657,15 +1335,41 @@ void gta04_gps_cleanup(void)
 	if (gta04_gps == NULL)
 		return;
 
+	gta04_gps_cache_save();
+
+	// Nothing may be released while the thread can still use it
+	gta04_gps_thread_terminate();
+
+	pthread_cond_destroy(&gta04_gps->thread_cond);
 	pthread_mutex_destroy(&gta04_gps->mutex);
+	pthread_mutex_destroy(&gta04_gps->events_mutex);
 
 	if (gta04_gps->event_fd >= 0) {
-		gta04_gps_event_write(GTA04_GPS_EVENT_TERMINATE);
-
 		close(gta04_gps->event_fd);
 		gta04_gps->event_fd = -1;
 	}
 
+	if (gta04_gps->watchdog_fd >= 0) {
+		close(gta04_gps->watchdog_fd);
+		gta04_gps->watchdog_fd = -1;
+	}
+
+	if (gta04_gps->schedule_fd >= 0) {
+		close(gta04_gps->schedule_fd);
+		gta04_gps->schedule_fd = -1;
+	}
+
+	if (gta04_gps->epoll_fd >= 0) {
+		close(gta04_gps->epoll_fd);
+		gta04_gps->epoll_fd = -1;
+	}
+
+	if (gta04_gps->xtra_data != NULL)
+		free(gta04_gps->xtra_data);
+
+	if (gta04_gps->batch.locations != NULL)
+		free(gta04_gps->batch.locations);
+
 	free(gta04_gps);
 	gta04_gps = NULL;
 }
@@ -710,6 +1414,11 @@ int gta04_gps_inject_time(GpsUtcTime time, int64_t reference,
 	if (gta04_gps == NULL)
 		return -1;
 
+	pthread_mutex_lock(&gta04_gps->mutex);
+	gta04_gps->time_offset = time - reference;
+	gta04_gps->time_injected = 1;
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
 	rc = gta04_gps_event_write(GTA04_GPS_EVENT_INJECT_TIME);
 	if (rc < 0) {
 		ALOGE("Writing event failed");
@@ -721,6 +1430,7 @@ int gta04_gps_inject_time(GpsUtcTime time, int64_t reference,
 
 int gta04_gps_inject_location(double latitude, double longitude, float accuracy)
 {
+	GpsUtcTime time;
 	int rc;
 
 	ALOGD("%s(%f, %f, %f)", __func__, latitude, longitude, accuracy);
@@ -728,6 +1438,22 @@ int gta04_gps_inject_location(double latitude, double longitude, float accuracy)
 	if (gta04_gps == NULL)
 		return -1;
 
+	time = gta04_gps_time();
+
+	pthread_mutex_lock(&gta04_gps->mutex);
+
+	// Recent fixes from the receiver itself are more accurate
+	if (!(gta04_gps->cache.flags & GTA04_GPS_CACHE_HAS_LOCATION) || (time - gta04_gps->cache.location_timestamp) > GTA04_GPS_CACHE_LOCATION_AGE) {
+		gta04_gps->cache.latitude = latitude;
+		gta04_gps->cache.longitude = longitude;
+		gta04_gps->cache.altitude = 0;
+		gta04_gps->cache.accuracy = accuracy;
+		gta04_gps->cache.location_timestamp = time;
+		gta04_gps->cache.flags |= GTA04_GPS_CACHE_HAS_LOCATION;
+	}
+
+	pthread_mutex_unlock(&gta04_gps->mutex);
+
 	rc = gta04_gps_event_write(GTA04_GPS_EVENT_INJECT_LOCATION);
 	if (rc < 0) {
 		ALOGE("Writing event failed");
@@ -739,7 +1465,9 @@ int gta04_gps_inject_location(double latitude, double longitude, float accuracy)
 
 void gta04_gps_delete_aiding_data(GpsAidingData flags)
 {
-	return;
+	ALOGD("%s(0x%x)", __func__, flags);
+
+	gta04_gps_cache_delete(flags);
 }
 
 int gta04_gps_set_position_mode(GpsPositionMode mode,
@@ -753,8 +1481,11 @@ int gta04_gps_set_position_mode(GpsPositionMode mode,
 	if (gta04_gps == NULL)
 		return -1;
 
-	gta04_gps->recurrence = recurrence;
-	gta04_gps->interval = interval;
+	pthread_mutex_lock(&gta04_gps->mutex);
+	gta04_gps->position_recurrence = recurrence;
+	gta04_gps->position_interval = interval;
+	gta04_gps_position_mode_update();
+	pthread_mutex_unlock(&gta04_gps->mutex);
 
 	rc = gta04_gps_event_write(GTA04_GPS_EVENT_SET_POSITION_MODE);
 	if (rc < 0) {
@@ -769,6 +1500,14 @@ const void *gta04_gps_get_extension(const char *name)
 {
 	ALOGD("%s(%s)", __func__, name);
 
+	if (name == NULL)
+		return NULL;
+
+	if (strcmp(name, GPS_XTRA_INTERFACE) == 0)
+		return &gta04_gps_xtra_interface;
+	else if (strcmp(name, GTA04_GPS_BATCHING_INTERFACE) == 0)
+		return &gta04_gps_batching_interface;
+
 	return NULL;
 }
 
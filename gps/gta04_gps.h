@@ -16,20 +16,96 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <termios.h>
 #include <sys/eventfd.h>
 
+#include <cutils/properties.h>
 #include <hardware/gps.h>
 
 #ifndef _GTA04_GPS_H_
 #define _GTA04_GPS_H_
 
+#define GTA04_GPS_EVENTS_COUNT			16
+#define GTA04_GPS_SERIAL_BUFFER_LENGTH		256
+
 /*
  * Structures
  */
 
+struct gta04_gps_cache {
+	uint32_t magic;
+	uint32_t flags;
+
+	double latitude;
+	double longitude;
+	double altitude;
+	float accuracy;
+	GpsUtcTime location_timestamp;
+
+	GpsUtcTime xtra_timestamp;
+	uint32_t xtra_length;
+} __attribute__((__packed__));
+
+typedef void (*gta04_gps_batch_location)(int count, GpsLocation **locations);
+
+struct gta04_gps_batching_callbacks {
+	size_t size;
+	gta04_gps_batch_location location_cb;
+};
+
+struct gta04_gps_batch_options {
+	int64_t period_ns;
+	uint32_t flags;
+	size_t max_memory;
+};
+
+struct gta04_gps_batch_stats {
+	uint32_t fixes;
+	uint32_t bursts;
+	uint32_t dropped;
+	uint32_t wakeups_avoided;
+};
+
+struct gta04_gps_batching_interface {
+	size_t size;
+	int (*init)(struct gta04_gps_batching_callbacks *callbacks);
+	int (*get_batch_size)(void);
+	int (*start_batching)(struct gta04_gps_batch_options *options);
+	int (*stop_batching)(void);
+	void (*get_batched_location)(int count);
+	void (*get_stats)(struct gta04_gps_batch_stats *stats);
+};
+
+struct gta04_gps_batch {
+	unsigned char enabled;
+	uint32_t flags;
+	GpsUtcTime period;
+	GpsUtcTime timestamp;
+
+	GpsLocation *locations;
+	int capacity;
+	int count;
+	int index;
+	int flush;
+
+	struct gta04_gps_batch_stats stats;
+};
+
+struct gta04_gps_duty_cycle {
+	unsigned char sleeping;
+	int64_t wake;
+	int64_t power_on;
+
+	int64_t on_time;
+	int64_t on_time_total;
+	uint32_t fixes;
+};
+
 struct gta04_gps {
 	GpsCallbacks *callbacks;
+	GpsXtraCallbacks *xtra_callbacks;
+	struct gta04_gps_batching_callbacks *batching_callbacks;
 
 	GpsLocation location;
 	GpsStatus status;
@@ -43,20 +119,88 @@ struct gta04_gps {
 	int month;
 	int day;
 
+	// Framework and batching are separate clients of the receiver, their
+	// sessions are changed by the thread, in the order of the events
+	unsigned char started;
+	GpsPositionRecurrence position_recurrence;
+	uint32_t position_interval;
+
+	// Mode the receiver runs with, serving both clients
 	GpsPositionRecurrence recurrence;
 	uint32_t interval;
 
+	struct gta04_gps_cache cache;
+	void *xtra_data;
+
+	int64_t time_offset;
+	unsigned char time_injected;
+
+	struct gta04_gps_batch batch;
+	struct gta04_gps_duty_cycle duty_cycle;
+
 	pthread_mutex_t mutex;
 	pthread_t thread;
+	pthread_cond_t thread_cond;
+	unsigned char thread_running;
+
+	int events[GTA04_GPS_EVENTS_COUNT];
+	int events_index;
+	int events_count;
+	pthread_mutex_t events_mutex;
+
+	char serial_path[PROPERTY_VALUE_MAX];
+	char rfkill_path[PROPERTY_VALUE_MAX];
+	char antenna_state_path[PROPERTY_VALUE_MAX];
+	char cache_path[PROPERTY_VALUE_MAX];
 
 	int serial_fd;
+	char serial_buffer[GTA04_GPS_SERIAL_BUFFER_LENGTH];
+	size_t serial_length;
+
+	int epoll_fd;
 	int event_fd;
+	int watchdog_fd;
+	int schedule_fd;
 };
 
 /*
  * Values
  */
 
+// Properties overriding the default paths, to run without the actual device
+#define GTA04_GPS_PROPERTY_SERIAL_PATH		"gta04.gps.serial_path"
+#define GTA04_GPS_PROPERTY_RFKILL_PATH		"gta04.gps.rfkill_path"
+#define GTA04_GPS_PROPERTY_ANTENNA_PATH		"gta04.gps.antenna_path"
+#define GTA04_GPS_PROPERTY_CACHE_PATH		"gta04.gps.cache_path"
+
+#define GTA04_GPS_CACHE_MAGIC			0x34304743
+#define GTA04_GPS_CACHE_HAS_LOCATION		(1 << 0)
+#define GTA04_GPS_CACHE_HAS_XTRA		(1 << 1)
+
+// Injected locations replace cached fixes older than an hour
+#define GTA04_GPS_CACHE_LOCATION_AGE		(60 * 60 * 1000)
+// XTRA data is valid for a week, refresh it every day
+#define GTA04_GPS_XTRA_AGE			(24 * 60 * 60 * 1000)
+#define GTA04_GPS_XTRA_LENGTH_MAX		(128 * 1024)
+
+// Modelled after the FLP batching API
+#define GTA04_GPS_BATCHING_INTERFACE		"gta04-gps-batching"
+#define GTA04_GPS_BATCH_WAKEUP_ON_FIFO_FULL	(1 << 0)
+#define GTA04_GPS_BATCH_MEMORY			(16 * 1024)
+#define GTA04_GPS_BATCH_COUNT_MAX		1024
+
+// Receiver is powered off between fixes for intervals of at least 30 s
+#define GTA04_GPS_DUTY_CYCLE_INTERVAL		30000
+#define GTA04_GPS_DUTY_CYCLE_OFF_MIN		10000
+#define GTA04_GPS_DUTY_CYCLE_MARGIN		2000
+
+// Serial is restarted when nothing was received for 2 s
+#define GTA04_GPS_WATCHDOG_TIMEOUT		2000
+
+// Seconds between UTC and GPS time, as of 2017
+#define GTA04_GPS_LEAP_SECONDS			18
+#define GTA04_GPS_EPOCH				315964800
+
 enum {
 	GTA04_GPS_EVENT_NONE,
 	GTA04_GPS_EVENT_TERMINATE,
@@ -66,6 +210,10 @@ enum {
 	GTA04_GPS_EVENT_INJECT_TIME,
 	GTA04_GPS_EVENT_INJECT_LOCATION,
 	GTA04_GPS_EVENT_SET_POSITION_MODE,
+	GTA04_GPS_EVENT_FLUSH,
+	GTA04_GPS_EVENT_SLEEP,
+	GTA04_GPS_EVENT_START_BATCHING,
+	GTA04_GPS_EVENT_STOP_BATCHING,
 };
 
 /*
@@ -74,12 +222,16 @@ enum {
 
 extern const char antenna_state_path[];
 extern const char serial_path[];
+extern const char rfkill_path[];
+extern const char cache_path[];
 extern const speed_t serial_speed;
 
 extern const int channel_count;
 
 extern struct gta04_gps *gta04_gps;
 
+extern const struct gta04_gps_batching_interface gta04_gps_batching_interface;
+
 /*
  * Declarations
  */
@@ -92,14 +244,50 @@ void gta04_gps_sv_status_callback(void);
 void gta04_gps_set_capabilities_callback(void);
 void gta04_gps_acquire_wakelock_callback(void);
 void gta04_gps_release_wakelock_callback(void);
+void gta04_gps_xtra_download_request_callback(void);
+void gta04_gps_batch_location_callback(int count, GpsLocation **locations);
 
 int gta04_gps_serial_open(void);
 int gta04_gps_serial_close(void);
 int gta04_gps_serial_read(void *buffer, size_t length);
 int gta04_gps_serial_write(void *buffer, size_t length);
 
-int gta04_gps_event_read(eventfd_t *event);
-int gta04_gps_event_write(eventfd_t event);
+int gta04_gps_event_read(int *event);
+int gta04_gps_event_write(int event);
+
+int gta04_gps_timer_set(int fd, int64_t delay);
+
+int gta04_gps_paths_setup(void);
+
+void gta04_gps_position_mode_update(void);
+int gta04_gps_position_mode_apply(void);
+
+GpsUtcTime gta04_gps_time(void);
+int64_t gta04_gps_boottime(void);
+
+int gta04_gps_power_on(void);
+int gta04_gps_power_off(void);
+
+int gta04_gps_duty_cycle_enabled(void);
+int gta04_gps_duty_cycle_schedule(void);
+int gta04_gps_duty_cycle_sleep(void);
+int gta04_gps_duty_cycle_wake(void);
+
+// Cache
+
+int gta04_gps_cache_load(void);
+int gta04_gps_cache_save(void);
+int gta04_gps_cache_location(double latitude, double longitude,
+	double altitude, float accuracy, GpsUtcTime timestamp);
+int gta04_gps_cache_xtra(char *data, size_t length);
+int gta04_gps_cache_delete(GpsAidingData flags);
+int gta04_gps_cache_inject(void);
+
+// Batching
+
+int gta04_gps_batch_add(void);
+int gta04_gps_batch_deliver(int count);
+void gta04_gps_batch_release(void);
 
 // NMEA
 
@@ -120,5 +308,7 @@ int gta04_gps_nmea_gpgsv(char *nmea);
 int gta04_gps_nmea_gprmc(char *nmea);
 
 int gta04_gps_nmea_psrf103(unsigned char message, int interval);
+int gta04_gps_nmea_psrf104(double latitude, double longitude, double altitude,
+	GpsUtcTime time, unsigned char reset);
 
 #endif
@@ -81,7 +81,8 @@ char *gta04_gps_nmea_extract(char *buffer, size_t length)
 			end = &buffer[c];
 	}
 
-	if (start == NULL || end == NULL || start == end)
+	// The end may belong to a previous, truncated sentence
+	if (start == NULL || end == NULL || end <= start)
 		goto error;
 
 	*end++ = '\0';
@@ -558,7 +559,46 @@ int gta04_gps_nmea_psrf103(unsigned char message, int interval)
 		return -1;
 	}
 
-	rc = gta04_gps_serial_write(&buffer, strlen(buffer) + 1);
+	rc = gta04_gps_serial_write(buffer, strlen(buffer));
+	if (rc < 0) {
+		ALOGE("Writing to serial failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int gta04_gps_nmea_psrf104(double latitude, double longitude, double altitude,
+	GpsUtcTime time, unsigned char reset)
+{
+	char nmea[74] = { 0 };
+	char *buffer;
+	int64_t seconds;
+	int week;
+	int tow;
+	int rc;
+
+	if (gta04_gps == NULL)
+		return -1;
+
+	// GPS time is expressed as weeks and seconds of week since its epoch
+	seconds = time / 1000 - GTA04_GPS_EPOCH + GTA04_GPS_LEAP_SECONDS;
+	if (seconds < 0)
+		return -1;
+
+	week = (int) (seconds / (7 * 24 * 60 * 60));
+	tow = (int) (seconds % (7 * 24 * 60 * 60));
+
+	// Clock offset of 0 keeps the last value known to the receiver
+	snprintf((char *) &nmea, sizeof(nmea), "PSRF104,%.6f,%.6f,%d,0,%d,%d,%d,%d", latitude, longitude, (int) altitude, tow, week, channel_count, reset);
+
+	buffer = gta04_gps_nmea_prepare(nmea);
+	if (buffer == NULL) {
+		ALOGE("Preparing NMEA failed");
+		return -1;
+	}
+
+	rc = gta04_gps_serial_write(buffer, strlen(buffer));
 	if (rc < 0) {
 		ALOGE("Writing to serial failed");
 		return -1;
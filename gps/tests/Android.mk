@@ -0,0 +1,55 @@
+# Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Host tests, running the HAL against a pty and files standing in for the
+# receiver, through the gta04.gps.* path properties:
+#   make gta04_gps_events_test && gta04_gps_events_test
+#   make gta04_gps_replay && gta04_gps_replay -s 10 drive.nmea
+
+LOCAL_PATH:= $(call my-dir)
+
+gta04_gps_test_src_files := \
+	fake.c \
+	../gta04_gps.c \
+	../nmea.c \
+	../cache.c \
+	../batching.c
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := events.c $(gta04_gps_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+# Properties are provided by fake.c instead of libcutils
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lutil -lrt -lm
+
+LOCAL_MODULE := gta04_gps_events_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := replay.c $(gta04_gps_test_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lutil -lrt -lm
+
+LOCAL_MODULE := gta04_gps_replay
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
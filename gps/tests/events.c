@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <hardware/gps.h>
+
+#include "gta04_gps.h"
+#include "fake.h"
+
+/*
+ * Event loop test: drives the HAL thread against a pty receiver, with
+ * commands posted back to back, the no-data watchdog, batching alongside the
+ * framework's session and cleanup while the thread is busy.
+ */
+
+#define GPRMC	"GPRMC,%02d%02d%02d.000,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W"
+
+static int failures;
+
+#define check(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: %s failed\n", __func__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static void send_fixes(struct gta04_gps_fake *fake, int first, int count)
+{
+	char sentence[100];
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		snprintf(sentence, sizeof(sentence), GPRMC, 12, i / 60, i % 60);
+		gta04_gps_fake_nmea(fake, sentence);
+		usleep(20000);
+	}
+}
+
+static int setup(struct gta04_gps_fake *fake)
+{
+	int rc;
+
+	rc = gta04_gps_fake_open(fake);
+	if (rc < 0)
+		return -1;
+
+	gta04_gps_record_reset();
+
+	rc = gta04_gps_interface.init(&gta04_gps_record_callbacks);
+	if (rc < 0) {
+		gta04_gps_fake_close(fake);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void teardown(struct gta04_gps_fake *fake)
+{
+	gta04_gps_interface.cleanup();
+
+	// Cleanup only returns once the thread is done with the HAL state
+	gta04_gps_record_join();
+
+	gta04_gps_fake_close(fake);
+}
+
+/*
+ * Position mode and start are posted without waiting: they used to be
+ * summed into a single eventfd value.
+ */
+static void test_start(void)
+{
+	struct gta04_gps_fake fake;
+	char buffer[256];
+
+	if (setup(&fake) < 0) {
+		failures++;
+		return;
+	}
+
+	// Init reports the engine as off
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_OFF] == 1);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 1);
+
+	gta04_gps_interface.set_position_mode(GPS_POSITION_MODE_STANDALONE, GPS_POSITION_RECURRENCE_PERIODIC, 1000, 0, 0);
+	gta04_gps_interface.start();
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 1, 1000) == 0);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 0);
+
+	send_fixes(&fake, 0, 5);
+
+	check(gta04_gps_record_wait_locations(5, 1000) == 0);
+	check(gta04_gps_record.status[GPS_STATUS_SESSION_BEGIN] == 1);
+
+	// Location messages every second
+	gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 100);
+	check(strstr(buffer, "$PSRF103,04,00,01,01*") != NULL);
+
+	gta04_gps_interface.stop();
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 2, 1000) == 0);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 1);
+
+	teardown(&fake);
+}
+
+/*
+ * Back to back start and stop requests, handled in order.
+ */
+static void test_start_stop(void)
+{
+	struct gta04_gps_fake fake;
+	int i;
+
+	if (setup(&fake) < 0) {
+		failures++;
+		return;
+	}
+
+	gta04_gps_interface.start();
+	gta04_gps_interface.stop();
+	gta04_gps_interface.start();
+
+	for (i = 0; i < 5; i++) {
+		gta04_gps_interface.stop();
+		gta04_gps_interface.start();
+	}
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 7, 2000) == 0);
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 7, 2000) == 0);
+
+	// The last request wins
+	usleep(100000);
+	check(gta04_gps_record.last_status == GPS_STATUS_ENGINE_ON);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 0);
+
+	send_fixes(&fake, 0, 3);
+	check(gta04_gps_record_wait_locations(3, 1000) == 0);
+
+	gta04_gps_interface.stop();
+	gta04_gps_interface.stop();
+
+	// The second one has nothing to stop
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 8, 1000) == 0);
+	usleep(100000);
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_OFF] == 8);
+
+	teardown(&fake);
+}
+
+/*
+ * Nothing received after powering on restarts the serial.
+ */
+static void test_watchdog(void)
+{
+	struct gta04_gps_fake fake;
+
+	if (setup(&fake) < 0) {
+		failures++;
+		return;
+	}
+
+	gta04_gps_interface.start();
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 1, 1000) == 0);
+
+	usleep((GTA04_GPS_WATCHDOG_TIMEOUT - 500) * 1000);
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_ON] == 1);
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 2, 1000) == 0);
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_OFF] == 2);
+
+	// Talking keeps the watchdog quiet
+	send_fixes(&fake, 0, 3);
+	check(gta04_gps_record_wait_locations(3, 1000) == 0);
+
+	gta04_gps_interface.stop();
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 3, 1000) == 0);
+
+	teardown(&fake);
+}
+
+/*
+ * Cleanup right after requests, while the thread is still handling them.
+ */
+static void test_cleanup(void)
+{
+	struct gta04_gps_fake fake;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		if (setup(&fake) < 0) {
+			failures++;
+			return;
+		}
+
+		gta04_gps_interface.start();
+		if (i % 2)
+			gta04_gps_interface.stop();
+
+		teardown(&fake);
+	}
+}
+
+static int batched;
+
+static void batch_location(int count, GpsLocation **locations)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	batched += count;
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static int batched_count(void)
+{
+	int count;
+
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	count = batched;
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+
+	return count;
+}
+
+static struct gta04_gps_batching_callbacks batching_callbacks = {
+	.size = sizeof(struct gta04_gps_batching_callbacks),
+	.location_cb = batch_location,
+};
+
+/*
+ * Batching and the framework are separate clients: neither takes the other's
+ * fixes, mode or session over.
+ */
+static void test_batching(void)
+{
+	struct gta04_gps_batch_options options;
+	struct gta04_gps_fake fake;
+	char buffer[256];
+
+	if (setup(&fake) < 0) {
+		failures++;
+		return;
+	}
+
+	batched = 0;
+	gta04_gps_batching_interface.init(&batching_callbacks);
+
+	memset(&options, 0, sizeof(options));
+	options.period_ns = 5000000000LL;
+
+	// Framework session first, batching on top of it
+	gta04_gps_interface.set_position_mode(GPS_POSITION_MODE_STANDALONE, GPS_POSITION_RECURRENCE_PERIODIC, 1000, 0, 0);
+	gta04_gps_interface.start();
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 1, 1000) == 0);
+
+	send_fixes(&fake, 0, 2);
+	check(gta04_gps_record_wait_locations(2, 1000) == 0);
+
+	gta04_gps_batching_interface.start_batching(&options);
+
+	send_fixes(&fake, 2, 3);
+	check(gta04_gps_record_wait_locations(5, 1000) == 0);
+
+	// The framework's interval is the shorter one
+	gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 100);
+	check(strstr(buffer, "$PSRF103,04,00,05,01*") == NULL);
+
+	gta04_gps_batching_interface.stop_batching();
+
+	// Only the fix of the batching period is kept, delivered when stopping
+	usleep(100000);
+	check(batched_count() == 1);
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_OFF] == 1);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 0);
+
+	send_fixes(&fake, 5, 2);
+	check(gta04_gps_record_wait_locations(7, 1000) == 0);
+
+	gta04_gps_interface.stop();
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 2, 1000) == 0);
+
+	// Batching first, the framework's session on top of it
+	batched = 0;
+	gta04_gps_batching_interface.start_batching(&options);
+
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 2, 1000) == 0);
+
+	send_fixes(&fake, 10, 2);
+
+	gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 100);
+	check(strstr(buffer, "$PSRF103,04,00,05,01*") != NULL);
+
+	// No fixes for the framework while it is off
+	usleep(100000);
+	check(gta04_gps_record.locations == 7);
+
+	gta04_gps_interface.start();
+	usleep(100000);
+
+	gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 100);
+	check(strstr(buffer, "$PSRF103,04,00,01,01*") != NULL);
+
+	send_fixes(&fake, 12, 2);
+	check(gta04_gps_record_wait_locations(9, 1000) == 0);
+
+	gta04_gps_interface.stop();
+
+	// Batching keeps the receiver on, back to its own interval
+	usleep(100000);
+	check(gta04_gps_record.status[GPS_STATUS_ENGINE_OFF] == 2);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 0);
+
+	gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 100);
+	check(strstr(buffer, "$PSRF103,04,00,05,01*") != NULL);
+
+	send_fixes(&fake, 14, 2);
+	usleep(100000);
+	check(gta04_gps_record.locations == 9);
+
+	gta04_gps_batching_interface.stop_batching();
+	check(gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 3, 1000) == 0);
+	check(gta04_gps_fake_rfkill_soft(&fake) == 1);
+	check(batched_count() == 2);
+
+	teardown(&fake);
+}
+
+int main(int argc, char *argv[])
+{
+	test_start();
+	test_start_stop();
+	test_watchdog();
+	test_batching();
+	test_cleanup();
+
+	if (failures > 0) {
+		printf("FAIL: %d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
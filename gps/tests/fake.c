@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include <cutils/properties.h>
+#include <hardware/gps.h>
+
+#include "gta04_gps.h"
+#include "rfkill.h"
+#include "fake.h"
+
+/*
+ * Properties
+ *
+ * The HAL reads its paths with property_get(), which is provided here instead
+ * of libcutils, so that they point to the stand-ins.
+ */
+
+struct gta04_gps_fake_property {
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+};
+
+static struct gta04_gps_fake_property gta04_gps_fake_properties[GTA04_GPS_FAKE_PROPERTIES_COUNT];
+
+void gta04_gps_fake_property_set(const char *key, const char *value)
+{
+	int i;
+
+	for (i = 0; i < GTA04_GPS_FAKE_PROPERTIES_COUNT; i++) {
+		if (gta04_gps_fake_properties[i].key[0] == '\0' || strcmp(gta04_gps_fake_properties[i].key, key) == 0)
+			break;
+	}
+
+	if (i == GTA04_GPS_FAKE_PROPERTIES_COUNT)
+		return;
+
+	strncpy(gta04_gps_fake_properties[i].key, key, PROPERTY_KEY_MAX - 1);
+	strncpy(gta04_gps_fake_properties[i].value, value, PROPERTY_VALUE_MAX - 1);
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+	const char *result = default_value;
+	int i;
+
+	for (i = 0; i < GTA04_GPS_FAKE_PROPERTIES_COUNT; i++) {
+		if (strcmp(gta04_gps_fake_properties[i].key, key) == 0) {
+			result = gta04_gps_fake_properties[i].value;
+			break;
+		}
+	}
+
+	if (result == NULL)
+		result = "";
+
+	strncpy(value, result, PROPERTY_VALUE_MAX - 1);
+	value[PROPERTY_VALUE_MAX - 1] = '\0';
+
+	return strlen(value);
+}
+
+/*
+ * Receiver
+ */
+
+int64_t gta04_gps_fake_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int gta04_gps_fake_open(struct gta04_gps_fake *fake)
+{
+	struct termios termios;
+	char name[PATH_MAX];
+	int fd;
+	int rc;
+
+	if (fake == NULL)
+		return -1;
+
+	memset(fake, 0, sizeof(struct gta04_gps_fake));
+	fake->master_fd = -1;
+	fake->slave_fd = -1;
+
+	strcpy(fake->directory, "/tmp/gta04-gps-XXXXXX");
+	if (mkdtemp(fake->directory) == NULL) {
+		fprintf(stderr, "Creating directory failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// The slave stays open on our side too, so that the HAL closing it does not hang up the master
+	rc = openpty(&fake->master_fd, &fake->slave_fd, name, NULL, NULL);
+	if (rc < 0) {
+		fprintf(stderr, "Opening pty failed: %s\n", strerror(errno));
+		goto error;
+	}
+
+	tcgetattr(fake->slave_fd, &termios);
+	cfmakeraw(&termios);
+	tcsetattr(fake->slave_fd, TCSANOW, &termios);
+
+	snprintf(fake->serial_path, sizeof(fake->serial_path), "%s", name);
+	snprintf(fake->rfkill_path, sizeof(fake->rfkill_path), "%s/rfkill", fake->directory);
+	snprintf(fake->antenna_path, sizeof(fake->antenna_path), "%s/antenna", fake->directory);
+	snprintf(fake->cache_path, sizeof(fake->cache_path), "%s/cache", fake->directory);
+
+	fd = open(fake->rfkill_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto error;
+	close(fd);
+
+	fd = open(fake->antenna_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto error;
+	write(fd, "external", 8);
+	close(fd);
+
+	gta04_gps_fake_property_set(GTA04_GPS_PROPERTY_SERIAL_PATH, fake->serial_path);
+	gta04_gps_fake_property_set(GTA04_GPS_PROPERTY_RFKILL_PATH, fake->rfkill_path);
+	gta04_gps_fake_property_set(GTA04_GPS_PROPERTY_ANTENNA_PATH, fake->antenna_path);
+	gta04_gps_fake_property_set(GTA04_GPS_PROPERTY_CACHE_PATH, fake->cache_path);
+
+	return 0;
+
+error:
+	gta04_gps_fake_close(fake);
+
+	return -1;
+}
+
+void gta04_gps_fake_close(struct gta04_gps_fake *fake)
+{
+	if (fake == NULL)
+		return;
+
+	if (fake->master_fd >= 0)
+		close(fake->master_fd);
+
+	if (fake->slave_fd >= 0)
+		close(fake->slave_fd);
+
+	fake->master_fd = -1;
+	fake->slave_fd = -1;
+
+	if (fake->directory[0] == '\0')
+		return;
+
+	unlink(fake->rfkill_path);
+	unlink(fake->antenna_path);
+	unlink(fake->cache_path);
+	rmdir(fake->directory);
+}
+
+/*
+ * The HAL writes one rfkill event to the node each time it opens it, so the
+ * file holds the last one.
+ */
+int gta04_gps_fake_rfkill_soft(struct gta04_gps_fake *fake)
+{
+	struct rfkill_event event;
+	int fd;
+	int rc;
+
+	fd = open(fake->rfkill_path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	rc = read(fd, &event, sizeof(event));
+	close(fd);
+
+	if (rc < (int) sizeof(event) || event.type != RFKILL_TYPE_GPS)
+		return -1;
+
+	return event.soft;
+}
+
+int gta04_gps_fake_nmea(struct gta04_gps_fake *fake, const char *sentence)
+{
+	char buffer[128];
+	unsigned char checksum = 0;
+	const char *p;
+	int length;
+	int rc;
+
+	for (p = sentence; *p != '\0'; p++)
+		checksum ^= (unsigned char) *p;
+
+	length = snprintf(buffer, sizeof(buffer), "$%s*%02X\r\n", sentence, checksum);
+	if (length >= (int) sizeof(buffer))
+		return -1;
+
+	rc = write(fake->master_fd, buffer, length);
+	if (rc < length)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Reads what the HAL sent to the receiver, waiting up to timeout ms for it.
+ */
+int gta04_gps_fake_receive(struct gta04_gps_fake *fake, char *buffer,
+	size_t length, int timeout)
+{
+	struct pollfd pfd;
+	size_t count = 0;
+	int rc;
+
+	pfd.fd = fake->master_fd;
+	pfd.events = POLLIN;
+
+	while (count < length - 1) {
+		rc = poll(&pfd, 1, count > 0 ? 10 : timeout);
+		if (rc <= 0)
+			break;
+
+		rc = read(fake->master_fd, buffer + count, length - 1 - count);
+		if (rc <= 0)
+			break;
+
+		count += rc;
+	}
+
+	buffer[count] = '\0';
+
+	return (int) count;
+}
+
+/*
+ * Callbacks
+ */
+
+struct gta04_gps_record gta04_gps_record;
+
+struct gta04_gps_record_thread {
+	void (*start)(void *);
+	void *data;
+};
+
+// Called with the record mutex held
+static void gta04_gps_record_log(const char *format, ...)
+{
+	va_list ap;
+	int64_t time;
+
+	if (gta04_gps_record.output == NULL)
+		return;
+
+	time = (gta04_gps_fake_time() - gta04_gps_record.start) / 1000;
+
+	fprintf(gta04_gps_record.output, "%lld.%06lld ", (long long int) (time / 1000000), (long long int) (time % 1000000));
+
+	va_start(ap, format);
+	vfprintf(gta04_gps_record.output, format, ap);
+	va_end(ap);
+
+	fputc('\n', gta04_gps_record.output);
+}
+
+static void gta04_gps_record_location(GpsLocation *location)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+
+	if (gta04_gps_record.locations > 0 && location->timestamp <= gta04_gps_record.location.timestamp)
+		gta04_gps_record.non_monotonic++;
+
+	memcpy(&gta04_gps_record.location, location, sizeof(GpsLocation));
+	gta04_gps_record.locations++;
+
+	gta04_gps_record_log("location 0x%x %.6f %.6f %.1f %.1f %.1f %.1f %lld", location->flags, location->latitude, location->longitude, location->altitude, location->speed, location->bearing, location->accuracy, (long long int) location->timestamp);
+
+	pthread_cond_broadcast(&gta04_gps_record.cond);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_status(GpsStatus *status)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+
+	if (status->status < GTA04_GPS_FAKE_STATUS_COUNT)
+		gta04_gps_record.status[status->status]++;
+	gta04_gps_record.last_status = status->status;
+	gta04_gps_record.statuses++;
+
+	gta04_gps_record_log("status %d", status->status);
+
+	pthread_cond_broadcast(&gta04_gps_record.cond);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_sv_status(GpsSvStatus *sv_status)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.sv_statuses++;
+	gta04_gps_record_log("sv_status %d 0x%08x", sv_status->num_svs, sv_status->used_in_fix_mask);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_nmea(GpsUtcTime timestamp, const char *nmea,
+	int length)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.nmeas++;
+	gta04_gps_record_log("nmea %lld %.*s", (long long int) timestamp, length, nmea);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_set_capabilities(uint32_t capabilities)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.capabilities++;
+	gta04_gps_record_log("set_capabilities 0x%x", capabilities);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_acquire_wakelock(void)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.wakelocks_acquired++;
+	gta04_gps_record_log("acquire_wakelock");
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void gta04_gps_record_release_wakelock(void)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.wakelocks_released++;
+	gta04_gps_record_log("release_wakelock");
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+static void *gta04_gps_record_thread_start(void *data)
+{
+	struct gta04_gps_record_thread thread;
+
+	memcpy(&thread, data, sizeof(thread));
+	free(data);
+
+	thread.start(thread.data);
+
+	return NULL;
+}
+
+/*
+ * Unlike the framework, threads are left joinable, to check that they are
+ * done once the HAL is cleaned up.
+ */
+static pthread_t gta04_gps_record_create_thread(const char *name,
+	void (*start)(void *), void *data)
+{
+	struct gta04_gps_record_thread *thread;
+	pthread_t pthread;
+	int rc;
+
+	thread = (struct gta04_gps_record_thread *) calloc(1, sizeof(struct gta04_gps_record_thread));
+	if (thread == NULL)
+		return 0;
+
+	thread->start = start;
+	thread->data = data;
+
+	rc = pthread_create(&pthread, NULL, gta04_gps_record_thread_start, thread);
+	if (rc != 0) {
+		free(thread);
+		return 0;
+	}
+
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.thread = pthread;
+	gta04_gps_record.threads++;
+	gta04_gps_record_log("create_thread %s", name);
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+
+	return pthread;
+}
+
+static void gta04_gps_record_request_utc_time(void)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record_log("request_utc_time");
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+GpsCallbacks gta04_gps_record_callbacks = {
+	.size = sizeof(GpsCallbacks),
+	.location_cb = gta04_gps_record_location,
+	.status_cb = gta04_gps_record_status,
+	.sv_status_cb = gta04_gps_record_sv_status,
+	.nmea_cb = gta04_gps_record_nmea,
+	.set_capabilities_cb = gta04_gps_record_set_capabilities,
+	.acquire_wakelock_cb = gta04_gps_record_acquire_wakelock,
+	.release_wakelock_cb = gta04_gps_record_release_wakelock,
+	.create_thread_cb = gta04_gps_record_create_thread,
+	.request_utc_time_cb = gta04_gps_record_request_utc_time,
+};
+
+void gta04_gps_record_reset(void)
+{
+	static int initialized = 0;
+
+	if (!initialized) {
+		pthread_mutex_init(&gta04_gps_record.mutex, NULL);
+		pthread_cond_init(&gta04_gps_record.cond, NULL);
+		initialized = 1;
+	}
+
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.locations = 0;
+	gta04_gps_record.statuses = 0;
+	gta04_gps_record.sv_statuses = 0;
+	gta04_gps_record.nmeas = 0;
+	gta04_gps_record.capabilities = 0;
+	gta04_gps_record.wakelocks_acquired = 0;
+	gta04_gps_record.wakelocks_released = 0;
+	gta04_gps_record.threads = 0;
+	memset(gta04_gps_record.status, 0, sizeof(gta04_gps_record.status));
+	gta04_gps_record.last_status = GPS_STATUS_NONE;
+	memset(&gta04_gps_record.location, 0, sizeof(GpsLocation));
+	gta04_gps_record.non_monotonic = 0;
+	gta04_gps_record.start = gta04_gps_fake_time();
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+void gta04_gps_record_output(FILE *output)
+{
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+	gta04_gps_record.output = output;
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+}
+
+void gta04_gps_record_join(void)
+{
+	if (gta04_gps_record.threads == 0)
+		return;
+
+	pthread_join(gta04_gps_record.thread, NULL);
+	gta04_gps_record.threads = 0;
+}
+
+static int gta04_gps_record_wait(int *value, int count, int timeout)
+{
+	struct timespec ts;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&gta04_gps_record.mutex);
+
+	while (*value < count && rc == 0)
+		rc = pthread_cond_timedwait(&gta04_gps_record.cond, &gta04_gps_record.mutex, &ts);
+
+	rc = *value >= count ? 0 : -1;
+
+	pthread_mutex_unlock(&gta04_gps_record.mutex);
+
+	return rc;
+}
+
+int gta04_gps_record_wait_status(GpsStatusValue status, int count, int timeout)
+{
+	if (status >= GTA04_GPS_FAKE_STATUS_COUNT)
+		return -1;
+
+	return gta04_gps_record_wait(&gta04_gps_record.status[status], count, timeout);
+}
+
+int gta04_gps_record_wait_locations(int count, int timeout)
+{
+	return gta04_gps_record_wait(&gta04_gps_record.locations, count, timeout);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <hardware/gps.h>
+
+#ifndef _GTA04_GPS_FAKE_H_
+#define _GTA04_GPS_FAKE_H_
+
+#define GTA04_GPS_FAKE_PROPERTIES_COUNT		8
+#define GTA04_GPS_FAKE_STATUS_COUNT		8
+
+/*
+ * Structures
+ */
+
+// Receiver stand-in: a pty for the serial and plain files for the rest
+struct gta04_gps_fake {
+	char directory[64];
+	char serial_path[PATH_MAX];
+	char rfkill_path[PATH_MAX];
+	char antenna_path[PATH_MAX];
+	char cache_path[PATH_MAX];
+
+	int master_fd;
+	int slave_fd;
+};
+
+// Every GpsCallbacks invocation, as seen by the framework
+struct gta04_gps_record {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	int locations;
+	int statuses;
+	int sv_statuses;
+	int nmeas;
+	int capabilities;
+	int wakelocks_acquired;
+	int wakelocks_released;
+	int threads;
+
+	// Number of reports for each status value
+	int status[GTA04_GPS_FAKE_STATUS_COUNT];
+	GpsStatusValue last_status;
+	GpsLocation location;
+	int non_monotonic;
+
+	pthread_t thread;
+
+	// Optional log of the invocations, timed from the last reset
+	FILE *output;
+	int64_t start;
+};
+
+/*
+ * Globals
+ */
+
+extern const GpsInterface gta04_gps_interface;
+
+extern struct gta04_gps_record gta04_gps_record;
+extern GpsCallbacks gta04_gps_record_callbacks;
+
+/*
+ * Declarations
+ */
+
+int gta04_gps_fake_open(struct gta04_gps_fake *fake);
+void gta04_gps_fake_close(struct gta04_gps_fake *fake);
+int gta04_gps_fake_rfkill_soft(struct gta04_gps_fake *fake);
+int gta04_gps_fake_nmea(struct gta04_gps_fake *fake, const char *sentence);
+int gta04_gps_fake_receive(struct gta04_gps_fake *fake, char *buffer,
+	size_t length, int timeout);
+
+void gta04_gps_fake_property_set(const char *key, const char *value);
+
+void gta04_gps_record_reset(void);
+void gta04_gps_record_output(FILE *output);
+void gta04_gps_record_join(void);
+int gta04_gps_record_wait_status(GpsStatusValue status, int count, int timeout);
+int gta04_gps_record_wait_locations(int count, int timeout);
+
+int64_t gta04_gps_fake_time(void);
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <hardware/gps.h>
+
+#include "gta04_gps.h"
+#include "fake.h"
+
+/*
+ * NMEA replay: feeds a log to the HAL through the pty, at the pace the
+ * receiver would send it (each second of data is sent at the UART rate, from
+ * the start of that second) or faster, records every callback and reports the
+ * fixes and the CPU time of the HAL thread.
+ *
+ * Usage: gta04_gps_replay [-s speed] [-b baud] [-o record] log.nmea
+ */
+
+#define GTA04_GPS_REPLAY_BAUD		9600
+#define GTA04_GPS_REPLAY_TIMEOUT	1000
+
+struct gta04_gps_replay {
+	char **sentences;
+	int count;
+
+	int fixes;
+	int first_second;
+	int last_second;
+};
+
+static void gta04_gps_replay_release(struct gta04_gps_replay *replay)
+{
+	int i;
+
+	if (replay->sentences != NULL) {
+		for (i = 0; i < replay->count; i++)
+			free(replay->sentences[i]);
+
+		free(replay->sentences);
+	}
+
+	memset(replay, 0, sizeof(struct gta04_gps_replay));
+}
+
+/*
+ * Seconds of the day of a GPGGA or GPRMC sentence, or -1.
+ */
+static int gta04_gps_replay_second(const char *sentence)
+{
+	int hour;
+	int minute;
+	int second;
+
+	if (strncmp(sentence, "$GPGGA,", 7) != 0 && strncmp(sentence, "$GPRMC,", 7) != 0)
+		return -1;
+
+	if (sscanf(sentence + 7, "%2d%2d%2d", &hour, &minute, &second) != 3)
+		return -1;
+
+	return hour * 3600 + minute * 60 + second;
+}
+
+static int gta04_gps_replay_load(struct gta04_gps_replay *replay,
+	const char *path)
+{
+	char line[256];
+	char **sentences;
+	size_t length;
+	int second;
+	FILE *file;
+
+	memset(replay, 0, sizeof(struct gta04_gps_replay));
+	replay->first_second = -1;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Opening %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		length = strcspn(line, "\r\n");
+		line[length] = '\0';
+
+		if (line[0] != '$')
+			continue;
+
+		if (replay->count % 1024 == 0) {
+			sentences = (char **) realloc(replay->sentences, (replay->count + 1024) * sizeof(char *));
+			if (sentences == NULL)
+				goto error;
+
+			replay->sentences = sentences;
+		}
+
+		replay->sentences[replay->count] = (char *) malloc(length + 3);
+		if (replay->sentences[replay->count] == NULL)
+			goto error;
+
+		snprintf(replay->sentences[replay->count], length + 3, "%s\r\n", line);
+		replay->count++;
+
+		second = gta04_gps_replay_second(line);
+		if (second >= 0) {
+			if (replay->first_second < 0)
+				replay->first_second = second;
+
+			// Midnight
+			if (second < replay->last_second)
+				second += 24 * 60 * 60;
+
+			replay->last_second = second;
+		}
+
+		// Fixes are reported from valid GPRMC sentences
+		if (strncmp(line, "$GPRMC,", 7) == 0 && strstr(line, ",A,") != NULL)
+			replay->fixes++;
+	}
+
+	fclose(file);
+
+	return 0;
+
+error:
+	fclose(file);
+	gta04_gps_replay_release(replay);
+
+	return -1;
+}
+
+static void gta04_gps_replay_wait(int64_t time)
+{
+	struct timespec ts;
+
+	ts.tv_sec = time / 1000000000LL;
+	ts.tv_nsec = time % 1000000000LL;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int64_t gta04_gps_replay_cpu(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) < 0)
+		return 0;
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	struct gta04_gps_replay replay;
+	struct gta04_gps_fake fake;
+	char buffer[256];
+	clockid_t clock;
+	double speed = 1;
+	int baud = GTA04_GPS_REPLAY_BAUD;
+	const char *output_path = NULL;
+	FILE *output = NULL;
+	int64_t data;
+	int64_t position;
+	int64_t start;
+	int64_t wall;
+	int64_t cpu_start;
+	int64_t cpu;
+	int second;
+	int offset;
+	int failures = 0;
+	int rc;
+	int i;
+
+	while ((rc = getopt(argc, argv, "s:b:o:")) != -1) {
+		switch (rc) {
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'b':
+				baud = atoi(optarg);
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (optind >= argc || speed <= 0 || baud <= 0)
+		goto usage;
+
+	rc = gta04_gps_replay_load(&replay, argv[optind]);
+	if (rc < 0)
+		return 1;
+
+	rc = gta04_gps_fake_open(&fake);
+	if (rc < 0)
+		return 1;
+
+	gta04_gps_record_reset();
+
+	if (output_path != NULL) {
+		output = fopen(output_path, "w");
+		if (output == NULL)
+			fprintf(stderr, "Opening %s failed: %s\n", output_path, strerror(errno));
+		else
+			gta04_gps_record_output(output);
+	}
+
+	rc = gta04_gps_interface.init(&gta04_gps_record_callbacks);
+	if (rc < 0) {
+		fprintf(stderr, "Initializing the HAL failed\n");
+		return 1;
+	}
+
+	gta04_gps_interface.set_position_mode(GPS_POSITION_MODE_STANDALONE, GPS_POSITION_RECURRENCE_PERIODIC, 1000, 0, 0);
+	gta04_gps_interface.start();
+
+	if (gta04_gps_record_wait_status(GPS_STATUS_ENGINE_ON, 1, GTA04_GPS_REPLAY_TIMEOUT) < 0) {
+		fprintf(stderr, "Starting the GPS failed\n");
+		return 1;
+	}
+
+	clock = CLOCK_THREAD_CPUTIME_ID;
+	pthread_getcpuclockid(gta04_gps_record.thread, &clock);
+	cpu_start = gta04_gps_replay_cpu(clock);
+
+	start = gta04_gps_fake_time();
+
+	// Position in the data, in ns
+	position = 0;
+	offset = 0;
+
+	for (i = 0; i < replay.count; i++) {
+		second = gta04_gps_replay_second(replay.sentences[i]);
+		if (second >= 0) {
+			if (second + offset < replay.first_second)
+				offset += 24 * 60 * 60;
+
+			data = (int64_t) (second + offset - replay.first_second) * 1000000000LL;
+			if (data > position)
+				position = data;
+		}
+
+		gta04_gps_replay_wait(start + (int64_t) (position / speed));
+
+		write(fake.master_fd, replay.sentences[i], strlen(replay.sentences[i]));
+
+		// 10 bits per byte on the line
+		position += (int64_t) strlen(replay.sentences[i]) * 10 * 1000000000LL / baud;
+
+		// Commands sent to the receiver are not looked at
+		if (i % 64 == 0)
+			gta04_gps_fake_receive(&fake, buffer, sizeof(buffer), 0);
+	}
+
+	wall = gta04_gps_fake_time() - start;
+
+	gta04_gps_record_wait_locations(replay.fixes, GTA04_GPS_REPLAY_TIMEOUT);
+
+	cpu = gta04_gps_replay_cpu(clock) - cpu_start;
+
+	gta04_gps_interface.stop();
+	gta04_gps_record_wait_status(GPS_STATUS_ENGINE_OFF, 2, GTA04_GPS_REPLAY_TIMEOUT);
+
+	gta04_gps_interface.cleanup();
+	gta04_gps_record_join();
+
+	gta04_gps_fake_close(&fake);
+
+	data = replay.last_second - replay.first_second + 1;
+
+	printf("Replayed %d sentences, %lld s of data in %.3f s (%.1fx)\n", replay.count, (long long int) data, wall / 1e9, data * 1e9 / wall);
+	printf("Fixes: %d expected, %d reported, %d with non-monotonic timestamps\n", replay.fixes, gta04_gps_record.locations, gta04_gps_record.non_monotonic);
+	printf("Callbacks: %d status, %d sv_status, %d nmea, %d/%d wakelocks acquired/released\n", gta04_gps_record.statuses, gta04_gps_record.sv_statuses, gta04_gps_record.nmeas, gta04_gps_record.wakelocks_acquired, gta04_gps_record.wakelocks_released);
+	printf("HAL thread CPU: %.3f ms, %.1f ms per hour of data, %.2f us per sentence\n", cpu / 1e6, cpu / 1e6 * 3600 / data, cpu / 1e3 / replay.count);
+
+	if (gta04_gps_record.locations != replay.fixes) {
+		printf("FAIL: fix count\n");
+		failures++;
+	}
+
+	if (gta04_gps_record.non_monotonic > 0) {
+		printf("FAIL: timestamps\n");
+		failures++;
+	}
+
+	if (gta04_gps_record.wakelocks_acquired != gta04_gps_record.wakelocks_released) {
+		printf("FAIL: wakelocks\n");
+		failures++;
+	}
+
+	if (output != NULL)
+		fclose(output);
+
+	gta04_gps_replay_release(&replay);
+
+	return failures > 0 ? 1 : 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s speed] [-b baud] [-o record] log.nmea\n", argv[0]);
+
+	return 1;
+}
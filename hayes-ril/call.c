@@ -24,6 +24,7 @@
 #define LOG_TAG "RIL-CALL"
 #include <utils/Log.h>
 #include <telephony/ril.h>
+#include <cutils/properties.h>
 #include <string.h>
 #include <errno.h>
 
@@ -58,6 +59,48 @@ void ril_call_state_changed(void *data)
 	ril_request_unsolicited(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
 }
 
+/*
+ * The call state is published for the audio RIL interface, that prepares
+ * voice routing before the call is connected.
+ */
+void ril_call_state_publish(const char *state)
+{
+	char value[PROPERTY_VALUE_MAX];
+
+	property_get(RIL_CALL_STATE_PROPERTY, value, "");
+	if (strcmp(value, state) == 0)
+		return;
+
+	property_set(RIL_CALL_STATE_PROPERTY, state);
+}
+
+static const char *ril_calls_state(RIL_Call **calls, int count)
+{
+	const char *state = RIL_CALL_STATE_IDLE;
+	int i;
+
+	for (i = 0 ; i < count ; i++) {
+		switch (calls[i]->state) {
+			case RIL_CALL_ACTIVE:
+			case RIL_CALL_HOLDING:
+				return RIL_CALL_STATE_ACTIVE;
+			case RIL_CALL_DIALING:
+			case RIL_CALL_ALERTING:
+				state = RIL_CALL_STATE_DIALING;
+				break;
+			case RIL_CALL_INCOMING:
+			case RIL_CALL_WAITING:
+				if (state == RIL_CALL_STATE_IDLE)
+					state = RIL_CALL_STATE_RINGING;
+				break;
+			default:
+				break;
+		}
+	}
+
+	return state;
+}
+
 int at_clcc_callback(char *string, int error, RIL_Token token)
 {
 	struct timeval poll_interval = { 0, 750000 };
@@ -116,6 +159,8 @@ int at_clcc_callback(char *string, int error, RIL_Token token)
 		ril_request_timed_callback(ril_call_state_changed, NULL, &poll_interval);
 
 complete:
+	ril_call_state_publish(ril_calls_state(calls, count));
+
 	ril_request_complete(token, RIL_E_SUCCESS, calls, sizeof(RIL_Call *) * count);
 
 	if (calls != NULL) {
@@ -160,6 +205,7 @@ void ril_request_get_current_calls(void *data, size_t length, RIL_Token token)
 
 int at_cring_unsol(char *string, int error)
 {
+	ril_call_state_publish(RIL_CALL_STATE_RINGING);
 	ril_request_unsolicited(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED, NULL, 0);
 
 	return AT_STATUS_HANDLED;
@@ -205,6 +251,8 @@ void ril_request_dial(void *data, size_t length, RIL_Token token)
 	if (string == NULL)
 		return;
 
+	ril_call_state_publish(RIL_CALL_STATE_DIALING);
+
 	rc = at_send_callback(string, token, at_generic_callback);
 	if (rc < 0)
 		ril_request_complete(token, RIL_E_GENERIC_FAILURE, NULL, 0);
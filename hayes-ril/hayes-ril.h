@@ -47,6 +47,12 @@
 #define RIL_TOKEN_UNSOL	(RIL_Token) 0xffff
 #define RIL_TOKEN_NULL	(RIL_Token) 0x0000
 
+#define RIL_CALL_STATE_PROPERTY		"ril.call.state"
+#define RIL_CALL_STATE_IDLE		"idle"
+#define RIL_CALL_STATE_RINGING		"ringing"
+#define RIL_CALL_STATE_DIALING		"dialing"
+#define RIL_CALL_STATE_ACTIVE		"active"
+
 /*
  * Structures
  */
@@ -94,6 +100,7 @@ extern struct ril_data *ril_data;
  */
 
 // Call
+void ril_call_state_publish(const char *state);
 int at_cring_unsol(char *string, int error);
 int at_cusd_unsol(char *string, int error);
 void ril_request_dtmf_start(void *data, size_t length, RIL_Token token);
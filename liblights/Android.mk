@@ -28,4 +28,6 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE := lights.gta04
 include $(BUILD_SHARED_LIBRARY)
 
+include $(call all-makefiles-under,$(LOCAL_PATH))
+
 endif
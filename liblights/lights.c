@@ -16,11 +16,15 @@
 
 #define LOG_TAG "lights"
 #include <cutils/log.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -35,66 +39,173 @@
 	_a > _b ? _a : _b; })
 
 static pthread_mutex_t lights_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lights_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t lights_thread;
+static int lights_users = 0;
+static int lights_quit = 0;
+
+/* Can be pointed to a fake tree, for testing */
+#ifndef LIGHTS_SYSFS
+#define LIGHTS_SYSFS "/sys"
+#endif
 
 #define L2804_GTA04 0
 #define L3704_7004  1
 int device_type = L2804_GTA04; /* Needs to be detected, default to GTA04 */
 
 char backlight_brightness[] =
-	"/sys/class/backlight/pwm-backlight/brightness";
+	LIGHTS_SYSFS "/class/backlight/pwm-backlight/brightness";
 char backlight_max_brightness[] =
-	"/sys/class/backlight/pwm-backlight/max_brightness";
+	LIGHTS_SYSFS "/class/backlight/pwm-backlight/max_brightness";
 
 /* GTA04/Letux2804 */
 char pwr_red_brightness[] =
-	"/sys/class/leds/gta04:red:power/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:red:power/brightness";
 char pwr_red_max_brightness[] =
-	"/sys/class/leds/gta04:red:power/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:red:power/max_brightness";
 char pwr_green_brightness[] =
-	"/sys/class/leds/gta04:green:power/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:green:power/brightness";
 char pwr_green_max_brightness[] =
-	"/sys/class/leds/gta04:green:power/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:green:power/max_brightness";
 
 char aux_red_brightness[] =
-	"/sys/class/leds/gta04:red:aux/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:red:aux/brightness";
 char aux_red_max_brightness[] =
-	"/sys/class/leds/gta04:red:aux/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:red:aux/max_brightness";
 char aux_green_brightness[] =
-	"/sys/class/leds/gta04:green:aux/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:green:aux/brightness";
 char aux_green_max_brightness[] =
-	"/sys/class/leds/gta04:green:aux/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:green:aux/max_brightness";
 
 /* Letux3704/Letux7004 */
 char right_brightness[] =
-	"/sys/class/leds/gta04:right/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:right/brightness";
 char right_max_brightness[] =
-	"/sys/class/leds/gta04:right/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:right/max_brightness";
 char left_brightness[] =
-	"/sys/class/leds/gta04:left/brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:left/brightness";
 char left_max_brightness[] =
-	"/sys/class/leds/gta04:left/max_brightness";
+	LIGHTS_SYSFS "/class/leds/gta04:left/max_brightness";
+
+/*
+ * LEDs
+ *
+ * The brightness nodes are kept open and their max_brightness is read once,
+ * when the first light is opened. Callers only leave the state they want in
+ * pending: the writer thread applies the latest one, if it changed, so bursts
+ * (e.g. brightness slider drags) are coalesced and never wait for sysfs.
+ *
+ * Blinking is left to the timer trigger of the LED, so that nothing has to
+ * wake up while it blinks. Without it, the writer thread toggles the LED.
+ */
+
+struct led_state {
+	int brightness;
+	int on_ms;
+	int off_ms;
+};
+
+struct lights_led {
+	char *brightness;
+	char *max_brightness;
+	int fd;
+	int max;
+	int timer;	// The timer trigger is available
+	int triggered;	// A trigger might be set
+
+	struct led_state value;	// Last applied, brightness -1 before that
+	struct led_state pending;
+
+	// Software blinking, only used by the writer
+	int blink;
+	int blink_on;
+	int64_t blink_time;
+};
+
+#define LED_BACKLIGHT	0
+#define LED_PWR_RED	1
+#define LED_PWR_GREEN	2
+#define LED_AUX_RED	3
+#define LED_AUX_GREEN	4
+#define LED_RIGHT	5
+#define LED_LEFT	6
+#define LED_COUNT	7
+
+struct lights_led leds[LED_COUNT] = {
+	{ .brightness = backlight_brightness, .max_brightness = backlight_max_brightness, .fd = -1 },
+	{ .brightness = pwr_red_brightness, .max_brightness = pwr_red_max_brightness, .fd = -1 },
+	{ .brightness = pwr_green_brightness, .max_brightness = pwr_green_max_brightness, .fd = -1 },
+	{ .brightness = aux_red_brightness, .max_brightness = aux_red_max_brightness, .fd = -1 },
+	{ .brightness = aux_green_brightness, .max_brightness = aux_green_max_brightness, .fd = -1 },
+	{ .brightness = right_brightness, .max_brightness = right_max_brightness, .fd = -1 },
+	{ .brightness = left_brightness, .max_brightness = left_max_brightness, .fd = -1 },
+};
 
 /*
  * Lights utils
  */
 
-int sysfs_write_int(char *path, int value)
+int sysfs_write_int(int fd, int value)
 {
-	char buf[10];
+	char buf[12];
 	int length = 0;
+	int rc;
+
+	if(fd < 0)
+		return -1;
+
+	length = snprintf(buf, sizeof(buf), "%d\n", value);
+
+	rc = pwrite(fd, buf, length, 0);
+	if(rc < length)
+		return -1;
+
+	return 0;
+}
+
+int sysfs_read_int(char *path)
+{
+	char buf[10];
+	int val = 0;
 	int fd = -1;
 	int rc;
 
 	if(path == NULL)
 		return -1;
 
-	length = snprintf(buf, 10, "%d\n", value);
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return -1;
+
+	rc = read(fd, buf, sizeof(buf) - 1);
+
+	close(fd);
+
+	if(rc <= 0)
+		return -1;
+
+	buf[rc] = '\0';
+	val = atoi(buf);
+
+	return val;
+}
+
+int sysfs_write_string(char *path, const char *value)
+{
+	int length;
+	int fd = -1;
+	int rc;
+
+	if(path == NULL || value == NULL)
+		return -1;
+
+	length = strlen(value);
 
 	fd = open(path, O_WRONLY);
 	if(fd < 0)
 		return -1;
 
-	rc = write(fd, buf, length);
+	rc = write(fd, value, length);
 
 	close(fd);
 
@@ -104,29 +215,335 @@ int sysfs_write_int(char *path, int value)
 	return 0;
 }
 
-int sysfs_read_int(char *path)
+int sysfs_read_string(char *path, char *buf, int size)
 {
-	char buf[10];
-	int val = 0;
 	int fd = -1;
 	int rc;
 
-	if(path == NULL)
+	if(path == NULL || buf == NULL || size <= 0)
 		return -1;
 
 	fd = open(path, O_RDONLY);
 	if(fd < 0)
 		return -1;
 
-	rc = read(fd, buf, 10);
-	if(rc <= 0) {
-		close(fd);
+	rc = read(fd, buf, size - 1);
+
+	close(fd);
+
+	if(rc <= 0)
+		return -1;
+
+	buf[rc] = '\0';
+
+	return rc;
+}
+
+/*
+ * LEDs utils
+ */
+
+// Scales a 0-255 value to the LED range
+static int led_scale(int led, int value)
+{
+	if(leds[led].max > 0)
+		value = (value * leds[led].max) / 0xff;
+
+	return value;
+}
+
+static int64_t lights_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Path of another attribute of the LED, next to its brightness
+static void led_path(int led, const char *attribute, char *path, int size)
+{
+	char *p;
+
+	snprintf(path, size, "%s", leds[led].brightness);
+
+	p = strrchr(path, '/');
+	if(p != NULL)
+		snprintf(p + 1, size - (p + 1 - path), "%s", attribute);
+}
+
+static int led_write_string(int led, const char *attribute, const char *value)
+{
+	char path[PATH_MAX];
+	int rc;
+
+	led_path(led, attribute, path, sizeof(path));
+
+	rc = sysfs_write_string(path, value);
+	if(rc < 0)
+		ALOGE("Unable to write %s: %s", path, strerror(errno));
+
+	return rc;
+}
+
+static int led_write_int(int led, const char *attribute, int value)
+{
+	char buf[12];
+
+	snprintf(buf, sizeof(buf), "%d\n", value);
+
+	return led_write_string(led, attribute, buf);
+}
+
+static int led_state_equal(struct led_state *a, struct led_state *b)
+{
+	return a->brightness == b->brightness && a->on_ms == b->on_ms &&
+		a->off_ms == b->off_ms;
+}
+
+// Called with lights_mutex locked
+static int led_set(int led, int brightness, int on_ms, int off_ms)
+{
+	struct led_state state;
+
+	if(leds[led].fd < 0)
 		return -1;
+
+	state.brightness = brightness;
+	// Blinking only makes sense with both delays and something to show
+	if(brightness > 0 && on_ms > 0 && off_ms > 0) {
+		state.on_ms = on_ms;
+		state.off_ms = off_ms;
+	} else {
+		state.on_ms = 0;
+		state.off_ms = 0;
 	}
 
-	val = atoi(buf);
+	if(!led_state_equal(&leds[led].pending, &state)) {
+		leds[led].pending = state;
+		pthread_cond_signal(&lights_cond);
+	}
 
-	return val;
+	return 0;
+}
+
+// Called with lights_mutex locked
+static int leds_pending(void)
+{
+	int i;
+
+	for(i = 0; i < LED_COUNT; i++)
+		if(!led_state_equal(&leds[i].pending, &leds[i].value))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Called by the writer only.
+ */
+static void led_apply(int led, struct led_state *state)
+{
+	struct lights_led *l = &leds[led];
+	int rc;
+
+	l->blink = 0;
+
+	if(state->on_ms > 0 && l->timer) {
+		// The timer trigger blinks with the brightness set before it
+		rc = sysfs_write_int(l->fd, state->brightness);
+		if(rc < 0)
+			ALOGE("Unable to write %s: %s", l->brightness, strerror(errno));
+
+		l->triggered = 1;
+
+		rc = led_write_string(led, "trigger", "timer");
+		if(rc >= 0)
+			rc = led_write_int(led, "delay_on", state->on_ms);
+		if(rc >= 0)
+			rc = led_write_int(led, "delay_off", state->off_ms);
+		if(rc >= 0)
+			return;
+
+		ALOGE("Unable to use the timer trigger, blinking in software");
+		l->timer = 0;
+	}
+
+	// Setting no trigger turns the LED off
+	if(l->triggered) {
+		led_write_string(led, "trigger", "none");
+		l->triggered = 0;
+	}
+
+	rc = sysfs_write_int(l->fd, state->brightness);
+	if(rc < 0)
+		ALOGE("Unable to write %s: %s", l->brightness, strerror(errno));
+
+	if(state->on_ms > 0) {
+		l->blink = 1;
+		l->blink_on = 1;
+		l->blink_time = lights_time() + state->on_ms;
+	}
+}
+
+/*
+ * Called by the writer only: toggles the LEDs blinking in software that are
+ * due and returns the time of the next toggle, or -1 when there is none.
+ */
+static int64_t leds_blink(struct led_state *states)
+{
+	struct lights_led *l;
+	int64_t next = -1;
+	int64_t now;
+	int i;
+
+	now = lights_time();
+
+	for(i = 0; i < LED_COUNT; i++) {
+		l = &leds[i];
+
+		if(!l->blink)
+			continue;
+
+		if(now >= l->blink_time) {
+			l->blink_on = !l->blink_on;
+			sysfs_write_int(l->fd, l->blink_on ? states[i].brightness : 0);
+
+			l->blink_time += l->blink_on ? states[i].on_ms : states[i].off_ms;
+			// Don't try to catch up after a late wake-up
+			if(l->blink_time <= now)
+				l->blink_time = now + (l->blink_on ? states[i].on_ms : states[i].off_ms);
+		}
+
+		if(next < 0 || l->blink_time < next)
+			next = l->blink_time;
+	}
+
+	return next;
+}
+
+static void *leds_writer(void *data)
+{
+	struct led_state states[LED_COUNT];
+	struct timespec ts;
+	int64_t next = -1;
+	int64_t delay;
+	int rc;
+	int i;
+
+	pthread_mutex_lock(&lights_mutex);
+
+	while(1) {
+		rc = 0;
+
+		while(!lights_quit && !leds_pending() && rc != ETIMEDOUT) {
+			if(next < 0) {
+				pthread_cond_wait(&lights_cond, &lights_mutex);
+				continue;
+			}
+
+			delay = next - lights_time();
+			if(delay <= 0) {
+				rc = ETIMEDOUT;
+				break;
+			}
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += delay / 1000;
+			ts.tv_nsec += (delay % 1000) * 1000000;
+			if(ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			rc = pthread_cond_timedwait(&lights_cond, &lights_mutex, &ts);
+		}
+
+		// What is still pending is applied before leaving
+		if(lights_quit && !leds_pending())
+			break;
+
+		for(i = 0; i < LED_COUNT; i++)
+			states[i] = leds[i].pending;
+
+		pthread_mutex_unlock(&lights_mutex);
+
+		for(i = 0; i < LED_COUNT; i++)
+			if(!led_state_equal(&states[i], &leds[i].value))
+				led_apply(i, &states[i]);
+
+		next = leds_blink(states);
+
+		pthread_mutex_lock(&lights_mutex);
+
+		// Failed writes are not retried until the state changes again
+		for(i = 0; i < LED_COUNT; i++)
+			leds[i].value = states[i];
+	}
+
+	pthread_mutex_unlock(&lights_mutex);
+
+	return NULL;
+}
+
+static void leds_open(void)
+{
+	char path[PATH_MAX];
+	char triggers[4096];
+	int rc;
+	int i;
+
+	for(i = 0; i < LED_COUNT; i++) {
+		leds[i].value.brightness = -1;
+		leds[i].pending.brightness = -1;
+
+		// Only open the LEDs the device has
+		if(device_type == L2804_GTA04 && (i == LED_RIGHT || i == LED_LEFT))
+			continue;
+		if(device_type == L3704_7004 && i != LED_BACKLIGHT && i != LED_RIGHT && i != LED_LEFT)
+			continue;
+
+		leds[i].fd = open(leds[i].brightness, O_WRONLY);
+		if(leds[i].fd < 0) {
+			ALOGE("Unable to open %s: %s", leds[i].brightness, strerror(errno));
+			continue;
+		}
+
+		leds[i].max = sysfs_read_int(leds[i].max_brightness);
+
+		if(i == LED_BACKLIGHT)
+			continue;
+
+		// The selected trigger is in brackets
+		led_path(i, "trigger", path, sizeof(path));
+		rc = sysfs_read_string(path, triggers, sizeof(triggers));
+		if(rc > 0) {
+			leds[i].timer = strstr(triggers, "timer") != NULL;
+			leds[i].triggered = strstr(triggers, "[none]") == NULL;
+		}
+
+		if(!leds[i].timer)
+			ALOGD("No timer trigger for %s, blinking in software", leds[i].brightness);
+	}
+}
+
+static void leds_close(void)
+{
+	int i;
+
+	for(i = 0; i < LED_COUNT; i++) {
+		if(leds[i].fd >= 0)
+			close(leds[i].fd);
+
+		leds[i].fd = -1;
+		leds[i].max = 0;
+		leds[i].timer = 0;
+		leds[i].triggered = 0;
+		leds[i].blink = 0;
+		memset(&leds[i].value, 0, sizeof(struct led_state));
+		memset(&leds[i].pending, 0, sizeof(struct led_state));
+	}
 }
 
 /*
@@ -138,7 +555,8 @@ static int set_light_notifications(struct light_device_t *dev,
 {
 	int red, green, blue;
 	unsigned int colorRGB;
-	int max;
+	int on_ms = 0;
+	int off_ms = 0;
 	int rc = 0;
 
 	colorRGB = state->color;
@@ -146,52 +564,38 @@ static int set_light_notifications(struct light_device_t *dev,
 	green = (colorRGB >> 8) & 0xFF;
 	blue  = colorRGB & 0xFF;
 
+	// Both timed and hardware flashing are done by the kernel when it can
+	if(state->flashMode != LIGHT_FLASH_NONE) {
+		on_ms = state->flashOnMS;
+		off_ms = state->flashOffMS;
+	}
+
 	if(device_type == L2804_GTA04) {
 		// GTA04 only has red and green, so use green LED as green & blue
 		green = max(green, blue);
 
-		// Red max
-		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(aux_red_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
-		// convert byte- VS percentage-representation
-		if(max > 0)
-			red = (red * max) / 0xff;
-
-		// Green max
-		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(aux_green_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
 		// convert byte- VS percentage-representation
-		if(max > 0)
-			green = (green * max) / 0xff;
+		red = led_scale(LED_AUX_RED, red);
+		green = led_scale(LED_AUX_GREEN, green);
 
 		pthread_mutex_lock(&lights_mutex);
-		rc = sysfs_write_int(aux_red_brightness, red);
+		rc = led_set(LED_AUX_RED, red, on_ms, off_ms);
 		if(rc >= 0)
-			rc = sysfs_write_int(aux_green_brightness, green);
+			rc = led_set(LED_AUX_GREEN, green, on_ms, off_ms);
 		pthread_mutex_unlock(&lights_mutex);
-		ALOGD("set_light_notifications: %d (red), %d (green)", red, green);
+		ALOGD("set_light_notifications: %d (red), %d (green), %d/%d ms", red, green, on_ms, off_ms);
 	} else if(device_type == L3704_7004) {
 		// Letux3704 has only one LED
 		red = max(red, green);
 		red = max(red, blue);
 
-		// Left max
-		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(left_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
 		// convert byte- VS percentage-representation
-		if(max > 0)
-			red = (red * max) / 0xff;
+		red = led_scale(LED_LEFT, red);
 
 		pthread_mutex_lock(&lights_mutex);
-		rc = sysfs_write_int(left_brightness, red);
+		rc = led_set(LED_LEFT, red, on_ms, off_ms);
 		pthread_mutex_unlock(&lights_mutex);
-		ALOGD("set_light_notifications: %d (left)", red);
+		ALOGD("set_light_notifications: %d (left), %d/%d ms", red, on_ms, off_ms);
 	}
 	else {
 		ALOGE("set_light_notifications: LED device nodes unknown.");
@@ -205,7 +609,8 @@ static int set_light_battery(struct light_device_t *dev,
 {
 	int red, green, blue;
 	unsigned int colorRGB;
-	int max;
+	int on_ms = 0;
+	int off_ms = 0;
 	int rc = 0;
 
 	colorRGB = state->color;
@@ -213,54 +618,40 @@ static int set_light_battery(struct light_device_t *dev,
 	green = (colorRGB >> 8) & 0xFF;
 	blue  = colorRGB & 0xFF;
 
+	// Both timed and hardware flashing are done by the kernel when it can
+	if(state->flashMode != LIGHT_FLASH_NONE) {
+		on_ms = state->flashOnMS;
+		off_ms = state->flashOffMS;
+	}
+
 	ALOGD("set_light_battery: %#x (red), %#x (green), %#x (blue)", red, green, blue);
 
 	if(device_type == L2804_GTA04) {
 		// GTA04 only has red and green, so use green LED as green & blue
 		green = max(green, blue);
 
-		// Red max
-		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(pwr_red_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
 		// convert byte- VS percentage-representation
-		if(max > 0)
-			red = (red * max) / 0xff;
+		red = led_scale(LED_PWR_RED, red);
+		green = led_scale(LED_PWR_GREEN, green);
 
-		// Green max
 		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(pwr_green_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
-		// convert byte- VS percentage-representation
-		if(max > 0)
-			green = (green * max) / 0xff;
-
-		pthread_mutex_lock(&lights_mutex);
-		rc = sysfs_write_int(pwr_red_brightness, red);
+		rc = led_set(LED_PWR_RED, red, on_ms, off_ms);
 		if(rc >= 0)
-			rc = sysfs_write_int(pwr_green_brightness, green);
+			rc = led_set(LED_PWR_GREEN, green, on_ms, off_ms);
 		pthread_mutex_unlock(&lights_mutex);
-		ALOGD("set_light_battery: %d (red), %d (green)", red, green);
+		ALOGD("set_light_battery: %d (red), %d (green), %d/%d ms", red, green, on_ms, off_ms);
 	} else if(device_type == L3704_7004) {
 		// Letux3704 has only one LED
 		green = max(red, green);
 		green = max(green, blue);
 
-		// Right max
-		pthread_mutex_lock(&lights_mutex);
-		max = sysfs_read_int(right_max_brightness);
-		pthread_mutex_unlock(&lights_mutex);
-
 		// convert byte- VS percentage-representation
-		if(max > 0)
-			green = (green * max) / 0xff;
+		green = led_scale(LED_RIGHT, green);
 
 		pthread_mutex_lock(&lights_mutex);
-		rc = sysfs_write_int(right_brightness, green);
+		rc = led_set(LED_RIGHT, green, on_ms, off_ms);
 		pthread_mutex_unlock(&lights_mutex);
-		ALOGD("set_light_battery: %d (right)", green);
+		ALOGD("set_light_battery: %d (right), %d/%d ms", green, on_ms, off_ms);
 	}
 	else {
 		ALOGE("set_light_battery: LED device nodes unknown.");
@@ -274,20 +665,13 @@ static int set_light_backlight(struct light_device_t *dev,
 {
 	int color;
 	unsigned char brightness;
-	int brightness_max;
 	int rc;
 
-	pthread_mutex_lock(&lights_mutex);
-	brightness_max =
-		sysfs_read_int(backlight_max_brightness);
-	pthread_mutex_unlock(&lights_mutex);
-
 	color = state->color & 0x00ffffff;
 	brightness = ((77*((color>>16) & 0x00ff)) + (150*((color>>8) & 0x00ff))
 		+ (29*(color & 0x00ff))) >> 8;
 
-	if(brightness_max > 0)
-		brightness = (brightness * brightness_max) / 0xff;
+	brightness = led_scale(LED_BACKLIGHT, brightness);
 
 	//avoid low brightness, but allow off (0)
 	//this helps in situations where you think the device is off/crashed,
@@ -298,7 +682,7 @@ static int set_light_backlight(struct light_device_t *dev,
 	//ALOGD("Setting brightness to: %d", brightness);
 
 	pthread_mutex_lock(&lights_mutex);
-	rc = sysfs_write_int(backlight_brightness, brightness);
+	rc = led_set(LED_BACKLIGHT, brightness, 0, 0);
 	pthread_mutex_unlock(&lights_mutex);
 
 	return rc;
@@ -335,30 +719,30 @@ static int close_lights(struct light_device_t *dev)
 {
 	ALOGD("close_lights()");
 
+	pthread_mutex_lock(&lights_mutex);
+
+	lights_users--;
+	if(lights_users == 0) {
+		lights_quit = 1;
+		pthread_cond_signal(&lights_cond);
+		pthread_mutex_unlock(&lights_mutex);
+
+		pthread_join(lights_thread, NULL);
+
+		pthread_mutex_lock(&lights_mutex);
+		leds_close();
+	}
+
+	pthread_mutex_unlock(&lights_mutex);
+
 	if(dev != NULL)
 		free(dev);
 
 	return 0;
 }
 
-static int open_lights(const struct hw_module_t *module, char const *name,
-	struct hw_device_t **device)
+static void detect_device_type(void)
 {
-	int (*set_light)(struct light_device_t *dev,
-		struct light_state_t const *state);
-
-	ALOGD("open_lights(): %s", name);
-
-	if(strcmp(LIGHT_ID_BACKLIGHT, name) == 0) {
-		set_light = set_light_backlight;
-	} else if(strcmp(LIGHT_ID_BATTERY, name) == 0) {
-		set_light = set_light_battery;
-	} else if(strcmp(LIGHT_ID_NOTIFICATIONS, name) == 0) {
-		set_light = set_light_notifications;
-	} else {
-		return -1;
-	}
-
 	if( access( pwr_red_brightness, F_OK ) != -1 &&
 		access( pwr_red_max_brightness, F_OK ) != -1 &&
 		access( pwr_green_brightness, F_OK ) != -1 &&
@@ -380,12 +764,57 @@ static int open_lights(const struct hw_module_t *module, char const *name,
 		ALOGE("Could not detect device variant. Assuming GTA04/Letux2804");
 		device_type = L2804_GTA04;
 	}
+}
 
-	pthread_mutex_init(&lights_mutex, NULL);
+static int open_lights(const struct hw_module_t *module, char const *name,
+	struct hw_device_t **device)
+{
+	int (*set_light)(struct light_device_t *dev,
+		struct light_state_t const *state);
+	struct light_device_t *dev;
+	int rc;
+
+	ALOGD("open_lights(): %s", name);
+
+	if(strcmp(LIGHT_ID_BACKLIGHT, name) == 0) {
+		set_light = set_light_backlight;
+	} else if(strcmp(LIGHT_ID_BATTERY, name) == 0) {
+		set_light = set_light_battery;
+	} else if(strcmp(LIGHT_ID_NOTIFICATIONS, name) == 0) {
+		set_light = set_light_notifications;
+	} else {
+		return -1;
+	}
+
+	dev = malloc(sizeof(struct light_device_t));
+	if(dev == NULL)
+		return -1;
 
-	struct light_device_t *dev = malloc(sizeof(struct light_device_t));
 	memset(dev, 0, sizeof(*dev));
 
+	pthread_mutex_lock(&lights_mutex);
+
+	// The LEDs and the writer are shared by all the lights
+	if(lights_users == 0) {
+		detect_device_type();
+		leds_open();
+
+		lights_quit = 0;
+
+		rc = pthread_create(&lights_thread, NULL, leds_writer, NULL);
+		if(rc != 0) {
+			ALOGE("Unable to create lights writer thread");
+			leds_close();
+			pthread_mutex_unlock(&lights_mutex);
+			free(dev);
+			return -1;
+		}
+	}
+
+	lights_users++;
+
+	pthread_mutex_unlock(&lights_mutex);
+
 	dev->common.tag = HARDWARE_DEVICE_TAG;
 	dev->common.version = 0;
 	dev->common.module = (struct hw_module_t *) module;
@@ -0,0 +1,33 @@
+# Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Host test, on a temporary LED tree standing in for sysfs:
+#   make gta04_lights_test && gta04_lights_test
+
+LOCAL_PATH:= $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := leds.c ../lights.c
+
+LOCAL_CFLAGS := -DLIGHTS_SYSFS=\"sys\"
+LOCAL_LDFLAGS := -Wl,--wrap=pwrite
+
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := gta04_lights_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
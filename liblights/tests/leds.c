@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2012 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <hardware/lights.h>
+
+/*
+ * LEDs test: the HAL is built with its sysfs root at "sys", relative to a
+ * temporary directory holding a GTA04 LED tree. The aux LEDs have the timer
+ * trigger, the power LEDs do not. Brightness writes go through pwrite, which
+ * is wrapped to count them and optionally made slow, to check that the
+ * writer coalesces bursts and that callers never wait for it.
+ *
+ * Usage: gta04_lights_test [-n count]
+ */
+
+#define LIGHTS_TEST_COUNT	1000
+#define LIGHTS_TEST_TIMEOUT	1000
+#define LIGHTS_TEST_SLOW_MS	10
+
+#define LIGHTS_TEST_BACKLIGHT	"sys/class/backlight/pwm-backlight"
+#define LIGHTS_TEST_RED_AUX	"sys/class/leds/gta04:red:aux"
+#define LIGHTS_TEST_GREEN_AUX	"sys/class/leds/gta04:green:aux"
+#define LIGHTS_TEST_RED_POWER	"sys/class/leds/gta04:red:power"
+#define LIGHTS_TEST_GREEN_POWER	"sys/class/leds/gta04:green:power"
+
+extern struct hw_module_t HAL_MODULE_INFO_SYM;
+
+static pthread_mutex_t lights_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int lights_test_writes;
+static int lights_test_slow_ms;
+
+static int failures;
+
+#define check(condition) \
+	do { \
+		if(!(condition)) { \
+			fprintf(stderr, "%s:%d: %s failed\n", __func__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while(0)
+
+/*
+ * Brightness writes
+ */
+
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	int slow_ms;
+
+	pthread_mutex_lock(&lights_test_mutex);
+	lights_test_writes++;
+	slow_ms = lights_test_slow_ms;
+	pthread_mutex_unlock(&lights_test_mutex);
+
+	if(slow_ms > 0)
+		usleep(slow_ms * 1000);
+
+	return __real_pwrite(fd, buf, count, offset);
+}
+
+static int lights_test_writes_get(void)
+{
+	int writes;
+
+	pthread_mutex_lock(&lights_test_mutex);
+	writes = lights_test_writes;
+	pthread_mutex_unlock(&lights_test_mutex);
+
+	return writes;
+}
+
+static void lights_test_slow_set(int slow_ms)
+{
+	pthread_mutex_lock(&lights_test_mutex);
+	lights_test_slow_ms = slow_ms;
+	pthread_mutex_unlock(&lights_test_mutex);
+}
+
+static int64_t lights_test_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Tree
+ */
+
+static int lights_test_write(const char *directory, const char *attribute,
+	const char *value)
+{
+	char path[256];
+	int fd;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", directory, attribute);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return -1;
+
+	rc = write(fd, value, strlen(value));
+
+	close(fd);
+
+	return rc < (int) strlen(value) ? -1 : 0;
+}
+
+// First line of an attribute, or the whole of it without a newline
+static int lights_test_read(const char *directory, const char *attribute,
+	char *buffer, size_t length)
+{
+	char path[256];
+	int fd;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", directory, attribute);
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return -1;
+
+	rc = read(fd, buffer, length - 1);
+
+	close(fd);
+
+	if(rc < 0)
+		return -1;
+
+	buffer[rc] = '\0';
+	buffer[strcspn(buffer, "\n")] = '\0';
+
+	return 0;
+}
+
+/*
+ * Waits for the writer to leave value in the attribute. Triggers are written
+ * over the list of triggers without truncating it, so only their start is
+ * compared.
+ */
+static int lights_test_wait(const char *directory, const char *attribute,
+	const char *value)
+{
+	char buffer[64];
+	size_t length;
+	int64_t timeout;
+
+	length = strcmp(attribute, "trigger") == 0 ? strlen(value) : sizeof(buffer);
+	timeout = lights_test_time() + LIGHTS_TEST_TIMEOUT;
+
+	do {
+		if(lights_test_read(directory, attribute, buffer, sizeof(buffer)) == 0 &&
+			strncmp(buffer, value, length) == 0)
+			return 0;
+
+		usleep(1000);
+	} while(lights_test_time() < timeout);
+
+	fprintf(stderr, "%s/%s is %s, expected %s\n", directory, attribute, buffer, value);
+
+	return -1;
+}
+
+static int lights_test_led(const char *directory, const char *max,
+	const char *trigger)
+{
+	int rc;
+
+	rc = mkdir(directory, 0755);
+	if(rc < 0)
+		return -1;
+
+	rc = lights_test_write(directory, "brightness", "0\n");
+	rc |= lights_test_write(directory, "max_brightness", max);
+
+	if(trigger != NULL) {
+		rc |= lights_test_write(directory, "trigger", trigger);
+		// Only there once the timer trigger is set on a real LED
+		rc |= lights_test_write(directory, "delay_on", "");
+		rc |= lights_test_write(directory, "delay_off", "");
+	}
+
+	return rc;
+}
+
+static int lights_test_tree(char *directory)
+{
+	int rc;
+
+	strcpy(directory, "/tmp/gta04-lights-XXXXXX");
+	if(mkdtemp(directory) == NULL || chdir(directory) < 0) {
+		fprintf(stderr, "Creating directory failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	rc = mkdir("sys", 0755);
+	rc |= mkdir("sys/class", 0755);
+	rc |= mkdir("sys/class/backlight", 0755);
+	rc |= mkdir("sys/class/leds", 0755);
+	if(rc < 0)
+		return -1;
+
+	rc = lights_test_led(LIGHTS_TEST_BACKLIGHT, "255\n", NULL);
+	rc |= lights_test_led(LIGHTS_TEST_RED_AUX, "100\n", "[none] timer heartbeat\n");
+	rc |= lights_test_led(LIGHTS_TEST_GREEN_AUX, "100\n", "[none] timer heartbeat\n");
+	rc |= lights_test_led(LIGHTS_TEST_RED_POWER, "255\n", "[none] heartbeat\n");
+	rc |= lights_test_led(LIGHTS_TEST_GREEN_POWER, "255\n", "[none] heartbeat\n");
+
+	return rc;
+}
+
+static int lights_test_remove(const char *path, const struct stat *st,
+	int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static struct light_device_t *lights_test_open(const char *name)
+{
+	struct hw_device_t *device = NULL;
+	int rc;
+
+	rc = HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM, name, &device);
+	if(rc < 0 || device == NULL) {
+		fprintf(stderr, "Opening %s failed\n", name);
+		return NULL;
+	}
+
+	return (struct light_device_t *) device;
+}
+
+/*
+ * Tests
+ */
+
+static void test_backlight(struct light_device_t *backlight)
+{
+	struct light_state_t state;
+
+	memset(&state, 0, sizeof(state));
+
+	state.color = 0xff808080;
+	backlight->set_light(backlight, &state);
+	check(lights_test_wait(LIGHTS_TEST_BACKLIGHT, "brightness", "128") == 0);
+
+	// Too dark to tell from off
+	state.color = 0xff050505;
+	backlight->set_light(backlight, &state);
+	check(lights_test_wait(LIGHTS_TEST_BACKLIGHT, "brightness", "15") == 0);
+
+	state.color = 0xff000000;
+	backlight->set_light(backlight, &state);
+	check(lights_test_wait(LIGHTS_TEST_BACKLIGHT, "brightness", "0") == 0);
+}
+
+static void test_timer(struct light_device_t *notifications)
+{
+	struct light_state_t state;
+
+	memset(&state, 0, sizeof(state));
+
+	// Scaled to the max brightness of 100, blinking left to the trigger
+	state.color = 0xffff0000;
+	state.flashMode = LIGHT_FLASH_TIMED;
+	state.flashOnMS = 500;
+	state.flashOffMS = 1500;
+	notifications->set_light(notifications, &state);
+
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "delay_off", "1500") == 0);
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "brightness", "100") == 0);
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "trigger", "timer") == 0);
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "delay_on", "500") == 0);
+	check(lights_test_wait(LIGHTS_TEST_GREEN_AUX, "brightness", "0") == 0);
+
+	// Solid again, the trigger is removed
+	state.color = 0xff00ff00;
+	state.flashMode = LIGHT_FLASH_NONE;
+	notifications->set_light(notifications, &state);
+
+	check(lights_test_wait(LIGHTS_TEST_GREEN_AUX, "brightness", "100") == 0);
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "trigger", "none") == 0);
+	check(lights_test_wait(LIGHTS_TEST_RED_AUX, "brightness", "0") == 0);
+
+	state.color = 0;
+	notifications->set_light(notifications, &state);
+	check(lights_test_wait(LIGHTS_TEST_GREEN_AUX, "brightness", "0") == 0);
+}
+
+static void test_software_blink(struct light_device_t *battery)
+{
+	struct light_state_t state;
+	int writes;
+
+	memset(&state, 0, sizeof(state));
+
+	// No timer trigger on the power LEDs: the writer toggles them
+	state.color = 0xff00ff00;
+	state.flashMode = LIGHT_FLASH_TIMED;
+	state.flashOnMS = 50;
+	state.flashOffMS = 50;
+	battery->set_light(battery, &state);
+
+	check(lights_test_wait(LIGHTS_TEST_GREEN_POWER, "brightness", "255") == 0);
+
+	writes = lights_test_writes_get();
+	usleep(500000);
+	writes = lights_test_writes_get() - writes;
+
+	printf("Software blinking 50/50 ms: %d toggles in 500 ms\n", writes);
+	check(writes >= 7 && writes <= 11);
+
+	state.color = 0;
+	state.flashMode = LIGHT_FLASH_NONE;
+	battery->set_light(battery, &state);
+	check(lights_test_wait(LIGHTS_TEST_GREEN_POWER, "brightness", "0") == 0);
+
+	// Nothing blinks anymore
+	usleep(50000);
+	writes = lights_test_writes_get();
+	usleep(200000);
+	check(lights_test_writes_get() == writes);
+}
+
+static void test_coalesce(struct light_device_t *backlight, int count)
+{
+	struct light_state_t state;
+	char value[16];
+	int64_t start;
+	int64_t time;
+	int writes;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+
+	// Every write takes a while: callers must not wait for them
+	lights_test_slow_set(LIGHTS_TEST_SLOW_MS);
+
+	writes = lights_test_writes_get();
+	start = lights_test_time();
+
+	for(i = 0; i < count; i++) {
+		state.color = 0xff000000 | (0x010101 * (16 + i % 240));
+		backlight->set_light(backlight, &state);
+	}
+
+	time = lights_test_time() - start;
+
+	snprintf(value, sizeof(value), "%d", 16 + (count - 1) % 240);
+	check(lights_test_wait(LIGHTS_TEST_BACKLIGHT, "brightness", value) == 0);
+
+	usleep(LIGHTS_TEST_SLOW_MS * 5 * 1000);
+	writes = lights_test_writes_get() - writes;
+
+	printf("Burst of %d backlight changes: %lld ms in set_light, %d writes of %d ms\n", count, (long long int) time, writes, LIGHTS_TEST_SLOW_MS);
+	check(writes <= 3);
+	check(time < LIGHTS_TEST_SLOW_MS * 5);
+
+	// The same state again is not written
+	writes = lights_test_writes_get();
+
+	for(i = 0; i < count; i++)
+		backlight->set_light(backlight, &state);
+
+	usleep(LIGHTS_TEST_SLOW_MS * 5 * 1000);
+	check(lights_test_writes_get() == writes);
+
+	lights_test_slow_set(0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct light_device_t *backlight;
+	struct light_device_t *notifications;
+	struct light_device_t *battery;
+	char directory[32];
+	int count = LIGHTS_TEST_COUNT;
+	int rc;
+
+	while((rc = getopt(argc, argv, "n:")) != -1) {
+		switch(rc) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n count]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(count <= 0 || lights_test_tree(directory) < 0) {
+		fprintf(stderr, "Creating the LED tree failed\n");
+		return 1;
+	}
+
+	backlight = lights_test_open(LIGHT_ID_BACKLIGHT);
+	notifications = lights_test_open(LIGHT_ID_NOTIFICATIONS);
+	battery = lights_test_open(LIGHT_ID_BATTERY);
+	if(backlight == NULL || notifications == NULL || battery == NULL)
+		return 1;
+
+	test_backlight(backlight);
+	test_timer(notifications);
+	test_software_blink(battery);
+	test_coalesce(backlight, count);
+
+	backlight->common.close(&backlight->common);
+	notifications->common.close(&notifications->common);
+	battery->common.close(&battery->common);
+
+	chdir("/");
+	nftw(directory, lights_test_remove, 16, FTW_DEPTH | FTW_PHYS);
+
+	if(failures > 0) {
+		printf("FAIL: %d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
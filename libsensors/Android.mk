@@ -19,19 +19,23 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	gta04_sensors.c \
+	paths.c \
+	discovery.c \
 	input.c \
 	iio.c \
+	fifo.c \
+	rate.c \
+	stats.c \
+	reader.c \
 	bma180.c \
 	lis302.c \
 	itg3200.c \
 	hmc5883l.c \
 	tept4400.c \
-	orientation.c \
+	fusion.c \
 	bmp085.c \
 	$(NULL)
 
-
-
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH)
 
@@ -43,3 +47,5 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -30,11 +30,12 @@
 #include "gta04_sensors.h"
 
 struct bma180_acceleration_data {
-	struct gta04_sensors_handlers *orientation_sensor;
-
 	char path_delay[PATH_MAX];
+	int delay_ms;
 
 	sensors_vec_t acceleration;
+
+	struct input_event input_events[INPUT_EVENTS_COUNT];
 };
 
 int bma180_acceleration_init(struct gta04_sensors_handlers *handlers,
@@ -44,7 +45,6 @@ int bma180_acceleration_init(struct gta04_sensors_handlers *handlers,
 	char path[PATH_MAX] = { 0 };
 	int input_fd = -1;
 	int rc;
-	int i;
 
 	ALOGD("%s(%p, %p)", __func__, handlers, device);
 
@@ -53,14 +53,6 @@ int bma180_acceleration_init(struct gta04_sensors_handlers *handlers,
 
 	data = (struct bma180_acceleration_data *) calloc(1, sizeof(struct bma180_acceleration_data));
 
-	for (i = 0; i < device->handlers_count; i++) {
-		if (device->handlers[i] == NULL)
-			continue;
-
-		if (device->handlers[i]->handle == SENSOR_TYPE_ORIENTATION)
-			data->orientation_sensor = device->handlers[i];
-	}
-
 	input_fd = input_open("bma150"); /* We're using the bma150 kernel driver for the bma180 chip */
 	if (input_fd < 0) {
 		ALOGE("%s: Unable to open input", __func__);
@@ -74,6 +66,11 @@ int bma180_acceleration_init(struct gta04_sensors_handlers *handlers,
 	}
 
 	snprintf(data->path_delay, PATH_MAX, "%s/poll", path);
+	data->delay_ms = -1;
+
+	// The chip can't poll slower than 200 ms, unless told otherwise by sysfs
+	handlers->rate.delay_max = 200000000LL;
+	sysfs_delay_range((char *) &path, &handlers->rate);
 
 	handlers->poll_fd = input_fd;
 	handlers->data = (void *) data;
@@ -148,24 +145,23 @@ int bma180_acceleration_deactivate(struct gta04_sensors_handlers *handlers)
 int bma180_acceleration_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
 {
 	struct bma180_acceleration_data *data;
+	int delay_ms;
 	int rc;
-	int delay_ms = (int)(delay/1000000); //bma150/180 expects milliseconds, not nanoseconds
-
-	if(delay_ms > 200) //bma150/180 expects 200ms maximum, TODO: get this value from 'max' node in sysfs
-		delay_ms = 200;
-
-	//if sensor is not active, set poll_delay to 0, in order to save power
-	if(handlers->activated == 0)
-		delay_ms = 0;
 
-	ALOGD("%s(%p, %d)", __func__, handlers, delay_ms);
+	ALOGD("%s(%p, %ld)", __func__, handlers, delay);
 
 	if (handlers == NULL || handlers->data == NULL)
 		return -EINVAL;
 
 	data = (struct bma180_acceleration_data *) handlers->data;
 
-	rc = sysfs_value_write(data->path_delay, delay_ms);
+	delay_ms = (int) (delay / 1000000); //bma150/180 expects milliseconds, not nanoseconds
+
+	//if sensor is not active, set poll_delay to 0, in order to save power
+	if (handlers->activated == 0)
+		delay_ms = 0;
+
+	rc = sysfs_value_write_cached(data->path_delay, delay_ms, &data->delay_ms);
 	if (rc < 0) {
 		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, delay_ms, data->path_delay);
 		return -1;
@@ -180,75 +176,68 @@ float bma180_acceleration_convert(int value)
 }
 
 int bma180_acceleration_get_data(struct gta04_sensors_handlers *handlers,
-	struct sensors_event_t *event)
+	struct sensors_event_t *events, int count)
 {
 	struct bma180_acceleration_data *data;
-	struct input_event input_event;
-	int input_fd;
-	int rc;
+	struct input_event *input_event;
+	struct sensors_event_t *event;
+	int input_count;
+	int i, n;
 
-//	ALOGD("%s(%p, %p)", __func__, handlers, event);
+//	ALOGD("%s(%p, %p, %d)", __func__, handlers, events, count);
 
-	if (handlers == NULL || handlers->data == NULL || event == NULL)
+	if (handlers == NULL || handlers->data == NULL || events == NULL || count <= 0)
 		return -EINVAL;
 
 	data = (struct bma180_acceleration_data *) handlers->data;
 
-	input_fd = handlers->poll_fd;
-	if (input_fd < 0)
+	if (handlers->poll_fd < 0)
 		return -EINVAL;
 
-	memset(event, 0, sizeof(struct sensors_event_t));
-	event->version = sizeof(struct sensors_event_t);
-	event->sensor = handlers->handle;
-	event->type = handlers->handle;
+	// Every reported event takes at least its SYN_REPORT input event
+	input_count = count < INPUT_EVENTS_COUNT ? count : INPUT_EVENTS_COUNT;
 
-	event->acceleration.x = data->acceleration.x;
-	event->acceleration.y = data->acceleration.y;
-	event->acceleration.z = data->acceleration.z;
+	input_count = input_read(handlers->poll_fd, data->input_events, input_count);
+	if (input_count <= 0)
+		return -1;
 
-	event->acceleration.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+	n = 0;
 
-	do {
-		rc = read(input_fd, &input_event, sizeof(input_event));
-		if (rc < (int) sizeof(input_event))
-			break;
+	// Values may span several reads, they are kept until their SYN_REPORT
+	for (i = 0; i < input_count; i++) {
+		input_event = &data->input_events[i];
 
-		if (input_event.type == EV_ABS) {
-			switch (input_event.code) {
+		if (input_event->type == EV_ABS) {
+			switch (input_event->code) {
 				case ABS_X:
-					//ALOGD("ABS_X: %d", input_event.value);
-					event->acceleration.x = bma180_acceleration_convert(input_event.value);
+					data->acceleration.x = bma180_acceleration_convert(input_event->value);
 					break;
 				case ABS_Y:
-					//ALOGD("ABS_Y: %d", input_event.value);
-					event->acceleration.y = bma180_acceleration_convert(input_event.value);
+					data->acceleration.y = bma180_acceleration_convert(input_event->value);
 					break;
 				case ABS_Z:
-					//ALOGD("ABS_Z: %d", input_event.value);
-					event->acceleration.z = bma180_acceleration_convert(input_event.value);
+					data->acceleration.z = bma180_acceleration_convert(input_event->value);
 					break;
 				default:
 					continue;
 			}
-		} else if (input_event.type == EV_SYN) {
-			//ALOGD("EV_SYN");
-			if (input_event.code == SYN_REPORT)
-				//ALOGD("SYN_REPORT");
-				event->timestamp = input_timestamp(&input_event);
+		} else if (input_event->type == EV_SYN && input_event->code == SYN_REPORT) {
+			event = &events[n++];
+
+			memset(event, 0, sizeof(struct sensors_event_t));
+			event->version = sizeof(struct sensors_event_t);
+			event->sensor = handlers->handle;
+			event->type = handlers->handle;
+			event->timestamp = input_timestamp(input_event);
+
+			event->acceleration.x = data->acceleration.x;
+			event->acceleration.y = data->acceleration.y;
+			event->acceleration.z = data->acceleration.z;
+			event->acceleration.status = SENSOR_STATUS_ACCURACY_MEDIUM;
 		}
-	} while (input_event.type != EV_SYN);
-
-	data->acceleration.x = event->acceleration.x;
-	data->acceleration.y = event->acceleration.y;
-	data->acceleration.z = event->acceleration.z;
-
-	/* FIXME: No combined orientation sensor for now
-	if (data->orientation_sensor != NULL)
-		orientation_fill(data->orientation_sensor, &event->acceleration, NULL);
-	*/
+	}
 
-	return 0;
+	return n;
 }
 
 struct gta04_sensors_handlers bma180 = {
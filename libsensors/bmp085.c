@@ -37,8 +37,11 @@
 
 struct bmp085_data {
 	char path_delay[PATH_MAX];
+	int delay_ms;
 	float pressure;
 	//char path_pressure[PATH_MAX];
+
+	struct input_event input_events[INPUT_EVENTS_COUNT];
 };
 
 int bmp085_init(struct gta04_sensors_handlers *handlers,
@@ -70,7 +73,8 @@ int bmp085_init(struct gta04_sensors_handlers *handlers,
 
 	//snprintf(data->path_delay, PATH_MAX, "%s/poll_delay", path);
 	//FIXME: static path
-	snprintf(data->path_delay, PATH_MAX, "%s", "/sys/devices/platform/omap_i2c.2/i2c-2/2-0077/poll_delay");
+	gta04_sensors_path(data->path_delay, PATH_MAX, "/sys/devices/platform/omap_i2c.2/i2c-2/2-0077/poll_delay");
+	data->delay_ms = -1;
 	//path = "/sys/devices/platform/omap_i2c.2/i2c-2/2-0077";
 	//snprintf(data->path_pressure, PATH_MAX, "%s/pressure0_input", path);
 
@@ -123,7 +127,7 @@ int bmp085_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
 
 	data = (struct bmp085_data *) handlers->data;
 
-	rc = sysfs_value_write(data->path_delay, delay_ms);
+	rc = sysfs_value_write_cached(data->path_delay, delay_ms, &data->delay_ms);
 	if (rc < 0) {
 		ALOGE("%s: Unable to write sysfs value", __func__);
 		return -1;
@@ -174,57 +178,59 @@ float bmp085_convert(int value)
 }
 
 int bmp085_get_data(struct gta04_sensors_handlers *handlers,
-	struct sensors_event_t *event)
+	struct sensors_event_t *events, int count)
 {
 	struct bmp085_data *data;
-	struct input_event input_event;
-	int input_fd;
-	int rc;
+	struct input_event *input_event;
+	struct sensors_event_t *event;
+	int input_count;
+	int i, n;
 
-//	ALOGD("%s(%p, %p)", __func__, handlers, event);
+//	ALOGD("%s(%p, %p, %d)", __func__, handlers, events, count);
 
-	if (handlers == NULL || handlers->data == NULL || event == NULL)
+	if (handlers == NULL || handlers->data == NULL || events == NULL || count <= 0)
 		return -EINVAL;
 
 	data = (struct bmp085_data *) handlers->data;
 
-	input_fd = handlers->poll_fd;
-	if (input_fd < 0)
+	if (handlers->poll_fd < 0)
 		return -EINVAL;
 
-	memset(event, 0, sizeof(struct sensors_event_t));
-	event->version = sizeof(struct sensors_event_t);
-	event->sensor = handlers->handle;
-	event->type = handlers->handle;
+	// Every reported event takes at least its SYN_REPORT input event
+	input_count = count < INPUT_EVENTS_COUNT ? count : INPUT_EVENTS_COUNT;
 
-	event->pressure = data->pressure;
+	input_count = input_read(handlers->poll_fd, data->input_events, input_count);
+	if (input_count <= 0)
+		return -1;
 
-	do {
-		rc = read(input_fd, &input_event, sizeof(input_event));
-		if (rc < (int) sizeof(input_event))
-			break;
+	n = 0;
 
-		if (input_event.type == EV_ABS) {
-			switch (input_event.code) {
+	// Values may span several reads, they are kept until their SYN_REPORT
+	for (i = 0; i < input_count; i++) {
+		input_event = &data->input_events[i];
+
+		if (input_event->type == EV_ABS) {
+			switch (input_event->code) {
 				case ABS_PRESSURE:
-					event->pressure = bmp085_convert(input_event.value);
+					data->pressure = bmp085_convert(input_event->value);
 					break;
 				default:
 					continue;
 			}
-		} else if (input_event.type == EV_SYN) {
-			if (input_event.code == SYN_REPORT) {
-				event->timestamp = input_timestamp(&input_event);
-				break;
-			} else {
-				return -1;
-			}
-		}
-	} while (input_event.type != EV_SYN);
+		} else if (input_event->type == EV_SYN && input_event->code == SYN_REPORT) {
+			event = &events[n++];
 
-	data->pressure = event->pressure;
+			memset(event, 0, sizeof(struct sensors_event_t));
+			event->version = sizeof(struct sensors_event_t);
+			event->sensor = handlers->handle;
+			event->type = handlers->handle;
+			event->timestamp = input_timestamp(input_event);
 
-	return 0;
+			event->pressure = data->pressure;
+		}
+	}
+
+	return n;
 }
 
 struct gta04_sensors_handlers bmp085 = {
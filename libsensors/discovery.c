@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+/*
+ * The index maps device names to their device node and sysfs directory.
+ * It is built in one pass over sysfs, without opening any device node, and
+ * only built again when the kernel reports input or IIO devices coming or
+ * going (or when a lookup misses, if uevents are not available).
+ */
+
+struct discovery {
+	struct discovery_entry entries[DISCOVERY_ENTRIES_COUNT];
+	int entries_count;
+
+	int built;
+	int uevent_fd;
+};
+
+static struct discovery discovery = {
+	.entries_count = 0,
+	.built = 0,
+	.uevent_fd = -1,
+};
+
+static pthread_mutex_t discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int discovery_name_read(char *path, char *name, size_t length)
+{
+	char *c;
+	int rc;
+
+	memset(name, 0, length);
+
+	rc = sysfs_string_read(path, name, length - 1);
+	if (rc < 0)
+		return -1;
+
+	c = strchr(name, '\n');
+	if (c != NULL)
+		*c = '\0';
+
+	return 0;
+}
+
+static struct discovery_entry *discovery_entry_add(void)
+{
+	struct discovery_entry *entry;
+
+	if (discovery.entries_count >= DISCOVERY_ENTRIES_COUNT) {
+		ALOGE("%s: Too many devices, ignoring the others", __func__);
+		return NULL;
+	}
+
+	entry = &discovery.entries[discovery.entries_count];
+	memset(entry, 0, sizeof(struct discovery_entry));
+
+	return entry;
+}
+
+static void discovery_input_scan(void)
+{
+	struct discovery_entry *entry;
+	struct dirent *di;
+	char sysfs[PATH_MAX];
+	char path[PATH_MAX];
+	DIR *d;
+	int id;
+	int rc;
+
+	rc = gta04_sensors_path(sysfs, sizeof(sysfs), DISCOVERY_INPUT_SYSFS);
+	if (rc < 0)
+		return;
+
+	d = opendir(sysfs);
+	if (d == NULL)
+		return;
+
+	while ((di = readdir(d)) != NULL) {
+		// Event handlers are listed there too, only keep the devices
+		if (sscanf(di->d_name, "input%d", &id) != 1)
+			continue;
+
+		entry = discovery_entry_add();
+		if (entry == NULL)
+			break;
+
+		rc = snprintf(path, sizeof(path), "%s/%s/name", sysfs, di->d_name);
+		if (rc < 0 || (size_t) rc >= sizeof(path))
+			continue;
+
+		rc = discovery_name_read(path, entry->name, sizeof(entry->name));
+		if (rc < 0)
+			continue;
+
+		// A truncated path would lead drivers to the wrong files
+		rc = snprintf(entry->sysfs, sizeof(entry->sysfs), "%s/%s", sysfs, di->d_name);
+		if (rc < 0 || (size_t) rc >= sizeof(entry->sysfs))
+			continue;
+
+		entry->type = DISCOVERY_TYPE_INPUT;
+		entry->id = id;
+		discovery.entries_count++;
+	}
+
+	closedir(d);
+}
+
+static void discovery_iio_scan(void)
+{
+	struct discovery_entry *entry;
+	struct dirent *di;
+	char sysfs[PATH_MAX];
+	char dev[PATH_MAX];
+	char path[PATH_MAX];
+	DIR *d;
+	int id;
+	int rc;
+
+	rc = gta04_sensors_path(sysfs, sizeof(sysfs), DISCOVERY_IIO_SYSFS);
+	if (rc < 0)
+		return;
+
+	rc = gta04_sensors_path(dev, sizeof(dev), DISCOVERY_IIO_DEV);
+	if (rc < 0)
+		return;
+
+	d = opendir(sysfs);
+	if (d == NULL)
+		return;
+
+	while ((di = readdir(d)) != NULL) {
+		if (sscanf(di->d_name, "iio:device%d", &id) != 1)
+			continue;
+
+		entry = discovery_entry_add();
+		if (entry == NULL)
+			break;
+
+		rc = snprintf(path, sizeof(path), "%s/%s/name", sysfs, di->d_name);
+		if (rc < 0 || (size_t) rc >= sizeof(path))
+			continue;
+
+		rc = discovery_name_read(path, entry->name, sizeof(entry->name));
+		if (rc < 0)
+			continue;
+
+		// A truncated path would lead drivers to the wrong files
+		rc = snprintf(entry->sysfs, sizeof(entry->sysfs), "%s/%s", sysfs, di->d_name);
+		if (rc < 0 || (size_t) rc >= sizeof(entry->sysfs))
+			continue;
+
+		rc = snprintf(entry->node, sizeof(entry->node), "%s/%s", dev, di->d_name);
+		if (rc < 0 || (size_t) rc >= sizeof(entry->node))
+			continue;
+
+		entry->type = DISCOVERY_TYPE_IIO;
+		entry->id = id;
+		discovery.entries_count++;
+	}
+
+	closedir(d);
+}
+
+/*
+ * The event node of an input device is only looked up for the devices that
+ * are actually used.
+ */
+static int discovery_input_node(struct discovery_entry *entry)
+{
+	struct dirent *di;
+	char dev[PATH_MAX];
+	DIR *d;
+	int rc;
+
+	if (entry->node[0] != '\0')
+		return 0;
+
+	rc = gta04_sensors_path(dev, sizeof(dev), DISCOVERY_INPUT_DEV);
+	if (rc < 0)
+		return -1;
+
+	d = opendir(entry->sysfs);
+	if (d == NULL)
+		return -1;
+
+	while ((di = readdir(d)) != NULL) {
+		if (strncmp(di->d_name, "event", 5) == 0) {
+			rc = snprintf(entry->node, sizeof(entry->node), "%s/%s", dev, di->d_name);
+			if (rc < 0 || (size_t) rc >= sizeof(entry->node))
+				entry->node[0] = '\0';
+
+			break;
+		}
+	}
+
+	closedir(d);
+
+	return entry->node[0] != '\0' ? 0 : -1;
+}
+
+static int discovery_uevent_open(void)
+{
+	struct sockaddr_nl address;
+	int fd;
+	int rc;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&address, 0, sizeof(address));
+	address.nl_family = AF_NETLINK;
+	address.nl_pid = 0;
+	address.nl_groups = 1;
+
+	rc = bind(fd, (struct sockaddr *) &address, sizeof(address));
+	if (rc < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int discovery_build(void)
+{
+	discovery.entries_count = 0;
+
+	discovery_input_scan();
+	discovery_iio_scan();
+
+	discovery.built = 1;
+
+	ALOGD("%s: Indexed %d devices", __func__, discovery.entries_count);
+
+	return 0;
+}
+
+/*
+ * Drains the pending uevents and tells whether any of them was about an
+ * input or IIO device, or whether some were lost to a socket overrun.
+ */
+static int discovery_uevent_pending(void)
+{
+	char buffer[1024];
+	char *c;
+	int changed = 0;
+	int rc;
+
+	if (discovery.uevent_fd < 0)
+		return 0;
+
+	while (1) {
+		rc = recv(discovery.uevent_fd, buffer, sizeof(buffer) - 1, 0);
+		if (rc < 0 && errno == ENOBUFS) {
+			// Uevents were dropped, any of them may have been about a sensor
+			changed = 1;
+			continue;
+		}
+
+		if (rc <= 0)
+			break;
+
+		buffer[rc] = '\0';
+
+		// The message is a list of null-terminated strings
+		for (c = buffer; c < buffer + rc; c += strlen(c) + 1) {
+			if (strcmp(c, "SUBSYSTEM=input") == 0 || strcmp(c, "SUBSYSTEM=iio") == 0) {
+				changed = 1;
+				break;
+			}
+		}
+	}
+
+	return changed;
+}
+
+int discovery_refresh(void)
+{
+	pthread_mutex_lock(&discovery_mutex);
+
+	if (!discovery.built) {
+		// Subscribe before scanning, so that no change gets missed
+		if (discovery.uevent_fd < 0)
+			discovery.uevent_fd = discovery_uevent_open();
+
+		discovery_build();
+	} else if (discovery_uevent_pending()) {
+		discovery_build();
+	}
+
+	pthread_mutex_unlock(&discovery_mutex);
+
+	return 0;
+}
+
+static struct discovery_entry *discovery_lookup(const char *name, int type)
+{
+	int i;
+
+	for (i = 0; i < discovery.entries_count; i++)
+		if (discovery.entries[i].type == type && strcmp(discovery.entries[i].name, name) == 0)
+			return &discovery.entries[i];
+
+	return NULL;
+}
+
+/*
+ * The entry is copied, so that it stays valid when the index is built again.
+ */
+int discovery_find(const char *name, int type, struct discovery_entry *entry)
+{
+	struct discovery_entry *found;
+
+	if (name == NULL || entry == NULL)
+		return -EINVAL;
+
+	discovery_refresh();
+
+	pthread_mutex_lock(&discovery_mutex);
+
+	found = discovery_lookup(name, type);
+	if (found == NULL && discovery.uevent_fd < 0) {
+		// Without uevents, the device may have shown up since the last scan
+		discovery_build();
+		found = discovery_lookup(name, type);
+	}
+
+	if (found != NULL) {
+		if (found->type == DISCOVERY_TYPE_INPUT)
+			discovery_input_node(found);
+
+		memcpy(entry, found, sizeof(struct discovery_entry));
+	}
+
+	pthread_mutex_unlock(&discovery_mutex);
+
+	return found != NULL ? 0 : -1;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+int64_t gta04_sensors_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int gta04_sensors_fifo_init(struct gta04_sensors_fifo *fifo, int size)
+{
+	if (fifo == NULL || size <= 0)
+		return -EINVAL;
+
+	memset(fifo, 0, sizeof(struct gta04_sensors_fifo));
+
+	fifo->events = (struct sensors_event_t *) calloc(size, sizeof(struct sensors_event_t));
+	if (fifo->events == NULL)
+		return -1;
+
+	fifo->size = size;
+
+	return 0;
+}
+
+void gta04_sensors_fifo_deinit(struct gta04_sensors_fifo *fifo)
+{
+	if (fifo == NULL)
+		return;
+
+	if (fifo->events != NULL)
+		free(fifo->events);
+
+	memset(fifo, 0, sizeof(struct gta04_sensors_fifo));
+}
+
+void gta04_sensors_fifo_clear(struct gta04_sensors_fifo *fifo)
+{
+	if (fifo == NULL)
+		return;
+
+	fifo->head = 0;
+	fifo->count = 0;
+	fifo->due = 0;
+}
+
+/*
+ * When the FIFO is full, the oldest event is dropped to make room for the new
+ * one, so that the most recent data is never lost.
+ */
+int gta04_sensors_fifo_push(struct gta04_sensors_fifo *fifo,
+	struct sensors_event_t *event)
+{
+	int index;
+
+	if (fifo == NULL || fifo->events == NULL || event == NULL)
+		return -EINVAL;
+
+	if (fifo->count == 0)
+		fifo->deadline = gta04_sensors_time() + fifo->latency;
+
+	if (fifo->count == fifo->size) {
+		fifo->head = (fifo->head + 1) % fifo->size;
+		fifo->count--;
+		fifo->dropped++;
+	}
+
+	index = (fifo->head + fifo->count) % fifo->size;
+	memcpy(&fifo->events[index], event, sizeof(struct sensors_event_t));
+
+	fifo->count++;
+	fifo->received++;
+
+	return fifo->count;
+}
+
+int gta04_sensors_fifo_pop(struct gta04_sensors_fifo *fifo,
+	struct sensors_event_t *events, int count)
+{
+	int length;
+	int n;
+
+	if (fifo == NULL || fifo->events == NULL || events == NULL || count <= 0)
+		return 0;
+
+	n = 0;
+
+	while (n < count && fifo->count > 0) {
+		// Copy contiguous chunks at once, up to the end of the ring
+		length = fifo->size - fifo->head;
+		if (length > fifo->count)
+			length = fifo->count;
+		if (length > count - n)
+			length = count - n;
+
+		memcpy(&events[n], &fifo->events[fifo->head], length * sizeof(struct sensors_event_t));
+
+		fifo->head = (fifo->head + length) % fifo->size;
+		fifo->count -= length;
+		n += length;
+	}
+
+	fifo->delivered += n;
+
+	return n;
+}
@@ -0,0 +1,818 @@
+/*
+ * Copyright (C) 2013 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+/*
+ * The fusion engine is fed with the samples of the physical sensors by the
+ * poll loop and computes the virtual sensors in place, only when one of their
+ * inputs changed. It runs with the device FIFO mutex held.
+ */
+
+#define FUSION_INPUT_ACCELERATION	0
+#define FUSION_INPUT_MAGNETIC		1
+#define FUSION_INPUT_GYROSCOPE		2
+#define FUSION_INPUTS_COUNT		3
+
+#define FUSION_ACCELERATION		(1 << FUSION_INPUT_ACCELERATION)
+#define FUSION_MAGNETIC			(1 << FUSION_INPUT_MAGNETIC)
+#define FUSION_GYROSCOPE		(1 << FUSION_INPUT_GYROSCOPE)
+
+// Time constant of the gravity low-pass filter, in seconds
+#define FUSION_GRAVITY_TAU		0.2f
+// Proportional gain of the attitude filter correction, in rad/s
+#define FUSION_FILTER_GAIN		0.5f
+// Longer gyroscope gaps reset the attitude filters, in seconds
+#define FUSION_GAP_MAX			0.5f
+
+struct fusion_quaternion {
+	float w;
+	float x;
+	float y;
+	float z;
+};
+
+struct fusion_filter {
+	struct fusion_quaternion q;
+	int initialized;
+};
+
+struct fusion_data {
+	struct gta04_sensors_device *device;
+
+	struct gta04_sensors_handlers *inputs[FUSION_INPUTS_COUNT];
+	int inputs_needed;
+
+	sensors_vec_t acceleration;
+	sensors_vec_t magnetic;
+	sensors_vec_t gravity;
+	int available;
+
+	int64_t acceleration_timestamp;
+	int64_t gyroscope_timestamp;
+
+	struct fusion_filter rotation;
+	struct fusion_filter game_rotation;
+};
+
+static struct fusion_data fusion;
+
+static struct gta04_sensors_handlers *fusion_outputs[] = {
+	&orientation,
+	&rotation_vector,
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+	&game_rotation_vector,
+#endif
+	&gravity,
+	&linear_acceleration,
+};
+
+static int fusion_outputs_count = sizeof(fusion_outputs) /
+	sizeof(struct gta04_sensors_handlers *);
+
+/*
+ * Vectors and quaternions
+ */
+
+static float rad2deg(float v)
+{
+	return (v * 180.0f / 3.1415926535f);
+}
+
+static float vector_scalar(sensors_vec_t *v, sensors_vec_t *d)
+{
+	return v->x * d->x + v->y * d->y + v->z * d->z;
+}
+
+static float vector_length(sensors_vec_t *v)
+{
+	return sqrtf(vector_scalar(v, v));
+}
+
+static void vector_cross(sensors_vec_t *v, sensors_vec_t *d, sensors_vec_t *r)
+{
+	r->x = v->y * d->z - v->z * d->y;
+	r->y = v->z * d->x - v->x * d->z;
+	r->z = v->x * d->y - v->y * d->x;
+}
+
+static int vector_normalize(sensors_vec_t *v)
+{
+	float l;
+
+	l = vector_length(v);
+	if (l < 1e-6f)
+		return -1;
+
+	v->x /= l;
+	v->y /= l;
+	v->z /= l;
+
+	return 0;
+}
+
+static void quaternion_normalize(struct fusion_quaternion *q)
+{
+	float l;
+
+	l = sqrtf(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
+	if (l < 1e-6f) {
+		q->w = 1.0f;
+		q->x = q->y = q->z = 0.0f;
+		return;
+	}
+
+	q->w /= l;
+	q->x /= l;
+	q->y /= l;
+	q->z /= l;
+}
+
+/*
+ * Builds the quaternion rotating device coordinates to world (East, North,
+ * Up) coordinates, as the rotation vector expects, from the gravity and
+ * magnetic field directions. Without a magnetic field, the device Y axis is
+ * used as North reference, which gives an arbitrary but stable heading.
+ */
+static int quaternion_measure(sensors_vec_t *a, sensors_vec_t *m,
+	struct fusion_quaternion *q)
+{
+	sensors_vec_t east, north, up;
+	sensors_vec_t reference = { .x = 0.0f, .y = 1.0f, .z = 0.0f };
+	float r[3][3];
+	float t, s;
+	int rc;
+
+	up = *a;
+	if (vector_normalize(&up) < 0)
+		return -1;
+
+	vector_cross(m != NULL ? m : &reference, &up, &east);
+	rc = vector_normalize(&east);
+	if (rc < 0 && m == NULL) {
+		// Device Y axis is vertical, use the Z axis instead
+		reference.y = 0.0f;
+		reference.z = -1.0f;
+		vector_cross(&reference, &up, &east);
+		rc = vector_normalize(&east);
+	}
+
+	if (rc < 0)
+		return -1;
+
+	vector_cross(&up, &east, &north);
+
+	r[0][0] = east.x;  r[0][1] = east.y;  r[0][2] = east.z;
+	r[1][0] = north.x; r[1][1] = north.y; r[1][2] = north.z;
+	r[2][0] = up.x;    r[2][1] = up.y;    r[2][2] = up.z;
+
+	t = r[0][0] + r[1][1] + r[2][2];
+	if (t > 0.0f) {
+		s = 0.5f / sqrtf(t + 1.0f);
+		q->w = 0.25f / s;
+		q->x = (r[2][1] - r[1][2]) * s;
+		q->y = (r[0][2] - r[2][0]) * s;
+		q->z = (r[1][0] - r[0][1]) * s;
+	} else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+		s = 2.0f * sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+		q->w = (r[2][1] - r[1][2]) / s;
+		q->x = 0.25f * s;
+		q->y = (r[0][1] + r[1][0]) / s;
+		q->z = (r[0][2] + r[2][0]) / s;
+	} else if (r[1][1] > r[2][2]) {
+		s = 2.0f * sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+		q->w = (r[0][2] - r[2][0]) / s;
+		q->x = (r[0][1] + r[1][0]) / s;
+		q->y = 0.25f * s;
+		q->z = (r[1][2] + r[2][1]) / s;
+	} else {
+		s = 2.0f * sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+		q->w = (r[1][0] - r[0][1]) / s;
+		q->x = (r[0][2] + r[2][0]) / s;
+		q->y = (r[1][2] + r[2][1]) / s;
+		q->z = 0.25f * s;
+	}
+
+	quaternion_normalize(q);
+
+	return 0;
+}
+
+/*
+ * Attitude filter
+ *
+ * The gyroscope rate is integrated and corrected with a proportional term
+ * pulling the estimated Up (and North, when a magnetic field is given)
+ * directions towards the measured ones (Mahony filter).
+ */
+
+static void fusion_filter_update(struct fusion_filter *filter,
+	sensors_vec_t *gyro, sensors_vec_t *a, sensors_vec_t *m, float dt)
+{
+	struct fusion_quaternion *q = &filter->q;
+	struct fusion_quaternion d;
+	sensors_vec_t up, north, error, e;
+	sensors_vec_t an, mn, h;
+	float gx, gy, gz;
+	float by, bz;
+
+	if (!filter->initialized) {
+		if (quaternion_measure(a, m, q) < 0)
+			return;
+
+		filter->initialized = 1;
+		return;
+	}
+
+	// Second and third rows of the device to world rotation matrix
+	north.x = 2.0f * (q->x * q->y + q->w * q->z);
+	north.y = 1.0f - 2.0f * (q->x * q->x + q->z * q->z);
+	north.z = 2.0f * (q->y * q->z - q->w * q->x);
+	up.x = 2.0f * (q->x * q->z - q->w * q->y);
+	up.y = 2.0f * (q->y * q->z + q->w * q->x);
+	up.z = 1.0f - 2.0f * (q->x * q->x + q->y * q->y);
+
+	error.x = error.y = error.z = 0.0f;
+
+	an = *a;
+	if (vector_normalize(&an) == 0) {
+		vector_cross(&an, &up, &e);
+		error.x += e.x;
+		error.y += e.y;
+		error.z += e.z;
+	}
+
+	if (m != NULL) {
+		mn = *m;
+		if (vector_normalize(&mn) == 0) {
+			// Magnetic field in world coordinates, reduced to North and Up
+			h.x = (1.0f - 2.0f * (q->y * q->y + q->z * q->z)) * mn.x + 2.0f * (q->x * q->y - q->w * q->z) * mn.y + 2.0f * (q->x * q->z + q->w * q->y) * mn.z;
+			h.y = vector_scalar(&north, &mn);
+			h.z = vector_scalar(&up, &mn);
+
+			by = sqrtf(h.x * h.x + h.y * h.y);
+			bz = h.z;
+
+			h.x = by * north.x + bz * up.x;
+			h.y = by * north.y + bz * up.y;
+			h.z = by * north.z + bz * up.z;
+
+			vector_cross(&mn, &h, &e);
+			error.x += e.x;
+			error.y += e.y;
+			error.z += e.z;
+		}
+	}
+
+	gx = (gyro->x + FUSION_FILTER_GAIN * error.x) * 0.5f * dt;
+	gy = (gyro->y + FUSION_FILTER_GAIN * error.y) * 0.5f * dt;
+	gz = (gyro->z + FUSION_FILTER_GAIN * error.z) * 0.5f * dt;
+
+	d.w = -q->x * gx - q->y * gy - q->z * gz;
+	d.x = q->w * gx + q->y * gz - q->z * gy;
+	d.y = q->w * gy - q->x * gz + q->z * gx;
+	d.z = q->w * gz + q->x * gy - q->y * gx;
+
+	q->w += d.w;
+	q->x += d.x;
+	q->y += d.y;
+	q->z += d.z;
+
+	quaternion_normalize(q);
+}
+
+/*
+ * Outputs
+ */
+
+void orientation_calculate(sensors_vec_t *a, sensors_vec_t *m, sensors_vec_t *o)
+{
+	float azimuth, pitch, roll;
+	float la, sinp, cosp, sinr, cosr, x, y;
+
+	if (a == NULL || m == NULL || o == NULL)
+		return;
+
+	la = vector_length(a);
+	pitch = asinf(-(a->y) / la);
+	roll = asinf((a->x) / la);
+
+	sinp = sinf(pitch);
+	cosp = cosf(pitch);
+	sinr = sinf(roll);
+	cosr = cosf(roll);
+
+	y = -(m->x) * cosr + m->z * sinr;
+	x = m->x * sinp * sinr + m->y * cosp + m->z * sinp * cosr;
+	azimuth = atan2f(y, x);
+
+	o->azimuth = rad2deg(azimuth);
+	o->pitch = rad2deg(pitch);
+	o->roll = rad2deg(roll);
+
+	if (o->azimuth < 0)
+		o->azimuth += 360.0f;
+}
+
+static struct sensors_event_t *fusion_event(struct gta04_sensors_handlers *handlers,
+	int64_t timestamp, struct sensors_event_t *event)
+{
+	if (handlers == NULL || !(handlers->needed & GTA04_SENSORS_NEEDED_API))
+		return NULL;
+
+	if (!gta04_sensors_rate_accept(handlers, GTA04_SENSORS_CLIENT_API, timestamp))
+		return NULL;
+
+	memset(event, 0, sizeof(struct sensors_event_t));
+	event->version = sizeof(struct sensors_event_t);
+	event->sensor = handlers->handle;
+	event->type = handlers->handle;
+	event->timestamp = timestamp;
+
+	return event;
+}
+
+static void fusion_rotation_vector(struct gta04_sensors_handlers *handlers,
+	int64_t timestamp, struct fusion_quaternion *q, int heading)
+{
+	struct sensors_event_t event;
+
+	if (fusion_event(handlers, timestamp, &event) == NULL)
+		return;
+
+	// Keep the scalar part positive, both signs describe the same rotation
+	if (q->w < 0.0f) {
+		event.data[0] = -q->x;
+		event.data[1] = -q->y;
+		event.data[2] = -q->z;
+		event.data[3] = -q->w;
+	} else {
+		event.data[0] = q->x;
+		event.data[1] = q->y;
+		event.data[2] = q->z;
+		event.data[3] = q->w;
+	}
+
+	// Heading accuracy is unknown
+	if (heading)
+		event.data[4] = -1.0f;
+
+	gta04_sensors_fifo_push(&handlers->fifo, &event);
+}
+
+static void fusion_acceleration(int64_t timestamp)
+{
+	struct sensors_event_t event;
+	float dt, alpha;
+
+	if (!(fusion.available & FUSION_ACCELERATION) || fusion.acceleration_timestamp == 0) {
+		fusion.gravity = fusion.acceleration;
+	} else {
+		dt = (timestamp - fusion.acceleration_timestamp) / 1000000000.0f;
+		if (dt < 0.0f || dt > FUSION_GAP_MAX)
+			dt = FUSION_GAP_MAX;
+
+		alpha = dt / (FUSION_GRAVITY_TAU + dt);
+		fusion.gravity.x += alpha * (fusion.acceleration.x - fusion.gravity.x);
+		fusion.gravity.y += alpha * (fusion.acceleration.y - fusion.gravity.y);
+		fusion.gravity.z += alpha * (fusion.acceleration.z - fusion.gravity.z);
+	}
+
+	fusion.acceleration_timestamp = timestamp;
+	fusion.available |= FUSION_ACCELERATION;
+
+	if (fusion_event(&gravity, timestamp, &event) != NULL) {
+		event.acceleration.x = fusion.gravity.x;
+		event.acceleration.y = fusion.gravity.y;
+		event.acceleration.z = fusion.gravity.z;
+		event.acceleration.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+
+		gta04_sensors_fifo_push(&gravity.fifo, &event);
+	}
+
+	if (fusion_event(&linear_acceleration, timestamp, &event) != NULL) {
+		event.acceleration.x = fusion.acceleration.x - fusion.gravity.x;
+		event.acceleration.y = fusion.acceleration.y - fusion.gravity.y;
+		event.acceleration.z = fusion.acceleration.z - fusion.gravity.z;
+		event.acceleration.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+
+		gta04_sensors_fifo_push(&linear_acceleration.fifo, &event);
+	}
+}
+
+static void fusion_orientation(int64_t timestamp)
+{
+	struct sensors_event_t event;
+	struct fusion_quaternion q;
+
+	if ((fusion.available & (FUSION_ACCELERATION | FUSION_MAGNETIC)) != (FUSION_ACCELERATION | FUSION_MAGNETIC))
+		return;
+
+	if (fusion_event(&orientation, timestamp, &event) != NULL) {
+		orientation_calculate(&fusion.gravity, &fusion.magnetic, &event.orientation);
+		event.orientation.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+
+		gta04_sensors_fifo_push(&orientation.fifo, &event);
+	}
+
+	// Without a gyroscope, the rotation vector follows the measurements
+	if (fusion.inputs[FUSION_INPUT_GYROSCOPE] == NULL && quaternion_measure(&fusion.gravity, &fusion.magnetic, &q) == 0)
+		fusion_rotation_vector(&rotation_vector, timestamp, &q, 1);
+}
+
+static void fusion_gyroscope(sensors_vec_t *gyro, int64_t timestamp)
+{
+	float dt;
+
+	if (fusion.gyroscope_timestamp == 0) {
+		fusion.gyroscope_timestamp = timestamp;
+		return;
+	}
+
+	dt = (timestamp - fusion.gyroscope_timestamp) / 1000000000.0f;
+	fusion.gyroscope_timestamp = timestamp;
+
+	if (dt <= 0.0f)
+		return;
+
+	if (dt > FUSION_GAP_MAX) {
+		fusion.rotation.initialized = 0;
+		fusion.game_rotation.initialized = 0;
+	}
+
+	if (!(fusion.available & FUSION_ACCELERATION))
+		return;
+
+	if ((rotation_vector.needed & GTA04_SENSORS_NEEDED_API) && (fusion.available & FUSION_MAGNETIC)) {
+		fusion_filter_update(&fusion.rotation, gyro, &fusion.acceleration, &fusion.magnetic, dt);
+		if (fusion.rotation.initialized)
+			fusion_rotation_vector(&rotation_vector, timestamp, &fusion.rotation.q, 1);
+	}
+
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+	if (game_rotation_vector.needed & GTA04_SENSORS_NEEDED_API) {
+		fusion_filter_update(&fusion.game_rotation, gyro, &fusion.acceleration, NULL, dt);
+		if (fusion.game_rotation.initialized)
+			fusion_rotation_vector(&game_rotation_vector, timestamp, &fusion.game_rotation.q, 0);
+	}
+#endif
+}
+
+/**
+ * fusion_input - function to feed the fusion engine with a physical sample
+ * Must be called with the device FIFO mutex held.
+ */
+int fusion_input(struct sensors_event_t *event)
+{
+	if (event == NULL)
+		return -EINVAL;
+
+	switch (event->type) {
+		case SENSOR_TYPE_ACCELEROMETER:
+			fusion.acceleration = event->acceleration;
+			fusion_acceleration(event->timestamp);
+			fusion_orientation(event->timestamp);
+			break;
+		case SENSOR_TYPE_MAGNETIC_FIELD:
+			fusion.magnetic = event->magnetic;
+			fusion.available |= FUSION_MAGNETIC;
+			fusion_orientation(event->timestamp);
+			break;
+		case SENSOR_TYPE_GYROSCOPE:
+			fusion_gyroscope(&event->gyro, event->timestamp);
+			break;
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Virtual sensors
+ */
+
+static int fusion_inputs(struct gta04_sensors_handlers *handlers)
+{
+	int inputs = 0;
+
+	switch (handlers->handle) {
+		case SENSOR_TYPE_ORIENTATION:
+			inputs = FUSION_ACCELERATION | FUSION_MAGNETIC;
+			break;
+		case SENSOR_TYPE_ROTATION_VECTOR:
+			inputs = FUSION_ACCELERATION | FUSION_MAGNETIC | FUSION_GYROSCOPE;
+			break;
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+		case SENSOR_TYPE_GAME_ROTATION_VECTOR:
+			inputs = FUSION_ACCELERATION | FUSION_GYROSCOPE;
+			break;
+#endif
+		case SENSOR_TYPE_GRAVITY:
+		case SENSOR_TYPE_LINEAR_ACCELERATION:
+			inputs = FUSION_ACCELERATION;
+			break;
+	}
+
+	// The rotation vector does without gyroscope, at a lower quality
+	if (handlers->handle == SENSOR_TYPE_ROTATION_VECTOR && fusion.inputs[FUSION_INPUT_GYROSCOPE] == NULL)
+		inputs &= ~FUSION_GYROSCOPE;
+
+	return inputs;
+}
+
+/*
+ * Runs each physical sensor at the fastest rate of the active virtual
+ * sensors that use it.
+ */
+static void fusion_rates_update(void)
+{
+	int64_t delay;
+	int inputs;
+	int i, j;
+
+	for (i = 0; i < FUSION_INPUTS_COUNT; i++) {
+		if (fusion.inputs[i] == NULL)
+			continue;
+
+		delay = 0;
+
+		for (j = 0; j < fusion_outputs_count; j++) {
+			if (!fusion_outputs[j]->activated || fusion_outputs[j]->rate.delay <= 0)
+				continue;
+
+			inputs = fusion_inputs(fusion_outputs[j]);
+			if (!(inputs & (1 << i)))
+				continue;
+
+			if (delay == 0 || fusion_outputs[j]->rate.delay < delay)
+				delay = fusion_outputs[j]->rate.delay;
+		}
+
+		// Redundant chip settings are not written again by the drivers
+		gta04_sensors_rate_request(fusion.inputs[i], GTA04_SENSORS_CLIENT_FUSION, delay);
+	}
+}
+
+/*
+ * Enables the physical sensors needed by the active virtual sensors and
+ * disables the ones that are no longer needed.
+ */
+static void fusion_inputs_update(void)
+{
+	struct gta04_sensors_handlers *input;
+	int needed = 0;
+	int i;
+
+	for (i = 0; i < fusion_outputs_count; i++)
+		if (fusion_outputs[i]->activated)
+			needed |= fusion_inputs(fusion_outputs[i]);
+
+	for (i = 0; i < FUSION_INPUTS_COUNT; i++) {
+		input = fusion.inputs[i];
+		if (input == NULL)
+			continue;
+
+		if ((needed & (1 << i)) && !(fusion.inputs_needed & (1 << i))) {
+			input->needed |= GTA04_SENSORS_NEEDED_FUSION;
+			if (input->needed == GTA04_SENSORS_NEEDED_FUSION && input->activate != NULL) {
+				gta04_sensors_handlers_lock(input);
+				input->activate(input);
+				gta04_sensors_handlers_unlock(input);
+			}
+		} else if (!(needed & (1 << i)) && (fusion.inputs_needed & (1 << i))) {
+			input->needed &= ~GTA04_SENSORS_NEEDED_FUSION;
+			if (input->needed == 0 && input->deactivate != NULL) {
+				gta04_sensors_handlers_lock(input);
+				input->deactivate(input);
+				gta04_sensors_handlers_unlock(input);
+			}
+
+			fusion.available &= ~(1 << i);
+		}
+	}
+
+	fusion.inputs_needed = needed;
+
+	fusion_rates_update();
+}
+
+int fusion_init(struct gta04_sensors_handlers *handlers,
+	struct gta04_sensors_device *device)
+{
+	int inputs;
+	int i;
+
+	ALOGD("%s(%p, %p)", __func__, handlers, device);
+
+	if (handlers == NULL || device == NULL)
+		return -EINVAL;
+
+	if (fusion.device == NULL) {
+		memset(&fusion, 0, sizeof(fusion));
+		fusion.device = device;
+
+		for (i = 0; i < device->handlers_count; i++) {
+			if (device->handlers[i] == NULL || device->handlers[i]->data == NULL)
+				continue;
+
+			if (device->handlers[i]->handle == SENSOR_TYPE_ACCELEROMETER)
+				fusion.inputs[FUSION_INPUT_ACCELERATION] = device->handlers[i];
+			else if (device->handlers[i]->handle == SENSOR_TYPE_MAGNETIC_FIELD)
+				fusion.inputs[FUSION_INPUT_MAGNETIC] = device->handlers[i];
+			else if (device->handlers[i]->handle == SENSOR_TYPE_GYROSCOPE)
+				fusion.inputs[FUSION_INPUT_GYROSCOPE] = device->handlers[i];
+		}
+	}
+
+	inputs = fusion_inputs(handlers);
+
+	for (i = 0; i < FUSION_INPUTS_COUNT; i++) {
+		if ((inputs & (1 << i)) && fusion.inputs[i] == NULL) {
+			ALOGE("%s: Missing sensors for %s", __func__, handlers->name);
+			handlers->data = NULL;
+			return -1;
+		}
+	}
+
+	handlers->poll_fd = -1;
+	handlers->data = (void *) &fusion;
+
+	return 0;
+}
+
+int fusion_deinit(struct gta04_sensors_handlers *handlers)
+{
+	ALOGD("%s(%p)", __func__, handlers);
+
+	if (handlers == NULL)
+		return -EINVAL;
+
+	handlers->activated = 0;
+	handlers->data = NULL;
+
+	fusion.device = NULL;
+
+	return 0;
+}
+
+int fusion_activate(struct gta04_sensors_handlers *handlers)
+{
+	ALOGD("%s(%p)", __func__, handlers);
+
+	if (handlers == NULL || handlers->data == NULL || fusion.device == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fusion.device->fifo_mutex);
+
+	if (handlers->handle == SENSOR_TYPE_ROTATION_VECTOR)
+		fusion.rotation.initialized = 0;
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+	else if (handlers->handle == SENSOR_TYPE_GAME_ROTATION_VECTOR)
+		fusion.game_rotation.initialized = 0;
+#endif
+
+	handlers->activated = 1;
+	fusion_inputs_update();
+
+	pthread_mutex_unlock(&fusion.device->fifo_mutex);
+
+	return 0;
+}
+
+int fusion_deactivate(struct gta04_sensors_handlers *handlers)
+{
+	ALOGD("%s(%p)", __func__, handlers);
+
+	if (handlers == NULL || handlers->data == NULL || fusion.device == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fusion.device->fifo_mutex);
+
+	handlers->activated = 0;
+	fusion_inputs_update();
+
+	pthread_mutex_unlock(&fusion.device->fifo_mutex);
+
+	return 0;
+}
+
+/*
+ * The delay is the one arbitrated for the virtual sensor, which is already
+ * in its rate. Must be called with the device FIFO mutex held.
+ */
+int fusion_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
+{
+	ALOGD("%s(%p, %ld)", __func__, handlers, delay);
+
+	if (handlers == NULL || handlers->data == NULL)
+		return -EINVAL;
+
+	fusion_rates_update();
+
+	return 0;
+}
+
+struct gta04_sensors_handlers orientation = {
+	.name = "Orientation",
+	.handle = SENSOR_TYPE_ORIENTATION,
+	.init = fusion_init,
+	.deinit = fusion_deinit,
+	.activate = fusion_activate,
+	.deactivate = fusion_deactivate,
+	.set_delay = fusion_set_delay,
+	.get_data = NULL,
+	.activated = 0,
+	.needed = 0,
+	.poll_fd = -1,
+	.data = NULL,
+};
+
+struct gta04_sensors_handlers rotation_vector = {
+	.name = "Rotation Vector",
+	.handle = SENSOR_TYPE_ROTATION_VECTOR,
+	.init = fusion_init,
+	.deinit = fusion_deinit,
+	.activate = fusion_activate,
+	.deactivate = fusion_deactivate,
+	.set_delay = fusion_set_delay,
+	.get_data = NULL,
+	.activated = 0,
+	.needed = 0,
+	.poll_fd = -1,
+	.data = NULL,
+};
+
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+struct gta04_sensors_handlers game_rotation_vector = {
+	.name = "Game Rotation Vector",
+	.handle = SENSOR_TYPE_GAME_ROTATION_VECTOR,
+	.init = fusion_init,
+	.deinit = fusion_deinit,
+	.activate = fusion_activate,
+	.deactivate = fusion_deactivate,
+	.set_delay = fusion_set_delay,
+	.get_data = NULL,
+	.activated = 0,
+	.needed = 0,
+	.poll_fd = -1,
+	.data = NULL,
+};
+#endif
+
+struct gta04_sensors_handlers gravity = {
+	.name = "Gravity",
+	.handle = SENSOR_TYPE_GRAVITY,
+	.init = fusion_init,
+	.deinit = fusion_deinit,
+	.activate = fusion_activate,
+	.deactivate = fusion_deactivate,
+	.set_delay = fusion_set_delay,
+	.get_data = NULL,
+	.activated = 0,
+	.needed = 0,
+	.poll_fd = -1,
+	.data = NULL,
+};
+
+struct gta04_sensors_handlers linear_acceleration = {
+	.name = "Linear Acceleration",
+	.handle = SENSOR_TYPE_LINEAR_ACCELERATION,
+	.init = fusion_init,
+	.deinit = fusion_deinit,
+	.activate = fusion_activate,
+	.deactivate = fusion_deactivate,
+	.set_delay = fusion_set_delay,
+	.get_data = NULL,
+	.activated = 0,
+	.needed = 0,
+	.poll_fd = -1,
+	.data = NULL,
+};
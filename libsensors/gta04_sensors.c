@@ -20,13 +20,16 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <poll.h>
-#include <sys/select.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <hardware/sensors.h>
 #include <hardware/hardware.h>
 
 #define LOG_TAG "gta04_sensors"
 #include <utils/Log.h>
+#include <cutils/properties.h>
 
 #include "gta04_sensors.h"
 
@@ -34,32 +37,54 @@
  * Sensors list
  */
 /* Values (from sensors.h):
- * name, vendor, hw/driver version, handle, type, maxRange (SI units), resolution, power (mA), minDelay, reserved
+ * name, vendor, hw/driver version, handle, type, maxRange (SI units), resolution, power (mA), minDelay,
+ * fifoReservedEventCount and fifoMaxEventCount (HAL 1.1), reserved
  */
 struct sensor_t gta04_sensors[] = {
 	{ "BMA180 Acceleration Sensor", "Bosch", 1, SENSOR_TYPE_ACCELEROMETER,
-		SENSOR_TYPE_ACCELEROMETER, 2 * GRAVITY_EARTH, 0.0096f, 0.25f, 10000, {}, },
+		SENSOR_TYPE_ACCELEROMETER, 2 * GRAVITY_EARTH, 0.0096f, 0.25f, 10000, GTA04_SENSORS_FIFO_COUNTS {}, },
 	{ "ITG3200 Gyroscope Sensor", "InvenSense", 1, SENSOR_TYPE_GYROSCOPE,
-		SENSOR_TYPE_GYROSCOPE, 500.0f * (3.1415926535f / 180.0f), (70.0f / 4000.0f) * (3.1415926535f / 180.0f), 6.1f, 5000, {}, },
+		SENSOR_TYPE_GYROSCOPE, 500.0f * (3.1415926535f / 180.0f), (70.0f / 4000.0f) * (3.1415926535f / 180.0f), 6.1f, 5000, GTA04_SENSORS_FIFO_COUNTS {}, },
 	{ "HMC5883L Magnetic Sensor", "Honeywell", 1, SENSOR_TYPE_MAGNETIC_FIELD,
-		SENSOR_TYPE_MAGNETIC_FIELD, 500.0f * (3.1415926535f / 180.0f), (70.0f / 4000.0f) * (3.1415926535f / 180.0f), 6.1f, 5000, {}, }, //TODO: adopt parameters
+		SENSOR_TYPE_MAGNETIC_FIELD, 500.0f * (3.1415926535f / 180.0f), (70.0f / 4000.0f) * (3.1415926535f / 180.0f), 6.1f, 5000, GTA04_SENSORS_FIFO_COUNTS {}, }, //TODO: adopt parameters
 	{ "TEPT4400 Light Sensor", "Vishay", 1, SENSOR_TYPE_LIGHT,
-		SENSOR_TYPE_LIGHT, 10.0f, 0.1f, 10.0f, 5000, {}, }, //TODO: power, min_delay
-	{ "Orientation Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_ORIENTATION,
-		SENSOR_TYPE_ORIENTATION, 360.0f, 0.1f, 0.0f, 10000, {}, },
+		SENSOR_TYPE_LIGHT, 10.0f, 0.1f, 10.0f, 5000, GTA04_SENSORS_FIFO_COUNTS {}, }, //TODO: power, min_delay
 	{ "BMP085 Pressure Sensor", "Bosch", 1, SENSOR_TYPE_PRESSURE,
-		SENSOR_TYPE_PRESSURE, 1000.0f, 1.0f, 1.0f, 66700, {}, },
+		SENSOR_TYPE_PRESSURE, 1000.0f, 1.0f, 1.0f, 66700, GTA04_SENSORS_FIFO_COUNTS {}, },
+	{ "Orientation Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_ORIENTATION,
+		SENSOR_TYPE_ORIENTATION, 360.0f, 0.1f, 0.0f, 10000, GTA04_SENSORS_FIFO_COUNTS {}, },
+	{ "Rotation Vector Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_ROTATION_VECTOR,
+		SENSOR_TYPE_ROTATION_VECTOR, 1.0f, 1.0f / (1 << 24), 6.35f, 5000, GTA04_SENSORS_FIFO_COUNTS {}, },
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+	{ "Game Rotation Vector Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_GAME_ROTATION_VECTOR,
+		SENSOR_TYPE_GAME_ROTATION_VECTOR, 1.0f, 1.0f / (1 << 24), 6.35f, 5000, GTA04_SENSORS_FIFO_COUNTS {}, },
+#endif
+	{ "Gravity Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_GRAVITY,
+		SENSOR_TYPE_GRAVITY, GRAVITY_EARTH, 0.0096f, 0.25f, 10000, GTA04_SENSORS_FIFO_COUNTS {}, },
+	{ "Linear Acceleration Sensor", "GTA04 Sensors", 1, SENSOR_TYPE_LINEAR_ACCELERATION,
+		SENSOR_TYPE_LINEAR_ACCELERATION, 2 * GRAVITY_EARTH, 0.0096f, 0.25f, 10000, GTA04_SENSORS_FIFO_COUNTS {}, },
 };
 
 int gta04_sensors_count = sizeof(gta04_sensors) / sizeof(struct sensor_t);
 
+// Sensors whose handlers initialized, as published to the framework
+struct sensor_t gta04_sensors_available[sizeof(gta04_sensors) / sizeof(struct sensor_t)];
+int gta04_sensors_available_count = -1;
+
 struct gta04_sensors_handlers *gta04_sensors_handlers[] = {
 	&bma180,
 	&itg3200,
 	&hmc5883l,
 	&tept4400,
-	&orientation,
 	&bmp085,
+	// Virtual sensors come last, they need the physical ones initialized
+	&orientation,
+	&rotation_vector,
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+	&game_rotation_vector,
+#endif
+	&gravity,
+	&linear_acceleration,
 };
 
 int gta04_sensors_handlers_count = sizeof(gta04_sensors_handlers) /
@@ -71,15 +96,14 @@ int gta04_sensors_handlers_count = sizeof(gta04_sensors_handlers) /
 
 int gta04_sensors_hwdetect()
 {
-	char buf[50];
-	int rc;
-	if (input_open("bma150") < 0) {
+	struct discovery_entry entry;
+	if (discovery_find("bma150", DISCOVERY_TYPE_INPUT, &entry) < 0) {
 	//rc = sysfs_string_read("/sys/class/input/input1/name", (char*)&buf, 6);
 	//if(strncmp(buf, "bma150", 6) != 0 && strncmp(buf, "bma180", 6) != 0) {
 		//switch accel, because the default BMA180 is not available
 		ALOGD("BMA150/180 accel not available, switching to LIS302.");
 		struct sensor_t lis302_data = { "LIS302 Acceleration Sensor", "STMicroelectronics", 1, SENSOR_TYPE_ACCELEROMETER,
-						SENSOR_TYPE_ACCELEROMETER, 2 * GRAVITY_EARTH, 0.0096f, 0.25f, 10000, {}, };
+						SENSOR_TYPE_ACCELEROMETER, 2 * GRAVITY_EARTH, 0.0096f, 0.25f, 10000, GTA04_SENSORS_FIFO_COUNTS {}, };
 		gta04_sensors[0] = lis302_data;
 		gta04_sensors_handlers[0] = &lis302; //defined in gta04_sensors.h
 	}
@@ -89,11 +113,46 @@ int gta04_sensors_hwdetect()
 	return 0;
 }
 
+static struct gta04_sensors_handlers *gta04_sensors_handlers_find(
+	struct gta04_sensors_device *device, int handle)
+{
+	int i;
+
+	if (device->handlers == NULL || device->handlers_count <= 0)
+		return NULL;
+
+	for (i = 0; i < device->handlers_count; i++) {
+		if (device->handlers[i] == NULL)
+			continue;
+
+		if (device->handlers[i]->handle == handle)
+			return device->handlers[i];
+	}
+
+	return NULL;
+}
+
+static void gta04_sensors_list_update(struct gta04_sensors_device *device)
+{
+	int i;
+
+	gta04_sensors_available_count = 0;
+
+	for (i = 0; i < gta04_sensors_count; i++) {
+		if (gta04_sensors_handlers_find(device, gta04_sensors[i].handle) == NULL)
+			continue;
+
+		gta04_sensors_available[gta04_sensors_available_count++] = gta04_sensors[i];
+	}
+}
+
 int gta04_sensors_activate(struct sensors_poll_device_t *dev, int handle,
 	int enabled)
 {
 	struct gta04_sensors_device *device;
-	int i;
+	struct gta04_sensors_handlers *handlers;
+	struct gta04_sensors_fifo *fifo;
+	int rc;
 
 	ALOGD("%s(%p, %d, %d)", __func__, dev, handle, enabled);
 
@@ -105,35 +164,66 @@ int gta04_sensors_activate(struct sensors_poll_device_t *dev, int handle,
 	if (device->handlers == NULL || device->handlers_count <= 0)
 		return -EINVAL;
 
-	for (i = 0; i < device->handlers_count; i++) {
-		if (device->handlers[i] == NULL)
-			continue;
+	handlers = gta04_sensors_handlers_find(device, handle);
+	if (handlers == NULL)
+		return -1;
+
+	if (enabled && handlers->activate != NULL) {
+		pthread_mutex_lock(&device->fifo_mutex);
+		gta04_sensors_stats_clear(&handlers->stats);
+		pthread_mutex_unlock(&device->fifo_mutex);
+
+		handlers->needed |= GTA04_SENSORS_NEEDED_API;
+		if (handlers->needed == GTA04_SENSORS_NEEDED_API) {
+			gta04_sensors_handlers_lock(handlers);
+			rc = handlers->activate(handlers);
+			gta04_sensors_handlers_unlock(handlers);
+		} else {
+			rc = 0;
+		}
+	} else if (!enabled && handlers->deactivate != NULL) {
+		fifo = &handlers->fifo;
 
-		if (device->handlers[i]->handle == handle) {
-			if (enabled && device->handlers[i]->activate != NULL) {
-				device->handlers[i]->needed |= GTA04_SENSORS_NEEDED_API;
-				if (device->handlers[i]->needed == GTA04_SENSORS_NEEDED_API)
-					return device->handlers[i]->activate(device->handlers[i]);
-				else
-					return 0;
-			} else if (!enabled && device->handlers[i]->deactivate != NULL) {
-				device->handlers[i]->needed &= ~GTA04_SENSORS_NEEDED_API;
-				if (device->handlers[i]->needed == 0)
-					return device->handlers[i]->deactivate(device->handlers[i]);
-				else
-					return 0;
-			}
+		pthread_mutex_lock(&device->fifo_mutex);
+
+		ALOGD("%s: %u events received, %u delivered, %u dropped in %u wakeups", handlers->name, fifo->received, fifo->delivered, fifo->dropped, device->wakeups);
+		gta04_sensors_stats_dump(handlers, -1);
+
+		// Batched events of a disabled sensor are not reported
+		gta04_sensors_fifo_clear(fifo);
+		fifo->flush = 0;
+
+		pthread_mutex_unlock(&device->fifo_mutex);
+
+		handlers->needed &= ~GTA04_SENSORS_NEEDED_API;
+		if (handlers->needed == 0) {
+			gta04_sensors_handlers_lock(handlers);
+			rc = handlers->deactivate(handlers);
+			gta04_sensors_handlers_unlock(handlers);
+		} else {
+			rc = 0;
 		}
+	} else {
+		return -1;
 	}
 
-	return -1;
+	if (rc < 0)
+		return rc;
+
+	// The remaining clients may need a different rate
+	pthread_mutex_lock(&device->fifo_mutex);
+	gta04_sensors_rate_update(handlers);
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return 0;
 }
 
 int gta04_sensors_set_delay(struct sensors_poll_device_t *dev, int handle,
 	int64_t ns)
 {
 	struct gta04_sensors_device *device;
-	int i;
+	struct gta04_sensors_handlers *handlers;
+	int rc;
 
 	ALOGD("%s(%p, %d, %ld)", __func__, dev, handle, (long int) ns);
 
@@ -145,66 +235,402 @@ int gta04_sensors_set_delay(struct sensors_poll_device_t *dev, int handle,
 	if (device->handlers == NULL || device->handlers_count <= 0)
 		return -EINVAL;
 
+	handlers = gta04_sensors_handlers_find(device, handle);
+	if (handlers == NULL)
+		return 0;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+	rc = gta04_sensors_rate_request(handlers, GTA04_SENSORS_CLIENT_API, ns);
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return rc;
+}
+
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+int gta04_sensors_batch(struct sensors_poll_device_1 *dev, int handle,
+	int flags, int64_t period_ns, int64_t timeout)
+{
+	struct gta04_sensors_device *device;
+	struct gta04_sensors_handlers *handlers;
+	int rc;
+
+	ALOGD("%s(%p, %d, %d, %lld, %lld)", __func__, dev, handle, flags, (long long int) period_ns, (long long int) timeout);
+
+	if (dev == NULL || period_ns < 0 || timeout < 0)
+		return -EINVAL;
+
+	device = (struct gta04_sensors_device *) dev;
+
+	handlers = gta04_sensors_handlers_find(device, handle);
+	if (handlers == NULL || handlers->fifo.events == NULL)
+		return -EINVAL;
+
+	if (flags & SENSORS_BATCH_DRY_RUN)
+		return 0;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	rc = gta04_sensors_rate_request(handlers, GTA04_SENSORS_CLIENT_API, period_ns);
+	if (rc < 0) {
+		pthread_mutex_unlock(&device->fifo_mutex);
+		return rc;
+	}
+
+	handlers->fifo.latency = timeout;
+
+	// Events already held must not wait longer than the new timeout
+	if (handlers->fifo.count > 0 && handlers->fifo.deadline > gta04_sensors_time() + timeout)
+		handlers->fifo.deadline = gta04_sensors_time() + timeout;
+
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	eventfd_write(device->flush_fd, 1);
+
+	return 0;
+}
+
+int gta04_sensors_flush(struct sensors_poll_device_1 *dev, int handle)
+{
+	struct gta04_sensors_device *device;
+	struct gta04_sensors_handlers *handlers;
+
+	ALOGD("%s(%p, %d)", __func__, dev, handle);
+
+	if (dev == NULL)
+		return -EINVAL;
+
+	device = (struct gta04_sensors_device *) dev;
+
+	handlers = gta04_sensors_handlers_find(device, handle);
+	if (handlers == NULL || !(handlers->needed & GTA04_SENSORS_NEEDED_API))
+		return -EINVAL;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+	handlers->fifo.flush++;
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	eventfd_write(device->flush_fd, 1);
+
+	return 0;
+}
+#endif
+
+/*
+ * Hands out the events of every FIFO that is due: when its sensor is not
+ * batched, when its oldest event reached the batch timeout, when it is full
+ * or when a flush was requested. A flush complete event follows the last
+ * event of a flushed FIFO.
+ */
+static int gta04_sensors_fifo_deliver(struct gta04_sensors_device *device,
+	struct sensors_event_t *data, int count)
+{
+	struct gta04_sensors_fifo *fifo;
+	int64_t time;
+	int n;
+	int i;
+
+	time = gta04_sensors_time();
+	n = 0;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	for (i = 0; i < device->handlers_count && n < count; i++) {
+		if (device->handlers[i] == NULL)
+			continue;
+
+		fifo = &device->handlers[i]->fifo;
+		if (fifo->events == NULL)
+			continue;
+
+		if (fifo->count > 0 && (fifo->latency == 0 || fifo->count == fifo->size || time >= fifo->deadline || fifo->flush > 0))
+			fifo->due = 1;
+
+		if (fifo->due) {
+			n += gta04_sensors_fifo_pop(fifo, &data[n], count - n);
+			if (fifo->count == 0)
+				fifo->due = 0;
+		}
+
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+		while (fifo->count == 0 && fifo->flush > 0 && n < count) {
+			memset(&data[n], 0, sizeof(struct sensors_event_t));
+			data[n].version = META_DATA_VERSION;
+			data[n].type = SENSOR_TYPE_META_DATA;
+			data[n].meta_data.what = META_DATA_FLUSH_COMPLETE;
+			data[n].meta_data.sensor = device->handlers[i]->handle;
+
+			fifo->flush--;
+			n++;
+		}
+#endif
+	}
+
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return n;
+}
+
+/*
+ * Returns the poll timeout in ms until the earliest batch timeout, or -1 when
+ * no FIFO holds any event.
+ */
+static int gta04_sensors_fifo_timeout(struct gta04_sensors_device *device)
+{
+	struct gta04_sensors_fifo *fifo;
+	int64_t deadline = -1;
+	int64_t time;
+	int i;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
 	for (i = 0; i < device->handlers_count; i++) {
 		if (device->handlers[i] == NULL)
 			continue;
 
-		if (device->handlers[i]->handle == handle && device->handlers[i]->set_delay != NULL)
-			return device->handlers[i]->set_delay(device->handlers[i], (long int) ns);
+		fifo = &device->handlers[i]->fifo;
+		if (fifo->events == NULL || fifo->count == 0)
+			continue;
+
+		if (deadline < 0 || fifo->deadline < deadline)
+			deadline = fifo->deadline;
 	}
 
-	return 0;
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	if (deadline < 0)
+		return -1;
+
+	time = gta04_sensors_time();
+	if (deadline <= time)
+		return 0;
+
+	// Round up, so that the deadline is reached when poll times out
+	return (int) ((deadline - time + 999999) / 1000000);
+}
+
+/*
+ * Hands an event of a sensor to its clients, each at the rate it requested.
+ * Must be called with the device FIFO mutex held.
+ */
+static void gta04_sensors_queue(struct gta04_sensors_handlers *handlers,
+	struct sensors_event_t *event)
+{
+	if ((handlers->needed & GTA04_SENSORS_NEEDED_API) && gta04_sensors_rate_accept(handlers, GTA04_SENSORS_CLIENT_API, event->timestamp))
+		gta04_sensors_fifo_push(&handlers->fifo, event);
+
+	if ((handlers->needed & GTA04_SENSORS_NEEDED_FUSION) && gta04_sensors_rate_accept(handlers, GTA04_SENSORS_CLIENT_FUSION, event->timestamp))
+		fusion_input(event);
+}
+
+/*
+ * Reads all the events available from a sensor in bulk and queues them.
+ */
+static int gta04_sensors_read(struct gta04_sensors_device *device,
+	struct gta04_sensors_handlers *handlers)
+{
+	int count;
+	int i;
+
+	if (handlers->get_data == NULL)
+		return -1;
+
+	gta04_sensors_handlers_lock(handlers);
+	count = handlers->get_data(handlers, device->events, GTA04_SENSORS_EVENTS_COUNT);
+	gta04_sensors_handlers_unlock(handlers);
+
+	if (count <= 0)
+		return count;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	for (i = 0; i < count; i++)
+		gta04_sensors_queue(handlers, &device->events[i]);
+
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return count;
+}
+
+/*
+ * In threaded mode, queues the events the reader threads collected, merging
+ * their rings in timestamp order.
+ */
+static int gta04_sensors_merge(struct gta04_sensors_device *device)
+{
+	struct gta04_sensors_handlers *handlers;
+	struct gta04_sensors_reader *reader;
+	struct sensors_event_t *event;
+	struct sensors_event_t *oldest;
+	int count = 0;
+	int i;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	while (1) {
+		oldest = NULL;
+		reader = NULL;
+
+		for (i = 0; i < device->handlers_count; i++) {
+			handlers = device->handlers[i];
+			if (handlers == NULL || handlers->reader == NULL)
+				continue;
+
+			event = gta04_sensors_ring_peek(&handlers->reader->ring);
+			if (event == NULL)
+				continue;
+
+			if (oldest == NULL || event->timestamp < oldest->timestamp) {
+				oldest = event;
+				reader = handlers->reader;
+			}
+		}
+
+		if (oldest == NULL)
+			break;
+
+		gta04_sensors_queue(reader->handlers, oldest);
+		gta04_sensors_ring_pop(&reader->ring);
+		count++;
+	}
+
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return count;
+}
+
+/*
+ * Records the latency of the events about to be returned by poll.
+ */
+static void gta04_sensors_poll_stats(struct gta04_sensors_device *device,
+	struct sensors_event_t *data, int count)
+{
+	struct gta04_sensors_handlers *handlers = NULL;
+	int64_t time;
+	int i;
+
+	time = gta04_sensors_time();
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	for (i = 0; i < count; i++) {
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+		if (data[i].type == SENSOR_TYPE_META_DATA)
+			continue;
+#endif
+
+		if (handlers == NULL || handlers->handle != data[i].sensor)
+			handlers = gta04_sensors_handlers_find(device, data[i].sensor);
+
+		gta04_sensors_stats_record(handlers, data[i].timestamp, time);
+	}
+
+	pthread_mutex_unlock(&device->fifo_mutex);
 }
 
 int gta04_sensors_poll(struct sensors_poll_device_t *dev,
 	struct sensors_event_t* data, int count)
 {
 	struct gta04_sensors_device *device;
-	int i, j;
-	int c, n;
-	int poll_rc, rc;
+	struct gta04_sensors_handlers *handlers;
+	struct epoll_event events[GTA04_SENSORS_EVENTS_COUNT];
+	eventfd_t value;
+	int timeout;
+	int i;
+	int n;
+	int rc;
 
 //	ALOGD("%s(%p, %p, %d)", __func__, dev, data, count);
 
-	if (dev == NULL)
+	if (dev == NULL || data == NULL || count <= 0)
 		return -EINVAL;
 
 	device = (struct gta04_sensors_device *) dev;
 
 	if (device->handlers == NULL || device->handlers_count <= 0 ||
-		device->poll_fds == NULL || device->poll_fds_count <= 0)
+		device->epoll_fd < 0)
 		return -EINVAL;
 
 	n = 0;
 
-	do {
-		poll_rc = poll(device->poll_fds, device->poll_fds_count, n > 0 ? 0 : -1);
-		if (poll_rc < 0)
+	while (1) {
+		n += gta04_sensors_fifo_deliver(device, &data[n], count - n);
+		if (n == count)
+			break;
+
+		// Once there is something to report, only pick up what is ready
+		timeout = n > 0 ? 0 : gta04_sensors_fifo_timeout(device);
+
+		rc = epoll_wait(device->epoll_fd, events, GTA04_SENSORS_EVENTS_COUNT, timeout);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (n > 0)
+				break;
+
 			return -1;
+		}
+
+		if (rc == 0 && n > 0)
+			break;
+
+		for (i = 0; i < rc; i++) {
+			handlers = (struct gta04_sensors_handlers *) events[i].data.ptr;
+
+			if (handlers == NULL) {
+				eventfd_read(device->flush_fd, &value);
+				continue;
+			}
 
-		for (i = 0; i < device->poll_fds_count; i++) {
-			if (!(device->poll_fds[i].revents & POLLIN))
+			if (events[i].data.ptr == (void *) device) {
+				eventfd_read(device->ring_fd, &value);
+				gta04_sensors_merge(device);
 				continue;
+			}
 
-			for (j = 0; j < device->handlers_count; j++) {
-				if (device->handlers[j] == NULL || device->handlers[j]->poll_fd != device->poll_fds[i].fd || device->handlers[j]->get_data == NULL)
-					continue;
-
-				rc = device->handlers[j]->get_data(device->handlers[j], &data[n]);
-				if (rc < 0) {
-					device->poll_fds[i].revents = 0;
-					poll_rc = -1;
-				} else {
-					n++;
-					count--;
-				}
+			// The node went away, it would be reported again on each wait
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				ALOGE("%s: Polling %s failed, removing it", __func__, handlers->name);
+				epoll_ctl(device->epoll_fd, EPOLL_CTL_DEL, handlers->poll_fd, NULL);
+				continue;
 			}
+
+			gta04_sensors_read(device, handlers);
 		}
-	} while ((poll_rc > 0 || n < 1) && count > 0);
+	}
+
+	gta04_sensors_poll_stats(device, data, n);
+
+	device->wakeups++;
 
 	return n;
 }
 
+/*
+ * Writes the latency and jitter histograms of every sensor that was used to
+ * fd, or to the log when fd is negative.
+ */
+int gta04_sensors_dump(struct gta04_sensors_device *device, int fd)
+{
+	int i;
+
+	if (device == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&device->fifo_mutex);
+
+	for (i = 0; i < device->handlers_count; i++) {
+		if (device->handlers[i] == NULL || device->handlers[i]->stats.count == 0)
+			continue;
+
+		gta04_sensors_stats_dump(device->handlers[i], fd);
+	}
+
+	pthread_mutex_unlock(&device->fifo_mutex);
+
+	return 0;
+}
+
 /*
  * Interface
  */
@@ -221,16 +647,39 @@ int gta04_sensors_close(hw_device_t *device)
 
 	gta04_sensors_device = (struct gta04_sensors_device *) device;
 
-	if (gta04_sensors_device->poll_fds != NULL)
-		free(gta04_sensors_device->poll_fds);
+	gta04_sensors_dump(gta04_sensors_device, -1);
+
+	// Reader threads must be gone before the drivers are torn down
+	for (i = 0; i < gta04_sensors_device->handlers_count; i++)
+		if (gta04_sensors_device->handlers[i] != NULL && gta04_sensors_device->handlers[i]->reader != NULL)
+			gta04_sensors_reader_stop(gta04_sensors_device->handlers[i]);
+
+	if (gta04_sensors_device->epoll_fd >= 0)
+		close(gta04_sensors_device->epoll_fd);
 
 	for (i = 0; i < gta04_sensors_device->handlers_count; i++) {
-		if (gta04_sensors_device->handlers[i] == NULL || gta04_sensors_device->handlers[i]->deinit == NULL)
+		if (gta04_sensors_device->handlers[i] == NULL)
 			continue;
 
-		gta04_sensors_device->handlers[i]->deinit(gta04_sensors_device->handlers[i]);
+		gta04_sensors_fifo_deinit(&gta04_sensors_device->handlers[i]->fifo);
+
+		if (gta04_sensors_device->handlers[i]->deinit != NULL)
+			gta04_sensors_device->handlers[i]->deinit(gta04_sensors_device->handlers[i]);
+
+		pthread_mutex_destroy(&gta04_sensors_device->handlers[i]->mutex);
 	}
 
+	if (gta04_sensors_device->flush_fd >= 0)
+		close(gta04_sensors_device->flush_fd);
+
+	if (gta04_sensors_device->ring_fd >= 0)
+		close(gta04_sensors_device->ring_fd);
+
+	pthread_mutex_destroy(&gta04_sensors_device->fifo_mutex);
+
+	if (gta04_sensors_device->handlers != NULL)
+		free(gta04_sensors_device->handlers);
+
 	free(device);
 
 	return 0;
@@ -239,9 +688,13 @@ int gta04_sensors_close(hw_device_t *device)
 int gta04_sensors_open(const struct hw_module_t* module, const char *id,
 	struct hw_device_t** device)
 {
+	gta04_sensors_paths_setup();
 	gta04_sensors_hwdetect();
 	struct gta04_sensors_device *gta04_sensors_device;
+	struct epoll_event event;
+	char value[PROPERTY_VALUE_MAX];
 	int p, i;
+	int rc;
 
 	ALOGD("%s(%p, %s, %p)", __func__, module, id, device);
 
@@ -251,32 +704,105 @@ int gta04_sensors_open(const struct hw_module_t* module, const char *id,
 	gta04_sensors_device = (struct gta04_sensors_device *)
 		calloc(1, sizeof(struct gta04_sensors_device));
 	gta04_sensors_device->device.common.tag = HARDWARE_DEVICE_TAG;
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+	gta04_sensors_device->device.common.version = SENSORS_DEVICE_API_VERSION_1_1;
+#else
 	gta04_sensors_device->device.common.version = 0;
+#endif
 	gta04_sensors_device->device.common.module = (struct hw_module_t *) module;
 	gta04_sensors_device->device.common.close = gta04_sensors_close;
 	gta04_sensors_device->device.activate = gta04_sensors_activate;
 	gta04_sensors_device->device.setDelay = gta04_sensors_set_delay;
 	gta04_sensors_device->device.poll = gta04_sensors_poll;
-	gta04_sensors_device->handlers = gta04_sensors_handlers;
-	gta04_sensors_device->handlers_count = gta04_sensors_handlers_count;
-	gta04_sensors_device->poll_fds = (struct pollfd *)
-		calloc(1, gta04_sensors_handlers_count * sizeof(struct pollfd));
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+	gta04_sensors_device->device.batch = gta04_sensors_batch;
+	gta04_sensors_device->device.flush = gta04_sensors_flush;
+#endif
+	gta04_sensors_device->handlers = (struct gta04_sensors_handlers **)
+		calloc(gta04_sensors_handlers_count, sizeof(struct gta04_sensors_handlers *));
+	gta04_sensors_device->handlers_count = 0;
+	gta04_sensors_device->epoll_fd = epoll_create(gta04_sensors_handlers_count + 1);
+
+	pthread_mutex_init(&gta04_sensors_device->fifo_mutex, NULL);
+
+	// Optionally read each physical sensor from its own thread
+	property_get(GTA04_SENSORS_PROPERTY_THREADS, value, "0");
+	gta04_sensors_device->threaded = atoi(value) > 0;
+	gta04_sensors_device->ring_fd = -1;
+
+	if (gta04_sensors_device->threaded) {
+		gta04_sensors_device->ring_fd = eventfd(0, EFD_NONBLOCK);
+		if (gta04_sensors_device->ring_fd < 0) {
+			ALOGE("%s: Unable to create ring eventfd, not using threads", __func__);
+			gta04_sensors_device->threaded = 0;
+		} else {
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.ptr = (void *) gta04_sensors_device;
+
+			epoll_ctl(gta04_sensors_device->epoll_fd, EPOLL_CTL_ADD, gta04_sensors_device->ring_fd, &event);
+		}
+	}
 
 	p = 0;
 	for (i = 0; i < gta04_sensors_handlers_count; i++) {
 		if (gta04_sensors_handlers[i] == NULL || gta04_sensors_handlers[i]->init == NULL)
 			continue;
 
-		gta04_sensors_handlers[i]->init(gta04_sensors_handlers[i], gta04_sensors_device);
-		if (gta04_sensors_handlers[i]->poll_fd >= 0) {
-			gta04_sensors_device->poll_fds[p].fd = gta04_sensors_handlers[i]->poll_fd;
-			gta04_sensors_device->poll_fds[p].events = POLLIN;
-			p++;
+		gta04_sensors_fifo_init(&gta04_sensors_handlers[i]->fifo, GTA04_SENSORS_FIFO_SIZE);
+		pthread_mutex_init(&gta04_sensors_handlers[i]->mutex, NULL);
+
+		rc = gta04_sensors_handlers[i]->init(gta04_sensors_handlers[i], gta04_sensors_device);
+		if (rc < 0) {
+			ALOGE("%s: Unable to initialize %s", __func__, gta04_sensors_handlers[i]->name);
+			gta04_sensors_fifo_deinit(&gta04_sensors_handlers[i]->fifo);
+			pthread_mutex_destroy(&gta04_sensors_handlers[i]->mutex);
+			continue;
 		}
+
+		// Only the handlers that initialized are used, virtual ones find their inputs there
+		gta04_sensors_device->handlers[gta04_sensors_device->handlers_count++] = gta04_sensors_handlers[i];
+
+		if (gta04_sensors_handlers[i]->poll_fd < 0)
+			continue;
+
+		if (gta04_sensors_device->threaded) {
+			rc = gta04_sensors_reader_start(gta04_sensors_device, gta04_sensors_handlers[i]);
+			if (rc == 0) {
+				p++;
+				continue;
+			}
+
+			ALOGE("%s: Unable to start reader for %s, polling it directly", __func__, gta04_sensors_handlers[i]->name);
+		}
+
+		// The handlers are found back directly from the epoll event
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = (void *) gta04_sensors_handlers[i];
+
+		rc = epoll_ctl(gta04_sensors_device->epoll_fd, EPOLL_CTL_ADD, gta04_sensors_handlers[i]->poll_fd, &event);
+		if (rc < 0) {
+			ALOGE("%s: Unable to add %s to epoll", __func__, gta04_sensors_handlers[i]->name);
+			continue;
+		}
+
+		p++;
+	}
+
+	// Wakes poll up on flush and batch requests
+	gta04_sensors_device->flush_fd = eventfd(0, EFD_NONBLOCK);
+	if (gta04_sensors_device->flush_fd >= 0) {
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+
+		epoll_ctl(gta04_sensors_device->epoll_fd, EPOLL_CTL_ADD, gta04_sensors_device->flush_fd, &event);
 	}
 
-	if (p > 0) {
-		gta04_sensors_device->poll_fds_count = p;
+	gta04_sensors_list_update(gta04_sensors_device);
+
+	if (p > 0 && gta04_sensors_device->flush_fd >= 0) {
 		*device = &(gta04_sensors_device->device.common);
 		return 0;
 	}
@@ -292,8 +818,14 @@ int gta04_sensors_get_sensors_list(struct sensors_module_t* module,
 	if (sensors_p == NULL)
 		return -EINVAL;
 
-	*sensors_p = gta04_sensors;
-	return gta04_sensors_count;
+	// Nothing is known about the sensors until the device was opened
+	if (gta04_sensors_available_count < 0) {
+		*sensors_p = gta04_sensors;
+		return gta04_sensors_count;
+	}
+
+	*sensors_p = gta04_sensors_available;
+	return gta04_sensors_available_count;
 }
 
 struct hw_module_methods_t gta04_sensors_module_methods = {
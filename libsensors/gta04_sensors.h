@@ -16,7 +16,8 @@
  */
 
 #include <stdint.h>
-#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <linux/input.h>
 
 #include <hardware/sensors.h>
@@ -25,11 +26,109 @@
 #ifndef _GTA04_SENSORS_H_
 #define _GTA04_SENSORS_H_
 
-#define GTA04_SENSORS_NEEDED_API		(1 << 0)
-#define GTA04_SENSORS_NEEDED_ORIENTATION	(1 << 1)
+#define GTA04_SENSORS_CLIENT_API		0
+#define GTA04_SENSORS_CLIENT_FUSION		1
+#define GTA04_SENSORS_CLIENTS_COUNT		2
+
+#define GTA04_SENSORS_NEEDED_API		(1 << GTA04_SENSORS_CLIENT_API)
+#define GTA04_SENSORS_NEEDED_FUSION		(1 << GTA04_SENSORS_CLIENT_FUSION)
+
+#define GTA04_SENSORS_FIFO_SIZE			300
+
+// The FIFO is only reported to the framework starting from HAL 1.1
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+#define GTA04_SENSORS_FIFO_COUNTS		GTA04_SENSORS_FIFO_SIZE, GTA04_SENSORS_FIFO_SIZE,
+#else
+#define GTA04_SENSORS_FIFO_COUNTS
+#endif
+
+#define GTA04_SENSORS_EVENTS_COUNT		64
+#define GTA04_SENSORS_STATS_BUCKETS		20
+#define GTA04_SENSORS_RING_SIZE			256
+
+#define GTA04_SENSORS_PROPERTY_THREADS		"gta04.sensors.threads"
+
+/*
+ * The framework expects timestamps in the elapsedRealtimeNanos time base.
+ */
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME				7
+#endif
 
 struct gta04_sensors_device;
 
+/*
+ * Events are held in a per-sensor FIFO until the batch timeout expires, the
+ * FIFO is full or a flush is requested.
+ */
+struct gta04_sensors_fifo {
+	struct sensors_event_t *events;
+	int size;
+	int head;
+	int count;
+
+	int64_t latency;
+	int64_t deadline;
+	int due;
+	int flush;
+
+	unsigned int received;
+	unsigned int delivered;
+	unsigned int dropped;
+};
+
+/*
+ * Histograms of the time between a sample and the poll call returning it,
+ * and of the deviation between consecutive samples and the requested delay.
+ * Bucket i counts values below 2^i us, the last one counts the rest.
+ */
+struct gta04_sensors_stats {
+	unsigned int latency[GTA04_SENSORS_STATS_BUCKETS];
+	unsigned int jitter[GTA04_SENSORS_STATS_BUCKETS];
+
+	int64_t latency_max;
+	int64_t jitter_max;
+	int64_t timestamp;
+	unsigned int count;
+};
+
+/*
+ * Each client (API, fusion) requests its own delay: the sensor runs at the
+ * fastest one, clamped to what the chip supports, and every client gets
+ * its events decimated to the delay it requested.
+ */
+struct gta04_sensors_rate {
+	int64_t delays[GTA04_SENSORS_CLIENTS_COUNT];
+	int64_t next[GTA04_SENSORS_CLIENTS_COUNT];
+
+	int64_t delay;
+	int64_t delay_min;
+	int64_t delay_max;
+};
+
+/*
+ * Single producer (reader thread), single consumer (poll) ring. Each index
+ * is only written by its owner and they wrap around.
+ */
+struct gta04_sensors_ring {
+	struct sensors_event_t events[GTA04_SENSORS_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+
+	unsigned int dropped;
+};
+
+struct gta04_sensors_reader {
+	struct gta04_sensors_device *device;
+	struct gta04_sensors_handlers *handlers;
+
+	struct gta04_sensors_ring ring;
+	struct sensors_event_t events[GTA04_SENSORS_EVENTS_COUNT];
+
+	pthread_t thread;
+	int stop_fd;
+};
+
 struct gta04_sensors_handlers {
 	char *name;
 	int handle;
@@ -42,23 +141,43 @@ struct gta04_sensors_handlers {
 	int (*set_delay)(struct gta04_sensors_handlers *handlers,
 		long int delay);
 	int (*get_data)(struct gta04_sensors_handlers *handlers,
-		struct sensors_event_t *event);
+		struct sensors_event_t *events, int count);
 
 	int activated;
 	int needed;
 	int poll_fd;
 
+	struct gta04_sensors_fifo fifo;
+	struct gta04_sensors_rate rate;
+	struct gta04_sensors_stats stats;
+	struct gta04_sensors_reader *reader;
+
+	// Serializes the calls into a physical driver, see reader.c
+	pthread_mutex_t mutex;
+
 	void *data;
 };
 
 struct gta04_sensors_device {
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+	struct sensors_poll_device_1 device;
+#else
 	struct sensors_poll_device_t device;
+#endif
 
 	struct gta04_sensors_handlers **handlers;
 	int handlers_count;
 
-	struct pollfd *poll_fds;
-	int poll_fds_count;
+	int epoll_fd;
+	struct sensors_event_t events[GTA04_SENSORS_EVENTS_COUNT];
+
+	pthread_mutex_t fifo_mutex;
+	int flush_fd;
+
+	int threaded;
+	int ring_fd;
+
+	unsigned int wakeups;
 };
 
 extern struct gta04_sensors_handlers *gta04_sensors_handlers[];
@@ -70,46 +189,184 @@ int gta04_sensors_set_delay(struct sensors_poll_device_t *dev, int handle,
 	int64_t ns);
 int gta04_sensors_poll(struct sensors_poll_device_t *dev,
 	struct sensors_event_t* data, int count);
+#ifdef SENSORS_DEVICE_API_VERSION_1_1
+int gta04_sensors_batch(struct sensors_poll_device_1 *dev, int handle,
+	int flags, int64_t period_ns, int64_t timeout);
+int gta04_sensors_flush(struct sensors_poll_device_1 *dev, int handle);
+#endif
+int gta04_sensors_dump(struct gta04_sensors_device *device, int fd);
+
+/*
+ * FIFO
+ */
+
+int64_t gta04_sensors_time(void);
+int gta04_sensors_fifo_init(struct gta04_sensors_fifo *fifo, int size);
+void gta04_sensors_fifo_deinit(struct gta04_sensors_fifo *fifo);
+void gta04_sensors_fifo_clear(struct gta04_sensors_fifo *fifo);
+int gta04_sensors_fifo_push(struct gta04_sensors_fifo *fifo,
+	struct sensors_event_t *event);
+int gta04_sensors_fifo_pop(struct gta04_sensors_fifo *fifo,
+	struct sensors_event_t *events, int count);
+
+/*
+ * Rate
+ */
+
+int gta04_sensors_rate_request(struct gta04_sensors_handlers *handlers,
+	int client, int64_t delay);
+int gta04_sensors_rate_update(struct gta04_sensors_handlers *handlers);
+int gta04_sensors_rate_accept(struct gta04_sensors_handlers *handlers,
+	int client, int64_t timestamp);
+
+/*
+ * Reader
+ */
+
+int gta04_sensors_ring_push(struct gta04_sensors_ring *ring,
+	struct sensors_event_t *event);
+struct sensors_event_t *gta04_sensors_ring_peek(struct gta04_sensors_ring *ring);
+void gta04_sensors_ring_pop(struct gta04_sensors_ring *ring);
+int gta04_sensors_reader_start(struct gta04_sensors_device *device,
+	struct gta04_sensors_handlers *handlers);
+int gta04_sensors_reader_stop(struct gta04_sensors_handlers *handlers);
+void gta04_sensors_handlers_lock(struct gta04_sensors_handlers *handlers);
+void gta04_sensors_handlers_unlock(struct gta04_sensors_handlers *handlers);
+
+/*
+ * Stats
+ */
+
+void gta04_sensors_stats_clear(struct gta04_sensors_stats *stats);
+void gta04_sensors_stats_record(struct gta04_sensors_handlers *handlers,
+	int64_t timestamp, int64_t time);
+int gta04_sensors_stats_dump(struct gta04_sensors_handlers *handlers, int fd);
+
+/*
+ * Paths
+ */
+
+#define GTA04_SENSORS_PROPERTY_ROOT		"gta04.sensors.root"
+
+int gta04_sensors_paths_setup(void);
+int gta04_sensors_path(char *buffer, size_t length, const char *path);
+
+/*
+ * Discovery
+ */
+
+#define DISCOVERY_INPUT_SYSFS			"/sys/class/input"
+#define DISCOVERY_INPUT_DEV			"/dev/input"
+#define DISCOVERY_IIO_SYSFS			"/sys/bus/iio/devices"
+#define DISCOVERY_IIO_DEV			"/dev"
+
+#define DISCOVERY_ENTRIES_COUNT			64
+
+#define DISCOVERY_TYPE_INPUT			0
+#define DISCOVERY_TYPE_IIO			1
+
+struct discovery_entry {
+	char name[80];
+	int type;
+	int id;
+
+	char node[128];
+	char sysfs[192];
+};
+
+int discovery_refresh(void);
+int discovery_find(const char *name, int type, struct discovery_entry *entry);
 
 /*
  * Input
  */
 
-void input_event_set(struct input_event *event, int type, int code, int value);
-long int timestamp(struct timeval *time);
-long int input_timestamp(struct input_event *event);
-int uinput_rel_create(const char *name);
-void uinput_destroy(int uinput_fd);
+#define INPUT_EVENTS_COUNT			GTA04_SENSORS_EVENTS_COUNT
+#define INPUT_FDS_COUNT				1024
+
+int64_t timestamp(struct timeval *time);
+int64_t input_timestamp(struct input_event *event);
 int input_open(char *name);
+int input_read(int fd, struct input_event *events, int count);
 int sysfs_path_prefix(char *name, char *path_prefix);
 int sysfs_value_read(char *path);
 int sysfs_value_write(char *path, int value);
+int sysfs_value_write_cached(char *path, int value, int *cache);
+int sysfs_delay_range(char *path_prefix, struct gta04_sensors_rate *rate);
 int sysfs_string_read(char *path, char *buffer, size_t length);
 int sysfs_string_write(char *path, char *buffer, size_t length);
 
-
 /*
  * IIO
  */
 
+#define IIO_SCAN_SAMPLES_COUNT		32
+#define IIO_FREQUENCIES_COUNT		16
+#define IIO_FREQUENCY_LENGTH		16
+
+struct iio_scan_channel {
+	char *name;
+	int index;
+	int is_signed;
+	int big_endian;
+	int bits;
+	int storage_bytes;
+	int shift;
+	int offset;
+};
+
+struct iio_scan {
+	char *device_name;
+
+	struct iio_scan_channel *channels;
+	int channels_count;
+	struct iio_scan_channel timestamp;
+	int timestamp_realtime;
+	int64_t timestamp_offset;
+
+	int size;
+};
+
 int open_input(char* mInputName, const char* inputName);
 int find_type_by_name(const char *name, const char *type);
 char *make_sysfs_name(const char *device_name, const char *file_name);
 int iio_set_default_trigger(char* device_name, char* name, int dev_num);
 int iio_set_buffer_state(char* device_name, int state);
+int iio_frequencies_available(char *device_name, const char *file_name,
+	char frequencies[][IIO_FREQUENCY_LENGTH], int count);
+int iio_frequency_select(char frequencies[][IIO_FREQUENCY_LENGTH], int count,
+	double frequency);
+int iio_frequencies_delay_range(char frequencies[][IIO_FREQUENCY_LENGTH], int count,
+	struct gta04_sensors_rate *rate);
+int iio_scan_init(struct iio_scan *scan, char *device_name,
+	const char **channels, int channels_count);
+void iio_scan_deinit(struct iio_scan *scan);
+int iio_scan_read(struct iio_scan *scan, int fd, unsigned char *buffer,
+	int count);
+int iio_scan_value(struct iio_scan *scan, unsigned char *sample, int channel);
+int64_t iio_scan_timestamp(struct iio_scan *scan, unsigned char *sample);
 
 /*
- * Sensors
+ * Fusion
  */
 
-int orientation_fill(struct gta04_sensors_handlers *handlers,
-	sensors_vec_t *acceleration, sensors_vec_t *magnetic);
+int fusion_input(struct sensors_event_t *event);
+
+/*
+ * Sensors
+ */
 
 extern struct gta04_sensors_handlers bma180;
 extern struct gta04_sensors_handlers lis302;
 extern struct gta04_sensors_handlers itg3200;
 extern struct gta04_sensors_handlers hmc5883l;
 extern struct gta04_sensors_handlers orientation;
+extern struct gta04_sensors_handlers rotation_vector;
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+extern struct gta04_sensors_handlers game_rotation_vector;
+#endif
+extern struct gta04_sensors_handlers gravity;
+extern struct gta04_sensors_handlers linear_acceleration;
 extern struct gta04_sensors_handlers tept4400;
 extern struct gta04_sensors_handlers bmp085;
 
@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <fcntl.h>
@@ -38,64 +39,30 @@
 struct hmc5883l_data {
 	char* name;
 	char* iio_name;
-	sensors_vec_t magnetic;
 
-	int x_fp;
-	int y_fp;
-	int z_fp;
-};
-
-int hmc5883l_enable_iio_channels(char* device_name)
-{
-	char *tmp;
-	int rc;
-
-	//Enable IIO channel X
-	tmp = make_sysfs_name(device_name, "scan_elements/in_magn_x_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
-
-	//Enable IIO channel Y
-	tmp = make_sysfs_name(device_name, "scan_elements/in_magn_y_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
+	struct iio_scan scan;
+	unsigned char *samples;
 
-	//Enable IIO channel Z
-	tmp = make_sysfs_name(device_name, "scan_elements/in_magn_z_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
-
-	return 0;
+	char frequencies[IIO_FREQUENCIES_COUNT][IIO_FREQUENCY_LENGTH];
+	int frequencies_count;
+	int frequency;
+};
 
-error:
-	free(tmp);
-	return -1;
-}
+const char *hmc5883l_iio_channels[] = {
+	"in_magn_x",
+	"in_magn_y",
+	"in_magn_z",
+};
 
 int hmc5883l_init(struct gta04_sensors_handlers *handlers,
 	struct gta04_sensors_device *device)
 {
 	struct hmc5883l_data *data = NULL;
 	char path[PATH_MAX] = { 0 };
+	char node[PATH_MAX];
 	int iio_fd = -1;
 	int rc;
 	int dev_num;
-	char* tmp;
-	char *x_path;
-	char *y_path;
-	char *z_path;
 
 	ALOGD("%s(%p, %p)", __func__, handlers, device);
 
@@ -108,30 +75,29 @@ int hmc5883l_init(struct gta04_sensors_handlers *handlers,
 	dev_num = find_type_by_name(data->name, "iio:device");
 	asprintf(&(data->iio_name), "iio:device%d", dev_num); //i.e. device_name = iio:device0
 
-	hmc5883l_enable_iio_channels(data->iio_name);
 	iio_set_default_trigger(data->iio_name, data->name, dev_num);
 
-	x_path = make_sysfs_name(data->iio_name, "in_magn_x_raw");
-	y_path = make_sysfs_name(data->iio_name, "in_magn_y_raw");
-	z_path = make_sysfs_name(data->iio_name, "in_magn_z_raw");
-	data->x_fp = open(x_path, O_RDONLY);
-	data->y_fp = open(y_path, O_RDONLY);
-	data->z_fp = open(z_path, O_RDONLY);
-	if (data->x_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, x_path);
-	if (data->y_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, y_path);
-	if (data->z_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, z_path);
-	free(x_path);
-	free(y_path);
-	free(z_path);
+	// The HMC5883L only supports a fixed set of output rates
+	data->frequency = -1;
+	data->frequencies_count = iio_frequencies_available(data->iio_name, "in_magn_sampling_frequency_available", data->frequencies, IIO_FREQUENCIES_COUNT);
+	if (data->frequencies_count <= 0)
+		data->frequencies_count = iio_frequencies_available(data->iio_name, "sampling_frequency_available", data->frequencies, IIO_FREQUENCIES_COUNT);
 
-/*
-	int flags = fcntl(iio_fd, F_GETFL, 0);
-	fcntl(iio_fd, F_SETFL, flags | O_NONBLOCK);
-*/
-	iio_fd = open("/dev/iio:device0", O_RDONLY);// | O_NONBLOCK);
+	if (data->frequencies_count > 0)
+		iio_frequencies_delay_range(data->frequencies, data->frequencies_count, &handlers->rate);
+
+	rc = iio_scan_init(&data->scan, data->iio_name, hmc5883l_iio_channels, 3);
+	if (rc < 0) {
+		ALOGE("%s: Unable to setup IIO scan elements", __func__);
+		goto error;
+	}
+
+	data->samples = (unsigned char *) calloc(IIO_SCAN_SAMPLES_COUNT, data->scan.size);
+
+	snprintf((char *) &node, sizeof(node), "/dev/%s", data->iio_name);
+	gta04_sensors_path((char *) &path, sizeof(path), node);
+
+	iio_fd = open(path, O_RDONLY | O_NONBLOCK);
 	if (iio_fd < 0) {
 		ALOGE("%s: Unable to open device.", __func__);
 		goto error;
@@ -143,8 +109,17 @@ int hmc5883l_init(struct gta04_sensors_handlers *handlers,
 	return 0;
 
 error:
-	if (data != NULL)
+	if (data != NULL) {
+		iio_scan_deinit(&data->scan);
+
+		if (data->samples != NULL)
+			free(data->samples);
+
+		if (data->iio_name != NULL)
+			free(data->iio_name);
+
 		free(data);
+	}
 
 	if (iio_fd >= 0)
 		close(iio_fd);
@@ -163,17 +138,22 @@ int hmc5883l_deinit(struct gta04_sensors_handlers *handlers)
 	if (handlers == NULL)
 		return -EINVAL;
 
-	data = (struct hmc5883l_data *) handlers->data;
-	close(data->x_fp);
-	close(data->y_fp);
-	close(data->z_fp);
-
 	if (handlers->poll_fd >= 0)
 		close(handlers->poll_fd);
 	handlers->poll_fd = -1;
 
-	if (handlers->data != NULL)
-		free(handlers->data);
+	data = (struct hmc5883l_data *) handlers->data;
+	if (data != NULL) {
+		iio_scan_deinit(&data->scan);
+
+		if (data->samples != NULL)
+			free(data->samples);
+
+		if (data->iio_name != NULL)
+			free(data->iio_name);
+
+		free(data);
+	}
 	handlers->data = NULL;
 
 	return 0;
@@ -265,31 +245,40 @@ int hmc5883l_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
 	char *tmp;
 	long int one_second = 1000000000; //in nanoseconds
 	int frequency = 0; //in Hz
+	int index;
 
 	ALOGD("%s(%p, %ld)", __func__, handlers, delay);
 
-	if (handlers == NULL || handlers->data == NULL)
+	if (handlers == NULL || handlers->data == NULL || delay <= 0)
 		return -EINVAL;
 
 	data = (struct hmc5883l_data *) handlers->data;
 
+	// Without the list of available frequencies, leave the chip as it is
+	if (data->frequencies_count <= 0)
+		return 0;
+
 	frequency = (int)ceil((double)one_second/(double)delay);
 
-	//if sensor is not active, set sampling_frequency to 0, in order to save power
-	/* Does not work for some reason: Sensor won't deliver data if deactivated for the 1st time.
-	if(handlers->activated == 0)
-		frequency = 0;
-	*/
+	index = iio_frequency_select(data->frequencies, data->frequencies_count, frequency);
+	if (index < 0)
+		return -1;
+
+	// Only write when the chip setting actually changes
+	if (index == data->frequency)
+		return 0;
 
 	tmp = make_sysfs_name(data->iio_name, "in_magn_sampling_frequency");
-/* TODO: hmc5883l has only a certain set of frequencies (see sampling_frequency_available in sysfs)
-	ALOGD("%s: setting sampling_frequency to %d", __func__, frequency);
-	rc = sysfs_value_write(tmp, frequency);
+
+	ALOGD("%s: setting sampling_frequency to %s", __func__, data->frequencies[index]);
+	rc = sysfs_string_write(tmp, data->frequencies[index], strlen(data->frequencies[index]));
 	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 0, tmp);
+		ALOGE("%s: Unable to write sysfs value (%s) to %s", __func__, data->frequencies[index], tmp);
 		goto error;
 	}
-*/
+
+	data->frequency = index;
+
 	free(tmp);
 
 	return 0;
@@ -306,56 +295,48 @@ float hmc5883l_convert(int value)
 }
 
 int hmc5883l_get_data(struct gta04_sensors_handlers *handlers,
-	struct sensors_event_t *event)
+	struct sensors_event_t *events, int count)
 {
 	struct hmc5883l_data *data;
-	struct input_event input_event;
-	int iio_fd;
-	int rc;
-	char buf[1024];
+	struct sensors_event_t *event;
+	unsigned char *sample;
+	int i;
 
-	//ALOGD("%s(%p, %p)", __func__, handlers, event);
+	//ALOGD("%s(%p, %p, %d)", __func__, handlers, events, count);
 
-	if (handlers == NULL || handlers->data == NULL || event == NULL)
+	if (handlers == NULL || handlers->data == NULL || events == NULL || count <= 0)
 		return -EINVAL;
 
 	data = (struct hmc5883l_data *) handlers->data;
 
-	iio_fd = handlers->poll_fd;
-	if (iio_fd < 0)
+	if (handlers->poll_fd < 0)
 		return -EINVAL;
 
-	//clear '/dev/iio:device0', so poll() won't loop infinitely
-	do {
-		rc = read(iio_fd, &buf, 1024);
-		//ALOGD("hmc5883l: read %d bytes", rc);
-	} while (rc > 0);
-
-
-	memset(event, 0, sizeof(struct sensors_event_t));
-	event->version = sizeof(struct sensors_event_t);
-	event->sensor = handlers->handle;
-	event->type = handlers->handle;
-
-	event->magnetic.x = data->magnetic.x;
-	event->magnetic.y = data->magnetic.y;
-	event->magnetic.z = data->magnetic.z;
+	if (count > IIO_SCAN_SAMPLES_COUNT)
+		count = IIO_SCAN_SAMPLES_COUNT;
 
-	//TODO: use bytes from iio_fd, instead of reading sysfs
-	rc = pread(data->x_fp, &buf, 1024, 0);
-	event->magnetic.y = hmc5883l_convert(atoi(buf)) - 75.0; //X and Y are interchanged
+	// Whole samples are read in bulk, each one is reported
+	count = iio_scan_read(&data->scan, handlers->poll_fd, data->samples, count);
+	if (count <= 0)
+		return -1;
 
-	rc = pread(data->y_fp, &buf, 1024, 0);
-	event->magnetic.x = hmc5883l_convert(atoi(buf)) + 10.0; //X and Y are interchanged
+	for (i = 0; i < count; i++) {
+		sample = data->samples + i * data->scan.size;
+		event = &events[i];
 
-	rc = pread(data->z_fp, &buf, 1024, 0);
-	event->magnetic.z = hmc5883l_convert(atoi(buf)) - 50.0;
+		memset(event, 0, sizeof(struct sensors_event_t));
+		event->version = sizeof(struct sensors_event_t);
+		event->sensor = handlers->handle;
+		event->type = handlers->handle;
+		event->timestamp = iio_scan_timestamp(&data->scan, sample);
 
-	data->magnetic.x = event->magnetic.x;
-	data->magnetic.y = event->magnetic.y;
-	data->magnetic.z = event->magnetic.z;
+		// X and Y are interchanged
+		event->magnetic.x = hmc5883l_convert(iio_scan_value(&data->scan, sample, 1)) + 10.0;
+		event->magnetic.y = hmc5883l_convert(iio_scan_value(&data->scan, sample, 0)) - 75.0;
+		event->magnetic.z = hmc5883l_convert(iio_scan_value(&data->scan, sample, 2)) - 50.0;
+	}
 
-	return 0;
+	return count;
 }
 
 struct gta04_sensors_handlers hmc5883l = {
@@ -22,6 +22,10 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/time.h>
+#include <time.h>
 #include <linux/ioctl.h>
 //#include <linux/iio/iio.h>
 //#include "iio/linux_iio_iio.h"
@@ -37,10 +41,15 @@ const char *iio_dir = "/sys/bus/iio/devices/";
 
 char *make_sysfs_name(const char *device_name, const char *file_name)
 {
+	char path[PATH_MAX];
 	char *name;
 	int ret;
 
-	ret = asprintf(&name, "/sys/bus/iio/devices/%s/%s", device_name, file_name);
+	ret = gta04_sensors_path(path, sizeof(path), iio_dir);
+	if (ret < 0)
+		return NULL;
+
+	ret = asprintf(&name, "%s%s/%s", path, device_name, file_name);
 	if (ret < 0)
 		return NULL;
 
@@ -103,6 +112,480 @@ error:
 	return -1;
 }
 
+/**
+ * iio_frequencies_available - function to read the sampling frequencies a chip supports
+ * The frequencies are kept as strings, so that they can be written back as-is.
+ *
+ * @device_name: the sensor's sysfs name (i.e. iio:device0)
+ * @file_name: the list's sysfs name (i.e. sampling_frequency_available)
+ * @frequencies: room for count frequencies
+ */
+int iio_frequencies_available(char *device_name, const char *file_name,
+	char frequencies[][IIO_FREQUENCY_LENGTH], int count)
+{
+	char buffer[IIO_FREQUENCIES_COUNT * IIO_FREQUENCY_LENGTH];
+	char *token;
+	char *save;
+	char *path;
+	int rc;
+	int n;
+
+	if (device_name == NULL || file_name == NULL || frequencies == NULL || count <= 0)
+		return -EINVAL;
+
+	path = make_sysfs_name(device_name, file_name);
+
+	memset(&buffer, 0, sizeof(buffer));
+	rc = sysfs_string_read(path, (char *) &buffer, sizeof(buffer) - 1);
+	free(path);
+
+	if (rc < 0)
+		return -1;
+
+	n = 0;
+	token = strtok_r(buffer, " \t\n", &save);
+
+	while (token != NULL && n < count) {
+		if (atof(token) > 0 && strlen(token) < IIO_FREQUENCY_LENGTH) {
+			strcpy(frequencies[n], token);
+			n++;
+		}
+
+		token = strtok_r(NULL, " \t\n", &save);
+	}
+
+	return n;
+}
+
+/**
+ * iio_frequency_select - function to pick the slowest available frequency that
+ * is at least as fast as requested, or the fastest one
+ *
+ * @frequency: the requested frequency, in Hz
+ */
+int iio_frequency_select(char frequencies[][IIO_FREQUENCY_LENGTH], int count,
+	double frequency)
+{
+	double value;
+	double best = 0;
+	double fastest = 0;
+	int index = -1;
+	int fastest_index = -1;
+	int i;
+
+	if (frequencies == NULL || count <= 0)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		value = atof(frequencies[i]);
+
+		if (value > fastest) {
+			fastest = value;
+			fastest_index = i;
+		}
+
+		if (value >= frequency && (index < 0 || value < best)) {
+			best = value;
+			index = i;
+		}
+	}
+
+	return index >= 0 ? index : fastest_index;
+}
+
+/**
+ * iio_frequencies_delay_range - function to derive the delay range of a sensor
+ * from its available sampling frequencies
+ */
+int iio_frequencies_delay_range(char frequencies[][IIO_FREQUENCY_LENGTH], int count,
+	struct gta04_sensors_rate *rate)
+{
+	double value;
+	double slowest = 0;
+	double fastest = 0;
+	int i;
+
+	if (frequencies == NULL || count <= 0 || rate == NULL)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		value = atof(frequencies[i]);
+
+		if (slowest == 0 || value < slowest)
+			slowest = value;
+
+		if (value > fastest)
+			fastest = value;
+	}
+
+	rate->delay_min = (int64_t) (1000000000.0 / fastest);
+	rate->delay_max = (int64_t) (1000000000.0 / slowest);
+
+	return 0;
+}
+
+/*
+ * IIO scan elements
+ *
+ * A triggered buffer hands out whole samples ("scans") holding every enabled
+ * channel, laid out by increasing scan index and each one aligned to its own
+ * storage size. The layout of each channel is described by the
+ * scan_elements/<channel>_type and scan_elements/<channel>_index sysfs files.
+ */
+
+static int iio_scan_channel_setup(char *device_name, const char *name,
+	struct iio_scan_channel *channel)
+{
+	char buffer[50];
+	char endian, sign;
+	char *path = NULL;
+	char *element = NULL;
+	int rc;
+
+	memset(channel, 0, sizeof(struct iio_scan_channel));
+	channel->name = strdup(name);
+
+	asprintf(&element, "scan_elements/%s_en", name);
+	path = make_sysfs_name(device_name, element);
+	rc = sysfs_value_write(path, 1);
+	if (rc < 0) {
+		ALOGE("%s: Unable to enable %s", __func__, path);
+		goto error;
+	}
+	free(element);
+	free(path);
+
+	asprintf(&element, "scan_elements/%s_index", name);
+	path = make_sysfs_name(device_name, element);
+	channel->index = sysfs_value_read(path);
+	if (channel->index < 0) {
+		ALOGE("%s: Unable to read %s", __func__, path);
+		goto error;
+	}
+	free(element);
+	free(path);
+
+	// Format is [be|le]:[s|u]bits/storagebits>>shift, i.e. le:s12/16>>4
+	asprintf(&element, "scan_elements/%s_type", name);
+	path = make_sysfs_name(device_name, element);
+	memset(&buffer, 0, sizeof(buffer));
+	rc = sysfs_string_read(path, (char *) &buffer, sizeof(buffer) - 1);
+	if (rc < 0) {
+		ALOGE("%s: Unable to read %s", __func__, path);
+		goto error;
+	}
+
+	rc = sscanf(buffer, "%ce:%c%d/%d>>%d", &endian, &sign, &channel->bits, &channel->storage_bytes, &channel->shift);
+	if (rc != 5 || channel->bits <= 0 || channel->bits > channel->storage_bytes || (channel->storage_bytes != 8 && channel->storage_bytes != 16 && channel->storage_bytes != 32 && channel->storage_bytes != 64)) {
+		ALOGE("%s: Invalid scan element type for %s: %s", __func__, name, buffer);
+		goto error;
+	}
+
+	channel->big_endian = endian == 'b';
+	channel->is_signed = sign == 's';
+	channel->storage_bytes /= 8;
+
+	rc = 0;
+	goto complete;
+
+error:
+	free(channel->name);
+	channel->name = NULL;
+
+	rc = -1;
+
+complete:
+	if (element != NULL)
+		free(element);
+
+	if (path != NULL)
+		free(path);
+
+	return rc;
+}
+
+static int iio_scan_channel_requested(struct iio_scan *scan, const char *name,
+	size_t length)
+{
+	int i;
+
+	if (length == strlen("in_timestamp") && strncmp(name, "in_timestamp", length) == 0)
+		return 1;
+
+	for (i = 0; i < scan->channels_count; i++)
+		if (length == strlen(scan->channels[i].name) && strncmp(name, scan->channels[i].name, length) == 0)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Other channels left enabled (by a previous user of the device) would be
+ * part of the scan too and shift every offset, so turn them off.
+ */
+static void iio_scan_channels_disable_others(struct iio_scan *scan)
+{
+	struct dirent *ent;
+	char *directory;
+	char *element;
+	char *path;
+	size_t length;
+	DIR *dp;
+
+	directory = make_sysfs_name(scan->device_name, "scan_elements");
+	dp = opendir(directory);
+	free(directory);
+
+	if (dp == NULL)
+		return;
+
+	while ((ent = readdir(dp)) != NULL) {
+		length = strlen(ent->d_name);
+		if (length <= 3 || strcmp(ent->d_name + length - 3, "_en") != 0)
+			continue;
+
+		if (iio_scan_channel_requested(scan, ent->d_name, length - 3))
+			continue;
+
+		asprintf(&element, "scan_elements/%s", ent->d_name);
+		path = make_sysfs_name(scan->device_name, element);
+		sysfs_value_write(path, 0);
+		free(element);
+		free(path);
+	}
+
+	closedir(dp);
+}
+
+/**
+ * iio_scan_init - function to enable and describe the channels of an IIO scan
+ * The timestamp channel is always enabled, when the device provides one.
+ * The IIO buffer must be disabled while the scan elements are changed.
+ *
+ * @device_name: the sensor's sysfs name (i.e. iio:device1)
+ * @channels: the channels to enable (i.e. in_anglvel_x)
+ * @channels_count: the number of channels
+ */
+int iio_scan_init(struct iio_scan *scan, char *device_name,
+	const char **channels, int channels_count)
+{
+	struct iio_scan_channel *sorted[channels_count + 1];
+	struct iio_scan_channel *channel;
+	char *path;
+	int count;
+	int align;
+	int i, j;
+	int rc;
+
+	if (scan == NULL || device_name == NULL || channels == NULL || channels_count <= 0)
+		return -EINVAL;
+
+	memset(scan, 0, sizeof(struct iio_scan));
+	scan->device_name = device_name;
+	scan->channels = (struct iio_scan_channel *) calloc(channels_count, sizeof(struct iio_scan_channel));
+	scan->timestamp.index = -1;
+
+	iio_set_buffer_state(device_name, 0);
+
+	for (i = 0; i < channels_count; i++) {
+		rc = iio_scan_channel_setup(device_name, channels[i], &scan->channels[i]);
+		if (rc < 0)
+			goto error;
+
+		scan->channels_count++;
+	}
+
+	rc = iio_scan_channel_setup(device_name, "in_timestamp", &scan->timestamp);
+	if (rc < 0) {
+		ALOGD("%s: No timestamp channel for %s", __func__, device_name);
+		scan->timestamp.index = -1;
+	} else {
+		// Older kernels always use the wall clock for the timestamp channel
+		path = make_sysfs_name(device_name, "current_timestamp_clock");
+		rc = sysfs_string_write(path, "boottime\n", strlen("boottime\n"));
+		free(path);
+
+		scan->timestamp_realtime = rc < 0 ? 1 : 0;
+	}
+
+	iio_scan_channels_disable_others(scan);
+
+	count = 0;
+	for (i = 0; i < scan->channels_count; i++)
+		sorted[count++] = &scan->channels[i];
+
+	if (scan->timestamp.index >= 0)
+		sorted[count++] = &scan->timestamp;
+
+	for (i = 1; i < count; i++) {
+		channel = sorted[i];
+		for (j = i; j > 0 && sorted[j - 1]->index > channel->index; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = channel;
+	}
+
+	align = 1;
+	for (i = 0; i < count; i++) {
+		channel = sorted[i];
+
+		if (scan->size % channel->storage_bytes)
+			scan->size += channel->storage_bytes - scan->size % channel->storage_bytes;
+
+		channel->offset = scan->size;
+		scan->size += channel->storage_bytes;
+
+		if (channel->storage_bytes > align)
+			align = channel->storage_bytes;
+	}
+
+	if (scan->size % align)
+		scan->size += align - scan->size % align;
+
+	ALOGD("%s: %s scan is %d bytes", __func__, device_name, scan->size);
+
+	return 0;
+
+error:
+	iio_scan_deinit(scan);
+
+	return -1;
+}
+
+void iio_scan_deinit(struct iio_scan *scan)
+{
+	int i;
+
+	if (scan == NULL)
+		return;
+
+	if (scan->channels != NULL) {
+		for (i = 0; i < scan->channels_count; i++)
+			if (scan->channels[i].name != NULL)
+				free(scan->channels[i].name);
+
+		free(scan->channels);
+		scan->channels = NULL;
+	}
+
+	scan->channels_count = 0;
+
+	if (scan->timestamp.name != NULL)
+		free(scan->timestamp.name);
+	scan->timestamp.name = NULL;
+	scan->timestamp.index = -1;
+
+	scan->size = 0;
+}
+
+/**
+ * iio_scan_read - function to read as many whole samples as available
+ * The fd is expected to be non-blocking, so that the buffer is drained
+ * with a single read in the common case.
+ *
+ * @buffer: room for at least count samples of scan->size bytes
+ * @count: the maximum number of samples to read
+ */
+int iio_scan_read(struct iio_scan *scan, int fd, unsigned char *buffer,
+	int count)
+{
+	struct timespec ts;
+	int rc;
+
+	if (scan == NULL || scan->size <= 0 || fd < 0 || buffer == NULL || count <= 0)
+		return -EINVAL;
+
+	do {
+		rc = read(fd, buffer, scan->size * count);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) {
+		if (errno == EAGAIN)
+			return 0;
+
+		return -1;
+	}
+
+	// Wall clock timestamps are brought back to the boot time base
+	if (scan->timestamp_realtime && rc >= scan->size) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		scan->timestamp_offset = gta04_sensors_time() - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+	}
+
+	return rc / scan->size;
+}
+
+static uint64_t iio_scan_raw(struct iio_scan_channel *channel,
+	unsigned char *sample)
+{
+	unsigned char *p = sample + channel->offset;
+	uint64_t raw = 0;
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (channel->storage_bytes) {
+		case 1:
+			raw = *p;
+			break;
+		case 2:
+			memcpy(&v16, p, sizeof(v16));
+			raw = channel->big_endian ? be16toh(v16) : le16toh(v16);
+			break;
+		case 4:
+			memcpy(&v32, p, sizeof(v32));
+			raw = channel->big_endian ? be32toh(v32) : le32toh(v32);
+			break;
+		case 8:
+			memcpy(&raw, p, sizeof(raw));
+			raw = channel->big_endian ? be64toh(raw) : le64toh(raw);
+			break;
+	}
+
+	return raw;
+}
+
+/**
+ * iio_scan_value - function to decode a channel from a sample
+ *
+ * @sample: a whole sample, as read from the device
+ * @channel: the channel's position in the list given to iio_scan_init
+ */
+int iio_scan_value(struct iio_scan *scan, unsigned char *sample, int channel)
+{
+	struct iio_scan_channel *c;
+	uint64_t raw;
+	int bits;
+
+	if (scan == NULL || sample == NULL || channel < 0 || channel >= scan->channels_count)
+		return 0;
+
+	c = &scan->channels[channel];
+	bits = c->bits;
+
+	raw = iio_scan_raw(c, sample) >> c->shift;
+	if (bits < 64)
+		raw &= (1ULL << bits) - 1;
+
+	if (c->is_signed && bits < 64 && (raw & (1ULL << (bits - 1))))
+		raw |= ~((1ULL << bits) - 1);
+
+	return (int) (int64_t) raw;
+}
+
+/**
+ * iio_scan_timestamp - function to get the timestamp of a sample
+ * Falls back to the current time when the device has no timestamp channel.
+ * The timestamp is in the boot time base, like gta04_sensors_time.
+ *
+ * @sample: a whole sample, as read from the device
+ */
+int64_t iio_scan_timestamp(struct iio_scan *scan, unsigned char *sample)
+{
+	if (scan == NULL || sample == NULL || scan->timestamp.index < 0)
+		return gta04_sensors_time();
+
+	return (int64_t) iio_scan_raw(&scan->timestamp, sample) + scan->timestamp_offset;
+}
+
 /*
  * find_type_by_name() - function to match top level types by name
  * @name: top level type instance name
@@ -123,8 +606,21 @@ int find_type_by_name(const char *name, const char *type)
     DIR *dp;
     char thisname[IIO_MAX_NAME_LENGTH];
     char filename[PATH_MAX];
+    char directory[PATH_MAX];
+    struct discovery_entry entry;
+
+    /* Devices are looked up in the discovery index, only triggers are scanned */
+    if (strcmp(type, "iio:device") == 0) {
+        if (discovery_find(name, DISCOVERY_TYPE_IIO, &entry) < 0)
+            return ret;
+
+        return entry.id;
+    }
+
+    if (gta04_sensors_path(directory, sizeof(directory), iio_dir) < 0)
+        return ret;
 
-    dp = opendir(iio_dir);
+    dp = opendir(directory);
     if (dp == NULL) {
         ALOGE("No industrialio devices available");
         return ret;
@@ -138,7 +634,7 @@ int find_type_by_name(const char *name, const char *type)
             if (sscanf(ent->d_name + strlen(type), "%d", &iio_id) != 1)
                 continue;
 
-            sprintf(filename, "%s%s%d/name", iio_dir, type, iio_id);
+            snprintf(filename, sizeof(filename), "%s%s%d/name", directory, type, iio_id);
             nameFile = fopen(filename, "r");
             if (!nameFile)
                 continue;
@@ -21,38 +21,32 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
 #include <linux/ioctl.h>
 #include <linux/input.h>
-#include <linux/uinput.h>
 
 #define LOG_TAG "gta04_sensors"
 #include <utils/Log.h>
 
 #include "gta04_sensors.h"
 
-void input_event_set(struct input_event *event, int type, int code, int value)
-{
-	if (event == NULL)
-		return;
-
-	memset(event, 0, sizeof(struct input_event));
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID		_IOW('E', 0xa0, int)
+#endif
 
-	event->type = type,
-	event->code = code;
-	event->value = value;
+// Nodes stamping events with the monotonic clock, indexed by fd
+static unsigned char input_monotonic[INPUT_FDS_COUNT];
 
-	gettimeofday(&event->time, NULL);
-}
-
-long int timestamp(struct timeval *time)
+int64_t timestamp(struct timeval *time)
 {
 	if (time == NULL)
 		return -1;
 
-	return time->tv_sec * 1000000000LL + time->tv_usec * 1000;
+	return time->tv_sec * 1000000000LL + time->tv_usec * 1000LL;
 }
 
-long int input_timestamp(struct input_event *event)
+int64_t input_timestamp(struct input_event *event)
 {
 	if (event == NULL)
 		return -1;
@@ -60,157 +54,104 @@ long int input_timestamp(struct input_event *event)
 	return timestamp(&event->time);
 }
 
-int uinput_rel_create(const char *name)
+int input_open(char *name)
 {
-	struct uinput_user_dev uinput_dev;
-	int uinput_fd;
+	struct discovery_entry entry;
+	int clock;
+	int fd;
 	int rc;
 
 	if (name == NULL)
-		return -1;
-
-	uinput_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-	if (uinput_fd < 0) {
-		ALOGE("%s: Unable to open uinput device", __func__);
-		goto error;
-	}
-
-	memset(&uinput_dev, 0, sizeof(uinput_dev));
+		return -EINVAL;
 
-	strncpy(uinput_dev.name, name, sizeof(uinput_dev.name));
-	uinput_dev.id.bustype	= BUS_I2C;
-	uinput_dev.id.vendor	= 0;
-	uinput_dev.id.product	= 0;
-	uinput_dev.id.version	= 0;
+	rc = discovery_find(name, DISCOVERY_TYPE_INPUT, &entry);
+	if (rc < 0 || entry.node[0] == '\0')
+		return -1;
 
-	rc = 0;
-	rc |= ioctl(uinput_fd, UI_SET_EVBIT, EV_REL);
-	rc |= ioctl(uinput_fd, UI_SET_RELBIT, REL_X);
-	rc |= ioctl(uinput_fd, UI_SET_RELBIT, REL_Y);
-	rc |= ioctl(uinput_fd, UI_SET_RELBIT, REL_Z);
-	rc |= ioctl(uinput_fd, UI_SET_EVBIT, EV_SYN);
+	fd = open(entry.node, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
 
-	if (rc < 0) {
-		ALOGE("%s: Unable to set uinput bits", __func__);
-		goto error;
+	if (fd >= INPUT_FDS_COUNT) {
+		close(fd);
+		return -1;
 	}
 
-	rc = write(uinput_fd, &uinput_dev, sizeof(uinput_dev));
+	// Events are stamped with the wall clock unless told otherwise
+	clock = CLOCK_BOOTTIME;
+	rc = ioctl(fd, EVIOCSCLOCKID, &clock);
 	if (rc < 0) {
-		ALOGE("%s: Unable to write uinput device", __func__);
-		goto error;
-	}
+		ALOGE("%s: Unable to use the boot time clock for %s, falling back to monotonic", __func__, name);
 
-	rc = ioctl(uinput_fd, UI_DEV_CREATE);
-	if (rc < 0) {
-		ALOGE("%s: Unable to create uinput device", __func__);
-		goto error;
+		clock = CLOCK_MONOTONIC;
+		ioctl(fd, EVIOCSCLOCKID, &clock);
 	}
 
-	usleep(3000);
-
-	return uinput_fd;
-
-error:
-	if (uinput_fd >= 0)
-		close(uinput_fd);
+	input_monotonic[fd] = rc < 0 ? 1 : 0;
 
-	return -1;
+	return fd;
 }
 
-void uinput_destroy(int uinput_fd)
-{
-	if (uinput_fd < 0)
-		return;
-
-	ioctl(uinput_fd, UI_DEV_DESTROY);
-}
-
-int input_open(char *name)
+/*
+ * Reads as many input events as available, up to count, with a single
+ * syscall. The fd is expected to be non-blocking.
+ */
+int input_read(int fd, struct input_event *events, int count)
 {
-	DIR *d;
-	struct dirent *di;
-
-	char input_name[80] = { 0 };
-	char path[PATH_MAX];
-	char *c;
-	int fd;
+	struct timespec ts;
+	int64_t offset;
+	int64_t time;
 	int rc;
+	int i;
 
-	if (name == NULL)
+	if (fd < 0 || events == NULL || count <= 0)
 		return -EINVAL;
 
-	d = opendir("/dev/input");
-	if (d == NULL)
-		return -1;
+	do {
+		rc = read(fd, events, count * sizeof(struct input_event));
+	} while (rc < 0 && errno == EINTR);
 
-	while ((di = readdir(d))) {
-		if (di == NULL || strcmp(di->d_name, ".") == 0 || strcmp(di->d_name, "..") == 0)
-			continue;
+	if (rc < 0) {
+		if (errno == EAGAIN)
+			return 0;
 
-		snprintf(path, PATH_MAX, "/dev/input/%s", di->d_name);
-		fd = open(path, O_RDONLY | O_NONBLOCK);
-		if (fd < 0)
-			continue;
+		return -1;
+	}
+
+	count = rc / sizeof(struct input_event);
 
-		rc = ioctl(fd, EVIOCGNAME(sizeof(input_name) - 1), &input_name);
-		if (rc < 0)
-			continue;
+	// Monotonic timestamps are brought back to the boot time base, which is
+	// ahead by the time spent suspended
+	if (fd < INPUT_FDS_COUNT && input_monotonic[fd] && count > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		offset = gta04_sensors_time() - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
 
-		c = strstr((char *) &input_name, "\n");
-		if (c != NULL)
-			*c = '\0';
+		for (i = 0; i < count; i++) {
+			time = timestamp(&events[i].time) + offset;
 
-		if (strcmp(input_name, name) == 0)
-			return fd;
-		else
-			close(fd);
+			events[i].time.tv_sec = time / 1000000000LL;
+			events[i].time.tv_usec = (time % 1000000000LL) / 1000;
+		}
 	}
 
-	return -1;
+	return count;
 }
 
 int sysfs_path_prefix(char *name, char *path_prefix)
 {
-	DIR *d;
-	struct dirent *di;
-
-	char input_name[80] = { 0 };
-	char path[PATH_MAX];
-	char *c;
-	int fd;
+	struct discovery_entry entry;
+	int rc;
 
 	if (name == NULL || path_prefix == NULL)
 		return -EINVAL;
 
-	d = opendir("/sys/class/input");
-	if (d == NULL)
+	rc = discovery_find(name, DISCOVERY_TYPE_INPUT, &entry);
+	if (rc < 0)
 		return -1;
 
-	while ((di = readdir(d))) {
-		if (di == NULL || strcmp(di->d_name, ".") == 0 || strcmp(di->d_name, "..") == 0)
-			continue;
-
-		snprintf(path, PATH_MAX, "/sys/class/input/%s/name", di->d_name);
+	snprintf(path_prefix, PATH_MAX, "%s", entry.sysfs);
 
-		fd = open(path, O_RDONLY);
-		if (fd < 0)
-			continue;
-
-		read(fd, &input_name, sizeof(input_name));
-		close(fd);
-
-		c = strstr((char *) &input_name, "\n");
-		if (c != NULL)
-			*c = '\0';
-
-		if (strcmp(input_name, name) == 0) {
-			snprintf(path_prefix, PATH_MAX, "/sys/class/input/%s", di->d_name);
-			return 0;
-		}
-	}
-
-	return -1;
+	return 0;
 }
 
 int sysfs_value_read(char *path)
@@ -281,6 +222,54 @@ complete:
 	return rc;
 }
 
+/*
+ * Only writes the value when it differs from the last one written, which is
+ * kept in cache (initialized to -1 by the caller).
+ */
+int sysfs_value_write_cached(char *path, int value, int *cache)
+{
+	int rc;
+
+	if (cache == NULL)
+		return -EINVAL;
+
+	if (*cache == value)
+		return 0;
+
+	rc = sysfs_value_write(path, value);
+	if (rc < 0)
+		return -1;
+
+	*cache = value;
+
+	return 0;
+}
+
+/*
+ * Input polled devices expose the range of their poll interval, in ms, next
+ * to the poll node. The current range is kept when a node is missing.
+ */
+int sysfs_delay_range(char *path_prefix, struct gta04_sensors_rate *rate)
+{
+	char path[PATH_MAX];
+	int value;
+
+	if (path_prefix == NULL || rate == NULL)
+		return -EINVAL;
+
+	snprintf(path, PATH_MAX, "%s/min", path_prefix);
+	value = sysfs_value_read(path);
+	if (value > 0)
+		rate->delay_min = value * 1000000LL;
+
+	snprintf(path, PATH_MAX, "%s/max", path_prefix);
+	value = sysfs_value_read(path);
+	if (value > 0)
+		rate->delay_max = value * 1000000LL;
+
+	return 0;
+}
+
 int sysfs_string_read(char *path, char *buffer, size_t length)
 {
 	int fd = -1;
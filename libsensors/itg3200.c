@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <fcntl.h>
@@ -38,64 +39,30 @@
 struct itg3200_data {
 	char *name;
 	char *iio_name;
-	sensors_vec_t gyro;
 
-	int x_fp;
-	int y_fp;
-	int z_fp;
-};
-
-int itg3200_enable_iio_channels(char* device_name)
-{
-	char *tmp;
-	int rc;
-
-	//Enable IIO channel X
-	tmp = make_sysfs_name(device_name, "scan_elements/in_anglvel_x_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
-
-	//Enable IIO channel Y
-	tmp = make_sysfs_name(device_name, "scan_elements/in_anglvel_y_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
+	struct iio_scan scan;
+	unsigned char *samples;
 
-	//Enable IIO channel Z
-	tmp = make_sysfs_name(device_name, "scan_elements/in_anglvel_z_en");
-	rc = sysfs_value_write(tmp, 1); //1 == enable
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 1, tmp);
-		goto error;
-	}
-	free(tmp);
-
-	return 0;
+	char frequencies[IIO_FREQUENCIES_COUNT][IIO_FREQUENCY_LENGTH];
+	int frequencies_count;
+	int frequency;
+};
 
-error:
-	free(tmp);
-	return -1;
-}
+const char *itg3200_iio_channels[] = {
+	"in_anglvel_x",
+	"in_anglvel_y",
+	"in_anglvel_z",
+};
 
 int itg3200_init(struct gta04_sensors_handlers *handlers,
 	struct gta04_sensors_device *device)
 {
 	struct itg3200_data *data = NULL;
 	char path[PATH_MAX] = { 0 };
+	char node[PATH_MAX];
 	int iio_fd = -1;
 	int rc;
 	int dev_num;
-	char* tmp;
-	char *x_path;
-	char *y_path;
-	char *z_path;
 
 	ALOGD("%s(%p, %p)", __func__, handlers, device);
 
@@ -108,30 +75,29 @@ int itg3200_init(struct gta04_sensors_handlers *handlers,
 	dev_num = find_type_by_name(data->name, "iio:device");
 	asprintf(&(data->iio_name), "iio:device%d", dev_num); //i.e. data->iio_name = iio:device1
 
-	itg3200_enable_iio_channels(data->iio_name);
 	iio_set_default_trigger(data->iio_name, data->name, dev_num);
 
-	x_path = make_sysfs_name(data->iio_name, "in_anglvel_x_raw");
-	y_path = make_sysfs_name(data->iio_name, "in_anglvel_y_raw");
-	z_path = make_sysfs_name(data->iio_name, "in_anglvel_z_raw");
-	data->x_fp = open(x_path, O_RDONLY);
-	data->y_fp = open(y_path, O_RDONLY);
-	data->z_fp = open(z_path, O_RDONLY);
-	if (data->x_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, x_path);
-	if (data->y_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, y_path);
-	if (data->z_fp < 0)
-		ALOGE("%s: unable to open %s", __func__, z_path);
-	free(x_path);
-	free(y_path);
-	free(z_path);
+	data->frequency = -1;
+	data->frequencies_count = iio_frequencies_available(data->iio_name, "sampling_frequency_available", data->frequencies, IIO_FREQUENCIES_COUNT);
+	if (data->frequencies_count > 0) {
+		iio_frequencies_delay_range(data->frequencies, data->frequencies_count, &handlers->rate);
+	} else {
+		// The ITG3200 samples at up to 1 kHz, but the buffer can't keep up
+		handlers->rate.delay_min = 5000000LL;
+	}
 
-/*
-	int flags = fcntl(iio_fd, F_GETFL, 0);
-	fcntl(iio_fd, F_SETFL, flags | O_NONBLOCK);
-*/
-	iio_fd = open("/dev/iio:device1", O_RDONLY);// | O_NONBLOCK);
+	rc = iio_scan_init(&data->scan, data->iio_name, itg3200_iio_channels, 3);
+	if (rc < 0) {
+		ALOGE("%s: Unable to setup IIO scan elements", __func__);
+		goto error;
+	}
+
+	data->samples = (unsigned char *) calloc(IIO_SCAN_SAMPLES_COUNT, data->scan.size);
+
+	snprintf((char *) &node, sizeof(node), "/dev/%s", data->iio_name);
+	gta04_sensors_path((char *) &path, sizeof(path), node);
+
+	iio_fd = open(path, O_RDONLY | O_NONBLOCK);
 	if (iio_fd < 0) {
 		ALOGE("%s: Unable to open device.", __func__);
 		goto error;
@@ -143,8 +109,17 @@ int itg3200_init(struct gta04_sensors_handlers *handlers,
 	return 0;
 
 error:
-	if (data != NULL)
+	if (data != NULL) {
+		iio_scan_deinit(&data->scan);
+
+		if (data->samples != NULL)
+			free(data->samples);
+
+		if (data->iio_name != NULL)
+			free(data->iio_name);
+
 		free(data);
+	}
 
 	if (iio_fd >= 0)
 		close(iio_fd);
@@ -163,17 +138,22 @@ int itg3200_deinit(struct gta04_sensors_handlers *handlers)
 	if (handlers == NULL)
 		return -EINVAL;
 
-	data = (struct itg3200_data *) handlers->data;
-	close(data->x_fp);
-	close(data->y_fp);
-	close(data->z_fp);
-
 	if (handlers->poll_fd >= 0)
 		close(handlers->poll_fd);
 	handlers->poll_fd = -1;
 
-	if (handlers->data != NULL)
-		free(handlers->data);
+	data = (struct itg3200_data *) handlers->data;
+	if (data != NULL) {
+		iio_scan_deinit(&data->scan);
+
+		if (data->samples != NULL)
+			free(data->samples);
+
+		if (data->iio_name != NULL)
+			free(data->iio_name);
+
+		free(data);
+	}
 	handlers->data = NULL;
 
 	return 0;
@@ -238,10 +218,11 @@ int itg3200_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
 	char *tmp;
 	long int one_second = 1000000000; //in nanoseconds
 	int frequency = 0; //in Hz
+	int index;
 
 	ALOGD("%s(%p, %ld)", __func__, handlers, delay);
 
-	if (handlers == NULL || handlers->data == NULL)
+	if (handlers == NULL || handlers->data == NULL || delay <= 0)
 		return -EINVAL;
 
 	data = (struct itg3200_data *) handlers->data;
@@ -255,12 +236,34 @@ int itg3200_set_delay(struct gta04_sensors_handlers *handlers, long int delay)
 	*/
 
 	tmp = make_sysfs_name(data->iio_name, "sampling_frequency");
-	ALOGD("%s: setting sampling_frequency to %d", __func__, frequency);
-	rc = sysfs_value_write(tmp, frequency);
-	if (rc < 0) {
-		ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, 0, tmp);
-		goto error;
+
+	if (data->frequencies_count > 0) {
+		index = iio_frequency_select(data->frequencies, data->frequencies_count, frequency);
+		if (index < 0)
+			goto error;
+
+		// Only write when the chip setting actually changes
+		if (index == data->frequency)
+			goto complete;
+
+		ALOGD("%s: setting sampling_frequency to %s", __func__, data->frequencies[index]);
+		rc = sysfs_string_write(tmp, data->frequencies[index], strlen(data->frequencies[index]));
+		if (rc < 0) {
+			ALOGE("%s: Unable to write sysfs value (%s) to %s", __func__, data->frequencies[index], tmp);
+			goto error;
+		}
+
+		data->frequency = index;
+	} else {
+		ALOGD("%s: setting sampling_frequency to %d", __func__, frequency);
+		rc = sysfs_value_write_cached(tmp, frequency, &data->frequency);
+		if (rc < 0) {
+			ALOGE("%s: Unable to write sysfs value (%d) to %s", __func__, frequency, tmp);
+			goto error;
+		}
 	}
+
+complete:
 	free(tmp);
 
 	return 0;
@@ -277,59 +280,50 @@ float itg3200_convert(int value)
 }
 
 int itg3200_get_data(struct gta04_sensors_handlers *handlers,
-	struct sensors_event_t *event)
+	struct sensors_event_t *events, int count)
 {
 	struct itg3200_data *data;
-	struct input_event input_event;
-	int iio_fd;
-	int rc;
-	char buf[1024];
+	struct sensors_event_t *event;
+	unsigned char *sample;
+	int i;
 
-	//ALOGD("%s(%p, %p)", __func__, handlers, event);
+	//ALOGD("%s(%p, %p, %d)", __func__, handlers, events, count);
 
-	if (handlers == NULL || handlers->data == NULL || event == NULL)
+	if (handlers == NULL || handlers->data == NULL || events == NULL || count <= 0)
 		return -EINVAL;
 
 	data = (struct itg3200_data *) handlers->data;
 
-	iio_fd = handlers->poll_fd;
-	if (iio_fd < 0)
+	if (handlers->poll_fd < 0)
 		return -EINVAL;
 
-	//clear '/dev/iio:device1', so poll() won't loop infinitely
-	do {
-		rc = read(iio_fd, &buf, 1024);
-		//ALOGD("itg3200: read %d bytes", rc);
-	} while (rc > 0);
+	if (count > IIO_SCAN_SAMPLES_COUNT)
+		count = IIO_SCAN_SAMPLES_COUNT;
 
+	// Whole samples are read in bulk, each one is reported
+	count = iio_scan_read(&data->scan, handlers->poll_fd, data->samples, count);
+	if (count <= 0)
+		return -1;
 
-	memset(event, 0, sizeof(struct sensors_event_t));
-	event->version = sizeof(struct sensors_event_t);
-	event->sensor = handlers->handle;
-	event->type = handlers->handle;
-
-	event->gyro.x = data->gyro.x;
-	event->gyro.y = data->gyro.y;
-	event->gyro.z = data->gyro.z;
-
-	event->gyro.status = SENSOR_STATUS_ACCURACY_MEDIUM;
-
-	//TODO: use bytes from iio_fd, instead of reading sysfs
-	rc = pread(data->x_fp, &buf, 1024, 0);
-	event->gyro.y = itg3200_convert(atoi(buf)); //X and Y are interchanged
-
-	rc = pread(data->y_fp, &buf, 1024, 0);
-	event->gyro.x = itg3200_convert(atoi(buf)); //X and Y are interchanged
+	for (i = 0; i < count; i++) {
+		sample = data->samples + i * data->scan.size;
+		event = &events[i];
 
-	rc = pread(data->z_fp, &buf, 1024, 0);
-	event->gyro.z = itg3200_convert(atoi(buf));
+		memset(event, 0, sizeof(struct sensors_event_t));
+		event->version = sizeof(struct sensors_event_t);
+		event->sensor = handlers->handle;
+		event->type = handlers->handle;
+		event->timestamp = iio_scan_timestamp(&data->scan, sample);
 
-	data->gyro.x = event->gyro.x;
-	data->gyro.y = event->gyro.y;
-	data->gyro.z = event->gyro.z;
+		// X and Y are interchanged
+		event->gyro.x = itg3200_convert(iio_scan_value(&data->scan, sample, 1));
+		event->gyro.y = itg3200_convert(iio_scan_value(&data->scan, sample, 0));
+		event->gyro.z = itg3200_convert(iio_scan_value(&data->scan, sample, 2));
 
+		event->gyro.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+	}
 
-	return 0;
+	return count;
 }
 
 struct gta04_sensors_handlers itg3200 = {
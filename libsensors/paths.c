@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+#include <cutils/properties.h>
+
+#include "gta04_sensors.h"
+
+/*
+ * Every device node and sysfs path is looked up under a root directory,
+ * which is empty on the device. Pointing it elsewhere lets the HAL run
+ * against a fake /dev and /sys tree, fed with recorded sensor streams.
+ */
+
+static char gta04_sensors_root[PROPERTY_VALUE_MAX] = { 0 };
+
+int gta04_sensors_paths_setup(void)
+{
+	size_t length;
+
+	property_get(GTA04_SENSORS_PROPERTY_ROOT, gta04_sensors_root, "");
+
+	length = strlen(gta04_sensors_root);
+	while (length > 0 && gta04_sensors_root[length - 1] == '/')
+		gta04_sensors_root[--length] = '\0';
+
+	if (length > 0)
+		ALOGD("Using sensors root %s", gta04_sensors_root);
+
+	return 0;
+}
+
+int gta04_sensors_path(char *buffer, size_t length, const char *path)
+{
+	int rc;
+
+	if (buffer == NULL || length == 0 || path == NULL)
+		return -EINVAL;
+
+	rc = snprintf(buffer, length, "%s%s", gta04_sensors_root, path);
+	if (rc < 0 || (size_t) rc >= length)
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+/*
+ * The rate functions must be called with the device FIFO mutex held.
+ */
+
+int gta04_sensors_rate_request(struct gta04_sensors_handlers *handlers,
+	int client, int64_t delay)
+{
+	if (handlers == NULL || client < 0 || client >= GTA04_SENSORS_CLIENTS_COUNT || delay < 0)
+		return -EINVAL;
+
+	handlers->rate.delays[client] = delay;
+	handlers->rate.next[client] = 0;
+
+	return gta04_sensors_rate_update(handlers);
+}
+
+/*
+ * Programs the sensor at the fastest delay requested by the clients that
+ * currently need it. The drivers only write to sysfs when the resulting
+ * chip setting changes.
+ */
+int gta04_sensors_rate_update(struct gta04_sensors_handlers *handlers)
+{
+	struct gta04_sensors_rate *rate;
+	int64_t delay = -1;
+	int rc;
+	int i;
+
+	if (handlers == NULL)
+		return -EINVAL;
+
+	rate = &handlers->rate;
+
+	for (i = 0; i < GTA04_SENSORS_CLIENTS_COUNT; i++) {
+		if (!(handlers->needed & (1 << i)) || rate->delays[i] <= 0)
+			continue;
+
+		if (delay < 0 || rate->delays[i] < delay)
+			delay = rate->delays[i];
+	}
+
+	if (delay < 0)
+		return 0;
+
+	if (rate->delay_min > 0 && delay < rate->delay_min)
+		delay = rate->delay_min;
+
+	if (rate->delay_max > 0 && delay > rate->delay_max)
+		delay = rate->delay_max;
+
+	rate->delay = delay;
+
+	if (handlers->set_delay == NULL)
+		return 0;
+
+	gta04_sensors_handlers_lock(handlers);
+	rc = handlers->set_delay(handlers, (long int) delay);
+	gta04_sensors_handlers_unlock(handlers);
+
+	return rc;
+}
+
+/*
+ * Decimates the events of a sensor for a client: events are accepted on a
+ * schedule of the client's delay, with some tolerance for jitter. Late
+ * events are always accepted and the schedule restarts from them.
+ */
+int gta04_sensors_rate_accept(struct gta04_sensors_handlers *handlers,
+	int client, int64_t timestamp)
+{
+	struct gta04_sensors_rate *rate;
+	int64_t delay;
+
+	if (handlers == NULL || client < 0 || client >= GTA04_SENSORS_CLIENTS_COUNT)
+		return 0;
+
+	rate = &handlers->rate;
+	delay = rate->delays[client];
+
+	if (delay <= 0)
+		return 1;
+
+	if (rate->next[client] != 0 && timestamp < rate->next[client] - delay / 8)
+		return 0;
+
+	if (rate->next[client] == 0 || timestamp - rate->next[client] > delay)
+		rate->next[client] = timestamp + delay;
+	else
+		rate->next[client] += delay;
+
+	return 1;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+/*
+ * In threaded mode, each physical sensor is read by its own thread, so that
+ * a slow read doesn't hold the other sensors back. The events go through a
+ * single producer, single consumer ring to the poll thread, which is woken
+ * up through the device's ring eventfd.
+ *
+ * The drivers keep their state in their handlers, which get_data reads while
+ * activate, deactivate and set_delay change it from the API thread: the calls
+ * into a physical driver are serialized by its handlers mutex. Virtual ones
+ * have no get_data and call into their inputs with the FIFO mutex held, so
+ * they are not locked and the FIFO mutex always comes first.
+ */
+
+/*
+ * Lock
+ */
+
+void gta04_sensors_handlers_lock(struct gta04_sensors_handlers *handlers)
+{
+	if (handlers->get_data != NULL)
+		pthread_mutex_lock(&handlers->mutex);
+}
+
+void gta04_sensors_handlers_unlock(struct gta04_sensors_handlers *handlers)
+{
+	if (handlers->get_data != NULL)
+		pthread_mutex_unlock(&handlers->mutex);
+}
+
+/*
+ * Ring
+ */
+
+int gta04_sensors_ring_push(struct gta04_sensors_ring *ring,
+	struct sensors_event_t *event)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	// The consumer owns the oldest events, so the newest one is dropped
+	if (head - tail >= GTA04_SENSORS_RING_SIZE) {
+		ring->dropped++;
+		return -1;
+	}
+
+	memcpy(&ring->events[head % GTA04_SENSORS_RING_SIZE], event, sizeof(struct sensors_event_t));
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+struct sensors_event_t *gta04_sensors_ring_peek(struct gta04_sensors_ring *ring)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	tail = ring->tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return NULL;
+
+	return &ring->events[tail % GTA04_SENSORS_RING_SIZE];
+}
+
+void gta04_sensors_ring_pop(struct gta04_sensors_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reader
+ */
+
+static void *gta04_sensors_reader_thread(void *data)
+{
+	struct gta04_sensors_reader *reader;
+	struct gta04_sensors_handlers *handlers;
+	struct pollfd fds[2];
+	eventfd_t value;
+	int count;
+	int queued;
+	int rc;
+	int i;
+
+	reader = (struct gta04_sensors_reader *) data;
+	handlers = reader->handlers;
+
+	fds[0].fd = handlers->poll_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = reader->stop_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		rc = poll(fds, 2, -1);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ALOGE("%s: Polling %s failed", __func__, handlers->name);
+			break;
+		}
+
+		if (fds[1].revents & POLLIN)
+			break;
+
+		// The node went away, polling it again would return right away
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			ALOGE("%s: Polling %s failed, stopping its reader", __func__, handlers->name);
+			break;
+		}
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		gta04_sensors_handlers_lock(handlers);
+		count = handlers->get_data(handlers, reader->events, GTA04_SENSORS_EVENTS_COUNT);
+		gta04_sensors_handlers_unlock(handlers);
+		if (count <= 0)
+			continue;
+
+		queued = 0;
+		for (i = 0; i < count; i++)
+			if (gta04_sensors_ring_push(&reader->ring, &reader->events[i]) == 0)
+				queued++;
+
+		if (queued > 0)
+			eventfd_write(reader->device->ring_fd, 1);
+	}
+
+	eventfd_read(reader->stop_fd, &value);
+
+	return NULL;
+}
+
+int gta04_sensors_reader_start(struct gta04_sensors_device *device,
+	struct gta04_sensors_handlers *handlers)
+{
+	struct gta04_sensors_reader *reader;
+	int rc;
+
+	if (device == NULL || handlers == NULL || handlers->poll_fd < 0 || handlers->get_data == NULL)
+		return -EINVAL;
+
+	reader = (struct gta04_sensors_reader *) calloc(1, sizeof(struct gta04_sensors_reader));
+	reader->device = device;
+	reader->handlers = handlers;
+
+	reader->stop_fd = eventfd(0, EFD_NONBLOCK);
+	if (reader->stop_fd < 0)
+		goto error;
+
+	rc = pthread_create(&reader->thread, NULL, gta04_sensors_reader_thread, (void *) reader);
+	if (rc != 0) {
+		ALOGE("%s: Unable to create reader thread for %s", __func__, handlers->name);
+		goto error;
+	}
+
+	handlers->reader = reader;
+
+	return 0;
+
+error:
+	if (reader->stop_fd >= 0)
+		close(reader->stop_fd);
+
+	free(reader);
+
+	return -1;
+}
+
+int gta04_sensors_reader_stop(struct gta04_sensors_handlers *handlers)
+{
+	struct gta04_sensors_reader *reader;
+
+	if (handlers == NULL || handlers->reader == NULL)
+		return -EINVAL;
+
+	reader = handlers->reader;
+
+	eventfd_write(reader->stop_fd, 1);
+	pthread_join(reader->thread, NULL);
+
+	ALOGD("%s: %u events dropped by the reader", handlers->name, reader->ring.dropped);
+
+	close(reader->stop_fd);
+	free(reader);
+
+	handlers->reader = NULL;
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#define LOG_TAG "gta04_sensors"
+#include <utils/Log.h>
+
+#include "gta04_sensors.h"
+
+static int gta04_sensors_stats_bucket(int64_t value)
+{
+	int64_t us;
+	int i;
+
+	us = value / 1000;
+
+	for (i = 0; i < GTA04_SENSORS_STATS_BUCKETS - 1; i++)
+		if (us < (1LL << i))
+			return i;
+
+	return GTA04_SENSORS_STATS_BUCKETS - 1;
+}
+
+void gta04_sensors_stats_clear(struct gta04_sensors_stats *stats)
+{
+	if (stats == NULL)
+		return;
+
+	memset(stats, 0, sizeof(struct gta04_sensors_stats));
+}
+
+/*
+ * Records a sample handed to the framework: its latency is measured against
+ * the time poll returns, its jitter against the delay the API requested.
+ * Must be called with the device FIFO mutex held.
+ */
+void gta04_sensors_stats_record(struct gta04_sensors_handlers *handlers,
+	int64_t timestamp, int64_t time)
+{
+	struct gta04_sensors_stats *stats;
+	int64_t latency;
+	int64_t jitter;
+	int64_t delay;
+
+	if (handlers == NULL)
+		return;
+
+	stats = &handlers->stats;
+
+	latency = time - timestamp;
+	if (latency < 0)
+		latency = 0;
+
+	stats->latency[gta04_sensors_stats_bucket(latency)]++;
+	if (latency > stats->latency_max)
+		stats->latency_max = latency;
+
+	delay = handlers->rate.delays[GTA04_SENSORS_CLIENT_API];
+
+	if (stats->count > 0 && delay > 0) {
+		jitter = timestamp - stats->timestamp - delay;
+		if (jitter < 0)
+			jitter = -jitter;
+
+		stats->jitter[gta04_sensors_stats_bucket(jitter)]++;
+		if (jitter > stats->jitter_max)
+			stats->jitter_max = jitter;
+	}
+
+	stats->timestamp = timestamp;
+	stats->count++;
+}
+
+static void gta04_sensors_stats_histogram(char *buffer, size_t length,
+	unsigned int *buckets)
+{
+	size_t offset = 0;
+	int i;
+
+	buffer[0] = '\0';
+
+	for (i = 0; i < GTA04_SENSORS_STATS_BUCKETS && offset < length; i++) {
+		if (buckets[i] == 0)
+			continue;
+
+		if (i == GTA04_SENSORS_STATS_BUCKETS - 1)
+			offset += snprintf(buffer + offset, length - offset, " >=%lldus:%u", (long long) (1LL << (i - 1)), buckets[i]);
+		else
+			offset += snprintf(buffer + offset, length - offset, " <%lldus:%u", (long long) (1LL << i), buckets[i]);
+	}
+}
+
+/*
+ * Writes the histograms of a sensor to fd, or to the log when fd is negative.
+ * Must be called with the device FIFO mutex held.
+ */
+int gta04_sensors_stats_dump(struct gta04_sensors_handlers *handlers, int fd)
+{
+	struct gta04_sensors_stats *stats;
+	char latency[512];
+	char jitter[512];
+	char buffer[1280];
+	int length;
+
+	if (handlers == NULL)
+		return -EINVAL;
+
+	stats = &handlers->stats;
+
+	gta04_sensors_stats_histogram(latency, sizeof(latency), stats->latency);
+	gta04_sensors_stats_histogram(jitter, sizeof(jitter), stats->jitter);
+
+	if (fd < 0) {
+		ALOGD("%s: %u samples, latency max %lldus:%s", handlers->name, stats->count, (long long) (stats->latency_max / 1000), latency);
+		ALOGD("%s: jitter max %lldus:%s", handlers->name, (long long) (stats->jitter_max / 1000), jitter);
+	} else {
+		// No dprintf in bionic
+		length = snprintf(buffer, sizeof(buffer), "%s: %u samples\n  latency max %lldus:%s\n  jitter max %lldus:%s\n", handlers->name, stats->count, (long long) (stats->latency_max / 1000), latency, (long long) (stats->jitter_max / 1000), jitter);
+		if (length < 0)
+			return -1;
+
+		if (length >= (int) sizeof(buffer))
+			length = sizeof(buffer) - 1;
+
+		if (write(fd, buffer, length) < length)
+			return -1;
+	}
+
+	return 0;
+}
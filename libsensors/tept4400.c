@@ -36,6 +36,8 @@ const char SENSOR_PATH[] = "/sys/bus/i2c/devices/2-0048/values"; //tsc2007 on i2
 struct tept4400_light_data {
 	/* light in SI lux units */
 	float light;
+
+	struct input_event input_events[INPUT_EVENTS_COUNT];
 };
 
 int tept4400_init(struct gta04_sensors_handlers *handlers,
@@ -186,60 +188,59 @@ float tsc2007_read_sysfs()
 */
 
 int tept4400_get_data(struct gta04_sensors_handlers *handlers,
-	struct sensors_event_t *event)
+	struct sensors_event_t *events, int count)
 {
 	struct tept4400_light_data *data;
-	struct input_event input_event;
-	int input_fd;
-	int rc;
+	struct input_event *input_event;
+	struct sensors_event_t *event;
+	int input_count;
+	int i, n;
 
-	//ALOGD("%s(%p, %p)", __func__, handlers, event);
+//	ALOGD("%s(%p, %p, %d)", __func__, handlers, events, count);
 
-	if (handlers == NULL || handlers->data == NULL || event == NULL)
+	if (handlers == NULL || handlers->data == NULL || events == NULL || count <= 0)
 		return -EINVAL;
 
 	data = (struct tept4400_light_data *) handlers->data;
 
-	input_fd = handlers->poll_fd;
-	if (input_fd < 0)
-		return -1;
-
-	memset(event, 0, sizeof(struct sensors_event_t));
-	event->version = sizeof(struct sensors_event_t);
-	event->sensor = handlers->handle;
-	event->type = handlers->handle;
+	if (handlers->poll_fd < 0)
+		return -EINVAL;
 
-	event->light = data->light;
+	// Every reported event takes at least its SYN_REPORT input event
+	input_count = count < INPUT_EVENTS_COUNT ? count : INPUT_EVENTS_COUNT;
 
-	event->magnetic.status = SENSOR_STATUS_ACCURACY_MEDIUM; //TODO: needed?
+	input_count = input_read(handlers->poll_fd, data->input_events, input_count);
+	if (input_count <= 0)
+		return -1;
 
+	n = 0;
 
-	do {
-		rc = read(input_fd, &input_event, sizeof(input_event));
-		if (rc < (int) sizeof(input_event))
-			break;
+	// Values may span several reads, they are kept until their SYN_REPORT
+	for (i = 0; i < input_count; i++) {
+		input_event = &data->input_events[i];
 
-		if (input_event.type == EV_ABS) {
-			switch (input_event.code) {
+		if (input_event->type == EV_ABS) {
+			switch (input_event->code) {
 				case ABS_MISC:
-					//ALOGD("ABS_MISC: %d", input_event.value);
-					event->light = tept4400_convert(input_event.value);
+					data->light = tept4400_convert(input_event->value);
 					break;
 				default:
 					continue;
 			}
-		}
-		else if (input_event.type == EV_SYN) {
-			if (input_event.code == SYN_REPORT) {
-				//ALOGD("SYN_REPORT");
-				event->timestamp = input_timestamp(&input_event);
-			}
-		}
-	} while (input_event.type != EV_SYN);
+		} else if (input_event->type == EV_SYN && input_event->code == SYN_REPORT) {
+			event = &events[n++];
 
-	data->light = event->light;
+			memset(event, 0, sizeof(struct sensors_event_t));
+			event->version = sizeof(struct sensors_event_t);
+			event->sensor = handlers->handle;
+			event->type = handlers->handle;
+			event->timestamp = input_timestamp(input_event);
 
-	return 0;
+			event->light = data->light;
+		}
+	}
+
+	return n;
 }
 
 struct gta04_sensors_handlers tept4400 = {
@@ -0,0 +1,55 @@
+# Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Host tests, running the HAL against a fake /dev and /sys tree with FIFOs
+# standing in for the chips, through the gta04.sensors.root property:
+#   make gta04_sensors_replay && gta04_sensors_replay -s 100
+#   gta04_sensors_replay -t -o record.txt session.txt
+
+LOCAL_PATH:= $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	replay.c \
+	fake.c \
+	../gta04_sensors.c \
+	../paths.c \
+	../discovery.c \
+	../input.c \
+	../iio.c \
+	../fifo.c \
+	../rate.c \
+	../stats.c \
+	../reader.c \
+	../bma180.c \
+	../lis302.c \
+	../itg3200.c \
+	../hmc5883l.c \
+	../tept4400.c \
+	../fusion.c \
+	../bmp085.c \
+	$(NULL)
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+# Properties are provided by fake.c instead of libcutils
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread -lrt -lm
+
+LOCAL_MODULE := gta04_sensors_replay
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include <cutils/properties.h>
+#include <hardware/sensors.h>
+
+#include "gta04_sensors.h"
+#include "fake.h"
+
+/*
+ * Properties
+ *
+ * The HAL reads its root with property_get(), which is provided here instead
+ * of libcutils, so that it points to the fake tree.
+ */
+
+struct gta04_sensors_fake_property {
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+};
+
+static struct gta04_sensors_fake_property gta04_sensors_fake_properties[GTA04_SENSORS_FAKE_PROPERTIES_COUNT];
+
+void gta04_sensors_fake_property_set(const char *key, const char *value)
+{
+	int i;
+
+	for (i = 0; i < GTA04_SENSORS_FAKE_PROPERTIES_COUNT; i++) {
+		if (gta04_sensors_fake_properties[i].key[0] == '\0' || strcmp(gta04_sensors_fake_properties[i].key, key) == 0)
+			break;
+	}
+
+	if (i == GTA04_SENSORS_FAKE_PROPERTIES_COUNT)
+		return;
+
+	strncpy(gta04_sensors_fake_properties[i].key, key, PROPERTY_KEY_MAX - 1);
+	strncpy(gta04_sensors_fake_properties[i].value, value, PROPERTY_VALUE_MAX - 1);
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+	const char *result = default_value;
+	int i;
+
+	for (i = 0; i < GTA04_SENSORS_FAKE_PROPERTIES_COUNT; i++) {
+		if (strcmp(gta04_sensors_fake_properties[i].key, key) == 0) {
+			result = gta04_sensors_fake_properties[i].value;
+			break;
+		}
+	}
+
+	if (result == NULL)
+		result = "";
+
+	strncpy(value, result, PROPERTY_VALUE_MAX - 1);
+	value[PROPERTY_VALUE_MAX - 1] = '\0';
+
+	return strlen(value);
+}
+
+/*
+ * Tree
+ */
+
+static int gta04_sensors_fake_mkdir(struct gta04_sensors_fake *fake,
+	const char *path)
+{
+	char buffer[PATH_MAX];
+	char *c;
+
+	snprintf(buffer, sizeof(buffer), "%s%s", fake->root, path);
+
+	for (c = buffer + strlen(fake->root) + 1; *c != '\0'; c++) {
+		if (*c != '/')
+			continue;
+
+		*c = '\0';
+		if (mkdir(buffer, 0755) < 0 && errno != EEXIST)
+			return -1;
+		*c = '/';
+	}
+
+	if (mkdir(buffer, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static int gta04_sensors_fake_file(struct gta04_sensors_fake *fake,
+	const char *path, const char *value)
+{
+	char buffer[PATH_MAX];
+	char *c;
+	int fd;
+	int rc;
+
+	snprintf(buffer, sizeof(buffer), "%s", path);
+
+	c = strrchr(buffer, '/');
+	if (c != NULL && c != buffer) {
+		*c = '\0';
+		if (gta04_sensors_fake_mkdir(fake, buffer) < 0)
+			return -1;
+	}
+
+	snprintf(buffer, sizeof(buffer), "%s%s", fake->root, path);
+
+	fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	rc = write(fd, value, strlen(value));
+	close(fd);
+
+	return rc < (int) strlen(value) ? -1 : 0;
+}
+
+static int gta04_sensors_fake_node(struct gta04_sensors_fake *fake,
+	struct gta04_sensors_fake_device *device, const char *path)
+{
+	snprintf(device->node, sizeof(device->node), "%s%s", fake->root, path);
+
+	if (mkfifo(device->node, 0644) < 0)
+		return -1;
+
+	// Writes never block: a full FIFO stands for a kernel buffer overrun
+	device->fd = open(device->node, O_RDWR | O_NONBLOCK);
+	if (device->fd < 0)
+		return -1;
+
+	return 0;
+}
+
+static int gta04_sensors_fake_input(struct gta04_sensors_fake *fake,
+	struct gta04_sensors_fake_device *device, int id)
+{
+	char path[PATH_MAX];
+	char node[32];
+	int rc;
+
+	snprintf(path, sizeof(path), "/sys/class/input/input%d/event%d", id, id);
+	rc = gta04_sensors_fake_mkdir(fake, path);
+	if (rc < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "/sys/class/input/input%d/name", id);
+	rc = gta04_sensors_fake_file(fake, path, device->name);
+	if (rc < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "/sys/class/input/input%d/poll", id);
+	rc = gta04_sensors_fake_file(fake, path, "0\n");
+	if (rc < 0)
+		return -1;
+
+	rc = gta04_sensors_fake_mkdir(fake, "/dev/input");
+	if (rc < 0)
+		return -1;
+
+	snprintf(node, sizeof(node), "/dev/input/event%d", id);
+
+	return gta04_sensors_fake_node(fake, device, node);
+}
+
+/*
+ * Every IIO device has three 16-bit channels and a timestamp, in a 16 bytes
+ * scan.
+ */
+static int gta04_sensors_fake_iio(struct gta04_sensors_fake *fake,
+	struct gta04_sensors_fake_device *device, int id, const char *channel,
+	const char *frequency)
+{
+	char directory[64];
+	char path[PATH_MAX];
+	char node[32];
+	char index[8];
+	const char *axes[] = { "x", "y", "z" };
+	int rc;
+	int i;
+
+	snprintf(directory, sizeof(directory), "/sys/bus/iio/devices/iio:device%d", id);
+
+	snprintf(path, sizeof(path), "%s/name", directory);
+	rc = gta04_sensors_fake_file(fake, path, device->name);
+	if (rc < 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/trigger/current_trigger", directory);
+	gta04_sensors_fake_file(fake, path, "\n");
+	snprintf(path, sizeof(path), "%s/buffer/enable", directory);
+	gta04_sensors_fake_file(fake, path, "0\n");
+	snprintf(path, sizeof(path), "%s/current_timestamp_clock", directory);
+	gta04_sensors_fake_file(fake, path, "realtime\n");
+	snprintf(path, sizeof(path), "%s/%s", directory, frequency);
+	gta04_sensors_fake_file(fake, path, "50\n");
+	snprintf(path, sizeof(path), "%s/%s_available", directory, frequency);
+	gta04_sensors_fake_file(fake, path, "25 50 100 200\n");
+
+	for (i = 0; i < 3; i++) {
+		snprintf(path, sizeof(path), "%s/scan_elements/%s_%s_en", directory, channel, axes[i]);
+		gta04_sensors_fake_file(fake, path, "0\n");
+		snprintf(path, sizeof(path), "%s/scan_elements/%s_%s_type", directory, channel, axes[i]);
+		gta04_sensors_fake_file(fake, path, "le:s16/16>>0\n");
+		snprintf(path, sizeof(path), "%s/scan_elements/%s_%s_index", directory, channel, axes[i]);
+		snprintf(index, sizeof(index), "%d\n", i);
+		gta04_sensors_fake_file(fake, path, index);
+	}
+
+	snprintf(path, sizeof(path), "%s/scan_elements/in_timestamp_en", directory);
+	gta04_sensors_fake_file(fake, path, "0\n");
+	snprintf(path, sizeof(path), "%s/scan_elements/in_timestamp_type", directory);
+	gta04_sensors_fake_file(fake, path, "le:s64/64>>0\n");
+	snprintf(path, sizeof(path), "%s/scan_elements/in_timestamp_index", directory);
+	rc = gta04_sensors_fake_file(fake, path, "3\n");
+	if (rc < 0)
+		return -1;
+
+	snprintf(node, sizeof(node), "/dev/iio:device%d", id);
+
+	return gta04_sensors_fake_node(fake, device, node);
+}
+
+int64_t gta04_sensors_fake_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int gta04_sensors_fake_open(struct gta04_sensors_fake *fake)
+{
+	struct gta04_sensors_fake_device *device;
+	int rc;
+	int i;
+
+	if (fake == NULL)
+		return -1;
+
+	memset(fake, 0, sizeof(struct gta04_sensors_fake));
+
+	for (i = 0; i < GTA04_SENSORS_FAKE_DEVICES_COUNT; i++)
+		fake->devices[i].fd = -1;
+
+	strcpy(fake->root, "/tmp/gta04-sensors-XXXXXX");
+	if (mkdtemp(fake->root) == NULL) {
+		fprintf(stderr, "Creating directory failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// The BMA180 is driven by the bma150 kernel driver
+	device = &fake->devices[GTA04_SENSORS_FAKE_BMA180];
+	device->name = "bma150";
+	device->handle = SENSOR_TYPE_ACCELEROMETER;
+	device->values_count = 3;
+
+	rc = gta04_sensors_fake_input(fake, device, 0);
+	if (rc < 0)
+		goto error;
+
+	device = &fake->devices[GTA04_SENSORS_FAKE_TEPT4400];
+	device->name = "TSC2007 Touchscreen";
+	device->handle = SENSOR_TYPE_LIGHT;
+	device->values_count = 1;
+
+	rc = gta04_sensors_fake_input(fake, device, 1);
+	if (rc < 0)
+		goto error;
+
+	device = &fake->devices[GTA04_SENSORS_FAKE_BMP085];
+	device->name = "bmp085";
+	device->handle = SENSOR_TYPE_PRESSURE;
+	device->values_count = 1;
+
+	rc = gta04_sensors_fake_input(fake, device, 2);
+	if (rc < 0)
+		goto error;
+
+	gta04_sensors_fake_file(fake, "/sys/devices/platform/omap_i2c.2/i2c-2/2-0077/poll_delay", "0\n");
+
+	device = &fake->devices[GTA04_SENSORS_FAKE_HMC5883L];
+	device->name = "hmc5883l";
+	device->iio = 1;
+	device->handle = SENSOR_TYPE_MAGNETIC_FIELD;
+	device->values_count = 3;
+
+	rc = gta04_sensors_fake_iio(fake, device, 0, "in_magn", "in_magn_sampling_frequency");
+	if (rc < 0)
+		goto error;
+
+	device = &fake->devices[GTA04_SENSORS_FAKE_ITG3200];
+	device->name = "itg3200";
+	device->iio = 1;
+	device->handle = SENSOR_TYPE_GYROSCOPE;
+	device->values_count = 3;
+
+	rc = gta04_sensors_fake_iio(fake, device, 1, "in_anglvel", "sampling_frequency");
+	if (rc < 0)
+		goto error;
+
+	gta04_sensors_fake_property_set(GTA04_SENSORS_PROPERTY_ROOT, fake->root);
+
+	return 0;
+
+error:
+	fprintf(stderr, "Creating the fake tree failed: %s\n", strerror(errno));
+	gta04_sensors_fake_close(fake);
+
+	return -1;
+}
+
+static int gta04_sensors_fake_remove(const char *path, const struct stat *st,
+	int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void gta04_sensors_fake_close(struct gta04_sensors_fake *fake)
+{
+	int i;
+
+	if (fake == NULL)
+		return;
+
+	for (i = 0; i < GTA04_SENSORS_FAKE_DEVICES_COUNT; i++) {
+		if (fake->devices[i].fd >= 0)
+			close(fake->devices[i].fd);
+
+		fake->devices[i].fd = -1;
+	}
+
+	if (fake->root[0] == '\0')
+		return;
+
+	nftw(fake->root, gta04_sensors_fake_remove, 16, FTW_DEPTH | FTW_PHYS);
+	fake->root[0] = '\0';
+}
+
+int gta04_sensors_fake_find(struct gta04_sensors_fake *fake, const char *name)
+{
+	int i;
+
+	for (i = 0; i < GTA04_SENSORS_FAKE_DEVICES_COUNT; i++)
+		if (fake->devices[i].name != NULL && strcmp(fake->devices[i].name, name) == 0)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Writes one sample, as the kernel driver would report it: raw values with
+ * a SYN_REPORT for input devices, a whole scan for IIO devices. Returns -1
+ * when the node is full and the sample is lost.
+ */
+int gta04_sensors_fake_inject(struct gta04_sensors_fake *fake, int device,
+	int *values, int64_t timestamp)
+{
+	struct gta04_sensors_fake_device *fake_device;
+	struct input_event events[4];
+	struct timespec ts;
+	unsigned char scan[16];
+	int16_t value;
+	int count;
+	int rc;
+	int i;
+
+	if (fake == NULL || device < 0 || device >= GTA04_SENSORS_FAKE_DEVICES_COUNT || values == NULL)
+		return -EINVAL;
+
+	fake_device = &fake->devices[device];
+	if (fake_device->fd < 0)
+		return -EINVAL;
+
+	if (fake_device->iio) {
+		memset(&scan, 0, sizeof(scan));
+
+		for (i = 0; i < 3; i++) {
+			value = (int16_t) values[i];
+			memcpy(&scan[i * 2], &value, sizeof(value));
+		}
+
+		memcpy(&scan[8], &timestamp, sizeof(timestamp));
+
+		rc = write(fake_device->fd, &scan, sizeof(scan));
+
+		return rc == sizeof(scan) ? 0 : -1;
+	}
+
+	memset(&events, 0, sizeof(events));
+	count = 0;
+
+	for (i = 0; i < fake_device->values_count; i++) {
+		events[count].type = EV_ABS;
+
+		switch (fake_device->handle) {
+			case SENSOR_TYPE_ACCELEROMETER:
+				events[count].code = ABS_X + i;
+				break;
+			case SENSOR_TYPE_LIGHT:
+				events[count].code = ABS_MISC;
+				break;
+			case SENSOR_TYPE_PRESSURE:
+				events[count].code = ABS_PRESSURE;
+				break;
+		}
+
+		events[count].value = values[i];
+		count++;
+	}
+
+	events[count].type = EV_SYN;
+	events[count].code = SYN_REPORT;
+	count++;
+
+	// FIFOs cannot select the clock, the HAL takes them for nodes stamping
+	// with the monotonic clock
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	timestamp -= gta04_sensors_fake_time() - ((int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec);
+
+	for (i = 0; i < count; i++) {
+		events[i].time.tv_sec = timestamp / 1000000000LL;
+		events[i].time.tv_usec = (timestamp % 1000000000LL) / 1000;
+	}
+
+	rc = write(fake_device->fd, &events, count * sizeof(struct input_event));
+
+	return rc == (int) (count * sizeof(struct input_event)) ? 0 : -1;
+}
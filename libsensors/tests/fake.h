@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+
+#include <hardware/hardware.h>
+#include <hardware/sensors.h>
+
+#ifndef _GTA04_SENSORS_FAKE_H_
+#define _GTA04_SENSORS_FAKE_H_
+
+#define GTA04_SENSORS_FAKE_PROPERTIES_COUNT	8
+
+#define GTA04_SENSORS_FAKE_BMA180		0
+#define GTA04_SENSORS_FAKE_ITG3200		1
+#define GTA04_SENSORS_FAKE_HMC5883L		2
+#define GTA04_SENSORS_FAKE_TEPT4400		3
+#define GTA04_SENSORS_FAKE_BMP085		4
+#define GTA04_SENSORS_FAKE_DEVICES_COUNT	5
+
+/*
+ * Structures
+ */
+
+// Chip stand-in: a FIFO for the device node, the writing end is kept open
+struct gta04_sensors_fake_device {
+	const char *name;
+	int iio;
+	int handle;
+	int values_count;
+
+	char node[PATH_MAX];
+	int fd;
+};
+
+// Fake /dev and /sys tree, the HAL is pointed at it with gta04.sensors.root
+struct gta04_sensors_fake {
+	char root[64];
+
+	struct gta04_sensors_fake_device devices[GTA04_SENSORS_FAKE_DEVICES_COUNT];
+};
+
+/*
+ * Globals
+ */
+
+extern struct sensors_module_t HAL_MODULE_INFO_SYM;
+
+/*
+ * Declarations
+ */
+
+int gta04_sensors_fake_open(struct gta04_sensors_fake *fake);
+void gta04_sensors_fake_close(struct gta04_sensors_fake *fake);
+int gta04_sensors_fake_find(struct gta04_sensors_fake *fake, const char *name);
+int gta04_sensors_fake_inject(struct gta04_sensors_fake *fake, int device,
+	int *values, int64_t timestamp);
+
+void gta04_sensors_fake_property_set(const char *key, const char *value);
+
+int64_t gta04_sensors_fake_time(void);
+
+#endif
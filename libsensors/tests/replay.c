@@ -0,0 +1,586 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <hardware/sensors.h>
+#include <hardware/hardware.h>
+
+#include "gta04_sensors.h"
+#include "fake.h"
+
+/*
+ * Sensors replay: feeds a session, recorded or synthetic, to the HAL through
+ * the fake tree, at its own pace or faster. Each driver is run on its own,
+ * then the fusion path with the virtual sensors, and the events delivered,
+ * lost, their latency and the CPU time of the HAL are reported.
+ *
+ * Usage: gta04_sensors_replay [-s speed] [-g seconds] [-t] [-o record] [session]
+ *
+ * Sessions hold one sample per line: time in seconds, chip name and the raw
+ * values the kernel driver reports, i.e.:
+ *   0.010000 bma150 12 -3 256
+ * Without a session, one is synthesized for the given duration.
+ */
+
+#define GTA04_SENSORS_REPLAY_DURATION		60
+#define GTA04_SENSORS_REPLAY_SETTLE		200000000LL
+#define GTA04_SENSORS_REPLAY_HANDLES_COUNT	32
+
+struct gta04_sensors_replay_sample {
+	int64_t time;
+	int device;
+	int values[3];
+};
+
+struct gta04_sensors_replay_pass {
+	const char *name;
+	int devices[GTA04_SENSORS_FAKE_DEVICES_COUNT];
+	int devices_count;
+	int handles[8];
+	int handles_count;
+};
+
+struct gta04_sensors_replay_count {
+	int delivered;
+	int64_t latency;
+	int64_t latency_max;
+};
+
+struct gta04_sensors_replay {
+	struct gta04_sensors_replay_sample *samples;
+	int count;
+	int64_t duration;
+
+	struct sensors_poll_device_t *device;
+	pthread_t thread;
+	int stop;
+
+	pthread_mutex_t mutex;
+	struct gta04_sensors_replay_count counts[GTA04_SENSORS_REPLAY_HANDLES_COUNT];
+	int delivered;
+	int64_t last;
+
+	FILE *output;
+};
+
+static struct gta04_sensors_replay_pass gta04_sensors_replay_passes[] = {
+	{ "BMA180", { GTA04_SENSORS_FAKE_BMA180 }, 1, { SENSOR_TYPE_ACCELEROMETER }, 1 },
+	{ "ITG3200", { GTA04_SENSORS_FAKE_ITG3200 }, 1, { SENSOR_TYPE_GYROSCOPE }, 1 },
+	{ "HMC5883L", { GTA04_SENSORS_FAKE_HMC5883L }, 1, { SENSOR_TYPE_MAGNETIC_FIELD }, 1 },
+	{ "TEPT4400", { GTA04_SENSORS_FAKE_TEPT4400 }, 1, { SENSOR_TYPE_LIGHT }, 1 },
+	{ "BMP085", { GTA04_SENSORS_FAKE_BMP085 }, 1, { SENSOR_TYPE_PRESSURE }, 1 },
+	{ "Fusion", { GTA04_SENSORS_FAKE_BMA180, GTA04_SENSORS_FAKE_ITG3200, GTA04_SENSORS_FAKE_HMC5883L }, 3,
+		{ SENSOR_TYPE_ORIENTATION, SENSOR_TYPE_ROTATION_VECTOR,
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+		SENSOR_TYPE_GAME_ROTATION_VECTOR,
+#endif
+		SENSOR_TYPE_GRAVITY, SENSOR_TYPE_LINEAR_ACCELERATION },
+#ifdef SENSOR_TYPE_GAME_ROTATION_VECTOR
+		5 },
+#else
+		4 },
+#endif
+};
+
+static int gta04_sensors_replay_passes_count = sizeof(gta04_sensors_replay_passes) /
+	sizeof(struct gta04_sensors_replay_pass);
+
+static int gta04_sensors_replay_add(struct gta04_sensors_replay *replay,
+	int64_t time, int device, int *values)
+{
+	struct gta04_sensors_replay_sample *samples;
+
+	if (replay->count % 4096 == 0) {
+		samples = (struct gta04_sensors_replay_sample *) realloc(replay->samples, (replay->count + 4096) * sizeof(struct gta04_sensors_replay_sample));
+		if (samples == NULL)
+			return -1;
+
+		replay->samples = samples;
+	}
+
+	replay->samples[replay->count].time = time;
+	replay->samples[replay->count].device = device;
+	memcpy(replay->samples[replay->count].values, values, sizeof(replay->samples[replay->count].values));
+	replay->count++;
+
+	if (time > replay->duration)
+		replay->duration = time;
+
+	return 0;
+}
+
+static int gta04_sensors_replay_load(struct gta04_sensors_replay *replay,
+	struct gta04_sensors_fake *fake, const char *path)
+{
+	char line[256];
+	char name[64];
+	double time;
+	int values[3];
+	int device;
+	int line_number = 0;
+	FILE *file;
+	int rc;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Opening %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_number++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		memset(&values, 0, sizeof(values));
+
+		rc = sscanf(line, "%lf %63s %d %d %d", &time, name, &values[0], &values[1], &values[2]);
+		if (rc < 3)
+			goto invalid;
+
+		device = gta04_sensors_fake_find(fake, name);
+		if (device < 0 || rc - 2 < fake->devices[device].values_count)
+			goto invalid;
+
+		rc = gta04_sensors_replay_add(replay, (int64_t) (time * 1e9), device, values);
+		if (rc < 0)
+			goto error;
+
+		continue;
+
+invalid:
+		fprintf(stderr, "%s:%d: invalid sample\n", path, line_number);
+		goto error;
+	}
+
+	fclose(file);
+
+	return 0;
+
+error:
+	fclose(file);
+
+	return -1;
+}
+
+/*
+ * The device is slowly tilted back and forth around its Y axis, with each
+ * chip at its usual rate: samples are raw values, as the kernel drivers
+ * report them.
+ */
+static int gta04_sensors_replay_synthesize(struct gta04_sensors_replay *replay,
+	int seconds)
+{
+	const int64_t periods[GTA04_SENSORS_FAKE_DEVICES_COUNT] = {
+		[GTA04_SENSORS_FAKE_BMA180] = 10000000LL,
+		[GTA04_SENSORS_FAKE_ITG3200] = 5000000LL,
+		[GTA04_SENSORS_FAKE_HMC5883L] = 13333333LL,
+		[GTA04_SENSORS_FAKE_TEPT4400] = 100000000LL,
+		[GTA04_SENSORS_FAKE_BMP085] = 66666666LL,
+	};
+	int64_t next[GTA04_SENSORS_FAKE_DEVICES_COUNT] = { 0 };
+	int64_t end = (int64_t) seconds * 1000000000LL;
+	int64_t time;
+	double angle;
+	double rate;
+	double t;
+	int values[3];
+	int device;
+	int i;
+
+	while (1) {
+		device = -1;
+		for (i = 0; i < GTA04_SENSORS_FAKE_DEVICES_COUNT; i++)
+			if (device < 0 || next[i] < next[device])
+				device = i;
+
+		time = next[device];
+		if (time >= end)
+			break;
+
+		next[device] += periods[device];
+
+		t = time / 1e9;
+		angle = 0.5 * sin(2 * M_PI * 0.2 * t);
+		rate = 0.5 * 2 * M_PI * 0.2 * cos(2 * M_PI * 0.2 * t);
+
+		memset(&values, 0, sizeof(values));
+
+		switch (device) {
+			case GTA04_SENSORS_FAKE_BMA180:
+				// 256 per g
+				values[0] = (int) (256 * sin(angle));
+				values[2] = (int) (256 * cos(angle));
+				break;
+			case GTA04_SENSORS_FAKE_ITG3200:
+				// Inverted, 14.375 per degree per second, X and Y are interchanged
+				values[0] = (int) (-rate * 180.0 / M_PI * 2000.0 / 70.0);
+				break;
+			case GTA04_SENSORS_FAKE_HMC5883L:
+				values[0] = 0;
+				values[1] = (int) (300 * cos(angle));
+				values[2] = (int) (-300 * sin(angle));
+				break;
+			case GTA04_SENSORS_FAKE_TEPT4400:
+				values[0] = 2000 + (int) (100 * sin(t));
+				break;
+			case GTA04_SENSORS_FAKE_BMP085:
+				values[0] = 101325 + (int) (10 * sin(t));
+				break;
+		}
+
+		if (gta04_sensors_replay_add(replay, time, device, values) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int64_t gta04_sensors_replay_cpu(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) < 0)
+		return 0;
+
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void gta04_sensors_replay_wait(int64_t time)
+{
+	struct timespec ts;
+
+	ts.tv_sec = time / 1000000000LL;
+	ts.tv_nsec = time % 1000000000LL;
+
+	while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/*
+ * Stands for the framework's poll thread.
+ */
+static void *gta04_sensors_replay_thread(void *data)
+{
+	struct gta04_sensors_replay *replay;
+	struct gta04_sensors_replay_count *count;
+	struct sensors_event_t events[GTA04_SENSORS_EVENTS_COUNT];
+	int64_t latency;
+	int64_t time;
+	int n;
+	int i;
+
+	replay = (struct gta04_sensors_replay *) data;
+
+	while (1) {
+		n = replay->device->poll(replay->device, events, GTA04_SENSORS_EVENTS_COUNT);
+		if (n < 0)
+			break;
+
+		time = gta04_sensors_fake_time();
+
+		pthread_mutex_lock(&replay->mutex);
+
+		// The events of the wake up sample are not accounted
+		if (replay->stop) {
+			pthread_mutex_unlock(&replay->mutex);
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].sensor < 0 || events[i].sensor >= GTA04_SENSORS_REPLAY_HANDLES_COUNT)
+				continue;
+
+			count = &replay->counts[events[i].sensor];
+
+			latency = time - events[i].timestamp;
+			count->latency += latency;
+			if (latency > count->latency_max)
+				count->latency_max = latency;
+
+			count->delivered++;
+			replay->delivered++;
+
+			if (replay->output != NULL)
+				fprintf(replay->output, "%lld %d %f %f %f\n", (long long int) events[i].timestamp, events[i].sensor, events[i].data[0], events[i].data[1], events[i].data[2]);
+		}
+
+		replay->last = time;
+
+		pthread_mutex_unlock(&replay->mutex);
+	}
+
+	return NULL;
+}
+
+static int gta04_sensors_replay_run(struct gta04_sensors_replay *replay,
+	struct gta04_sensors_fake *fake, struct gta04_sensors_replay_pass *pass,
+	double speed)
+{
+	struct gta04_sensors_replay_sample *sample;
+	struct gta04_sensors_replay_count *count;
+	struct sensor_t const *list;
+	struct hw_device_t *device;
+	int injected[GTA04_SENSORS_FAKE_DEVICES_COUNT] = { 0 };
+	int wake[3] = { 0, 0, 256 };
+	int overruns[GTA04_SENSORS_FAKE_DEVICES_COUNT] = { 0 };
+	int64_t cpu_start;
+	int64_t cpu;
+	int64_t start;
+	int64_t wall;
+	int64_t time;
+	int total = 0;
+	int lost = 0;
+	int delivered;
+	int failures = 0;
+	int list_count;
+	int used;
+	int rc;
+	int i, j;
+
+	for (i = 0; i < replay->count; i++) {
+		for (j = 0; j < pass->devices_count; j++)
+			if (pass->devices[j] == replay->samples[i].device)
+				break;
+
+		if (j < pass->devices_count)
+			break;
+	}
+
+	if (i == replay->count) {
+		printf("%s: no samples\n", pass->name);
+		return 0;
+	}
+
+	rc = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common, SENSORS_HARDWARE_POLL, &device);
+	if (rc < 0) {
+		printf("%s: FAIL: opening the HAL failed\n", pass->name);
+		return -1;
+	}
+
+	replay->device = (struct sensors_poll_device_t *) device;
+
+	list_count = HAL_MODULE_INFO_SYM.get_sensors_list(&HAL_MODULE_INFO_SYM, &list);
+
+	for (i = 0; i < pass->handles_count; i++) {
+		for (j = 0; j < list_count; j++)
+			if (list[j].handle == pass->handles[i])
+				break;
+
+		if (j == list_count) {
+			printf("%s: FAIL: sensor %d is not listed\n", pass->name, pass->handles[i]);
+			failures++;
+			continue;
+		}
+
+		replay->device->activate(replay->device, pass->handles[i], 1);
+		replay->device->setDelay(replay->device, pass->handles[i], 0);
+	}
+
+	memset(&replay->counts, 0, sizeof(replay->counts));
+	replay->delivered = 0;
+	replay->stop = 0;
+
+	pthread_create(&replay->thread, NULL, gta04_sensors_replay_thread, (void *) replay);
+
+	// The HAL runs in the other threads, the samples are written from this one
+	cpu_start = gta04_sensors_replay_cpu(CLOCK_PROCESS_CPUTIME_ID) - gta04_sensors_replay_cpu(CLOCK_THREAD_CPUTIME_ID);
+	start = gta04_sensors_fake_time();
+
+	for (i = 0; i < replay->count; i++) {
+		sample = &replay->samples[i];
+
+		for (j = 0; j < pass->devices_count; j++)
+			if (pass->devices[j] == sample->device)
+				break;
+
+		if (j == pass->devices_count)
+			continue;
+
+		time = start + (int64_t) (sample->time / speed);
+		gta04_sensors_replay_wait(time);
+
+		rc = gta04_sensors_fake_inject(fake, sample->device, sample->values, gta04_sensors_fake_time());
+		if (rc < 0)
+			overruns[sample->device]++;
+
+		injected[sample->device]++;
+		total++;
+	}
+
+	wall = gta04_sensors_fake_time() - start;
+
+	// Done once nothing came out for a while
+	do {
+		usleep(GTA04_SENSORS_REPLAY_SETTLE / 4000);
+
+		pthread_mutex_lock(&replay->mutex);
+		time = replay->last;
+		pthread_mutex_unlock(&replay->mutex);
+	} while (gta04_sensors_fake_time() - time < GTA04_SENSORS_REPLAY_SETTLE);
+
+	cpu = gta04_sensors_replay_cpu(CLOCK_PROCESS_CPUTIME_ID) - gta04_sensors_replay_cpu(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+	pthread_mutex_lock(&replay->mutex);
+	replay->stop = 1;
+	delivered = replay->delivered;
+	pthread_mutex_unlock(&replay->mutex);
+
+	// Wakes poll up, with a sample for each device fusion may be waiting on
+	for (i = 0; i < pass->devices_count; i++)
+		gta04_sensors_fake_inject(fake, pass->devices[i], wake, gta04_sensors_fake_time());
+
+	pthread_join(replay->thread, NULL);
+
+	if (getenv("GTA04_SENSORS_REPLAY_DUMP") != NULL)
+		gta04_sensors_dump((struct gta04_sensors_device *) device, STDOUT_FILENO);
+
+	for (i = 0; i < pass->handles_count; i++)
+		replay->device->activate(replay->device, pass->handles[i], 0);
+
+	device->close(device);
+
+	printf("%s: %d samples in %.3f s, %.0f samples/s, HAL CPU %.1f ms, %.2f us per sample, %.2f us per event\n", pass->name, total, wall / 1e9, total * 1e9 / wall, cpu / 1e6, total > 0 ? cpu / 1e3 / total : 0, delivered > 0 ? cpu / 1e3 / delivered : 0);
+
+	for (i = 0; i < pass->devices_count; i++) {
+		j = pass->devices[i];
+
+		if (overruns[j] > 0)
+			printf("  %s: %d samples, %d overruns\n", fake->devices[j].name, injected[j], overruns[j]);
+	}
+
+	for (i = 0; i < pass->handles_count; i++) {
+		count = &replay->counts[pass->handles[i]];
+
+		printf("  sensor %d: %d events, latency avg %.0f us max %.0f us", pass->handles[i], count->delivered, count->delivered > 0 ? count->latency / 1e3 / count->delivered : 0, count->latency_max / 1e3);
+
+		// Physical sensors report every sample that made it to the node
+		for (j = 0; j < pass->devices_count; j++) {
+			if (fake->devices[pass->devices[j]].handle != pass->handles[i])
+				continue;
+
+			used = injected[pass->devices[j]] - overruns[pass->devices[j]];
+			printf(", %d lost", used - count->delivered);
+
+			if (count->delivered != used)
+				lost++;
+		}
+
+		printf("\n");
+
+		if (count->delivered == 0)
+			failures++;
+	}
+
+	if (lost > 0) {
+		printf("%s: FAIL: events lost\n", pass->name);
+		failures++;
+	}
+
+	return failures > 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct gta04_sensors_replay replay;
+	struct gta04_sensors_fake fake;
+	const char *output_path = NULL;
+	double speed = 1;
+	int seconds = GTA04_SENSORS_REPLAY_DURATION;
+	int threads = 0;
+	int failures = 0;
+	int rc;
+	int i;
+
+	while ((rc = getopt(argc, argv, "s:g:to:")) != -1) {
+		switch (rc) {
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'g':
+				seconds = atoi(optarg);
+				break;
+			case 't':
+				threads = 1;
+				break;
+			case 'o':
+				output_path = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (speed <= 0 || seconds <= 0)
+		goto usage;
+
+	memset(&replay, 0, sizeof(replay));
+	pthread_mutex_init(&replay.mutex, NULL);
+
+	rc = gta04_sensors_fake_open(&fake);
+	if (rc < 0)
+		return 1;
+
+	gta04_sensors_fake_property_set(GTA04_SENSORS_PROPERTY_THREADS, threads ? "1" : "0");
+
+	if (optind < argc)
+		rc = gta04_sensors_replay_load(&replay, &fake, argv[optind]);
+	else
+		rc = gta04_sensors_replay_synthesize(&replay, seconds);
+
+	if (rc < 0 || replay.count == 0)
+		goto error;
+
+	if (output_path != NULL) {
+		replay.output = fopen(output_path, "w");
+		if (replay.output == NULL)
+			fprintf(stderr, "Opening %s failed: %s\n", output_path, strerror(errno));
+	}
+
+	printf("Replaying %d samples, %.1f s of data at %.1fx, %s\n", replay.count, replay.duration / 1e9, speed, threads ? "reader threads" : "epoll");
+
+	for (i = 0; i < gta04_sensors_replay_passes_count; i++)
+		if (gta04_sensors_replay_run(&replay, &fake, &gta04_sensors_replay_passes[i], speed) < 0)
+			failures++;
+
+	if (replay.output != NULL)
+		fclose(replay.output);
+
+	gta04_sensors_fake_close(&fake);
+	free(replay.samples);
+
+	return failures > 0 ? 1 : 0;
+
+error:
+	gta04_sensors_fake_close(&fake);
+	free(replay.samples);
+
+	return 1;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s speed] [-g seconds] [-t] [-o record] [session]\n", argv[0]);
+
+	return 1;
+}
@@ -0,0 +1,19 @@
+# Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+# vibrator.c is built into libhardware_legacy, through
+# BOARD_HAS_VIBRATOR_IMPLEMENTATION: only the tests are built from here
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2014 Paul Kocialkowski <contact@paulk.fr>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+/*
+ * Vibrator benchmark: a uinput device with force feedback stands in for the
+ * twl4030 vibrator. It grants the effect uploads, and records the uploads
+ * and the time each vibration reaches the device. The time spent in sendit
+ * and until the device sees the vibration start is reported for haptic
+ * feedback durations, then patterns are checked.
+ *
+ * It needs /dev/uinput and no other input device named twl4030:vibrator,
+ * e.g. a Linux build machine.
+ *
+ * Usage: gta04_vibrator_bench [-n count]
+ */
+
+#define VIBRATOR_BENCH_NAME		"twl4030:vibrator"
+#define VIBRATOR_BENCH_COUNT		200
+#define VIBRATOR_BENCH_TIMEOUT		100
+
+struct vibrator_bench {
+	int fd;
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int uploads;
+	int erases;
+	int plays;
+	int64_t play_time;
+};
+
+struct vibrator_bench bench = {
+	.fd = -1,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+int vibrator_exists(void);
+int sendit(int duration);
+int vibrator_pattern(const int *timings, int count, int repeat);
+
+int64_t vibrator_bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Effect uploads and erases block the vibrator until they are granted here.
+ */
+void *vibrator_bench_thread(void *data)
+{
+	struct uinput_ff_upload upload;
+	struct uinput_ff_erase erase;
+	struct input_event event;
+	struct pollfd fd;
+	int rc;
+
+	fd.fd = bench.fd;
+	fd.events = POLLIN;
+
+	while (bench.running) {
+		rc = poll(&fd, 1, VIBRATOR_BENCH_TIMEOUT);
+		if (rc <= 0)
+			continue;
+
+		rc = read(bench.fd, &event, sizeof(event));
+		if (rc < (int) sizeof(event))
+			continue;
+
+		if (event.type == EV_UINPUT && event.code == UI_FF_UPLOAD) {
+			memset(&upload, 0, sizeof(upload));
+			upload.request_id = event.value;
+
+			ioctl(bench.fd, UI_BEGIN_FF_UPLOAD, &upload);
+			upload.retval = 0;
+			ioctl(bench.fd, UI_END_FF_UPLOAD, &upload);
+
+			pthread_mutex_lock(&bench.mutex);
+			bench.uploads++;
+			pthread_mutex_unlock(&bench.mutex);
+		} else if (event.type == EV_UINPUT && event.code == UI_FF_ERASE) {
+			memset(&erase, 0, sizeof(erase));
+			erase.request_id = event.value;
+
+			ioctl(bench.fd, UI_BEGIN_FF_ERASE, &erase);
+			erase.retval = 0;
+			ioctl(bench.fd, UI_END_FF_ERASE, &erase);
+
+			pthread_mutex_lock(&bench.mutex);
+			bench.erases++;
+			pthread_mutex_unlock(&bench.mutex);
+		} else if (event.type == EV_FF && event.value > 0) {
+			pthread_mutex_lock(&bench.mutex);
+			bench.plays++;
+			bench.play_time = vibrator_bench_time();
+			pthread_cond_broadcast(&bench.cond);
+			pthread_mutex_unlock(&bench.mutex);
+		}
+	}
+
+	return NULL;
+}
+
+int vibrator_bench_open(void)
+{
+	struct uinput_user_dev device;
+	int rc;
+
+	bench.fd = open("/dev/uinput", O_RDWR);
+	if (bench.fd < 0) {
+		fprintf(stderr, "Opening /dev/uinput failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&device, 0, sizeof(device));
+	strncpy(device.name, VIBRATOR_BENCH_NAME, UINPUT_MAX_NAME_SIZE - 1);
+	device.id.bustype = BUS_VIRTUAL;
+	device.ff_effects_max = 16;
+
+	if (ioctl(bench.fd, UI_SET_EVBIT, EV_FF) < 0 || ioctl(bench.fd, UI_SET_FFBIT, FF_RUMBLE) < 0)
+		goto error;
+
+	rc = write(bench.fd, &device, sizeof(device));
+	if (rc < (int) sizeof(device))
+		goto error;
+
+	if (ioctl(bench.fd, UI_DEV_CREATE) < 0)
+		goto error;
+
+	bench.running = 1;
+
+	rc = pthread_create(&bench.thread, NULL, vibrator_bench_thread, NULL);
+	if (rc != 0) {
+		bench.running = 0;
+		ioctl(bench.fd, UI_DEV_DESTROY);
+		goto error;
+	}
+
+	// Leaves time for the event node to show up
+	usleep(200000);
+
+	return 0;
+
+error:
+	fprintf(stderr, "Creating the uinput device failed: %s\n", strerror(errno));
+	close(bench.fd);
+	bench.fd = -1;
+
+	return -1;
+}
+
+void vibrator_bench_close(void)
+{
+	bench.running = 0;
+	pthread_join(bench.thread, NULL);
+
+	ioctl(bench.fd, UI_DEV_DESTROY);
+	close(bench.fd);
+	bench.fd = -1;
+}
+
+/*
+ * Waits for the device to see more than the given vibrations, returns the
+ * time the last one started or -1.
+ */
+int64_t vibrator_bench_wait(int plays, int timeout)
+{
+	struct timespec ts;
+	int64_t time = -1;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&bench.mutex);
+
+	while (bench.plays <= plays) {
+		if (pthread_cond_timedwait(&bench.cond, &bench.mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+
+	if (bench.plays > plays)
+		time = bench.play_time;
+
+	pthread_mutex_unlock(&bench.mutex);
+
+	return time;
+}
+
+int vibrator_bench_plays(void)
+{
+	int plays;
+
+	pthread_mutex_lock(&bench.mutex);
+	plays = bench.plays;
+	pthread_mutex_unlock(&bench.mutex);
+
+	return plays;
+}
+
+/*
+ * Calls sendit count times, alternating between both durations, with the
+ * given gap in-between.
+ */
+int vibrator_bench_run(const char *label, int first, int second, int gap,
+	int count)
+{
+	int64_t call_sum = 0;
+	int64_t call_max = 0;
+	int64_t latency_sum = 0;
+	int64_t latency_max = 0;
+	int64_t start;
+	int64_t call;
+	int64_t played;
+	int uploads;
+	int plays;
+	int missed = 0;
+	int i;
+
+	pthread_mutex_lock(&bench.mutex);
+	uploads = bench.uploads;
+	pthread_mutex_unlock(&bench.mutex);
+
+	for (i = 0; i < count; i++) {
+		plays = vibrator_bench_plays();
+
+		start = vibrator_bench_time();
+		sendit(i % 2 ? second : first);
+		call = vibrator_bench_time() - start;
+
+		played = vibrator_bench_wait(plays, VIBRATOR_BENCH_TIMEOUT);
+		if (played < 0) {
+			missed++;
+		} else {
+			latency_sum += played - start;
+			if (played - start > latency_max)
+				latency_max = played - start;
+		}
+
+		call_sum += call;
+		if (call > call_max)
+			call_max = call;
+
+		if (gap > 0)
+			usleep(gap * 1000);
+	}
+
+	sendit(0);
+
+	pthread_mutex_lock(&bench.mutex);
+	uploads = bench.uploads - uploads;
+	pthread_mutex_unlock(&bench.mutex);
+
+	printf("%s: sendit %lld us avg, %lld max, started on the device after %lld us avg, %lld max, %.2f uploads per call, %d missed\n", label, (long long int) (call_sum / count), (long long int) call_max, (long long int) (count > missed ? latency_sum / (count - missed) : 0), (long long int) latency_max, (double) uploads / count, missed);
+
+	return missed > 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int once[] = { 0, 20, 100, 20, 100, 40 };
+	int repeated[] = { 0, 50, 50 };
+	int empty[] = { 0, 0 };
+	int silent[] = { 0, 50, 0, 0 };
+	int count = VIBRATOR_BENCH_COUNT;
+	int failures = 0;
+	int plays;
+	int rc;
+
+	while ((rc = getopt(argc, argv, "n:")) != -1) {
+		switch (rc) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n count]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0)
+		count = VIBRATOR_BENCH_COUNT;
+
+	if (vibrator_bench_open() < 0)
+		return 1;
+
+	if (!vibrator_exists()) {
+		printf("FAIL: %s not found\n", VIBRATOR_BENCH_NAME);
+		vibrator_bench_close();
+		return 1;
+	}
+
+	// The first call opens the device and uploads the effects
+	sendit(20);
+	vibrator_bench_wait(0, VIBRATOR_BENCH_TIMEOUT);
+	sendit(0);
+
+	failures += vibrator_bench_run("20 ms clicks, 50 ms apart", 20, 20, 50, count / 4) < 0;
+	failures += vibrator_bench_run("20 ms clicks, back to back", 20, 20, 0, count);
+	failures += vibrator_bench_run("75 and 20 ms, alternating", 75, 20, 0, count);
+
+	plays = vibrator_bench_plays();
+	vibrator_pattern(once, sizeof(once) / sizeof(int), -1);
+	usleep(500000);
+	plays = vibrator_bench_plays() - plays;
+
+	printf("Pattern of 3 vibrations: %d started\n", plays);
+	if (plays != 3) {
+		printf("FAIL: pattern\n");
+		failures++;
+	}
+
+	plays = vibrator_bench_plays();
+	vibrator_pattern(repeated, sizeof(repeated) / sizeof(int), 0);
+	usleep(1000000);
+	sendit(0);
+	plays = vibrator_bench_plays() - plays;
+
+	printf("Repeating 50/50 ms pattern for 1 s: %d started\n", plays);
+	if (plays < 8 || plays > 11) {
+		printf("FAIL: repeating pattern\n");
+		failures++;
+	}
+
+	plays = vibrator_bench_plays();
+	usleep(300000);
+	if (vibrator_bench_plays() != plays) {
+		printf("FAIL: pattern still playing after sendit(0)\n");
+		failures++;
+	}
+
+	if (vibrator_pattern(empty, sizeof(empty) / sizeof(int), 0) != -EINVAL || vibrator_pattern(silent, sizeof(silent) / sizeof(int), 2) != -EINVAL) {
+		printf("FAIL: patterns repeating nothing were accepted\n");
+		failures++;
+	}
+
+	vibrator_bench_close();
+
+	return failures > 0 ? 1 : 0;
+}
@@ -17,9 +17,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <linux/input.h>
@@ -36,8 +39,50 @@
 
 const char rumble_input[] = "twl4030:vibrator";
 
+/*
+ * Effects for the durations haptic feedback uses are uploaded once, when the
+ * device is opened, so that starting one is a single write. Other durations
+ * share the last effect, which is updated in place.
+ */
+
+struct rumble_effect {
+	int duration;
+	int id;
+};
+
+#define RUMBLE_EFFECTS_COUNT	7
+
+struct rumble_effect rumble_effects[RUMBLE_EFFECTS_COUNT] = {
+	{ 10, -1 },
+	{ 20, -1 },
+	{ 30, -1 },
+	{ 40, -1 },
+	{ 50, -1 },
+	{ 100, -1 },
+	{ 0, -1 },
+};
+
 int rumble_fd = -1;
 int rumble_id = -1;
+int rumble_magnitude = -1;
+int64_t rumble_end = 0;
+
+/*
+ * Patterns are played by a thread, that only wakes up to start each
+ * vibration: the kernel stops them.
+ */
+
+#define RUMBLE_PATTERN_MAX	64
+
+pthread_mutex_t rumble_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t rumble_cond = PTHREAD_COND_INITIALIZER;
+pthread_t rumble_thread;
+int rumble_thread_started = 0;
+
+int rumble_pattern[RUMBLE_PATTERN_MAX];
+int rumble_pattern_count = 0;
+int rumble_pattern_repeat = -1;
+unsigned int rumble_pattern_serial = 0;
 
 /*
  * Device detect
@@ -80,138 +125,440 @@ void input_event_set(struct input_event *event, int type, int code, int value)
 	gettimeofday(&event->time, NULL);
 }
 
-int input_open(const char *name)
+/*
+ * The event node is found from the device names in sysfs, without opening
+ * every node, and kept for the next lookups. It is checked again on open in
+ * case the device went away in-between. Both are done with rumble_mutex
+ * locked.
+ */
+
+char rumble_node[PATH_MAX] = { 0 };
+
+int input_node_find(const char *name, char *node, size_t length)
 {
 	DIR *d;
+	DIR *e;
 	struct dirent *di;
+	struct dirent *ei;
 
-	char input_name[80] = { 0 };
+	char input_name[80];
 	char path[PATH_MAX];
 	char *c;
+	int found = 0;
 	int fd;
 	int rc;
 
-	if (name == NULL)
-		return -EINVAL;
-
-	d = opendir("/dev/input");
+	d = opendir("/sys/class/input");
 	if (d == NULL)
 		return -1;
 
-	while ((di = readdir(d))) {
-		if (di == NULL || strcmp(di->d_name, ".") == 0 || strcmp(di->d_name, "..") == 0)
+	while (!found && (di = readdir(d))) {
+		if (strncmp(di->d_name, "input", 5) != 0)
 			continue;
 
-		snprintf(path, PATH_MAX, "/dev/input/%s", di->d_name);
-		fd = open(path, O_RDWR | O_NONBLOCK);
+		snprintf(path, PATH_MAX, "/sys/class/input/%s/name", di->d_name);
+		fd = open(path, O_RDONLY);
 		if (fd < 0)
 			continue;
 
-		rc = ioctl(fd, EVIOCGNAME(sizeof(input_name) - 1), &input_name);
-		if (rc < 0)
+		memset(&input_name, 0, sizeof(input_name));
+		rc = read(fd, &input_name, sizeof(input_name) - 1);
+		close(fd);
+
+		if (rc <= 0)
 			continue;
 
 		c = strstr((char *) &input_name, "\n");
 		if (c != NULL)
 			*c = '\0';
 
-		if (strcmp(input_name, name) == 0)
-			return fd;
-		else
+		if (strcmp(input_name, name) != 0)
+			continue;
+
+		snprintf(path, PATH_MAX, "/sys/class/input/%s", di->d_name);
+		e = opendir(path);
+		if (e == NULL)
+			continue;
+
+		while ((ei = readdir(e))) {
+			if (strncmp(ei->d_name, "event", 5) == 0) {
+				snprintf(node, length, "/dev/input/%s", ei->d_name);
+				found = 1;
+				break;
+			}
+		}
+
+		closedir(e);
+	}
+
+	closedir(d);
+
+	return found ? 0 : -1;
+}
+
+int input_open(const char *name)
+{
+	char input_name[80] = { 0 };
+	char *c;
+	int fd;
+	int rc;
+
+	if (name == NULL)
+		return -EINVAL;
+
+	if (rumble_node[0] != '\0') {
+		fd = open(rumble_node, O_RDWR | O_NONBLOCK);
+		if (fd >= 0) {
+			rc = ioctl(fd, EVIOCGNAME(sizeof(input_name) - 1), &input_name);
+			if (rc >= 0) {
+				c = strstr((char *) &input_name, "\n");
+				if (c != NULL)
+					*c = '\0';
+
+				if (strcmp(input_name, name) == 0)
+					return fd;
+			}
+
 			close(fd);
+		}
+
+		rumble_node[0] = '\0';
 	}
 
-	return -1;
+	rc = input_node_find(name, rumble_node, sizeof(rumble_node));
+	if (rc < 0)
+		return -1;
+
+	return open(rumble_node, O_RDWR | O_NONBLOCK);
 }
 
 /*
- * Vibrator
+ * Rumble
  */
 
-int vibrator_exists(void)
+int64_t rumble_time(void)
 {
-	int fd;
+	struct timespec ts;
 
-	fd = input_open(rumble_input);
-	if (fd < 0)
-		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	close(fd);
-
-	return 1;
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-int sendit(int duration)
+int rumble_upload(struct rumble_effect *rumble, int duration)
 {
-	struct input_event event;
 	struct ff_effect effect;
 	int rc;
 
-	if (rumble_fd < 0)
-		rumble_fd = input_open(rumble_input);
+	memset(&effect, 0, sizeof(effect));
+	effect.type = FF_RUMBLE;
+	// An effect that was uploaded already is updated
+	effect.id = rumble->id;
+	effect.replay.length = duration;
+	effect.replay.delay = 0;
+	effect.u.rumble.strong_magnitude = rumble_magnitude;
+
+	rc = ioctl(rumble_fd, EVIOCSFF, &effect);
+	if (rc < 0) {
+		rumble->id = -1;
+		return -1;
+	}
 
+	rumble->id = effect.id;
+	rumble->duration = duration;
+
+	return 0;
+}
+
+void rumble_close(void)
+{
+	int i;
+
+	if (rumble_fd >= 0)
+		close(rumble_fd);
+
+	// The effects go away with the fd
+	for (i = 0; i < RUMBLE_EFFECTS_COUNT; i++)
+		rumble_effects[i].id = -1;
+
+	rumble_effects[RUMBLE_EFFECTS_COUNT - 1].duration = 0;
+
+	rumble_fd = -1;
+	rumble_id = -1;
+	rumble_end = 0;
+}
+
+int rumble_open(void)
+{
+	int rc;
+	int i;
+
+	if (rumble_fd >= 0)
+		return 0;
+
+	// The device doesn't change, detect it once
+	if (rumble_magnitude < 0) {
+		if (gta04_check_device() == L3704_7004)
+			rumble_magnitude = 0xbfff; //reduced intensity
+		else
+			rumble_magnitude = 0xffff;
+	}
+
+	rumble_fd = input_open(rumble_input);
 	if (rumble_fd < 0)
+		return -1;
+
+	for (i = 0; i < RUMBLE_EFFECTS_COUNT - 1; i++) {
+		rc = rumble_upload(&rumble_effects[i], rumble_effects[i].duration);
+		if (rc < 0)
+			ALOGE("Unable to upload %d ms effect: %s", rumble_effects[i].duration, strerror(errno));
+	}
+
+	return 0;
+}
+
+/*
+ * Called with rumble_mutex locked.
+ */
+int rumble_play(int duration)
+{
+	struct input_event event;
+	struct rumble_effect *rumble = NULL;
+	int64_t now;
+	int rc;
+	int i;
+
+	rc = rumble_open();
+	if (rc < 0)
 		goto error;
 
-	if (rumble_id >= 0) {
+	now = rumble_time();
+
+	// Nothing to stop when the last effect is over already
+	if (rumble_id >= 0 && now < rumble_end) {
 		input_event_set(&event, EV_FF, rumble_id, 0);
 
 		rc = write(rumble_fd, &event, sizeof(event));
 		if (rc < (int) sizeof(event))
 			goto error;
-
-		ioctl(rumble_fd, EVIOCRMFF, &rumble_id);
-
-		rumble_id = -1;
 	}
 
-	// Previous code should have removed the effect already
-	if (duration == 0) {
+	rumble_id = -1;
+
+	if (duration <= 0) {
 		rc = 0;
 		goto complete;
 	}
 
-	memset(&effect, 0, sizeof(effect));
-	effect.type = FF_RUMBLE;
-	effect.id = -1;
-	effect.replay.length = duration;
-	effect.replay.delay = 0;
-	if(gta04_check_device() == L3704_7004)
-		effect.u.rumble.strong_magnitude = 0xbfff; //reduced intensity
-	else
-		effect.u.rumble.strong_magnitude = 0xffff;
+	for (i = 0; i < RUMBLE_EFFECTS_COUNT - 1; i++) {
+		if (rumble_effects[i].duration == duration && rumble_effects[i].id >= 0) {
+			rumble = &rumble_effects[i];
+			break;
+		}
+	}
 
-	rc = ioctl(rumble_fd, EVIOCSFF, &effect);
-	if (rc < 0)
-		goto error;
+	if (rumble == NULL) {
+		rumble = &rumble_effects[RUMBLE_EFFECTS_COUNT - 1];
 
-	rumble_id = effect.id;
+		if (rumble->id < 0 || rumble->duration != duration) {
+			rc = rumble_upload(rumble, duration);
+			if (rc < 0)
+				goto error;
+		}
+	}
 
-	input_event_set(&event, EV_FF, rumble_id, 1);
+	input_event_set(&event, EV_FF, rumble->id, 1);
 
 	rc = write(rumble_fd, &event, sizeof(event));
 	if (rc < (int) sizeof(event))
 		goto error;
 
+	rumble_id = rumble->id;
+	rumble_end = now + duration;
+
 	rc = 0;
 	goto complete;
 
 error:
-	if (rumble_fd >= 0) {
-		if (rumble_id >= 0) {
-			input_event_set(&event, EV_FF, rumble_id, 0);
-			write(rumble_fd, &event, sizeof(event));
+	// The node is looked up again on the next call
+	rumble_close();
 
-			ioctl(rumble_fd, EVIOCRMFF, &rumble_id);
-			rumble_id = -1;
+	rc = -1;
+
+complete:
+	return rc;
+}
+
+/*
+ * Waits for the given time, unless the pattern changes meanwhile. Called with
+ * rumble_mutex locked.
+ */
+int rumble_pattern_wait(unsigned int serial, int duration)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += duration / 1000;
+	ts.tv_nsec += (duration % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	while (rumble_pattern_serial == serial) {
+		if (pthread_cond_timedwait(&rumble_cond, &rumble_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+
+	return rumble_pattern_serial == serial ? 0 : -1;
+}
+
+void *rumble_pattern_thread(void *data)
+{
+	unsigned int serial;
+	int index;
+	int rc;
+
+	pthread_mutex_lock(&rumble_mutex);
+
+	while (1) {
+		while (rumble_pattern_count == 0)
+			pthread_cond_wait(&rumble_cond, &rumble_mutex);
+
+		serial = rumble_pattern_serial;
+		index = 0;
+
+		while (rumble_pattern_serial == serial) {
+			if (index >= rumble_pattern_count) {
+				if (rumble_pattern_repeat < 0) {
+					rumble_pattern_count = 0;
+					break;
+				}
+
+				index = rumble_pattern_repeat;
+			}
+
+			// Timings alternate between off and on, starting with off
+			if (index % 2 == 1 && rumble_pattern[index] > 0) {
+				rc = rumble_play(rumble_pattern[index]);
+				if (rc < 0)
+					ALOGE("Unable to play pattern");
+			}
+
+			rc = rumble_pattern_wait(serial, rumble_pattern[index]);
+			if (rc < 0)
+				break;
+
+			index++;
 		}
+	}
 
-		close(rumble_fd);
-		rumble_fd = -1;
+	pthread_mutex_unlock(&rumble_mutex);
+
+	return NULL;
+}
+
+/*
+ * Vibrator
+ */
+
+int vibrator_exists(void)
+{
+	int fd;
+
+	pthread_mutex_lock(&rumble_mutex);
+
+	if (rumble_fd >= 0) {
+		pthread_mutex_unlock(&rumble_mutex);
+		return 1;
 	}
 
-	rc = -1;
+	fd = input_open(rumble_input);
+
+	pthread_mutex_unlock(&rumble_mutex);
+
+	if (fd < 0)
+		return 0;
+
+	close(fd);
+
+	return 1;
+}
+
+int sendit(int duration)
+{
+	int rc;
+
+	pthread_mutex_lock(&rumble_mutex);
+
+	// A single vibration, or stopping, ends the pattern
+	if (rumble_pattern_count > 0) {
+		rumble_pattern_count = 0;
+		rumble_pattern_serial++;
+		pthread_cond_broadcast(&rumble_cond);
+	}
+
+	rc = rumble_play(duration);
+
+	pthread_mutex_unlock(&rumble_mutex);
 
-complete:
 	return rc;
 }
+
+/*
+ * Plays the timings, in ms, alternating between off and on, like
+ * android.os.Vibrator does. The pattern starts over from the repeat index,
+ * unless it is negative.
+ *
+ * This is not part of the legacy vibrator interface: Android 4.2 only calls
+ * vibrator_exists and sendit, and plays patterns itself. Nothing in the
+ * framework calls it, only native callers and the benchmark do.
+ */
+int vibrator_pattern(const int *timings, int count, int repeat)
+{
+	int rc;
+	int i;
+
+	if (timings == NULL || count <= 0 || count > RUMBLE_PATTERN_MAX || repeat >= count)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++)
+		if (timings[i] < 0)
+			return -EINVAL;
+
+	// A repeated section that takes no time would keep the thread spinning
+	if (repeat >= 0) {
+		for (i = repeat; i < count; i++)
+			if (timings[i] > 0)
+				break;
+
+		if (i == count)
+			return -EINVAL;
+	}
+
+	pthread_mutex_lock(&rumble_mutex);
+
+	if (!rumble_thread_started) {
+		rc = pthread_create(&rumble_thread, NULL, rumble_pattern_thread, NULL);
+		if (rc != 0) {
+			ALOGE("Unable to create pattern thread");
+			pthread_mutex_unlock(&rumble_mutex);
+			return -1;
+		}
+
+		rumble_thread_started = 1;
+	}
+
+	// Whatever is vibrating belongs to the previous pattern
+	rumble_play(0);
+
+	memcpy(rumble_pattern, timings, count * sizeof(int));
+	rumble_pattern_count = count;
+	rumble_pattern_repeat = repeat;
+	rumble_pattern_serial++;
+	pthread_cond_broadcast(&rumble_cond);
+
+	pthread_mutex_unlock(&rumble_mutex);
+
+	return 0;
+}